@@ -12,6 +12,17 @@
  */
 ObjectFunction* Compile(const char* source);
 
+/**
+ * @brief Compiles the body of a function whose declaration was only skimmed.
+ * 
+ * Skimming already reported any syntax errors, so this can only fail on the limits of the bytecode itself.
+ * 
+ * @param function An ObjectFunction with a LazyBody.
+ * @return true The body compiled, and the function is ready to run.
+ * @return false The body has errors, which have been reported.
+ */
+bool CompileLazyBody(ObjectFunction* function);
+
 /**
  * @brief Marks all compiler roots for garbage collection.
  */
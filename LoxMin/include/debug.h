@@ -2,6 +2,7 @@
 #define loxmin_debug_h
 
 #include "chunk.h"
+#include "trace.h"
 
 /**
  * @brief Disassembles all of the instructions of a Chunk.
@@ -20,4 +21,35 @@ void DisassembleChunk(Chunk* chunk, const char* name);
  */
 int DisassembleInstruction(Chunk* chunk, int offset);
 
+#ifdef DEBUG_PROFILE_OPCODES
+/**
+ * @brief Records the opcode sequences that begin at an instruction about to execute.
+ * 
+ * @param chunk A Chunk holding the instruction.
+ * @param offset The offset of the instruction.
+ */
+void ProfileInstruction(Chunk* chunk, int offset);
+
+/**
+ * @brief Prints the most frequently executed opcode sequences to stderr.
+ */
+void PrintProfile();
+#endif
+
+#ifdef DEBUG_CACHE_STATS
+/**
+ * @brief Prints the hit and miss counts of every inline cache still alive to stderr.
+ */
+void PrintCacheStats();
+#endif
+
+#ifdef DEBUG_DUMP_TRACES
+/**
+ * @brief Prints a recorded trace: the steps the recorder took, the IR they became and what came of it.
+ * 
+ * @param trace A Trace to print.
+ */
+void PrintTrace(Trace* trace);
+#endif
+
 #endif
@@ -0,0 +1,113 @@
+#ifndef loxmin_jit_h
+#define loxmin_jit_h
+
+#include "common.h"
+#include "object.h"
+#include "trace.h"
+#include "vm.h"
+
+// Calls a function has to take before it is compiled to native code; Options carries it in every build
+#define JIT_CALL_THRESHOLD 100
+
+#ifdef JIT_COMPILER
+
+#if !defined(__x86_64__) || !defined(__linux__)
+#error "The baseline JIT only targets x86-64 Linux."
+#endif
+
+#ifndef NAN_BOXING
+#error "The baseline JIT works on NaN-boxed values."
+#endif
+
+/**
+ * @brief Enumerates the ways compiled code can hand control back to its caller.
+ */
+typedef enum
+{
+    JIT_RETURNED,
+    JIT_EXITED,
+    JIT_FAILED,
+} JitStatus;
+
+/**
+ * @brief Compiles a function to native code, leaving it interpreted if that is not possible.
+ *
+ * @param function The ObjectFunction to compile.
+ * @return true The function now has native code.
+ * @return false The function could not be compiled.
+ */
+bool CompileNative(ObjectFunction* function);
+
+/**
+ * @brief Frees the native code of a function, if it has any.
+ *
+ * @param function The ObjectFunction owning the code.
+ */
+void FreeNative(ObjectFunction* function);
+
+/**
+ * @brief Runs the native code of a freshly called frame.
+ *
+ * The frame is popped when the code returns. When the code exits early, for a guard that failed or an
+ * instruction it does not handle, the frame stays on top with its ip at the instruction to resume from.
+ *
+ * @param frame The CallFrame to run, on top of the frame stack.
+ * @return JitStatus How the code handed control back.
+ */
+JitStatus RunNative(CallFrame* frame);
+
+/**
+ * @brief Compiles a recorded trace to native code that runs its loop until one of its guards fails.
+ *
+ * @param trace The Trace to compile, with its IR built.
+ * @return true The trace now has native code.
+ * @return false The trace could not be compiled.
+ */
+bool CompileTrace(Trace* trace);
+
+/**
+ * @brief Frees the native code of a trace, if it has any.
+ *
+ * @param trace The Trace owning the code.
+ */
+void FreeNativeTrace(Trace* trace);
+
+/**
+ * @brief Runs a compiled trace from the header of its loop.
+ *
+ * On return the frame's ip and vm->sp describe the state the trace exited with, ready for the interpreter.
+ *
+ * @param trace The compiled Trace.
+ * @param frame The CallFrame running the loop, with vm->sp stored.
+ */
+void RunTrace(Trace* trace, CallFrame* frame);
+
+/**
+ * @brief Calls the value below the arguments on the stack and runs the callee until it returns.
+ *
+ * Implemented by the virtual machine for use from native code.
+ *
+ * @param argCount The number of arguments.
+ * @return JitStatus JIT_RETURNED with the result on the stack, or JIT_FAILED on a runtime error.
+ */
+JitStatus JitCall(int argCount);
+
+/**
+ * @brief Finishes the frame on top of the frame stack in the interpreter after its native code exited early.
+ *
+ * Implemented by the virtual machine for use from native code.
+ *
+ * @return JitStatus JIT_RETURNED with the result on the stack, or JIT_FAILED on a runtime error.
+ */
+JitStatus JitResume();
+
+/**
+ * @brief Pops the frame on top of the frame stack, leaving its result on the stack.
+ *
+ * Implemented by the virtual machine for use from native code.
+ */
+void JitReturn();
+
+#endif
+
+#endif
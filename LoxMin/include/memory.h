@@ -64,6 +64,22 @@ void MarkValue(Value value);
  */
 void MarkObject(Object* object);
 
+/**
+ * @brief Marks an object and everything it holds for good, so that the heap it lives in can be shared.
+ * 
+ * No collector writes to a frozen object again, and only freeing its whole heap frees it.
+ * 
+ * @param object A compiled function or one of its constants.
+ */
+void FreezeObject(Object* object);
+
+/**
+ * @brief Frees what a lazily compiled function holds on to for compiling its body.
+ * 
+ * @param function A function whose body has been compiled, or that is being freed.
+ */
+void FreeLazyBody(ObjectFunction* function);
+
 /**
  * @brief Frees all heap-stored objects.
  */
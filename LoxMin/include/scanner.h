@@ -75,6 +75,14 @@ typedef struct
  */
 void InitScanner(const char* source);
 
+/**
+ * @brief Initializes a Scanner to resume scanning a piece of source code partway through.
+ * 
+ * @param start Where in the source code to resume.
+ * @param line The line number at that point.
+ */
+void ResumeScanner(const char* start, int line);
+
 /**
  * @brief Scans in a Token from source code.
  * 
@@ -0,0 +1,52 @@
+#ifndef loxmin_serializer_h
+#define loxmin_serializer_h
+
+#include <stdio.h>
+#include "common.h"
+#include "vm.h"
+
+// Bumped whenever the layout of compiled script files changes; BYTECODE_VERSION covers the code in them
+#define LOXC_VERSION 1
+
+/**
+ * @brief Writes a frozen script to a compiled script file (.loxc).
+ * 
+ * The file holds the script's globals and its whole function tree: code, line tables, constants, nested
+ * functions and strings, after a header holding the format and bytecode versions and a checksum of the rest. It is laid out in the byte order and
+ * alignment of the machine writing it.
+ * 
+ * @param script The FrozenScript to write.
+ * @param file The stream to write to, opened in binary mode.
+ * @return true If the whole script was written.
+ * @return false If writing failed.
+ */
+bool SaveScript(const FrozenScript* script, FILE* file);
+
+/**
+ * @brief Loads a compiled script file into a frozen script, without compiling anything.
+ * 
+ * The file is mapped into memory and its code, line tables and strings are used in place, so it stays
+ * mapped until the script is freed. A file whose checksum does not match is refused, but the bytecode in
+ * one that matches is trusted without being verified.
+ * 
+ * @param isolate The VM used as a template, which errors are reported through.
+ * @param path A path to the compiled script file.
+ * @return FrozenScript* The frozen script, or NULL if the file could not be read or was not one this
+ *                       build can run.
+ */
+FrozenScript* LoadScript(VM* isolate, const char* path);
+
+/**
+ * @brief Loads a compiled script file already mapped into memory, reporting nothing.
+ * 
+ * The script takes the mapping over, as LoadScript() does, and it is unmapped straight away if the script
+ * cannot be loaded.
+ * 
+ * @param isolate The VM used as a template.
+ * @param mapping The whole file, mapped with mmap().
+ * @param size The size of the mapping.
+ * @return FrozenScript* The frozen script, or NULL if the file is damaged or not one this build can run.
+ */
+FrozenScript* LoadMappedScript(VM* isolate, void* mapping, size_t size);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef loxmin_snapshot_h
+#define loxmin_snapshot_h
+
+#include "common.h"
+#include "vm.h"
+
+// Bumped whenever the layout of heap snapshot files, or the order of the fields of an object in them, changes
+#define SNAPSHOT_VERSION 1
+
+/**
+ * @brief Writes a VM's whole heap to a snapshot file (.loxh).
+ *
+ * Garbage is collected first, then the globals, the interned strings and every object left are written as
+ * an image of the heap, objects laid out as this build lays them out in memory. Compiled code is kept as
+ * bytecode only; natives are written as the names of the globals they are defined as.
+ *
+ * The VM must be idle, and its heap must not refer to a frozen script, whose objects live in another heap.
+ *
+ * @param isolate The VM to write the heap of, which errors are reported through.
+ * @param path A path to the snapshot file to write.
+ * @return true If the whole heap was written.
+ * @return false If the heap cannot be written, or writing failed.
+ */
+bool SaveSnapshot(VM* isolate, const char* path);
+
+/**
+ * @brief Replaces a VM's heap with the one held by a snapshot file, without running any code.
+ *
+ * The file is mapped into memory and its objects are used in place once their pointers are relocated,
+ * so it stays mapped for as long as the VM lives. Only a build laying out objects and bytecode just as the
+ * one that wrote a snapshot did can restore it, its checksum must match, and every native it holds must already be defined in the VM under the same name.
+ *
+ * @param isolate The VM to restore into, which errors are reported through.
+ * @param path A path to the snapshot file.
+ * @return true If the heap was restored.
+ * @return false If the file could not be read, was not laid out for this build, or was damaged, leaving the VM as
+ *         it was.
+ */
+bool RestoreSnapshot(VM* isolate, const char* path);
+
+#endif
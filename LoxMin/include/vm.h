@@ -5,8 +5,12 @@
 #include "table.h"
 #include "value.h"
 
-#define FRAMES_MAX 64
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+// Default limit on the depth of the call stack, past which a call is a stack overflow
+#define FRAMES_MAX 10000
+#define FRAMES_INITIAL 16
+#define STACK_INITIAL 256
+// Frames a stack trace shows at each end of the stack; the ones in between are only counted
+#define TRACE_FRAMES_SHOWN 10
 
 /**
  * @brief Represents a call frame for a function call.
@@ -14,35 +18,99 @@
 typedef struct
 {
     ObjectClosure* closure;
-    uint8_t* ip;
+    Chunk* chunk;
+    ThreadedCode* ip;
     Value* slots;
+    // Frames this one replaced through tail calls, for stack traces
+    int tailCalls;
 } CallFrame;
 
 
+/**
+ * @brief Stores options that change how code is compiled and run.
+ * 
+ * The layout is the same in every build, so a host compiled without JIT_COMPILER can link a library built with it.
+ * Builds without the JIT ignore jitThreshold, and builds without the trace recorder ignore traceThreshold.
+ */
+typedef struct
+{
+    bool registerMode;
+    // Skim function bodies and compile each one on the function's first call
+    bool lazyCompile;
+    int maxFrames;
+    // Streams the script prints to and its errors are reported on
+    FILE* output;
+    FILE* errors;
+    int jitThreshold;
+    int traceThreshold;
+} Options;
+
 /**
  * @brief Stores the state of a virtual machine.
+ * 
+ * Every VM is an isolate with its own heap, globals and interned strings, sharing nothing with other VMs
+ * but the frozen scripts they run. Any number of them can run at once on separate threads, as long as each is only used by one thread at a time.
  */
 typedef struct
 {
-    CallFrame frames[FRAMES_MAX];
+    // Both stacks grow on demand; the value stack moves when it does, so nothing outside
+    // the VM may hold on to a stack slot across a call
+    CallFrame* frames;
     int frameCount;
+    int frameCapacity;
 
-    Value stack[STACK_MAX];
+    Value* stack;
+    Value* stackEnd;
     Value* sp;
-    Table globals;
+    Table globalSlots;
+    ValueArray globalValues;
+    ValueArray globalNames;
     Table strings;
     ObjectString* initString;
     ObjectUpvalue* openUpvalues;
 
+    // Values held by the host through HoldValue(); a released handle holds the next free one as an integer
+    ValueArray handles;
+    int freeHandle;
+
     size_t bytesAllocated;
     size_t nextGC;
     Object* objects;
     int grayCount;
     int grayCapacity;
     Object** grayStack;
+    // Heap snapshot the VM was restored from, mapped in for as long as it lives; its objects are never freed
+    void* snapshot;
+    size_t snapshotSize;
+
+    Options options;
+
+#ifdef COMPUTED_GOTO
+    void** handlers;
+#endif
 } VM;
 
-extern VM vm;
+/**
+ * @brief Stores a script compiled once and frozen, for any number of VMs to run at once.
+ * 
+ * The frozen functions and the strings they hold live in a heap of their own that never runs code or collects
+ * garbage again. They stay marked, so no collector ever writes to them or frees them.
+ */
+typedef struct
+{
+    VM* heap;
+    ObjectFunction* function;
+    // Globals the script was compiled against, in slot order
+    int globalCount;
+    // Compiled script file the code and strings were loaded from in place, if any
+    void* mapping;
+    size_t mappingSize;
+} FrozenScript;
+
+/**
+ * @brief The VM the calling thread is running, bound by the functions below for as long as they need it.
+ */
+extern THREAD_LOCAL VM* vm;
 
 /**
  * @brief Enumerates all available interpretation results.
@@ -55,22 +123,148 @@ typedef enum
 } InterpretResult;
 
 /**
- * @brief Initializes the virtual machine.
+ * @brief Fills in the default options.
+ * 
+ * @param options The Options to initialize.
+ */
+void InitOptions(Options* options);
+
+/**
+ * @brief Creates a new virtual machine.
+ * 
+ * @param options The Options the VM compiles and runs code with.
+ * @return VM* A pointer to the new VM.
  */
-void InitVM();
+VM* NewVM(const Options* options);
 
 /**
- * @brief Frees the virtual machine.
+ * @brief Frees a virtual machine and everything it allocated.
+ * 
+ * @param isolate The VM to free.
  */
-void FreeVM();
+void FreeVM(VM* isolate);
 
 /**
  * @brief Interprets a piece of source code.
  * 
+ * @param isolate The VM to run the code in, on the calling thread.
  * @param source A source code string.
  * @return InterpretResult The result of the interpretation.
  */
-InterpretResult Interpret(const char* source);
+InterpretResult Interpret(VM* isolate, const char* source);
+
+/**
+ * @brief Compiles a piece of source code once, into a frozen script that VMs laid out like a given one can run.
+ * 
+ * The script resolves its globals to slots when it is compiled. A VM can run it as long as the globals it
+ * defined before, natives included, are the ones the template had defined, in the same order.
+ * 
+ * @param isolate The VM used as a template, which compile errors are reported through.
+ * @param source A source code string.
+ * @return FrozenScript* The frozen script, or NULL if the source does not compile.
+ */
+FrozenScript* FreezeScript(VM* isolate, const char* source);
+
+/**
+ * @brief Interprets a frozen script.
+ * 
+ * The VM shares the script's code, lines and strings, and only instantiates the functions themselves,
+ * which keep the caches and native code specific to it.
+ * 
+ * @param isolate The VM to run the script in, on the calling thread.
+ * @param script The FrozenScript to run, which must outlive the VM.
+ * @return InterpretResult The result of the interpretation.
+ */
+InterpretResult InterpretFrozen(VM* isolate, const FrozenScript* script);
+
+/**
+ * @brief Frees a frozen script, once no VM that ran it is left.
+ * 
+ * @param script The FrozenScript to free.
+ */
+void FreeFrozenScript(FrozenScript* script);
+
+/**
+ * @brief Defines a native function as a global variable.
+ * 
+ * While it runs, the native can reach its VM through vm.
+ * 
+ * @param isolate The VM to define the function in.
+ * @param name The name of the function.
+ * @param function The function.
+ */
+void DefineNative(VM* isolate, const char* name, NativeFn function);
+
+/**
+ * @brief Reads a global variable, such as a function the script defined.
+ * 
+ * @param isolate The VM to read from.
+ * @param name The name of the global variable.
+ * @param value The resulting Value.
+ * @return true If the variable is defined.
+ * @return false If the variable is not defined.
+ */
+bool GetGlobal(VM* isolate, const char* name, Value* value);
+
+/**
+ * @brief Calls a function, bound method or class from the host, running it to completion.
+ * 
+ * Code interpreted earlier stays compiled, so a script can be interpreted once and its functions called as
+ * often as needed. Must not be called from inside a native function.
+ * 
+ * @param isolate The VM to run the call in, on the calling thread.
+ * @param callee The Value to call.
+ * @param argCount The number of arguments.
+ * @param args The arguments.
+ * @param result The Value the call returned, which is not kept alive past the next call into the VM
+ *               unless it is held with HoldValue().
+ * @return InterpretResult INTERPRET_OK, or INTERPRET_RUNTIME_ERROR once the error has been reported.
+ */
+InterpretResult CallFunction(VM* isolate, Value callee, int argCount, const Value* args, Value* result);
+
+/**
+ * @brief Creates a string Value for the host to pass into the VM.
+ * 
+ * @param isolate The VM the string belongs to.
+ * @param chars A pointer to the characters to copy.
+ * @param length The length of the string.
+ * @return Value The string, which is not kept alive past the next call into the VM unless it is held.
+ */
+Value MakeString(VM* isolate, const char* chars, int length);
+
+/**
+ * @brief Keeps a Value alive for the host until it is released.
+ * 
+ * @param isolate The VM the Value belongs to.
+ * @param value The Value to hold.
+ * @return int A handle to the Value.
+ */
+int HoldValue(VM* isolate, Value value);
+
+/**
+ * @brief Reads a held Value.
+ * 
+ * @param isolate The VM holding the Value.
+ * @param handle The handle returned by HoldValue().
+ * @return Value The held Value.
+ */
+Value HeldValue(VM* isolate, int handle);
+
+/**
+ * @brief Releases a held Value, which the garbage collector may then free.
+ * 
+ * @param isolate The VM holding the Value.
+ * @param handle The handle returned by HoldValue(), which must not be used again.
+ */
+void ReleaseValue(VM* isolate, int handle);
+
+/**
+ * @brief Finds the slot of a global variable, creating an undefined one for a name seen for the first time.
+ * 
+ * @param name The name of the global variable.
+ * @return int The index of the variable within the global value array.
+ */
+int GlobalSlot(ObjectString* name);
 
 /**
  * @brief Pushes a Value onto the stack.
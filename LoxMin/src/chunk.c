@@ -1,9 +1,27 @@
 #include <stdlib.h>
 #include "chunk.h"
 #include "memory.h"
+#include "trace.h"
 #include "value.h"
 #include "vm.h"
 
+// Longest fused run: GET_LOCAL, CONSTANT, LESS, NOT, JUMP_IF_FALSE, POP
+#define FUSE_MAX_LENGTH 6
+// Slots kept free above a frame for the values the runtime pushes to keep them away from the collector
+#define STACK_SLACK 8
+
+static bool IsJump(uint8_t instruction);
+static bool IsGlobal(uint8_t instruction);
+static int JumpTarget(Chunk* chunk, int offset);
+static int RegisterForm(uint8_t instruction);
+static int CompareJumpForm(uint8_t instruction);
+static int StackEffect(Chunk* chunk, int offset);
+static int MaxStackHeight(Chunk* chunk);
+static void WriteFused(uint8_t* code, int* lines, int* count, uint8_t byte, int line);
+#ifdef TRACE_RECORDER
+static void FreeLoops(LoopAnchor* loops, int loopCount);
+#endif
+
 void InitChunk(Chunk* chunk)
 {
     chunk->count = 0;
@@ -11,6 +29,23 @@ void InitChunk(Chunk* chunk)
     chunk->code = NULL;
     chunk->lines = NULL;
     InitValueArray(&chunk->constants);
+    chunk->isBorrowed = false;
+
+    chunk->threadedCount = 0;
+    chunk->threaded = NULL;
+    chunk->threadedOffsets = NULL;
+    chunk->stackSize = 0;
+
+    chunk->cacheCount = 0;
+    chunk->caches = NULL;
+    chunk->invokeCacheCount = 0;
+    chunk->invokeCaches = NULL;
+    chunk->callCacheCount = 0;
+    chunk->callCaches = NULL;
+#ifdef TRACE_RECORDER
+    chunk->loopCount = 0;
+    chunk->loops = NULL;
+#endif
 }
 
 void WriteChunk(Chunk* chunk, uint8_t byte, int line)
@@ -30,9 +65,20 @@ void WriteChunk(Chunk* chunk, uint8_t byte, int line)
 
 void FreeChunk(Chunk* chunk)
 {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    if (!chunk->isBorrowed)
+    {
+        FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+        FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    }
     FreeValueArray(&chunk->constants);
+    FREE_ARRAY(ThreadedCode, chunk->threaded, chunk->threadedCount);
+    FREE_ARRAY(int, chunk->threadedOffsets, chunk->threadedCount);
+    FREE_ARRAY(InlineCache, chunk->caches, chunk->cacheCount);
+    FREE_ARRAY(InvokeCache, chunk->invokeCaches, chunk->invokeCacheCount);
+    FREE_ARRAY(CallCache, chunk->callCaches, chunk->callCacheCount);
+#ifdef TRACE_RECORDER
+    FreeLoops(chunk->loops, chunk->loopCount);
+#endif
     InitChunk(chunk);
 }
 
@@ -43,3 +89,786 @@ int AddConstant(Chunk* chunk, Value value)
     StackPop();
     return chunk->constants.count - 1;
 }
+
+void FuseChunk(Chunk* chunk)
+{
+    int count = chunk->count;
+
+    // Fusing must never swallow an instruction that a jump lands on. A JUMP_IF_FALSE whose target is a POP
+    // may also be fused into a jump past that POP, so the instruction after it counts as a target too.
+    bool* isTarget = ALLOCATE(bool, count + 1);
+    for (int offset = 0; offset <= count; offset++)
+    {
+        isTarget[offset] = false;
+    }
+    for (int offset = 0; offset < count; offset += InstructionLength(chunk, offset))
+    {
+        if (IsJump(chunk->code[offset]))
+        {
+            int target = JumpTarget(chunk, offset);
+            isTarget[target] = true;
+            if (chunk->code[offset] == OP_JUMP_IF_FALSE && target < count && chunk->code[target] == OP_POP)
+            {
+                isTarget[target + 1] = true;
+            }
+        }
+    }
+
+    uint8_t* code = ALLOCATE(uint8_t, count);
+    int* lines = ALLOCATE(int, count);
+    int* newOffsets = ALLOCATE(int, count + 1);
+    int* oldTargets = ALLOCATE(int, count);
+    int newCount = 0;
+
+    for (int offset = 0; offset < count;)
+    {
+        // Gather the next few instructions; only a run free of jump targets past its first one can be fused
+        int at[FUSE_MAX_LENGTH + 1];
+        int length = 0;
+        at[0] = offset;
+        while (length < FUSE_MAX_LENGTH && at[length] < count)
+        {
+            at[length + 1] = at[length] + InstructionLength(chunk, at[length]);
+            length++;
+            if (at[length] < count && isTarget[at[length]])
+            {
+                break;
+            }
+        }
+
+        uint8_t* op = chunk->code;
+        int start = newCount;
+        int consumed = 1;
+
+        // GET_LOCAL, GET_LOCAL|CONSTANT, op is the register form of op
+        int registerOp = -1;
+        uint8_t left = 0;
+        uint8_t right = 0;
+        int registerLine = 0;
+        if (length >= 3 && op[at[0]] == OP_GET_LOCAL && (op[at[1]] == OP_GET_LOCAL || op[at[1]] == OP_CONSTANT) &&
+            RegisterForm(op[at[2]]) != -1)
+        {
+            registerOp = RegisterForm(op[at[2]]) + (op[at[1]] == OP_CONSTANT ? 1 : 0);
+            left = op[at[0] + 1];
+            right = op[at[1] + 1];
+            registerLine = chunk->lines[at[2]];
+            consumed = 3;
+        }
+        else if (op[at[0]] >= OP_ADD_LL && op[at[0]] <= OP_EQUAL_LK)
+        {
+            registerOp = op[at[0]];
+            left = op[at[0] + 1];
+            right = op[at[0] + 2];
+            registerLine = chunk->lines[at[0]];
+            consumed = 1;
+        }
+
+        if (registerOp != -1)
+        {
+            // A register compare, an optional NOT, then JUMP_IF_FALSE and POP becomes a compare-and-branch
+            // which lands after the POP at the jump target, so the condition never touches the stack
+            int next = consumed;
+            bool sense = false;
+            if (next < length && op[at[next]] == OP_NOT)
+            {
+                sense = true;
+                next++;
+            }
+            if (CompareJumpForm(registerOp) != -1 && next + 1 < length &&
+                op[at[next]] == OP_JUMP_IF_FALSE && op[at[next + 1]] == OP_POP &&
+                op[JumpTarget(chunk, at[next])] == OP_POP)
+            {
+                oldTargets[start] = JumpTarget(chunk, at[next]) + 1;
+                WriteFused(code, lines, &newCount, CompareJumpForm(registerOp), registerLine);
+                WriteFused(code, lines, &newCount, left, registerLine);
+                WriteFused(code, lines, &newCount, right, registerLine);
+                WriteFused(code, lines, &newCount, sense, registerLine);
+                WriteFused(code, lines, &newCount, 0xff, registerLine);
+                WriteFused(code, lines, &newCount, 0xff, registerLine);
+                consumed = next + 2;
+            }
+            else if (consumed > 1)
+            {
+                WriteFused(code, lines, &newCount, registerOp, registerLine);
+                WriteFused(code, lines, &newCount, left, registerLine);
+                WriteFused(code, lines, &newCount, right, registerLine);
+            }
+        }
+        if (newCount == start && length >= 2 && op[at[1]] == OP_POP &&
+            (op[at[0]] == OP_SET_LOCAL || op[at[0]] == OP_SET_GLOBAL))
+        {
+            // SET_LOCAL|SET_GLOBAL, POP stores the value without leaving it behind
+            WriteFused(code, lines, &newCount, op[at[0]] == OP_SET_LOCAL ? OP_POP_LOCAL : OP_POP_GLOBAL, chunk->lines[at[0]]);
+            for (int i = at[0] + 1; i < at[1]; i++)
+            {
+                WriteFused(code, lines, &newCount, op[i], chunk->lines[at[0]]);
+            }
+            consumed = 2;
+        }
+        if (newCount == start && length >= 2 && op[at[0]] == OP_JUMP_IF_FALSE && op[at[1]] == OP_POP &&
+            op[JumpTarget(chunk, at[0])] == OP_POP)
+        {
+            // JUMP_IF_FALSE, POP pops the condition on both paths by landing after the POP at its target
+            oldTargets[start] = JumpTarget(chunk, at[0]) + 1;
+            WriteFused(code, lines, &newCount, OP_POP_JUMP_IF_FALSE, chunk->lines[at[0]]);
+            WriteFused(code, lines, &newCount, 0xff, chunk->lines[at[0]]);
+            WriteFused(code, lines, &newCount, 0xff, chunk->lines[at[0]]);
+            consumed = 2;
+        }
+        if (newCount == start)
+        {
+            if (IsJump(op[offset]))
+            {
+                oldTargets[start] = JumpTarget(chunk, offset);
+            }
+            for (int i = offset; i < at[1]; i++)
+            {
+                WriteFused(code, lines, &newCount, op[i], chunk->lines[i]);
+            }
+            consumed = 1;
+        }
+
+        for (int i = 0; i < consumed; i++)
+        {
+            newOffsets[at[i]] = start;
+        }
+        offset = at[consumed];
+    }
+    newOffsets[count] = newCount;
+
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    chunk->code = code;
+    chunk->lines = lines;
+    chunk->count = newCount;
+    chunk->capacity = count;
+
+    // Point every jump at the new location of its old target
+    for (int offset = 0; offset < newCount;)
+    {
+        int length = InstructionLength(chunk, offset);
+        if (IsJump(code[offset]))
+        {
+            int target = newOffsets[oldTargets[offset]];
+            int jump = code[offset] == OP_LOOP ? offset + length - target : target - (offset + length);
+            code[offset + length - 2] = (jump >> 8) & 0xff;
+            code[offset + length - 1] = jump & 0xff;
+        }
+        offset += length;
+    }
+
+    FREE_ARRAY(bool, isTarget, count + 1);
+    FREE_ARRAY(int, newOffsets, count + 1);
+    FREE_ARRAY(int, oldTargets, count);
+}
+
+void ThreadChunk(Chunk* chunk)
+{
+    // Find where each instruction lands; a jump's two offset bytes shrink into one target word,
+    // as do a global's two slot bytes, while property, invoke and call instructions gain a word pointing at their inline cache
+    // and, with the trace recorder, a loop gains one pointing at its hotness counter
+    int* positions = ALLOCATE(int, chunk->count + 1);
+    int count = 0;
+    int cacheCount = 0;
+    int invokeCacheCount = 0;
+    int callCacheCount = 0;
+#ifdef TRACE_RECORDER
+    int loopCount = 0;
+#endif
+    for (int offset = 0; offset < chunk->count;)
+    {
+        uint8_t instruction = chunk->code[offset];
+        positions[offset] = count;
+        int length = InstructionLength(chunk, offset);
+        count += IsJump(instruction) || IsGlobal(instruction) ? length - 1 : length;
+        if (instruction == OP_GET_PROPERTY || instruction == OP_SET_PROPERTY)
+        {
+            count++;
+            cacheCount++;
+        }
+        else if (instruction == OP_INVOKE || instruction == OP_SUPER_INVOKE)
+        {
+            count++;
+            invokeCacheCount++;
+        }
+        else if (instruction == OP_CALL || instruction == OP_TAIL_CALL)
+        {
+            count++;
+            callCacheCount++;
+        }
+#ifdef TRACE_RECORDER
+        else if (instruction == OP_LOOP)
+        {
+            count++;
+            loopCount++;
+        }
+#endif
+        offset += length;
+    }
+    positions[chunk->count] = count;
+
+    ThreadedCode* threaded = ALLOCATE(ThreadedCode, count);
+    int* threadedOffsets = ALLOCATE(int, count);
+    InlineCache* caches = ALLOCATE(InlineCache, cacheCount);
+    InvokeCache* invokeCaches = ALLOCATE(InvokeCache, invokeCacheCount);
+    CallCache* callCaches = ALLOCATE(CallCache, callCacheCount);
+    cacheCount = 0;
+    invokeCacheCount = 0;
+    callCacheCount = 0;
+#ifdef TRACE_RECORDER
+    LoopAnchor* loops = ALLOCATE(LoopAnchor, loopCount);
+    loopCount = 0;
+#endif
+
+    for (int offset = 0; offset < chunk->count;)
+    {
+        uint8_t instruction = chunk->code[offset];
+        int length = InstructionLength(chunk, offset);
+        ThreadedCode* code = &threaded[positions[offset]];
+
+#ifdef COMPUTED_GOTO
+        code[0].handler = vm->handlers[instruction];
+#else
+        code[0].opcode = instruction;
+#endif
+
+        switch (instruction)
+        {
+            case OP_CONSTANT:
+            case OP_GET_SUPER:
+            case OP_CLASS:
+            case OP_METHOD:
+                code[1].value = chunk->constants.values[chunk->code[offset + 1]];
+                break;
+            case OP_GET_GLOBAL:
+            case OP_DEFINE_GLOBAL:
+            case OP_SET_GLOBAL:
+            case OP_POP_GLOBAL:
+                code[1].operand = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+                break;
+            case OP_GET_PROPERTY:
+            case OP_SET_PROPERTY:
+            {
+                InlineCache* cache = &caches[cacheCount++];
+                cache->shape = NULL;
+                cache->transition = NULL;
+                cache->method = NULL;
+                cache->index = 0;
+                cache->version = 0;
+                cache->offset = offset;
+                cache->hits = 0;
+                cache->misses = 0;
+
+                code[1].value = chunk->constants.values[chunk->code[offset + 1]];
+                code[2].cache = cache;
+                break;
+            }
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+            case OP_GET_UPVALUE:
+            case OP_SET_UPVALUE:
+            case OP_POP_LOCAL:
+                code[1].operand = chunk->code[offset + 1];
+                break;
+            case OP_CALL:
+            case OP_TAIL_CALL:
+            {
+                CallCache* cache = &callCaches[callCacheCount++];
+                cache->closure = NULL;
+                cache->offset = offset;
+                cache->hits = 0;
+                cache->misses = 0;
+
+                code[1].operand = chunk->code[offset + 1];
+                code[2].callCache = cache;
+                break;
+            }
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_LOOP:
+            case OP_POP_JUMP_IF_FALSE:
+            {
+                int jump = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+                int target = offset + 3 + (instruction == OP_LOOP ? -jump : jump);
+                code[1].target = &threaded[positions[target]];
+#ifdef TRACE_RECORDER
+                if (instruction == OP_LOOP)
+                {
+                    LoopAnchor* loop = &loops[loopCount++];
+                    loop->offset = offset;
+                    loop->header = target;
+                    loop->hits = 0;
+                    loop->attempts = 0;
+                    loop->trace = NULL;
+                    code[2].loop = loop;
+                }
+#endif
+                break;
+            }
+            case OP_ADD_LL:
+            case OP_SUBTRACT_LL:
+            case OP_MULTIPLY_LL:
+            case OP_DIVIDE_LL:
+            case OP_GREATER_LL:
+            case OP_LESS_LL:
+            case OP_EQUAL_LL:
+                code[1].operand = chunk->code[offset + 1];
+                code[2].operand = chunk->code[offset + 2];
+                break;
+            case OP_ADD_LK:
+            case OP_SUBTRACT_LK:
+            case OP_MULTIPLY_LK:
+            case OP_DIVIDE_LK:
+            case OP_GREATER_LK:
+            case OP_LESS_LK:
+            case OP_EQUAL_LK:
+                code[1].operand = chunk->code[offset + 1];
+                code[2].value = chunk->constants.values[chunk->code[offset + 2]];
+                break;
+            case OP_JUMP_GREATER_LL:
+            case OP_JUMP_GREATER_LK:
+            case OP_JUMP_LESS_LL:
+            case OP_JUMP_LESS_LK:
+            case OP_JUMP_EQUAL_LL:
+            case OP_JUMP_EQUAL_LK:
+            {
+                code[1].operand = chunk->code[offset + 1];
+                if (instruction == OP_JUMP_GREATER_LK || instruction == OP_JUMP_LESS_LK || instruction == OP_JUMP_EQUAL_LK)
+                {
+                    code[2].value = chunk->constants.values[chunk->code[offset + 2]];
+                }
+                else
+                {
+                    code[2].operand = chunk->code[offset + 2];
+                }
+                code[3].operand = chunk->code[offset + 3];
+
+                int jump = (chunk->code[offset + 4] << 8) | chunk->code[offset + 5];
+                code[4].target = &threaded[positions[offset + 6 + jump]];
+                break;
+            }
+            case OP_INVOKE:
+            case OP_SUPER_INVOKE:
+            {
+                InvokeCache* cache = &invokeCaches[invokeCacheCount++];
+                cache->count = 0;
+                cache->isMegamorphic = false;
+                cache->offset = offset;
+                cache->hits = 0;
+                cache->misses = 0;
+
+                code[1].value = chunk->constants.values[chunk->code[offset + 1]];
+                code[2].operand = chunk->code[offset + 2];
+                code[3].invokeCache = cache;
+                break;
+            }
+            case OP_CLOSURE:
+            {
+                code[1].value = chunk->constants.values[chunk->code[offset + 1]];
+                // Upvalue (isLocal, index) pairs follow as plain operands
+                for (int i = 2; i < length; i++)
+                {
+                    code[i].operand = chunk->code[offset + i];
+                }
+                break;
+            }
+            default:
+                break;
+        }
+
+        // Every word of an instruction maps back to its bytecode offset for line lookups
+        for (int i = positions[offset]; i < positions[offset + length]; i++)
+        {
+            threadedOffsets[i] = offset;
+        }
+
+        offset += length;
+    }
+
+    FREE_ARRAY(int, positions, chunk->count + 1);
+
+    chunk->stackSize = MaxStackHeight(chunk) + STACK_SLACK;
+    FREE_ARRAY(ThreadedCode, chunk->threaded, chunk->threadedCount);
+    FREE_ARRAY(int, chunk->threadedOffsets, chunk->threadedCount);
+    FREE_ARRAY(InlineCache, chunk->caches, chunk->cacheCount);
+    FREE_ARRAY(InvokeCache, chunk->invokeCaches, chunk->invokeCacheCount);
+    FREE_ARRAY(CallCache, chunk->callCaches, chunk->callCacheCount);
+    chunk->threadedCount = count;
+    chunk->threaded = threaded;
+    chunk->threadedOffsets = threadedOffsets;
+    chunk->cacheCount = cacheCount;
+    chunk->caches = caches;
+    chunk->invokeCacheCount = invokeCacheCount;
+    chunk->invokeCaches = invokeCaches;
+    chunk->callCacheCount = callCacheCount;
+    chunk->callCaches = callCaches;
+#ifdef TRACE_RECORDER
+    FreeLoops(chunk->loops, chunk->loopCount);
+    chunk->loopCount = loopCount;
+    chunk->loops = loops;
+#endif
+}
+
+ThreadedCode* ThreadedInstruction(Chunk* chunk, int offset)
+{
+    // Offsets only grow along the threaded code, so the first word of the instruction is a lower bound
+    int low = 0;
+    int high = chunk->threadedCount;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (chunk->threadedOffsets[middle] < offset)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return &chunk->threaded[low];
+}
+
+OpCode BaseOperation(OpCode instruction)
+{
+    switch (instruction)
+    {
+        case OP_ADD_LL:
+        case OP_ADD_LK:
+            return OP_ADD;
+        case OP_SUBTRACT_LL:
+        case OP_SUBTRACT_LK:
+            return OP_SUBTRACT;
+        case OP_MULTIPLY_LL:
+        case OP_MULTIPLY_LK:
+            return OP_MULTIPLY;
+        case OP_DIVIDE_LL:
+        case OP_DIVIDE_LK:
+            return OP_DIVIDE;
+        case OP_GREATER_LL:
+        case OP_GREATER_LK:
+        case OP_JUMP_GREATER_LL:
+        case OP_JUMP_GREATER_LK:
+            return OP_GREATER;
+        case OP_LESS_LL:
+        case OP_LESS_LK:
+        case OP_JUMP_LESS_LL:
+        case OP_JUMP_LESS_LK:
+            return OP_LESS;
+        default:
+            return OP_EQUAL;
+    }
+}
+
+int InstructionLength(Chunk* chunk, int offset)
+{
+    switch (chunk->code[offset])
+    {
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_CLASS:
+        case OP_METHOD:
+        case OP_POP_LOCAL:
+            return 2;
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_POP_GLOBAL:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:
+        case OP_ADD_LL:
+        case OP_ADD_LK:
+        case OP_SUBTRACT_LL:
+        case OP_SUBTRACT_LK:
+        case OP_MULTIPLY_LL:
+        case OP_MULTIPLY_LK:
+        case OP_DIVIDE_LL:
+        case OP_DIVIDE_LK:
+        case OP_GREATER_LL:
+        case OP_GREATER_LK:
+        case OP_LESS_LL:
+        case OP_LESS_LK:
+        case OP_EQUAL_LL:
+        case OP_EQUAL_LK:
+            return 3;
+        case OP_JUMP_GREATER_LL:
+        case OP_JUMP_GREATER_LK:
+        case OP_JUMP_LESS_LL:
+        case OP_JUMP_LESS_LK:
+        case OP_JUMP_EQUAL_LL:
+        case OP_JUMP_EQUAL_LK:
+            return 6;
+        case OP_CLOSURE:
+        {
+            ObjectFunction* function = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+            return 2 + function->upvalueCount * 2;
+        }
+        default:
+            return 1;
+    }
+}
+
+/**
+ * @brief Determines if an instruction takes a 16-bit global slot.
+ * 
+ * @param instruction An opcode to check.
+ * @return true The instruction accesses a global variable.
+ * @return false The instruction does not access a global variable.
+ */
+static bool IsGlobal(uint8_t instruction)
+{
+    switch (instruction)
+    {
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_POP_GLOBAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Determines if an instruction ends in a 16-bit jump offset.
+ * 
+ * @param instruction An opcode to check.
+ * @return true The instruction is a jump.
+ * @return false The instruction is not a jump.
+ */
+static bool IsJump(uint8_t instruction)
+{
+    switch (instruction)
+    {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_JUMP_GREATER_LL:
+        case OP_JUMP_GREATER_LK:
+        case OP_JUMP_LESS_LL:
+        case OP_JUMP_LESS_LK:
+        case OP_JUMP_EQUAL_LL:
+        case OP_JUMP_EQUAL_LK:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Finds the offset an instruction ending in a 16-bit jump offset lands on.
+ * 
+ * @param chunk The Chunk holding the instruction.
+ * @param offset The offset of the jump instruction.
+ * @return int The offset of the jump target.
+ */
+static int JumpTarget(Chunk* chunk, int offset)
+{
+    int length = InstructionLength(chunk, offset);
+    int jump = (chunk->code[offset + length - 2] << 8) | chunk->code[offset + length - 1];
+    return chunk->code[offset] == OP_LOOP ? offset + length - jump : offset + length + jump;
+}
+
+/**
+ * @brief Finds the register form reading two locals of a binary stack instruction.
+ * 
+ * @param instruction A binary stack opcode.
+ * @return int The matching _LL opcode, one below its _LK form, or -1 if there is none.
+ */
+static int RegisterForm(uint8_t instruction)
+{
+    switch (instruction)
+    {
+        case OP_ADD:      return OP_ADD_LL;
+        case OP_SUBTRACT: return OP_SUBTRACT_LL;
+        case OP_MULTIPLY: return OP_MULTIPLY_LL;
+        case OP_DIVIDE:   return OP_DIVIDE_LL;
+        case OP_GREATER:  return OP_GREATER_LL;
+        case OP_LESS:     return OP_LESS_LL;
+        case OP_EQUAL:    return OP_EQUAL_LL;
+        default:          return -1;
+    }
+}
+
+/**
+ * @brief Finds the compare-and-branch form of a register compare instruction.
+ * 
+ * @param instruction A register opcode.
+ * @return int The matching OP_JUMP_* opcode, or -1 if the instruction is not a compare.
+ */
+static int CompareJumpForm(uint8_t instruction)
+{
+    switch (instruction)
+    {
+        case OP_GREATER_LL: return OP_JUMP_GREATER_LL;
+        case OP_GREATER_LK: return OP_JUMP_GREATER_LK;
+        case OP_LESS_LL:    return OP_JUMP_LESS_LL;
+        case OP_LESS_LK:    return OP_JUMP_LESS_LK;
+        case OP_EQUAL_LL:   return OP_JUMP_EQUAL_LL;
+        case OP_EQUAL_LK:   return OP_JUMP_EQUAL_LK;
+        default:            return -1;
+    }
+}
+
+/**
+ * @brief Determines how an instruction changes the height of the stack once it is done.
+ * 
+ * @param chunk The Chunk holding the instruction.
+ * @param offset The offset of the instruction.
+ * @return int The number of values pushed, negative for values popped.
+ */
+static int StackEffect(Chunk* chunk, int offset)
+{
+    switch (chunk->code[offset])
+    {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_CLOSURE:
+        case OP_CLASS:
+        case OP_ADD_LL:
+        case OP_ADD_LK:
+        case OP_SUBTRACT_LL:
+        case OP_SUBTRACT_LK:
+        case OP_MULTIPLY_LL:
+        case OP_MULTIPLY_LK:
+        case OP_DIVIDE_LL:
+        case OP_DIVIDE_LK:
+        case OP_GREATER_LL:
+        case OP_GREATER_LK:
+        case OP_LESS_LL:
+        case OP_LESS_LK:
+        case OP_EQUAL_LL:
+        case OP_EQUAL_LK:
+            return 1;
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_PRINT:
+        case OP_CLOSE_UPVALUE:
+        case OP_RETURN:
+        case OP_INHERIT:
+        case OP_METHOD:
+        case OP_POP_LOCAL:
+        case OP_POP_GLOBAL:
+        case OP_POP_JUMP_IF_FALSE:
+            return -1;
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            return -chunk->code[offset + 1];
+        case OP_INVOKE:
+            return -chunk->code[offset + 2];
+        case OP_SUPER_INVOKE:
+            return -chunk->code[offset + 2] - 1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Finds the highest the stack of a frame running a Chunk can get, above its callee and arguments.
+ * 
+ * Only loops jump backwards, and they jump to code already seen at the same height, so a single pass
+ * that hands the height over to each forward jump's target sees every path.
+ * 
+ * @param chunk The Chunk to measure.
+ * @return int The greatest number of values on the stack.
+ */
+static int MaxStackHeight(Chunk* chunk)
+{
+    int* heights = ALLOCATE(int, chunk->count + 1);
+    for (int offset = 0; offset <= chunk->count; offset++)
+    {
+        heights[offset] = -1;
+    }
+
+    int height = 0;
+    int maxHeight = 0;
+    bool isReachable = true;
+    for (int offset = 0; offset < chunk->count; offset += InstructionLength(chunk, offset))
+    {
+        // Code after an unconditional jump is only reached through a jump to it
+        if (!isReachable || heights[offset] > height)
+        {
+            height = heights[offset] < 0 ? 0 : heights[offset];
+        }
+
+        uint8_t instruction = chunk->code[offset];
+        height += StackEffect(chunk, offset);
+        if (height > maxHeight)
+        {
+            maxHeight = height;
+        }
+
+        if (IsJump(instruction) && instruction != OP_LOOP)
+        {
+            int target = JumpTarget(chunk, offset);
+            if (height > heights[target])
+            {
+                heights[target] = height;
+            }
+        }
+        isReachable = instruction != OP_JUMP && instruction != OP_LOOP && instruction != OP_RETURN;
+    }
+
+    FREE_ARRAY(int, heights, chunk->count + 1);
+    return maxHeight;
+}
+
+/**
+ * @brief Appends a byte to the code FuseChunk() is building.
+ * 
+ * @param code The code being built.
+ * @param lines The line of each byte of code.
+ * @param count The number of bytes written so far, advanced by one.
+ * @param byte A byte to be written.
+ * @param line The line of source code where the byte originates from.
+ */
+static void WriteFused(uint8_t* code, int* lines, int* count, uint8_t byte, int line)
+{
+    code[*count] = byte;
+    lines[*count] = line;
+    (*count)++;
+}
+
+#ifdef TRACE_RECORDER
+/**
+ * @brief Frees the loop anchors of a Chunk along with their traces.
+ * 
+ * @param loops The LoopAnchor array.
+ * @param loopCount The number of anchors.
+ */
+static void FreeLoops(LoopAnchor* loops, int loopCount)
+{
+    for (int i = 0; i < loopCount; i++)
+    {
+        FreeTrace(loops[i].trace);
+    }
+    FREE_ARRAY(LoopAnchor, loops, loopCount);
+}
+#endif
@@ -93,11 +93,18 @@ typedef struct Compiler
     struct Compiler* enclosing;
     ObjectFunction* function;
     FunctionType type;
+    // The skimmed body being compiled, which resolves its upvalues by name as it has no enclosing compiler
+    LazyBody* lazy;
 
     Local locals[UINT8_COUNT];
     int localCount;
     Upvalue upvalues[UINT8_COUNT];
     int scopeDepth;
+
+    int operandStart;
+    int lastTarget;
+    int lastLocalSet;
+    int lastCall;
 } Compiler;
 
 /**
@@ -123,6 +130,9 @@ static void CompileReturnStatement();
 static void CompileWhileStatement();
 static void CompileForStatement();
 static void CompileFunction(FunctionType type);
+static void CompileParameters();
+static ObjectFunction* SkimBody(FunctionType type, Token* parameters);
+static ObjectString* UpvalueName(Compiler* compiler, int index);
 static void CompileMethod();
 static void CompileNumber(bool canAssign);
 static void CompileGrouping(bool canAssign);
@@ -142,9 +152,9 @@ static void CompileSuper(bool canAssign);
 
 static void ParsePrecedence(Precedence precedence);
 static ParseRule* GetParseRule(TokenType type);
-static uint8_t ParseVariable(const char* errorMessage);
+static int ParseVariable(const char* errorMessage);
 static void DeclareVariable();
-static void DefineVariable(uint8_t global);
+static void DefineVariable(int global);
 static void AddLocalVariable(Token name);
 static int ResolveLocalVariable(Compiler* compiler, Token* name);
 static int AddUpvalue(Compiler* compiler, uint8_t index, bool isLocal);
@@ -160,18 +170,24 @@ static void SynchronizeState();
 
 static void EmitByte(uint8_t byte);
 static void EmitTwoBytes(uint8_t byte1, uint8_t byte2);
+static void EmitGlobal(uint8_t instruction, int slot);
 static int EmitJump(uint8_t instruction);
 static void PatchJump(int offset);
 static void EmitLoop(int loopStart);
 static void EmitConstant(Value value);
 static void EmitReturn();
+static bool EmitRegisterBinary(uint8_t stackOp, int leftStart, int rightStart);
+static int EmitConditionJump(int conditionStart, bool* isPopped);
+static void EmitPop();
+static void MarkJumpTarget();
 
 static uint8_t MakeConstant(Value value);
 static uint8_t MakeIdentifierConstant(Token* name);
+static int MakeGlobalSlot(Token* name);
 static bool AreIdentifiersEqual(Token* a, Token* b);
 
 static Chunk* CurrentChunk();
-static void InitCompiler(Compiler* compiler, FunctionType type);
+static void InitCompiler(Compiler* compiler, FunctionType type, ObjectFunction* function);
 static ObjectFunction* EndCompiler();
 static void BeginScope();
 static void EndScope();
@@ -227,15 +243,25 @@ ParseRule rules[] =
     [TOKEN_EOF]                 = {NULL,            NULL,          PRECEDENCE_NONE},
 };
 
-Parser parser;
-Compiler* current = NULL;
-ClassCompiler* currentClass = NULL;
+THREAD_LOCAL Parser parser;
+THREAD_LOCAL Compiler* current = NULL;
+THREAD_LOCAL ClassCompiler* currentClass = NULL;
+THREAD_LOCAL ObjectString* scriptSource = NULL;
+// Set while a body is skimmed: parsed and resolved as usual, with no code emitted
+THREAD_LOCAL bool isSkimming = false;
 
 ObjectFunction* Compile(const char* source)
 {
+    // Skimmed bodies are compiled later from a copy of the source that lives as long as they do
+    if (vm->options.lazyCompile)
+    {
+        scriptSource = CopyString(source, (int)strlen(source));
+        source = scriptSource->chars;
+    }
+
     InitScanner(source);
     Compiler compiler;
-    InitCompiler(&compiler, TYPE_SCRIPT);
+    InitCompiler(&compiler, TYPE_SCRIPT, NULL);
 
     parser.hadError = false;
     parser.panic = false;
@@ -248,11 +274,55 @@ ObjectFunction* Compile(const char* source)
     }
 
     ObjectFunction* function = EndCompiler();
+    scriptSource = NULL;
     return parser.hadError ? NULL : function;
 }
 
+bool CompileLazyBody(ObjectFunction* function)
+{
+    LazyBody* body = function->lazy;
+    ResumeScanner(body->start, body->line);
+    scriptSource = body->source;
+
+    // Only whether the body is in a class, and whether that class has a superclass, can matter to it
+    ClassCompiler classCompiler;
+    classCompiler.enclosing = NULL;
+    classCompiler.hasSuperclass = body->hasSuperclass;
+    currentClass = body->isInClass ? &classCompiler : NULL;
+
+    Compiler compiler;
+    InitCompiler(&compiler, (FunctionType)body->type, function);
+    compiler.lazy = body;
+    BeginScope();
+
+    parser.hadError = false;
+    parser.panic = false;
+    NextToken();
+
+    function->arity = 0;
+    CompileParameters();
+    ConsumeToken(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    CompileBlock();
+    EndCompiler();
+
+    currentClass = NULL;
+    scriptSource = NULL;
+    if (parser.hadError)
+    {
+        // Left skimmed, so every call reports the errors again
+        FreeChunk(&function->chunk);
+        InitChunk(&function->chunk);
+        function->chunk.stackSize = STACK_SIZE_LAZY;
+        return false;
+    }
+
+    FreeLazyBody(function);
+    return true;
+}
+
 void MarkCompilerRoots()
 {
+    MarkObject((Object*)scriptSource);
     Compiler* compiler = current;
     while (compiler != NULL)
     {
@@ -306,9 +376,10 @@ static void CompileClassDeclaration()
     Token className = parser.previous;
     uint8_t nameConstant = MakeIdentifierConstant(&parser.previous);
     DeclareVariable();
+    int global = current->scopeDepth > 0 ? 0 : MakeGlobalSlot(&parser.previous);
 
     EmitTwoBytes(OP_CLASS, nameConstant);
-    DefineVariable(nameConstant);
+    DefineVariable(global);
 
     // Track the current class for "this"
     ClassCompiler classCompiler;
@@ -361,7 +432,7 @@ static void CompileClassDeclaration()
  */
 static void CompileFunctionDeclaration()
 {
-    uint8_t global = ParseVariable("Expect function name.");
+    int global = ParseVariable("Expect function name.");
     MarkInitialized();
     CompileFunction(TYPE_FUNCTION);
     DefineVariable(global);
@@ -372,7 +443,7 @@ static void CompileFunctionDeclaration()
  */
 static void CompileVariableDeclaration()
 {
-    uint8_t global = ParseVariable("Expect variable name.");
+    int global = ParseVariable("Expect variable name.");
 
     if (MatchToken(TOKEN_EQUAL))
     {
@@ -431,7 +502,7 @@ static void CompileExpressionStatement()
 {
     CompileExpression();
     ConsumeToken(TOKEN_SEMICOLON, "Expect ';' after expression.");
-    EmitByte(OP_POP);
+    EmitPop();
 }
 
 /**
@@ -463,17 +534,25 @@ static void CompileBlock()
 static void CompileIfStatement()
 {
     ConsumeToken(TOKEN_LEFT_PARENTHESES, "Expect '(' after 'if'.");
+    int conditionStart = CurrentChunk()->count;
     CompileExpression();
     ConsumeToken(TOKEN_RIGHT_PARENTHESES, "Expect ')' after condition.");
 
-    int thenJump = EmitJump(OP_JUMP_IF_FALSE);
-    EmitByte(OP_POP);
+    bool isPopped;
+    int thenJump = EmitConditionJump(conditionStart, &isPopped);
+    if (!isPopped)
+    {
+        EmitByte(OP_POP);
+    }
     CompileStatement();
 
     int elseJump = EmitJump(OP_JUMP);
 
     PatchJump(thenJump);
-    EmitByte(OP_POP);
+    if (!isPopped)
+    {
+        EmitByte(OP_POP);
+    }
 
     if (MatchToken(TOKEN_ELSE))
     {
@@ -505,6 +584,14 @@ static void CompileReturnStatement()
 
         CompileExpression();
         ConsumeToken(TOKEN_SEMICOLON, "Expect ';' after return value.");
+
+        // A call whose result is returned straight away can hand its frame over to the callee; the return
+        // stays behind for callees that do not take a frame, like natives and classes
+        Chunk* chunk = CurrentChunk();
+        if (current->lastCall == chunk->count - 2 && chunk->code[current->lastCall] == OP_CALL)
+        {
+            chunk->code[current->lastCall] = OP_TAIL_CALL;
+        }
         EmitByte(OP_RETURN);
     }
 }
@@ -515,17 +602,25 @@ static void CompileReturnStatement()
 static void CompileWhileStatement()
 {
     int loopStart = CurrentChunk()->count;
+    MarkJumpTarget();
     ConsumeToken(TOKEN_LEFT_PARENTHESES, "Expect '(' after 'while'.");
     CompileExpression();
     ConsumeToken(TOKEN_RIGHT_PARENTHESES, "Expect ')' after condition.");
 
-    int exitJump = EmitJump(OP_JUMP_IF_FALSE);
-    EmitByte(OP_POP);
+    bool isPopped;
+    int exitJump = EmitConditionJump(loopStart, &isPopped);
+    if (!isPopped)
+    {
+        EmitByte(OP_POP);
+    }
     CompileStatement();
     EmitLoop(loopStart);
 
     PatchJump(exitJump);
-    EmitByte(OP_POP);
+    if (!isPopped)
+    {
+        EmitByte(OP_POP);
+    }
 }
 
 /**
@@ -549,22 +644,28 @@ static void CompileForStatement()
     }
 
     int loopStart = CurrentChunk()->count;
+    MarkJumpTarget();
     int exitJump = -1;
+    bool isPopped = false;
     if (!MatchToken(TOKEN_SEMICOLON))
     {
         CompileExpression();
         ConsumeToken(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
 
-        exitJump = EmitJump(OP_JUMP_IF_FALSE);
-        EmitByte(OP_POP);
+        exitJump = EmitConditionJump(loopStart, &isPopped);
+        if (!isPopped)
+        {
+            EmitByte(OP_POP);
+        }
     }
 
     if (!MatchToken(TOKEN_RIGHT_PARENTHESES))
     {
         int bodyJump = EmitJump(OP_JUMP);
         int incrementStart = CurrentChunk()->count;
+        MarkJumpTarget();
         CompileExpression();
-        EmitByte(OP_POP);
+        EmitPop();
         ConsumeToken(TOKEN_RIGHT_PARENTHESES, "Expect ')' after for clauses.");
 
         EmitLoop(loopStart);
@@ -578,7 +679,10 @@ static void CompileForStatement()
     if (exitJump != -1)
     {
         PatchJump(exitJump);
-        EmitByte(OP_POP);
+        if (!isPopped)
+        {
+            EmitByte(OP_POP);
+        }
     }
 
     EndScope();
@@ -592,9 +696,36 @@ static void CompileForStatement()
 static void CompileFunction(FunctionType type)
 {
     Compiler compiler;
-    InitCompiler(&compiler, type);
+    InitCompiler(&compiler, type, NULL);
     BeginScope();
 
+    Token parameters = parser.current;
+    CompileParameters();
+    ConsumeToken(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+
+    ObjectFunction* function;
+    if (vm->options.lazyCompile)
+    {
+        function = SkimBody(type, &parameters);
+    }
+    else
+    {
+        CompileBlock();
+        function = EndCompiler();
+    }
+    EmitTwoBytes(OP_CLOSURE, MakeConstant(OBJECT_VALUE(function)));
+
+    for (int i = 0; i < function->upvalueCount; i++)
+    {
+        EmitTwoBytes(compiler.upvalues[i].isLocal ? 1 : 0, compiler.upvalues[i].index);
+    }
+}
+
+/**
+ * @brief Compiles the parameter list of the current function, declaring each parameter as a local.
+ */
+static void CompileParameters()
+{
     ConsumeToken(TOKEN_LEFT_PARENTHESES, "Expect '(' after function name.");
     if (!CheckToken(TOKEN_RIGHT_PARENTHESES))
     {
@@ -611,16 +742,77 @@ static void CompileFunction(FunctionType type)
     }
 
     ConsumeToken(TOKEN_RIGHT_PARENTHESES, "Expect ')' after parameters.");
-    ConsumeToken(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+}
+
+/**
+ * @brief Parses the body of the current function without generating its code, which waits for the function's first call.
+ * 
+ * The body is parsed and its names are resolved just as a compiled body's are, so its errors are reported
+ * now and the closure captures exactly the enclosing variables the body uses. Only emitting code is skipped,
+ * for the body and every function nested in it.
+ * 
+ * @param type The type of the function.
+ * @param parameters The Token opening the parameter list, where compiling the body will start.
+ * @return ObjectFunction* The function, whose body is left uncompiled.
+ */
+static ObjectFunction* SkimBody(FunctionType type, Token* parameters)
+{
+    bool wasSkimming = isSkimming;
+    isSkimming = true;
     CompileBlock();
+    isSkimming = wasSkimming;
 
-    ObjectFunction* function = EndCompiler();
-    EmitTwoBytes(OP_CLOSURE, MakeConstant(OBJECT_VALUE(function)));
+    // A function nested in a skimmed body is thrown away, and skimmed again when that body is compiled
+    ObjectFunction* function = current->function;
+    if (!isSkimming)
+    {
+        LazyBody* body = ALLOCATE(LazyBody, 1);
+        body->source = scriptSource;
+        body->start = parameters->start;
+        body->line = parameters->line;
+        body->type = (uint8_t)type;
+        body->isInClass = currentClass != NULL;
+        body->hasSuperclass = currentClass != NULL && currentClass->hasSuperclass;
+        body->upvalueNames = ALLOCATE(ObjectString*, function->upvalueCount);
+        for (int i = 0; i < function->upvalueCount; i++)
+        {
+            body->upvalueNames[i] = NULL;
+        }
+        function->lazy = body;
+        function->chunk.stackSize = STACK_SIZE_LAZY;
+        for (int i = 0; i < function->upvalueCount; i++)
+        {
+            body->upvalueNames[i] = UpvalueName(current, i);
+        }
+    }
 
-    for (int i = 0; i < function->upvalueCount; i++)
+    current = current->enclosing;
+    return function;
+}
+
+/**
+ * @brief Finds the name of the variable an upvalue captures, following it out through the enclosing functions.
+ * 
+ * @param compiler The Compiler of the function the upvalue belongs to.
+ * @param index The index of the upvalue.
+ * @return ObjectString* The name of the variable.
+ */
+static ObjectString* UpvalueName(Compiler* compiler, int index)
+{
+    // A body compiled lazily has no enclosing compiler, but knows the names it captured
+    if (compiler->lazy != NULL)
     {
-        EmitTwoBytes(compiler.upvalues[i].isLocal ? 1 : 0, compiler.upvalues[i].index);
+        return compiler->lazy->upvalueNames[index];
     }
+
+    Upvalue* upvalue = &compiler->upvalues[index];
+    if (!upvalue->isLocal)
+    {
+        return UpvalueName(compiler->enclosing, upvalue->index);
+    }
+
+    Token* name = &compiler->enclosing->locals[upvalue->index].name;
+    return CopyString(name->start, name->length);
 }
 
 /**
@@ -647,7 +839,16 @@ static void CompileMethod()
 static void CompileNumber(bool canAssign)
 {
     double value = strtod(parser.previous.start, NULL);
-    EmitConstant(NUMBER_VALUE(value));
+
+    // Whole numbers that fit in 32 bits start out as integers, which print and compare as the same doubles
+    if (value <= INT32_MAX && value == (int32_t)value)
+    {
+        EmitConstant(INTEGER_VALUE((int32_t)value));
+    }
+    else
+    {
+        EmitConstant(NUMBER_VALUE(value));
+    }
 }
 
 /**
@@ -690,40 +891,45 @@ static void CompileUnary(bool canAssign)
 static void CompileBinary(bool canAssign)
 {
     TokenType op = parser.previous.type;
+    int leftStart = current->operandStart;
+    int rightStart = CurrentChunk()->count;
     ParseRule* rule = GetParseRule(op);
     ParsePrecedence((Precedence)(rule->precedence + 1));
 
     switch (op)
     {
         case TOKEN_BANG_EQUAL:
-            EmitTwoBytes(OP_EQUAL, OP_NOT);
+            EmitRegisterBinary(OP_EQUAL, leftStart, rightStart);
+            EmitByte(OP_NOT);
             break;
         case TOKEN_EQUAL_EQUAL:
-            EmitByte(OP_EQUAL);
+            EmitRegisterBinary(OP_EQUAL, leftStart, rightStart);
             break;
         case TOKEN_GREATER:
-            EmitByte(OP_GREATER);
+            EmitRegisterBinary(OP_GREATER, leftStart, rightStart);
             break;
         case TOKEN_GREATER_EQUAL:
-            EmitTwoBytes(OP_LESS, OP_NOT);
+            EmitRegisterBinary(OP_LESS, leftStart, rightStart);
+            EmitByte(OP_NOT);
             break;
         case TOKEN_LESS:
-            EmitByte(OP_LESS);
+            EmitRegisterBinary(OP_LESS, leftStart, rightStart);
             break;
         case TOKEN_LESS_EQUAL:
-            EmitTwoBytes(OP_GREATER, OP_NOT);
+            EmitRegisterBinary(OP_GREATER, leftStart, rightStart);
+            EmitByte(OP_NOT);
             break;
         case TOKEN_PLUS:
-            EmitByte(OP_ADD);
+            EmitRegisterBinary(OP_ADD, leftStart, rightStart);
             break;
         case TOKEN_MINUS:
-            EmitByte(OP_SUBTRACT);
+            EmitRegisterBinary(OP_SUBTRACT, leftStart, rightStart);
             break;
         case TOKEN_STAR:
-            EmitByte(OP_MULTIPLY);
+            EmitRegisterBinary(OP_MULTIPLY, leftStart, rightStart);
             break;
         case TOKEN_SLASH:
-            EmitByte(OP_DIVIDE);
+            EmitRegisterBinary(OP_DIVIDE, leftStart, rightStart);
             break;
         // Unknown operator
         default:
@@ -737,6 +943,7 @@ static void CompileBinary(bool canAssign)
 static void CompileCall(bool canAssign)
 {
     uint8_t argCount = CompileArgumentList();
+    current->lastCall = CurrentChunk()->count;
     EmitTwoBytes(OP_CALL, argCount);
 }
 
@@ -817,7 +1024,7 @@ static void CompileLiteral(bool canAssign)
  */
 static void CompileString(bool canAssign)
 {
-    EmitConstant(OBJECT_VALUE(CopyString(parser.previous.start + 1, parser.previous.length - 2)));
+    EmitConstant(StringValue(parser.previous.start + 1, parser.previous.length - 2));
 }
 
 /**
@@ -850,7 +1057,7 @@ static void CompileNamedVariable(Token name, bool canAssign)
     }
     else
     {
-        arg = MakeIdentifierConstant(&name);
+        arg = MakeGlobalSlot(&name);
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
     }
@@ -858,7 +1065,22 @@ static void CompileNamedVariable(Token name, bool canAssign)
     if (canAssign && MatchToken(TOKEN_EQUAL))
     {
         CompileExpression();
-        EmitTwoBytes(setOp, (uint8_t)arg);
+        if (setOp == OP_SET_LOCAL)
+        {
+            current->lastLocalSet = CurrentChunk()->count;
+        }
+        if (setOp == OP_SET_GLOBAL)
+        {
+            EmitGlobal(setOp, arg);
+        }
+        else
+        {
+            EmitTwoBytes(setOp, (uint8_t)arg);
+        }
+    }
+    else if (getOp == OP_GET_GLOBAL)
+    {
+        EmitGlobal(getOp, arg);
     }
     else
     {
@@ -956,6 +1178,7 @@ static void ParsePrecedence(Precedence precedence)
     }
 
     bool canAssign = precedence <= PRECEDENCE_ASSIGNMENT;
+    int start = CurrentChunk()->count;
     prefixRule(canAssign);
 
     // Attempt to parse out an infix
@@ -963,6 +1186,7 @@ static void ParsePrecedence(Precedence precedence)
     {
         NextToken();
         ParseFn infixRule = GetParseRule(parser.previous.type)->infix;
+        current->operandStart = start;
         infixRule(canAssign);
     }
 
@@ -987,9 +1211,9 @@ static ParseRule* GetParseRule(TokenType type)
  * @brief Parses out a variable.
  * 
  * @param errorMessage An error message if the parsing fails.
- * @return uint8_t An identifier constant.
+ * @return int A global variable slot.
  */
-static uint8_t ParseVariable(const char* errorMessage)
+static int ParseVariable(const char* errorMessage)
 {
     ConsumeToken(TOKEN_IDENTIFIER, errorMessage);
 
@@ -999,7 +1223,7 @@ static uint8_t ParseVariable(const char* errorMessage)
         return 0;
     }
 
-    return MakeIdentifierConstant(&parser.previous);
+    return MakeGlobalSlot(&parser.previous);
 }
 
 /**
@@ -1033,9 +1257,9 @@ static void DeclareVariable()
 /**
  * @brief Defines a global variable.
  * 
- * @param global A variable index.
+ * @param global A global variable slot.
  */
-static void DefineVariable(uint8_t global)
+static void DefineVariable(int global)
 {
     if (current->scopeDepth > 0)
     {
@@ -1043,7 +1267,7 @@ static void DefineVariable(uint8_t global)
         return;
     }
 
-    EmitTwoBytes(OP_DEFINE_GLOBAL, global);
+    EmitGlobal(OP_DEFINE_GLOBAL, global);
 }
 
 /**
@@ -1134,6 +1358,15 @@ static int ResolveUpvalue(Compiler* compiler, Token* name)
     // No enclosing, reached globals so nothing to do
     if (compiler->enclosing == NULL)
     {
+        // A skimmed body's closure has already captured everything it can use, by name
+        for (int i = 0; compiler->lazy != NULL && i < compiler->function->upvalueCount; i++)
+        {
+            ObjectString* upvalue = compiler->lazy->upvalueNames[i];
+            if (upvalue->length == name->length && memcmp(upvalue->chars, name->start, name->length) == 0)
+            {
+                return i;
+            }
+        }
         return -1;
     }
 
@@ -1292,6 +1525,10 @@ static void SynchronizeState()
  */
 static void EmitByte(uint8_t byte)
 {
+    if (isSkimming)
+    {
+        return;
+    }
     WriteChunk(CurrentChunk(), byte, parser.previous.line);
 }
 
@@ -1307,6 +1544,18 @@ static void EmitTwoBytes(uint8_t byte1, uint8_t byte2)
     EmitByte(byte2);
 }
 
+/**
+ * @brief Appends a global variable instruction with its 16-bit slot to the current Chunk.
+ * 
+ * @param instruction A global variable instruction to append.
+ * @param slot The slot of the global variable.
+ */
+static void EmitGlobal(uint8_t instruction, int slot)
+{
+    EmitByte(instruction);
+    EmitTwoBytes((slot >> 8) & 0xff, slot & 0xff);
+}
+
 /**
  * @brief Appends a jump instruction to the current Chunk.
  * 
@@ -1327,6 +1576,12 @@ static int EmitJump(uint8_t instruction)
  */
 static void PatchJump(int offset)
 {
+    // Nothing was emitted to patch
+    if (isSkimming)
+    {
+        return;
+    }
+
     // -2 adjusts for IP overshoot of current instruction
     int jump = CurrentChunk()->count - offset - 2;
 
@@ -1337,6 +1592,7 @@ static void PatchJump(int offset)
 
     CurrentChunk()->code[offset] = (jump >> 8) & 0xff;
     CurrentChunk()->code[offset + 1] = jump & 0xff;
+    MarkJumpTarget();
 }
 
 /**
@@ -1384,6 +1640,131 @@ static void EmitReturn()
     EmitByte(OP_RETURN);
 }
 
+/**
+ * @brief Emits a binary operation, using its register form when both operands are simple.
+ * 
+ * In register mode, a left operand that is a single local read and a right operand that is a single
+ * local or constant read are folded into one three-address instruction that reads the frame directly.
+ * 
+ * @param stackOp The stack form of the operation.
+ * @param leftStart The offset where the left operand's code begins.
+ * @param rightStart The offset where the right operand's code begins.
+ * @return true The register form was emitted.
+ * @return false The stack form was emitted.
+ */
+static bool EmitRegisterBinary(uint8_t stackOp, int leftStart, int rightStart)
+{
+    Chunk* chunk = CurrentChunk();
+    bool isSimple = vm->options.registerMode && current->lastTarget <= leftStart &&
+                    rightStart - leftStart == 2 && chunk->code[leftStart] == OP_GET_LOCAL &&
+                    chunk->count - rightStart == 2 &&
+                    (chunk->code[rightStart] == OP_GET_LOCAL || chunk->code[rightStart] == OP_CONSTANT);
+    if (!isSimple)
+    {
+        EmitByte(stackOp);
+        return false;
+    }
+
+    bool isConstant = chunk->code[rightStart] == OP_CONSTANT;
+    uint8_t left = chunk->code[leftStart + 1];
+    uint8_t right = chunk->code[rightStart + 1];
+
+    uint8_t registerOp;
+    switch (stackOp)
+    {
+        case OP_ADD:      registerOp = isConstant ? OP_ADD_LK : OP_ADD_LL; break;
+        case OP_SUBTRACT: registerOp = isConstant ? OP_SUBTRACT_LK : OP_SUBTRACT_LL; break;
+        case OP_MULTIPLY: registerOp = isConstant ? OP_MULTIPLY_LK : OP_MULTIPLY_LL; break;
+        case OP_DIVIDE:   registerOp = isConstant ? OP_DIVIDE_LK : OP_DIVIDE_LL; break;
+        case OP_GREATER:  registerOp = isConstant ? OP_GREATER_LK : OP_GREATER_LL; break;
+        case OP_LESS:     registerOp = isConstant ? OP_LESS_LK : OP_LESS_LL; break;
+        case OP_EQUAL:    registerOp = isConstant ? OP_EQUAL_LK : OP_EQUAL_LL; break;
+        default:
+            EmitByte(stackOp);
+            return false;
+    }
+
+    // Rewind over both operand reads and replace them
+    chunk->count = leftStart;
+    EmitByte(registerOp);
+    EmitTwoBytes(left, right);
+    return true;
+}
+
+/**
+ * @brief Emits the conditional jump of an if, while or for statement.
+ * 
+ * In register mode, a condition that is a single register comparison (optionally negated) becomes a
+ * compare-and-branch instruction that never pushes the condition onto the stack.
+ * 
+ * @param conditionStart The offset where the condition's code begins.
+ * @param isPopped Set to whether the condition is already off the stack on both paths.
+ * @return int The offset of the jump operand to patch.
+ */
+static int EmitConditionJump(int conditionStart, bool* isPopped)
+{
+    Chunk* chunk = CurrentChunk();
+    int length = chunk->count - conditionStart;
+    bool isNegated = length == 4 && chunk->code[chunk->count - 1] == OP_NOT;
+
+    *isPopped = false;
+    if (!vm->options.registerMode || current->lastTarget > conditionStart || (length != 3 && !isNegated))
+    {
+        return EmitJump(OP_JUMP_IF_FALSE);
+    }
+
+    uint8_t jumpOp;
+    switch (chunk->code[conditionStart])
+    {
+        case OP_GREATER_LL: jumpOp = OP_JUMP_GREATER_LL; break;
+        case OP_GREATER_LK: jumpOp = OP_JUMP_GREATER_LK; break;
+        case OP_LESS_LL:    jumpOp = OP_JUMP_LESS_LL; break;
+        case OP_LESS_LK:    jumpOp = OP_JUMP_LESS_LK; break;
+        case OP_EQUAL_LL:   jumpOp = OP_JUMP_EQUAL_LL; break;
+        case OP_EQUAL_LK:   jumpOp = OP_JUMP_EQUAL_LK; break;
+        default:
+            return EmitJump(OP_JUMP_IF_FALSE);
+    }
+
+    uint8_t left = chunk->code[conditionStart + 1];
+    uint8_t right = chunk->code[conditionStart + 2];
+
+    // Jump away when the comparison matches the sense operand
+    chunk->count = conditionStart;
+    EmitByte(jumpOp);
+    EmitTwoBytes(left, right);
+    EmitByte(isNegated ? 1 : 0);
+
+    *isPopped = true;
+    EmitTwoBytes(0xff, 0xff);
+    return CurrentChunk()->count - 2;
+}
+
+/**
+ * @brief Emits a pop, folding a preceding local assignment into a register store when possible.
+ */
+static void EmitPop()
+{
+    Chunk* chunk = CurrentChunk();
+    if (vm->options.registerMode && current->lastLocalSet == chunk->count - 2 &&
+        current->lastTarget <= current->lastLocalSet)
+    {
+        chunk->code[current->lastLocalSet] = OP_POP_LOCAL;
+        current->lastLocalSet = -1;
+        return;
+    }
+
+    EmitByte(OP_POP);
+}
+
+/**
+ * @brief Records that code emitted from here on may be jumped to.
+ */
+static void MarkJumpTarget()
+{
+    current->lastTarget = CurrentChunk()->count;
+}
+
 /**
  * @brief Converts a Value to a constant and adds it to the current Chunk.
  * 
@@ -1392,6 +1773,11 @@ static void EmitReturn()
  */
 static uint8_t MakeConstant(Value value)
 {
+    if (isSkimming)
+    {
+        return 0;
+    }
+
     int constant = AddConstant(CurrentChunk(), value);
     if (constant > UINT8_MAX)
     {
@@ -1410,9 +1796,37 @@ static uint8_t MakeConstant(Value value)
  */
 static uint8_t MakeIdentifierConstant(Token* name)
 {
+    if (isSkimming)
+    {
+        return 0;
+    }
     return MakeConstant(OBJECT_VALUE(CopyString(name->start, name->length)));
 }
 
+/**
+ * @brief Resolves a global variable name to its slot in the global value array.
+ * 
+ * @param name The name Token of the global variable.
+ * @return int A global variable slot.
+ */
+static int MakeGlobalSlot(Token* name)
+{
+    // The globals a skimmed body uses get their slots once it is compiled
+    if (isSkimming)
+    {
+        return 0;
+    }
+
+    int slot = GlobalSlot(CopyString(name->start, name->length));
+    if (slot > UINT16_MAX)
+    {
+        Error("Too many global variables.");
+        return 0;
+    }
+
+    return slot;
+}
+
 /**
  * @brief Compares two identifiers and returns if they are equal.
  * 
@@ -1447,17 +1861,24 @@ static Chunk* CurrentChunk()
  * @brief Initializes a Compiler.
  * 
  * @param compiler A Compiler to initialize.
+ * @param type The type of the function.
+ * @param function A skimmed function to compile the body of, or NULL to compile a new function.
  */
-static void InitCompiler(Compiler* compiler, FunctionType type)
+static void InitCompiler(Compiler* compiler, FunctionType type, ObjectFunction* function)
 {
-    compiler->enclosing = current;
+    compiler->enclosing = function != NULL ? NULL : current;
     compiler->function = NULL;
     compiler->type = type;
+    compiler->lazy = NULL;
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
-    compiler->function = NewFunction();
+    compiler->operandStart = 0;
+    compiler->lastTarget = 0;
+    compiler->lastLocalSet = -1;
+    compiler->lastCall = -1;
+    compiler->function = function != NULL ? function : NewFunction();
     current = compiler;
-    if (type != TYPE_SCRIPT)
+    if (type != TYPE_SCRIPT && function == NULL)
     {
         current->function->name = CopyString(parser.previous.start, parser.previous.length);
     }
@@ -1485,6 +1906,12 @@ static ObjectFunction* EndCompiler()
     EmitReturn();
     ObjectFunction* function = current->function;
 
+    if (!parser.hadError)
+    {
+        FuseChunk(CurrentChunk());
+        ThreadChunk(CurrentChunk());
+    }
+
 #ifdef DEBUG_PRINT_CODE
     if (!parser.hadError)
     {
@@ -1555,22 +1982,22 @@ static void ErrorAt(Token* token, const char* message)
     }
 
     // Report line
-    fprintf(stderr, "[line %d] Error", token->line);
+    fprintf(vm->options.errors, "[line %d] Error", token->line);
 
     // Add positional indicator
     switch (token->type)
     {
         case TOKEN_EOF:
-            fprintf(stderr, " at end");
+            fprintf(vm->options.errors, " at end");
             break;
         case TOKEN_ERROR:
             break;
         default:
-            fprintf(stderr, " at '%.*s'", token->length, token->start);
+            fprintf(vm->options.errors, " at '%.*s'", token->length, token->start);
             break;
     }
 
-    fprintf(stderr, ": %s\n", message);
+    fprintf(vm->options.errors, ": %s\n", message);
     parser.hadError = true;
 }
 
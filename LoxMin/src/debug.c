@@ -1,13 +1,112 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "debug.h"
 #include "object.h"
 #include "value.h"
+#include "vm.h"
 
 static int SimpleInstruction(const char* name, int offset);
 static int ConstantInstruction(const char* name, Chunk* chunk, int offset);
+static int GlobalInstruction(const char* name, Chunk* chunk, int offset);
 static int ByteInstruction(const char* name, Chunk* chunk, int offset);
 static int JumpInstruction(const char* name, int sign, Chunk* chunk, int offset);
 static int InvokeInstruction(const char* name, Chunk* chunk, int offset);
+static int RegisterInstruction(const char* name, bool isConstant, Chunk* chunk, int offset);
+static int CompareJumpInstruction(const char* name, bool isConstant, Chunk* chunk, int offset);
+#ifdef DEBUG_DUMP_TRACES
+static void PrintIrVariable(Trace* trace, int variable);
+#endif
+
+#ifdef DEBUG_PROFILE_OPCODES
+#define PROFILE_CAPACITY 8192
+#define PROFILE_MAX_LENGTH 4
+#define PROFILE_TOP 15
+
+/**
+ * @brief Stores how often a sequence of opcodes was executed.
+ */
+typedef struct
+{
+    uint64_t key;
+    uint64_t count;
+} ProfileEntry;
+
+static THREAD_LOCAL ProfileEntry profile[PROFILE_CAPACITY];
+
+static void CountSequence(uint64_t key);
+static int CompareProfileEntries(const void* a, const void* b);
+#endif
+
+#if defined(DEBUG_PROFILE_OPCODES) || defined(DEBUG_CACHE_STATS)
+static const char* opcodeNames[] =
+{
+    [OP_CONSTANT] = "OP_CONSTANT",
+    [OP_NIL] = "OP_NIL",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_POP] = "OP_POP",
+    [OP_GET_LOCAL] = "OP_GET_LOCAL",
+    [OP_SET_LOCAL] = "OP_SET_LOCAL",
+    [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+    [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+    [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+    [OP_GET_UPVALUE] = "OP_GET_UPVALUE",
+    [OP_SET_UPVALUE] = "OP_SET_UPVALUE",
+    [OP_GET_PROPERTY] = "OP_GET_PROPERTY",
+    [OP_SET_PROPERTY] = "OP_SET_PROPERTY",
+    [OP_GET_SUPER] = "OP_GET_SUPER",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_LESS] = "OP_LESS",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUBTRACT] = "OP_SUBTRACT",
+    [OP_MULTIPLY] = "OP_MULTIPLY",
+    [OP_DIVIDE] = "OP_DIVIDE",
+    [OP_NOT] = "OP_NOT",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_PRINT] = "OP_PRINT",
+    [OP_JUMP] = "OP_JUMP",
+    [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+    [OP_LOOP] = "OP_LOOP",
+    [OP_CALL] = "OP_CALL",
+    [OP_TAIL_CALL] = "OP_TAIL_CALL",
+    [OP_INVOKE] = "OP_INVOKE",
+    [OP_SUPER_INVOKE] = "OP_SUPER_INVOKE",
+    [OP_CLOSURE] = "OP_CLOSURE",
+    [OP_CLOSE_UPVALUE] = "OP_CLOSE_UPVALUE",
+    [OP_RETURN] = "OP_RETURN",
+    [OP_CLASS] = "OP_CLASS",
+    [OP_INHERIT] = "OP_INHERIT",
+    [OP_METHOD] = "OP_METHOD",
+    [OP_ADD_LL] = "OP_ADD_LL",
+    [OP_ADD_LK] = "OP_ADD_LK",
+    [OP_SUBTRACT_LL] = "OP_SUBTRACT_LL",
+    [OP_SUBTRACT_LK] = "OP_SUBTRACT_LK",
+    [OP_MULTIPLY_LL] = "OP_MULTIPLY_LL",
+    [OP_MULTIPLY_LK] = "OP_MULTIPLY_LK",
+    [OP_DIVIDE_LL] = "OP_DIVIDE_LL",
+    [OP_DIVIDE_LK] = "OP_DIVIDE_LK",
+    [OP_GREATER_LL] = "OP_GREATER_LL",
+    [OP_GREATER_LK] = "OP_GREATER_LK",
+    [OP_LESS_LL] = "OP_LESS_LL",
+    [OP_LESS_LK] = "OP_LESS_LK",
+    [OP_EQUAL_LL] = "OP_EQUAL_LL",
+    [OP_EQUAL_LK] = "OP_EQUAL_LK",
+    [OP_JUMP_GREATER_LL] = "OP_JUMP_GREATER_LL",
+    [OP_JUMP_GREATER_LK] = "OP_JUMP_GREATER_LK",
+    [OP_JUMP_LESS_LL] = "OP_JUMP_LESS_LL",
+    [OP_JUMP_LESS_LK] = "OP_JUMP_LESS_LK",
+    [OP_JUMP_EQUAL_LL] = "OP_JUMP_EQUAL_LL",
+    [OP_JUMP_EQUAL_LK] = "OP_JUMP_EQUAL_LK",
+    [OP_POP_LOCAL] = "OP_POP_LOCAL",
+    [OP_POP_GLOBAL] = "OP_POP_GLOBAL",
+    [OP_POP_JUMP_IF_FALSE] = "OP_POP_JUMP_IF_FALSE",
+    [OP_ADD_NUMBER] = "OP_ADD_NUMBER",
+    [OP_ADD_STRING] = "OP_ADD_STRING",
+    [OP_EQUAL_NUMBER] = "OP_EQUAL_NUMBER",
+};
+#endif
 
 void DisassembleChunk(Chunk* chunk, const char* name)
 {
@@ -50,11 +149,11 @@ int DisassembleInstruction(Chunk* chunk, int offset)
         case OP_SET_LOCAL:
             return ByteInstruction("OP_SET_LOCAL", chunk, offset);
         case OP_GET_GLOBAL:
-            return ConstantInstruction("OP_GET_GLOBAL", chunk, offset);
+            return GlobalInstruction("OP_GET_GLOBAL", chunk, offset);
         case OP_DEFINE_GLOBAL:
-            return ConstantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+            return GlobalInstruction("OP_DEFINE_GLOBAL", chunk, offset);
         case OP_SET_GLOBAL:
-            return ConstantInstruction("OP_SET_GLOBAL", chunk, offset);
+            return GlobalInstruction("OP_SET_GLOBAL", chunk, offset);
         case OP_GET_UPVALUE:
             return ByteInstruction("OP_GET_UPVALUE", chunk, offset);
         case OP_SET_UPVALUE:
@@ -93,6 +192,8 @@ int DisassembleInstruction(Chunk* chunk, int offset)
             return JumpInstruction("OP_LOOP", -1, chunk, offset);
         case OP_CALL:
             return ByteInstruction("OP_CALL", chunk, offset);
+        case OP_TAIL_CALL:
+            return ByteInstruction("OP_TAIL_CALL", chunk, offset);
         case OP_CLOSE_UPVALUE:
             return SimpleInstruction("OP_CLOSE_UPVALUE", offset);
         case OP_INVOKE:
@@ -104,7 +205,7 @@ int DisassembleInstruction(Chunk* chunk, int offset)
             offset++;
             uint8_t constant = chunk->code[offset++];
             printf("%-16s %4d ", "OP_CLOSURE", constant);
-            PrintValue(chunk->constants.values[constant]);
+            PrintValue(stdout, chunk->constants.values[constant]);
             printf("\n");
 
             ObjectFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
@@ -125,6 +226,52 @@ int DisassembleInstruction(Chunk* chunk, int offset)
             return SimpleInstruction("OP_INHERIT", offset);
         case OP_METHOD:
             return ConstantInstruction("OP_METHOD", chunk, offset);
+        case OP_ADD_LL:
+            return RegisterInstruction("OP_ADD_LL", false, chunk, offset);
+        case OP_ADD_LK:
+            return RegisterInstruction("OP_ADD_LK", true, chunk, offset);
+        case OP_SUBTRACT_LL:
+            return RegisterInstruction("OP_SUBTRACT_LL", false, chunk, offset);
+        case OP_SUBTRACT_LK:
+            return RegisterInstruction("OP_SUBTRACT_LK", true, chunk, offset);
+        case OP_MULTIPLY_LL:
+            return RegisterInstruction("OP_MULTIPLY_LL", false, chunk, offset);
+        case OP_MULTIPLY_LK:
+            return RegisterInstruction("OP_MULTIPLY_LK", true, chunk, offset);
+        case OP_DIVIDE_LL:
+            return RegisterInstruction("OP_DIVIDE_LL", false, chunk, offset);
+        case OP_DIVIDE_LK:
+            return RegisterInstruction("OP_DIVIDE_LK", true, chunk, offset);
+        case OP_GREATER_LL:
+            return RegisterInstruction("OP_GREATER_LL", false, chunk, offset);
+        case OP_GREATER_LK:
+            return RegisterInstruction("OP_GREATER_LK", true, chunk, offset);
+        case OP_LESS_LL:
+            return RegisterInstruction("OP_LESS_LL", false, chunk, offset);
+        case OP_LESS_LK:
+            return RegisterInstruction("OP_LESS_LK", true, chunk, offset);
+        case OP_EQUAL_LL:
+            return RegisterInstruction("OP_EQUAL_LL", false, chunk, offset);
+        case OP_EQUAL_LK:
+            return RegisterInstruction("OP_EQUAL_LK", true, chunk, offset);
+        case OP_JUMP_GREATER_LL:
+            return CompareJumpInstruction("OP_JUMP_GREATER_LL", false, chunk, offset);
+        case OP_JUMP_GREATER_LK:
+            return CompareJumpInstruction("OP_JUMP_GREATER_LK", true, chunk, offset);
+        case OP_JUMP_LESS_LL:
+            return CompareJumpInstruction("OP_JUMP_LESS_LL", false, chunk, offset);
+        case OP_JUMP_LESS_LK:
+            return CompareJumpInstruction("OP_JUMP_LESS_LK", true, chunk, offset);
+        case OP_JUMP_EQUAL_LL:
+            return CompareJumpInstruction("OP_JUMP_EQUAL_LL", false, chunk, offset);
+        case OP_JUMP_EQUAL_LK:
+            return CompareJumpInstruction("OP_JUMP_EQUAL_LK", true, chunk, offset);
+        case OP_POP_LOCAL:
+            return ByteInstruction("OP_POP_LOCAL", chunk, offset);
+        case OP_POP_GLOBAL:
+            return GlobalInstruction("OP_POP_GLOBAL", chunk, offset);
+        case OP_POP_JUMP_IF_FALSE:
+            return JumpInstruction("OP_POP_JUMP_IF_FALSE", 1, chunk, offset);
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
@@ -157,12 +304,31 @@ static int ConstantInstruction(const char* name, Chunk* chunk, int offset)
     uint8_t constant = chunk->code[offset + 1];
 
     printf("%-16s %4d '", name, constant);
-    PrintValue(chunk->constants.values[constant]);
+    PrintValue(stdout, chunk->constants.values[constant]);
     printf("'\n");
     
     return offset + 2;
 }
 
+/**
+ * @brief Prints a global variable instruction.
+ * 
+ * @param name The name of the instruction.
+ * @param chunk A Chunk holding the instruction.
+ * @param offset The offset of the instruction.
+ * @return int The offset of the next instruction.
+ */
+static int GlobalInstruction(const char* name, Chunk* chunk, int offset)
+{
+    uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+
+    printf("%-16s %4d '", name, slot);
+    PrintValue(stdout, vm->globalNames.values[slot]);
+    printf("'\n");
+
+    return offset + 3;
+}
+
 /**
  * @brief Prints a byte instruction.
  * 
@@ -208,7 +374,364 @@ static int InvokeInstruction(const char* name, Chunk* chunk, int offset)
     uint8_t constant = chunk->code[offset + 1];
     uint8_t argCount= chunk->code[offset + 2];
     printf("%-16s (%d args) %4d '", name, argCount, constant);
-    PrintValue(chunk->constants.values[constant]);
+    PrintValue(stdout, chunk->constants.values[constant]);
     printf("'\n");
     return offset + 3;
 }
+
+/**
+ * @brief Prints a register instruction.
+ * 
+ * @param name The name of the instruction.
+ * @param isConstant Whether the second operand is a constant rather than a local.
+ * @param chunk The Chunk where the instruction resides.
+ * @param offset The offset of the instruction.
+ * @return int The offset of the next instruction.
+ */
+static int RegisterInstruction(const char* name, bool isConstant, Chunk* chunk, int offset)
+{
+    uint8_t left = chunk->code[offset + 1];
+    uint8_t right = chunk->code[offset + 2];
+    if (isConstant)
+    {
+        printf("%-16s r%-3d %4d '", name, left, right);
+        PrintValue(stdout, chunk->constants.values[right]);
+        printf("'\n");
+    }
+    else
+    {
+        printf("%-16s r%-3d r%d\n", name, left, right);
+    }
+    return offset + 3;
+}
+
+/**
+ * @brief Prints a compare-and-branch instruction.
+ * 
+ * @param name The name of the instruction.
+ * @param isConstant Whether the second operand is a constant rather than a local.
+ * @param chunk The Chunk where the instruction resides.
+ * @param offset The offset of the instruction.
+ * @return int The offset of the next instruction.
+ */
+static int CompareJumpInstruction(const char* name, bool isConstant, Chunk* chunk, int offset)
+{
+    uint8_t left = chunk->code[offset + 1];
+    uint8_t right = chunk->code[offset + 2];
+    uint8_t sense = chunk->code[offset + 3];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 4] << 8);
+    jump |= chunk->code[offset + 5];
+
+    printf("%-16s r%-3d ", name, left);
+    if (isConstant)
+    {
+        printf("'");
+        PrintValue(stdout, chunk->constants.values[right]);
+        printf("'");
+    }
+    else
+    {
+        printf("r%d", right);
+    }
+    printf(" if %s -> %d\n", sense ? "true" : "false", offset + 6 + jump);
+    return offset + 6;
+}
+
+#ifdef DEBUG_PROFILE_OPCODES
+void ProfileInstruction(Chunk* chunk, int offset)
+{
+    // Count every straight-line sequence of 2 to 4 opcodes starting here
+    uint64_t key = 0;
+    for (int length = 1; length <= PROFILE_MAX_LENGTH && offset < chunk->count; length++)
+    {
+        key = (key << 8) | chunk->code[offset];
+        if (length > 1)
+        {
+            CountSequence(((uint64_t)length << 32) | key);
+        }
+        offset += InstructionLength(chunk, offset);
+    }
+}
+
+void PrintProfile()
+{
+    ProfileEntry sorted[PROFILE_CAPACITY];
+    memcpy(sorted, profile, sizeof(profile));
+    qsort(sorted, PROFILE_CAPACITY, sizeof(ProfileEntry), CompareProfileEntries);
+
+    for (int length = 2; length <= PROFILE_MAX_LENGTH; length++)
+    {
+        fprintf(stderr, "== top %d-opcode sequences ==\n", length);
+
+        int printed = 0;
+        for (int i = 0; i < PROFILE_CAPACITY && printed < PROFILE_TOP; i++)
+        {
+            if (sorted[i].count == 0 || (int)(sorted[i].key >> 32) != length)
+            {
+                continue;
+            }
+
+            fprintf(stderr, "%12llu ", (unsigned long long)sorted[i].count);
+            for (int j = length - 1; j >= 0; j--)
+            {
+                fprintf(stderr, " %s", opcodeNames[(sorted[i].key >> (j * 8)) & 0xff]);
+            }
+            fprintf(stderr, "\n");
+            printed++;
+        }
+    }
+}
+
+/**
+ * @brief Adds one execution to the counter of an opcode sequence.
+ * 
+ * @param key The sequence length in the upper 32 bits and its opcodes packed into the lower 32 bits.
+ */
+static void CountSequence(uint64_t key)
+{
+    uint32_t index = (uint32_t)(key * 0x9E3779B97F4A7C15ULL >> 40) & (PROFILE_CAPACITY - 1);
+    for (int probes = 0; probes < PROFILE_CAPACITY; probes++)
+    {
+        ProfileEntry* entry = &profile[index];
+        if (entry->count == 0 || entry->key == key)
+        {
+            entry->key = key;
+            entry->count++;
+            return;
+        }
+        index = (index + 1) & (PROFILE_CAPACITY - 1);
+    }
+}
+
+/**
+ * @brief Orders profile entries by descending count, for qsort().
+ */
+static int CompareProfileEntries(const void* a, const void* b)
+{
+    uint64_t countA = ((const ProfileEntry*)a)->count;
+    uint64_t countB = ((const ProfileEntry*)b)->count;
+    return countA < countB ? 1 : countA > countB ? -1 : 0;
+}
+#endif
+
+#ifdef DEBUG_CACHE_STATS
+void PrintCacheStats()
+{
+    int monomorphic = 0;
+    int polymorphic = 0;
+    int megamorphic = 0;
+
+    fprintf(stderr, "== inline caches ==\n");
+    for (Object* object = vm->objects; object != NULL; object = object->next)
+    {
+        if (object->type != OBJECT_FUNCTION)
+        {
+            continue;
+        }
+
+        ObjectFunction* function = (ObjectFunction*)object;
+        const char* functionName = function->name != NULL ? function->name->chars : "<script>";
+        Chunk* chunk = &function->chunk;
+        for (int i = 0; i < chunk->cacheCount; i++)
+        {
+            InlineCache* cache = &chunk->caches[i];
+            uint64_t total = cache->hits + cache->misses;
+            if (total == 0)
+            {
+                continue;
+            }
+
+            fprintf(stderr, "%-12s line %-4d %-16s %-12s %10llu hits %8llu misses %6.2f%%\n",
+                    functionName, chunk->lines[cache->offset], opcodeNames[chunk->code[cache->offset]],
+                    AS_CSTRING(chunk->constants.values[chunk->code[cache->offset + 1]]),
+                    (unsigned long long)cache->hits, (unsigned long long)cache->misses,
+                    100.0 * cache->hits / total);
+        }
+        for (int i = 0; i < chunk->invokeCacheCount; i++)
+        {
+            InvokeCache* cache = &chunk->invokeCaches[i];
+            uint64_t total = cache->hits + cache->misses;
+            if (total == 0)
+            {
+                continue;
+            }
+
+            char polymorphism[32];
+            if (cache->isMegamorphic)
+            {
+                snprintf(polymorphism, sizeof(polymorphism), "megamorphic");
+                megamorphic++;
+            }
+            else if (cache->count > 1)
+            {
+                snprintf(polymorphism, sizeof(polymorphism), "polymorphic (%d)", cache->count);
+                polymorphic++;
+            }
+            else
+            {
+                snprintf(polymorphism, sizeof(polymorphism), "monomorphic");
+                monomorphic++;
+            }
+
+            fprintf(stderr, "%-12s line %-4d %-16s %-12s %10llu hits %8llu misses %6.2f%%  %s\n",
+                    functionName, chunk->lines[cache->offset], opcodeNames[chunk->code[cache->offset]],
+                    AS_CSTRING(chunk->constants.values[chunk->code[cache->offset + 1]]),
+                    (unsigned long long)cache->hits, (unsigned long long)cache->misses,
+                    100.0 * cache->hits / total, polymorphism);
+        }
+        for (int i = 0; i < chunk->callCacheCount; i++)
+        {
+            CallCache* cache = &chunk->callCaches[i];
+            uint64_t total = cache->hits + cache->misses;
+            if (total == 0)
+            {
+                continue;
+            }
+
+            const char* calleeName = "-";
+            if (cache->closure != NULL)
+            {
+                calleeName = cache->closure->function->name != NULL ? cache->closure->function->name->chars
+                                                                    : "<script>";
+            }
+
+            fprintf(stderr, "%-12s line %-4d %-16s %-12s %10llu hits %8llu misses %6.2f%%\n",
+                    functionName, chunk->lines[cache->offset], opcodeNames[chunk->code[cache->offset]], calleeName,
+                    (unsigned long long)cache->hits, (unsigned long long)cache->misses,
+                    100.0 * cache->hits / total);
+        }
+    }
+
+    fprintf(stderr, "invoke sites: %d monomorphic, %d polymorphic, %d megamorphic\n",
+            monomorphic, polymorphic, megamorphic);
+}
+#endif
+
+#ifdef DEBUG_DUMP_TRACES
+static const char* traceTypeNames[] =
+{
+    [TYPE_NONE] = "",
+    [TYPE_NIL] = "nil",
+    [TYPE_BOOL] = "bool",
+    [TYPE_NUMBER] = "number",
+    [TYPE_OBJECT] = "object",
+};
+
+static const char* irNames[] =
+{
+    [IR_CONSTANT] = "CONSTANT",
+    [IR_LOAD] = "LOAD",
+    [IR_READ] = "READ",
+    [IR_STORE] = "STORE",
+    [IR_UNBOX] = "UNBOX",
+    [IR_ADD] = "ADD",
+    [IR_SUBTRACT] = "SUBTRACT",
+    [IR_MULTIPLY] = "MULTIPLY",
+    [IR_DIVIDE] = "DIVIDE",
+    [IR_NEGATE] = "NEGATE",
+    [IR_GREATER] = "GREATER",
+    [IR_LESS] = "LESS",
+    [IR_EQUAL_NUMBER] = "EQUAL_NUMBER",
+    [IR_EQUAL] = "EQUAL",
+    [IR_NOT] = "NOT",
+    [IR_GUARD_TRUE] = "GUARD_TRUE",
+    [IR_GUARD_FALSE] = "GUARD_FALSE",
+    [IR_PRINT] = "PRINT",
+    [IR_LOOP] = "LOOP",
+};
+
+void PrintTrace(Trace* trace)
+{
+    printf("== trace of loop at line %d ==\n", trace->chunk->lines[trace->loopOffset]);
+    for (int i = 0; i < trace->stepCount; i++)
+    {
+        TraceStep* step = &trace->steps[i];
+        printf("%-7s %-7s ", traceTypeNames[step->types[0]], traceTypeNames[step->types[1]]);
+        DisassembleInstruction(trace->chunk, step->offset);
+    }
+
+    if (trace->irCount > 0)
+    {
+        printf("-- ir --\n");
+    }
+    for (int i = 0; i < trace->irCount; i++)
+    {
+        IrInstruction* instruction = &trace->ir[i];
+        printf("%04d %s %-12s ", i, instruction->isNumber ? "num" : "   ", irNames[instruction->op]);
+        switch (instruction->op)
+        {
+            case IR_CONSTANT:
+                PrintValue(stdout, instruction->constant);
+                break;
+            case IR_LOAD:
+            case IR_READ:
+                PrintIrVariable(trace, instruction->a);
+                break;
+            case IR_STORE:
+                PrintIrVariable(trace, instruction->a);
+                printf(" <- %04d", instruction->b);
+                break;
+            default:
+            {
+                int operands[2];
+                int operandCount = IrOperands(instruction, operands);
+                for (int j = 0; j < operandCount; j++)
+                {
+                    printf("%s%04d", j > 0 ? " " : "", operands[j]);
+                }
+                break;
+            }
+        }
+
+        if (instruction->snapshot != -1 && instruction->op != IR_PRINT)
+        {
+            Snapshot* snapshot = &trace->snapshots[instruction->snapshot];
+            printf("  exit -> %04d [", snapshot->resume);
+            for (int j = 0; j < snapshot->count; j++)
+            {
+                printf("%s%04d", j > 0 ? " " : "", trace->snapshotRefs[snapshot->first + j]);
+            }
+            printf("]");
+        }
+        printf("%s\n", instruction->isDead ? "  (dead)" : "");
+    }
+
+    if (trace->abortReason != NULL)
+    {
+        printf("-- aborted: %s --\n", trace->abortReason);
+    }
+    else if (trace->code != NULL)
+    {
+        printf("-- compiled --\n");
+    }
+    else
+    {
+        printf("-- recorded --\n");
+    }
+}
+
+/**
+ * @brief Prints a variable named by an IR instruction.
+ * 
+ * @param trace The Trace holding the variable.
+ * @param variable The index of the variable.
+ */
+static void PrintIrVariable(Trace* trace, int variable)
+{
+    TraceVariable* entry = &trace->variables[variable];
+    if (entry->isGlobal)
+    {
+        printf("global %d '", entry->slot);
+        PrintValue(stdout, vm->globalNames.values[entry->slot]);
+        printf("'");
+    }
+    else
+    {
+        printf("local %d", entry->slot);
+    }
+    if (entry->isPromoted)
+    {
+        printf(" (promoted)");
+    }
+}
+#endif
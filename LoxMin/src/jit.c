@@ -0,0 +1,2077 @@
+#include "jit.h"
+
+#ifdef JIT_COMPILER
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "memory.h"
+
+/**
+ * @brief Enumerates the x86-64 general purpose registers by their encoding.
+ */
+typedef enum
+{
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+} Register;
+
+// Interpreter state held for the whole of a compiled function, all in callee-saved registers
+#define SP_REGISTER      RBX
+#define SLOTS_REGISTER   R12
+#define FRAME_REGISTER   R13
+#define GLOBALS_REGISTER R14
+#define QNAN_REGISTER    R15
+
+// Scratch registers, clear of the ones traces keep their values in
+#define SCRATCH_XMM0 6
+#define SCRATCH_XMM1 7
+
+/**
+ * @brief Enumerates the x86-64 condition codes used by compiled code.
+ */
+typedef enum
+{
+    CONDITION_BELOW = 0x2,
+    CONDITION_ABOVE_EQUAL = 0x3,
+    CONDITION_EQUAL = 0x4,
+    CONDITION_NOT_EQUAL = 0x5,
+    CONDITION_BELOW_EQUAL = 0x6,
+    CONDITION_ABOVE = 0x7,
+    CONDITION_PARITY = 0xa,
+    CONDITION_NO_PARITY = 0xb,
+} Condition;
+
+/**
+ * @brief Enumerates integer ALU operations by their ModRM opcode extension.
+ */
+typedef enum
+{
+    ALU_ADD = 0,
+    ALU_OR = 1,
+    ALU_AND = 4,
+    ALU_SUB = 5,
+    ALU_XOR = 6,
+    ALU_CMP = 7,
+} AluOperation;
+
+#define SSE_ADD      0x58
+#define SSE_MULTIPLY 0x59
+#define SSE_SUBTRACT 0x5c
+#define SSE_DIVIDE   0x5e
+#define SSE_MOVE     0x28
+#define SSE_COMPARE  0x2e
+
+/**
+ * @brief A jump whose 32-bit displacement is filled in once its target has been emitted.
+ */
+typedef struct
+{
+    int at;
+    int target;
+    bool isExit;
+} JitPatch;
+
+/**
+ * @brief Stores the native code of a function or a trace while it is being compiled.
+ */
+typedef struct
+{
+    ObjectFunction* function;
+    Chunk* chunk;
+    uint8_t* code;
+    int count;
+    int capacity;
+
+    int* labels;
+    int* exitStubs;
+    int exitCount;
+    int* threadedStarts;
+
+    JitPatch* patches;
+    int patchCount;
+    int patchCapacity;
+
+    int epilogue;
+    int exitCommon;
+} Assembler;
+
+/**
+ * @brief Stores the state of a trace while it is being compiled.
+ *
+ * Each IR instruction producing a value owns a register from the moment it runs until its last use: an xmm
+ * register for an unboxed number, a general purpose one for anything boxed. Promoted variables live in
+ * xmm registers of their own for the whole trace.
+ */
+typedef struct
+{
+    Trace* trace;
+    Assembler* as;
+    int* registers;
+    int* lastUses;
+    int* uses;
+    int* variableRegisters;
+} TraceAssembler;
+
+// Registers handed out to the values of a trace; none of them survive a call
+static const Register traceRegisters[] = { RSI, RDI, R8, R9, R10, R11 };
+#define TRACE_REGISTER_COUNT 6
+#define TRACE_XMM_COUNT 6
+#define PROMOTED_XMM 8
+
+typedef JitStatus (*NativeCode)(CallFrame* frame);
+
+static void InitAssembler(Assembler* as, ObjectFunction* function, Chunk* chunk, int exitCount);
+static void FreeAssembler(Assembler* as);
+static bool EmitInstruction(Assembler* as, int offset);
+static void EmitPrologue(Assembler* as);
+static void EmitExitStubs(Assembler* as);
+static void* Install(Assembler* as, size_t* size);
+
+static void EmitStackPush(Assembler* as, Register source);
+static void EmitStackPop(Assembler* as, Register destination);
+static void EmitStackPeek(Assembler* as, Register destination, int distance);
+static void EmitStoreSp(Assembler* as);
+static void EmitStoreIp(Assembler* as, int offset);
+static void EmitNumberGuard(Assembler* as, Register value, int offset);
+static void EmitIntegerToDouble(Assembler* as, Register value);
+static void EmitUndefinedGuard(Assembler* as, Register value, int offset);
+static void EmitBinary(Assembler* as, OpCode operation, int offset);
+static void EmitEquality(Assembler* as);
+static void EmitBoolResult(Assembler* as);
+static void EmitFalseyTest(Assembler* as);
+static void EmitJumpTo(Assembler* as, int condition, int target);
+static void EmitExitIf(Assembler* as, int condition, int offset);
+static void EmitLoadUpvalue(Assembler* as, Register destination, int index);
+static void EmitCallValue(Assembler* as, int offset, int argCount);
+static void EmitTailCall(Assembler* as, int offset, int argCount);
+static void EmitReturn(Assembler* as);
+static Value WidenConstant(Value value);
+static void PrintLine(Value value);
+
+static bool AllocateRegisters(TraceAssembler* ta);
+static void EmitTraceEntry(TraceAssembler* ta);
+static bool EmitIr(TraceAssembler* ta, int index, int loop);
+static bool EmitTracePrint(TraceAssembler* ta, int index);
+static void EmitTraceExits(TraceAssembler* ta);
+static void EmitWriteBack(TraceAssembler* ta);
+static Condition EmitNumberCompare(TraceAssembler* ta, IrInstruction* compare);
+static bool IsFusedCompare(TraceAssembler* ta, int index);
+static int NumberOperand(TraceAssembler* ta, int value, int scratch);
+static Register ValueOperand(TraceAssembler* ta, int value, Register scratch);
+static Register VariableBase(TraceVariable* variable);
+
+static void EmitByte(Assembler* as, uint8_t byte);
+static void EmitInt32(Assembler* as, int32_t value);
+static void EmitInt64(Assembler* as, uint64_t value);
+static void EmitRex(Assembler* as, bool isWide, int reg, int rm);
+static void EmitMemoryOperand(Assembler* as, int reg, Register base, int32_t displacement);
+static void EmitRegisterOperand(Assembler* as, int reg, int rm);
+static void EmitLoad(Assembler* as, Register destination, Register base, int32_t displacement);
+static void EmitLoadInt32(Assembler* as, Register destination, Register base, int32_t displacement);
+static void EmitStore(Assembler* as, Register base, int32_t displacement, Register source);
+static void EmitMove(Assembler* as, Register destination, Register source);
+static void EmitMoveImmediate(Assembler* as, Register destination, uint64_t value);
+static void EmitAlu(Assembler* as, AluOperation operation, Register destination, Register source);
+static void EmitAluImmediate(Assembler* as, AluOperation operation, Register destination, int32_t value);
+static void EmitAluMemory32(Assembler* as, AluOperation operation, Register base, int32_t displacement, int8_t value);
+static void EmitLea(Assembler* as, Register destination, Register base, int32_t displacement);
+static void EmitToXmm(Assembler* as, int xmm, Register source);
+static void EmitFromXmm(Assembler* as, Register destination, int xmm);
+static void EmitSse(Assembler* as, uint8_t prefix, uint8_t opcode, int destination, int source);
+static void EmitSetCondition(Assembler* as, Condition condition, Register destination);
+static void EmitCall(Assembler* as, uint64_t address);
+static void EmitPushRegister(Assembler* as, Register source);
+static void EmitPopRegister(Assembler* as, Register destination);
+static int EmitJump(Assembler* as, int condition);
+static void PatchJump(Assembler* as, int at, int target);
+
+// Marks an unconditional jump for EmitJump()
+#define ALWAYS -1
+
+bool CompileNative(ObjectFunction* function)
+{
+    Assembler as;
+    InitAssembler(&as, function, &function->chunk, function->chunk.count);
+
+    EmitPrologue(&as);
+    for (int offset = 0; offset < as.chunk->count; offset += InstructionLength(as.chunk, offset))
+    {
+        as.labels[offset] = as.count;
+        if (!EmitInstruction(&as, offset))
+        {
+            FreeAssembler(&as);
+            return false;
+        }
+    }
+    EmitExitStubs(&as);
+
+    for (int i = 0; i < as.patchCount; i++)
+    {
+        JitPatch* patch = &as.patches[i];
+        PatchJump(&as, patch->at, patch->isExit ? as.exitStubs[patch->target] : as.labels[patch->target]);
+    }
+
+    function->jitCode = Install(&as, &function->jitSize);
+    FreeAssembler(&as);
+    return function->jitCode != NULL;
+}
+
+void FreeNative(ObjectFunction* function)
+{
+    if (function->jitCode != NULL)
+    {
+        munmap(function->jitCode, function->jitSize);
+        function->jitCode = NULL;
+        function->jitSize = 0;
+    }
+}
+
+JitStatus RunNative(CallFrame* frame)
+{
+    return ((NativeCode)frame->closure->function->jitCode)(frame);
+}
+
+bool CompileTrace(Trace* trace)
+{
+    Assembler as;
+    InitAssembler(&as, NULL, trace->chunk, trace->snapshotCount + 1);
+
+    TraceAssembler ta;
+    ta.trace = trace;
+    ta.as = &as;
+    ta.registers = ALLOCATE(int, trace->irCount);
+    ta.lastUses = ALLOCATE(int, trace->irCount);
+    ta.uses = ALLOCATE(int, trace->irCount);
+    ta.variableRegisters = ALLOCATE(int, trace->variableCount);
+
+    bool isCompiled = AllocateRegisters(&ta);
+    if (isCompiled)
+    {
+        EmitPrologue(&as);
+        EmitTraceEntry(&ta);
+        int loop = as.count;
+        for (int i = 0; isCompiled && i < trace->irCount; i++)
+        {
+            isCompiled = trace->ir[i].isDead || EmitIr(&ta, i, loop);
+        }
+    }
+
+    if (isCompiled)
+    {
+        EmitTraceExits(&ta);
+        for (int i = 0; i < as.patchCount; i++)
+        {
+            PatchJump(&as, as.patches[i].at, as.exitStubs[as.patches[i].target]);
+        }
+        trace->code = Install(&as, &trace->codeSize);
+        isCompiled = trace->code != NULL;
+    }
+
+    FREE_ARRAY(int, ta.registers, trace->irCount);
+    FREE_ARRAY(int, ta.lastUses, trace->irCount);
+    FREE_ARRAY(int, ta.uses, trace->irCount);
+    FREE_ARRAY(int, ta.variableRegisters, trace->variableCount);
+    FreeAssembler(&as);
+    return isCompiled;
+}
+
+void FreeNativeTrace(Trace* trace)
+{
+    if (trace->code != NULL)
+    {
+        munmap(trace->code, trace->codeSize);
+        trace->code = NULL;
+        trace->codeSize = 0;
+    }
+}
+
+void RunTrace(Trace* trace, CallFrame* frame)
+{
+    ((NativeCode)trace->code)(frame);
+}
+
+/**
+ * @brief Initializes an Assembler for a function or a trace.
+ *
+ * @param as The Assembler to initialize.
+ * @param function The ObjectFunction to compile, or NULL for a trace.
+ * @param chunk The Chunk holding the code to compile.
+ * @param exitCount The number of places the code can exit to the interpreter from.
+ */
+static void InitAssembler(Assembler* as, ObjectFunction* function, Chunk* chunk, int exitCount)
+{
+    as->function = function;
+    as->chunk = chunk;
+    as->code = NULL;
+    as->count = 0;
+    as->capacity = 0;
+    as->patches = NULL;
+    as->patchCount = 0;
+    as->patchCapacity = 0;
+
+    as->labels = ALLOCATE(int, chunk->count);
+    as->exitStubs = ALLOCATE(int, exitCount);
+    as->exitCount = exitCount;
+    as->threadedStarts = ALLOCATE(int, chunk->count);
+    for (int i = 0; i < chunk->count; i++)
+    {
+        as->labels[i] = -1;
+    }
+    for (int i = 0; i < exitCount; i++)
+    {
+        as->exitStubs[i] = -1;
+    }
+
+    // The first threaded word of each instruction is where the interpreter resumes it
+    for (int i = chunk->threadedCount - 1; i >= 0; i--)
+    {
+        as->threadedStarts[chunk->threadedOffsets[i]] = i;
+    }
+}
+
+/**
+ * @brief Frees an Assembler.
+ *
+ * @param as The Assembler to free.
+ */
+static void FreeAssembler(Assembler* as)
+{
+    FREE_ARRAY(uint8_t, as->code, as->capacity);
+    FREE_ARRAY(int, as->labels, as->chunk->count);
+    FREE_ARRAY(int, as->exitStubs, as->exitCount);
+    FREE_ARRAY(int, as->threadedStarts, as->chunk->count);
+    FREE_ARRAY(JitPatch, as->patches, as->patchCapacity);
+}
+
+/**
+ * @brief Emits the native code for a single instruction.
+ *
+ * Numbers are handled inline behind guards. Anything else the code cannot handle itself, such as a
+ * string concatenation or an undefined global, exits to the interpreter at the start of the instruction.
+ *
+ * @param as The Assembler to emit to.
+ * @param offset The offset of the instruction.
+ * @return true The instruction was emitted.
+ * @return false The instruction has no native form.
+ */
+static bool EmitInstruction(Assembler* as, int offset)
+{
+    Chunk* chunk = as->chunk;
+    uint8_t* code = &chunk->code[offset];
+    uint8_t instruction = code[0];
+
+    switch (instruction)
+    {
+        case OP_CONSTANT:
+            EmitMoveImmediate(as, RAX, chunk->constants.values[code[1]]);
+            EmitStackPush(as, RAX);
+            break;
+        case OP_NIL:
+            EmitMoveImmediate(as, RAX, NIL_VALUE);
+            EmitStackPush(as, RAX);
+            break;
+        case OP_TRUE:
+            EmitMoveImmediate(as, RAX, TRUE_VALUE);
+            EmitStackPush(as, RAX);
+            break;
+        case OP_FALSE:
+            EmitMoveImmediate(as, RAX, FALSE_VALUE);
+            EmitStackPush(as, RAX);
+            break;
+        case OP_POP:
+            EmitAluImmediate(as, ALU_SUB, SP_REGISTER, sizeof(Value));
+            break;
+        case OP_GET_LOCAL:
+            EmitLoad(as, RAX, SLOTS_REGISTER, code[1] * sizeof(Value));
+            EmitStackPush(as, RAX);
+            break;
+        case OP_SET_LOCAL:
+            EmitStackPeek(as, RAX, 0);
+            EmitStore(as, SLOTS_REGISTER, code[1] * sizeof(Value), RAX);
+            break;
+        case OP_POP_LOCAL:
+            EmitStackPop(as, RAX);
+            EmitStore(as, SLOTS_REGISTER, code[1] * sizeof(Value), RAX);
+            break;
+        case OP_GET_GLOBAL:
+        {
+            int slot = (code[1] << 8) | code[2];
+            EmitLoad(as, RAX, GLOBALS_REGISTER, slot * sizeof(Value));
+            EmitUndefinedGuard(as, RAX, offset);
+            EmitStackPush(as, RAX);
+            break;
+        }
+        case OP_DEFINE_GLOBAL:
+        {
+            int slot = (code[1] << 8) | code[2];
+            EmitStackPop(as, RAX);
+            EmitStore(as, GLOBALS_REGISTER, slot * sizeof(Value), RAX);
+            break;
+        }
+        case OP_SET_GLOBAL:
+        case OP_POP_GLOBAL:
+        {
+            int slot = (code[1] << 8) | code[2];
+            EmitLoad(as, RAX, GLOBALS_REGISTER, slot * sizeof(Value));
+            EmitUndefinedGuard(as, RAX, offset);
+            EmitStackPeek(as, RAX, 0);
+            EmitStore(as, GLOBALS_REGISTER, slot * sizeof(Value), RAX);
+            if (instruction == OP_POP_GLOBAL)
+            {
+                EmitAluImmediate(as, ALU_SUB, SP_REGISTER, sizeof(Value));
+            }
+            break;
+        }
+        case OP_GET_UPVALUE:
+            EmitLoadUpvalue(as, RAX, code[1]);
+            EmitLoad(as, RAX, RAX, 0);
+            EmitStackPush(as, RAX);
+            break;
+        case OP_SET_UPVALUE:
+            EmitLoadUpvalue(as, RAX, code[1]);
+            EmitStackPeek(as, RCX, 0);
+            EmitStore(as, RAX, 0, RCX);
+            break;
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+            EmitStackPeek(as, RAX, 1);
+            EmitStackPeek(as, RCX, 0);
+            EmitBinary(as, instruction, offset);
+            EmitStore(as, SP_REGISTER, -2 * (int)sizeof(Value), RAX);
+            EmitAluImmediate(as, ALU_SUB, SP_REGISTER, sizeof(Value));
+            break;
+        case OP_ADD_LL:
+        case OP_SUBTRACT_LL:
+        case OP_MULTIPLY_LL:
+        case OP_DIVIDE_LL:
+        case OP_GREATER_LL:
+        case OP_LESS_LL:
+        case OP_EQUAL_LL:
+            EmitLoad(as, RAX, SLOTS_REGISTER, code[1] * sizeof(Value));
+            EmitLoad(as, RCX, SLOTS_REGISTER, code[2] * sizeof(Value));
+            EmitBinary(as, BaseOperation(instruction), offset);
+            EmitStackPush(as, RAX);
+            break;
+        case OP_ADD_LK:
+        case OP_SUBTRACT_LK:
+        case OP_MULTIPLY_LK:
+        case OP_DIVIDE_LK:
+        case OP_GREATER_LK:
+        case OP_LESS_LK:
+        case OP_EQUAL_LK:
+            EmitLoad(as, RAX, SLOTS_REGISTER, code[1] * sizeof(Value));
+            EmitMoveImmediate(as, RCX, WidenConstant(chunk->constants.values[code[2]]));
+            EmitBinary(as, BaseOperation(instruction), offset);
+            EmitStackPush(as, RAX);
+            break;
+        case OP_JUMP_GREATER_LL:
+        case OP_JUMP_GREATER_LK:
+        case OP_JUMP_LESS_LL:
+        case OP_JUMP_LESS_LK:
+        case OP_JUMP_EQUAL_LL:
+        case OP_JUMP_EQUAL_LK:
+        {
+            EmitLoad(as, RAX, SLOTS_REGISTER, code[1] * sizeof(Value));
+            if (instruction == OP_JUMP_GREATER_LK || instruction == OP_JUMP_LESS_LK || instruction == OP_JUMP_EQUAL_LK)
+            {
+                EmitMoveImmediate(as, RCX, WidenConstant(chunk->constants.values[code[2]]));
+            }
+            else
+            {
+                EmitLoad(as, RCX, SLOTS_REGISTER, code[2] * sizeof(Value));
+            }
+            EmitBinary(as, BaseOperation(instruction), offset);
+
+            // Jump when the boolean EmitBinary() left in rax matches the sense
+            bool sense = code[3];
+            int jump = (code[4] << 8) | code[5];
+            EmitMoveImmediate(as, RCX, TRUE_VALUE);
+            EmitAlu(as, ALU_CMP, RAX, RCX);
+            EmitJumpTo(as, sense ? CONDITION_EQUAL : CONDITION_NOT_EQUAL, offset + 6 + jump);
+            break;
+        }
+        case OP_NOT:
+            EmitStackPeek(as, RAX, 0);
+            EmitFalseyTest(as);
+            EmitSetCondition(as, CONDITION_BELOW_EQUAL, RAX);
+            EmitBoolResult(as);
+            EmitStore(as, SP_REGISTER, -(int)sizeof(Value), RAX);
+            break;
+        case OP_NEGATE:
+            EmitStackPeek(as, RAX, 0);
+            EmitNumberGuard(as, RAX, offset);
+            EmitMoveImmediate(as, RCX, SIGN_BIT);
+            EmitAlu(as, ALU_XOR, RAX, RCX);
+            EmitStore(as, SP_REGISTER, -(int)sizeof(Value), RAX);
+            break;
+        case OP_PRINT:
+            EmitStackPop(as, RDI);
+            EmitCall(as, (uint64_t)(uintptr_t)&PrintLine);
+            break;
+        case OP_JUMP:
+        case OP_LOOP:
+        {
+            int jump = (code[1] << 8) | code[2];
+            EmitJumpTo(as, ALWAYS, offset + 3 + (instruction == OP_LOOP ? -jump : jump));
+            break;
+        }
+        case OP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_FALSE:
+        {
+            int jump = (code[1] << 8) | code[2];
+            if (instruction == OP_JUMP_IF_FALSE)
+            {
+                EmitStackPeek(as, RAX, 0);
+            }
+            else
+            {
+                EmitStackPop(as, RAX);
+            }
+            EmitFalseyTest(as);
+            EmitJumpTo(as, CONDITION_BELOW_EQUAL, offset + 3 + jump);
+            break;
+        }
+        case OP_CALL:
+            EmitCallValue(as, offset, code[1]);
+            break;
+        case OP_TAIL_CALL:
+            EmitTailCall(as, offset, code[1]);
+            break;
+        case OP_RETURN:
+            EmitReturn(as);
+            break;
+        default:
+            // Objects, classes and closures stay with the interpreter
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Emits the entry of a compiled function, with the shared epilogue and exit path behind it.
+ *
+ * Compiled code is called as JitStatus (*)(CallFrame* frame).
+ *
+ * @param as The Assembler to emit to.
+ */
+static void EmitPrologue(Assembler* as)
+{
+    // Five pushes on top of the return address leave the stack 16-byte aligned for calls
+    EmitPushRegister(as, SP_REGISTER);
+    EmitPushRegister(as, SLOTS_REGISTER);
+    EmitPushRegister(as, FRAME_REGISTER);
+    EmitPushRegister(as, GLOBALS_REGISTER);
+    EmitPushRegister(as, QNAN_REGISTER);
+
+    EmitMove(as, FRAME_REGISTER, RDI);
+    EmitLoad(as, SLOTS_REGISTER, FRAME_REGISTER, offsetof(CallFrame, slots));
+    EmitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->sp);
+    EmitLoad(as, SP_REGISTER, RAX, 0);
+    EmitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->globalValues.values);
+    EmitLoad(as, GLOBALS_REGISTER, RAX, 0);
+    EmitMoveImmediate(as, QNAN_REGISTER, QNAN);
+    int body = EmitJump(as, ALWAYS);
+
+    as->epilogue = as->count;
+    EmitPopRegister(as, QNAN_REGISTER);
+    EmitPopRegister(as, GLOBALS_REGISTER);
+    EmitPopRegister(as, FRAME_REGISTER);
+    EmitPopRegister(as, SLOTS_REGISTER);
+    EmitPopRegister(as, SP_REGISTER);
+    EmitByte(as, 0xc3);
+
+    // Exit stubs set the frame's ip and land here to hand the stack back to the interpreter
+    as->exitCommon = as->count;
+    EmitStoreSp(as);
+    EmitMoveImmediate(as, RAX, JIT_EXITED);
+    PatchJump(as, EmitJump(as, ALWAYS), as->epilogue);
+
+    PatchJump(as, body, as->count);
+}
+
+/**
+ * @brief Emits one exit stub for every instruction that can exit to the interpreter.
+ *
+ * @param as The Assembler to emit to.
+ */
+static void EmitExitStubs(Assembler* as)
+{
+    for (int i = 0; i < as->patchCount; i++)
+    {
+        JitPatch* patch = &as->patches[i];
+        if (!patch->isExit || as->exitStubs[patch->target] != -1)
+        {
+            continue;
+        }
+
+        as->exitStubs[patch->target] = as->count;
+        ThreadedCode* resume = &as->chunk->threaded[as->threadedStarts[patch->target]];
+        EmitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)resume);
+        EmitStore(as, FRAME_REGISTER, offsetof(CallFrame, ip), RAX);
+        PatchJump(as, EmitJump(as, ALWAYS), as->exitCommon);
+    }
+}
+
+/**
+ * @brief Copies assembled code into executable memory.
+ *
+ * @param as The Assembler holding the code.
+ * @param size Where to store the size of the mapping.
+ * @return void* The executable code, or NULL if no memory could be mapped.
+ */
+static void* Install(Assembler* as, size_t* size)
+{
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    *size = ((size_t)as->count + pageSize - 1) & ~(pageSize - 1);
+
+    void* memory = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    // Never writable and executable at the same time
+    memcpy(memory, as->code, as->count);
+    if (mprotect(memory, *size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, *size);
+        return NULL;
+    }
+    return memory;
+}
+
+/**
+ * @brief Pushes a register onto the value stack.
+ *
+ * @param as The Assembler to emit to.
+ * @param source The register holding the Value.
+ */
+static void EmitStackPush(Assembler* as, Register source)
+{
+    EmitStore(as, SP_REGISTER, 0, source);
+    EmitAluImmediate(as, ALU_ADD, SP_REGISTER, sizeof(Value));
+}
+
+/**
+ * @brief Pops the value stack into a register.
+ *
+ * @param as The Assembler to emit to.
+ * @param destination The register to pop into.
+ */
+static void EmitStackPop(Assembler* as, Register destination)
+{
+    EmitAluImmediate(as, ALU_SUB, SP_REGISTER, sizeof(Value));
+    EmitLoad(as, destination, SP_REGISTER, 0);
+}
+
+/**
+ * @brief Loads a Value from the value stack without popping it.
+ *
+ * @param as The Assembler to emit to.
+ * @param destination The register to load into.
+ * @param distance How far down the stack to look.
+ */
+static void EmitStackPeek(Assembler* as, Register destination, int distance)
+{
+    EmitLoad(as, destination, SP_REGISTER, -(distance + 1) * (int)sizeof(Value));
+}
+
+/**
+ * @brief Writes the stack pointer back to the virtual machine.
+ *
+ * @param as The Assembler to emit to.
+ */
+static void EmitStoreSp(Assembler* as)
+{
+    EmitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->sp);
+    EmitStore(as, RAX, 0, SP_REGISTER);
+}
+
+/**
+ * @brief Points the frame's ip into an instruction so runtime errors report its line.
+ *
+ * @param as The Assembler to emit to.
+ * @param offset The offset of the instruction.
+ */
+static void EmitStoreIp(Assembler* as, int offset)
+{
+    ThreadedCode* ip = &as->chunk->threaded[as->threadedStarts[offset] + 1];
+    EmitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)ip);
+    EmitStore(as, FRAME_REGISTER, offsetof(CallFrame, ip), RAX);
+}
+
+/**
+ * @brief Exits to the interpreter unless a register holds a number, widening an integer to a double.
+ *
+ * @param as The Assembler to emit to.
+ * @param value The register to check.
+ * @param offset The offset of the instruction to resume at.
+ */
+static void EmitNumberGuard(Assembler* as, Register value, int offset)
+{
+    EmitIntegerToDouble(as, value);
+    EmitMove(as, RDX, value);
+    EmitAlu(as, ALU_AND, RDX, QNAN_REGISTER);
+    EmitAlu(as, ALU_CMP, RDX, QNAN_REGISTER);
+    EmitExitIf(as, CONDITION_EQUAL, offset);
+}
+
+/**
+ * @brief Replaces an integer in a register with the double it stands for, leaving any other value alone.
+ *
+ * Compiled code only does arithmetic on doubles; the interpreter takes whichever form it is given.
+ *
+ * @param as The Assembler to emit to.
+ * @param value The register to widen.
+ */
+static void EmitIntegerToDouble(Assembler* as, Register value)
+{
+    // shr rdx, 48 leaves the tag bits, which only integers have set to QNAN | TAG_INTEGER
+    EmitMove(as, RDX, value);
+    EmitRex(as, true, 0, RDX);
+    EmitByte(as, 0xc1);
+    EmitRegisterOperand(as, 5, RDX);
+    EmitByte(as, 48);
+    EmitAluImmediate(as, ALU_CMP, RDX, (int32_t)((QNAN | TAG_INTEGER) >> 48));
+    int notInteger = EmitJump(as, CONDITION_NOT_EQUAL);
+
+    // movsxd value, value32; cvtsi2sd xmm0, value
+    EmitRex(as, true, value, value);
+    EmitByte(as, 0x63);
+    EmitRegisterOperand(as, value, value);
+    EmitByte(as, 0xf2);
+    EmitRex(as, true, SCRATCH_XMM0, value);
+    EmitByte(as, 0x0f);
+    EmitByte(as, 0x2a);
+    EmitRegisterOperand(as, SCRATCH_XMM0, value);
+    EmitFromXmm(as, value, SCRATCH_XMM0);
+
+    PatchJump(as, notInteger, as->count);
+}
+
+/**
+ * @brief Exits to the interpreter, which reports the error, if a register holds an undefined global.
+ *
+ * @param as The Assembler to emit to.
+ * @param value The register to check.
+ * @param offset The offset of the instruction to resume at.
+ */
+static void EmitUndefinedGuard(Assembler* as, Register value, int offset)
+{
+    EmitMoveImmediate(as, RCX, UNDEFINED_VALUE);
+    EmitAlu(as, ALU_CMP, value, RCX);
+    EmitExitIf(as, CONDITION_EQUAL, offset);
+}
+
+/**
+ * @brief Emits a binary operation on rax and rcx, leaving the result in rax.
+ *
+ * @param as The Assembler to emit to.
+ * @param operation The stack form of the operation.
+ * @param offset The offset of the instruction, for guards.
+ */
+static void EmitBinary(Assembler* as, OpCode operation, int offset)
+{
+    if (operation == OP_EQUAL)
+    {
+        EmitEquality(as);
+        EmitBoolResult(as);
+        return;
+    }
+
+    EmitNumberGuard(as, RAX, offset);
+    EmitNumberGuard(as, RCX, offset);
+    EmitToXmm(as, SCRATCH_XMM0, RAX);
+    EmitToXmm(as, SCRATCH_XMM1, RCX);
+
+    switch (operation)
+    {
+        case OP_GREATER:
+            // ucomisd xmm0, xmm1; an unordered NaN leaves "above" unset
+            EmitSse(as, 0x66, SSE_COMPARE, SCRATCH_XMM0, SCRATCH_XMM1);
+            EmitSetCondition(as, CONDITION_ABOVE, RAX);
+            EmitBoolResult(as);
+            return;
+        case OP_LESS:
+            EmitSse(as, 0x66, SSE_COMPARE, SCRATCH_XMM1, SCRATCH_XMM0);
+            EmitSetCondition(as, CONDITION_ABOVE, RAX);
+            EmitBoolResult(as);
+            return;
+        case OP_ADD:
+            EmitSse(as, 0xf2, SSE_ADD, SCRATCH_XMM0, SCRATCH_XMM1);
+            break;
+        case OP_SUBTRACT:
+            EmitSse(as, 0xf2, SSE_SUBTRACT, SCRATCH_XMM0, SCRATCH_XMM1);
+            break;
+        case OP_MULTIPLY:
+            EmitSse(as, 0xf2, SSE_MULTIPLY, SCRATCH_XMM0, SCRATCH_XMM1);
+            break;
+        case OP_DIVIDE:
+            EmitSse(as, 0xf2, SSE_DIVIDE, SCRATCH_XMM0, SCRATCH_XMM1);
+            break;
+        default:
+            return;
+    }
+    EmitFromXmm(as, RAX, SCRATCH_XMM0);
+}
+
+/**
+ * @brief Compares rax and rcx the way AreValuesEqual() does, leaving the result in al.
+ *
+ * @param as The Assembler to emit to.
+ */
+static void EmitEquality(Assembler* as)
+{
+    // Anything that is not two numbers compares by its bits, once integers are doubles like every other number
+    EmitIntegerToDouble(as, RAX);
+    EmitIntegerToDouble(as, RCX);
+    EmitMove(as, RDX, RAX);
+    EmitAlu(as, ALU_AND, RDX, QNAN_REGISTER);
+    EmitAlu(as, ALU_CMP, RDX, QNAN_REGISTER);
+    int leftNotNumber = EmitJump(as, CONDITION_EQUAL);
+    EmitMove(as, RDX, RCX);
+    EmitAlu(as, ALU_AND, RDX, QNAN_REGISTER);
+    EmitAlu(as, ALU_CMP, RDX, QNAN_REGISTER);
+    int rightNotNumber = EmitJump(as, CONDITION_EQUAL);
+
+    // ucomisd flags NaN as unordered through the parity flag, and NaN equals nothing
+    EmitToXmm(as, SCRATCH_XMM0, RAX);
+    EmitToXmm(as, SCRATCH_XMM1, RCX);
+    EmitSse(as, 0x66, SSE_COMPARE, SCRATCH_XMM0, SCRATCH_XMM1);
+    EmitSetCondition(as, CONDITION_EQUAL, RAX);
+    EmitSetCondition(as, CONDITION_NO_PARITY, RCX);
+    EmitByte(as, 0x20);
+    EmitRegisterOperand(as, RCX, RAX);
+    int done = EmitJump(as, ALWAYS);
+
+    PatchJump(as, leftNotNumber, as->count);
+    PatchJump(as, rightNotNumber, as->count);
+    EmitAlu(as, ALU_CMP, RAX, RCX);
+    EmitSetCondition(as, CONDITION_EQUAL, RAX);
+
+    PatchJump(as, done, as->count);
+}
+
+/**
+ * @brief Turns the flag left in al into a boolean Value in rax.
+ *
+ * @param as The Assembler to emit to.
+ */
+static void EmitBoolResult(Assembler* as)
+{
+    // movzx eax, al, then false and true are QNAN | 2 and QNAN | 3
+    EmitByte(as, 0x0f);
+    EmitByte(as, 0xb6);
+    EmitRegisterOperand(as, RAX, RAX);
+    EmitAluImmediate(as, ALU_ADD, RAX, FALSE_VALUE & 0xff);
+    EmitAlu(as, ALU_OR, RAX, QNAN_REGISTER);
+}
+
+/**
+ * @brief Sets the flags so that "below or equal" holds when rax is falsey.
+ *
+ * @param as The Assembler to emit to.
+ */
+static void EmitFalseyTest(Assembler* as)
+{
+    // nil and false are adjacent, so one unsigned range check covers both
+    EmitMoveImmediate(as, RCX, NIL_VALUE);
+    EmitMove(as, RDX, RAX);
+    EmitAlu(as, ALU_SUB, RDX, RCX);
+    EmitAluImmediate(as, ALU_CMP, RDX, FALSE_VALUE - NIL_VALUE);
+}
+
+/**
+ * @brief Emits a jump to the native code of a bytecode instruction.
+ *
+ * @param as The Assembler to emit to.
+ * @param condition The condition to jump on, or ALWAYS.
+ * @param target The offset of the instruction to jump to.
+ */
+static void EmitJumpTo(Assembler* as, int condition, int target)
+{
+    if (as->patchCapacity < as->patchCount + 1)
+    {
+        int oldCapacity = as->patchCapacity;
+        as->patchCapacity = GROW_CAPACITY(oldCapacity);
+        as->patches = GROW_ARRAY(JitPatch, as->patches, oldCapacity, as->patchCapacity);
+    }
+
+    JitPatch* patch = &as->patches[as->patchCount++];
+    patch->at = EmitJump(as, condition);
+    patch->target = target;
+    patch->isExit = false;
+}
+
+/**
+ * @brief Emits a jump to the stub that exits to the interpreter at a bytecode instruction.
+ *
+ * @param as The Assembler to emit to.
+ * @param condition The condition to exit on, or ALWAYS.
+ * @param offset The offset of the instruction to resume at.
+ */
+static void EmitExitIf(Assembler* as, int condition, int offset)
+{
+    EmitJumpTo(as, condition, offset);
+    as->patches[as->patchCount - 1].isExit = true;
+}
+
+/**
+ * @brief Loads the location of one of the current closure's upvalues.
+ *
+ * @param as The Assembler to emit to.
+ * @param destination The register to load into.
+ * @param index The index of the upvalue.
+ */
+static void EmitLoadUpvalue(Assembler* as, Register destination, int index)
+{
+    EmitLoad(as, destination, FRAME_REGISTER, offsetof(CallFrame, closure));
+    EmitLoad(as, destination, destination, offsetof(ObjectClosure, upvalues));
+    EmitLoad(as, destination, destination, index * sizeof(ObjectUpvalue*));
+    EmitLoad(as, destination, destination, offsetof(ObjectUpvalue, location));
+}
+
+/**
+ * @brief Emits a call in tail position.
+ *
+ * Closures and bound methods exit to the interpreter, which hands them the frame so that tail calls never
+ * nest native frames; natives and classes are called as usual, for the return that follows.
+ *
+ * @param as The Assembler to emit to.
+ * @param offset The offset of the instruction.
+ * @param argCount The number of arguments.
+ */
+static void EmitTailCall(Assembler* as, int offset, int argCount)
+{
+    EmitStackPeek(as, RAX, argCount);
+    EmitMoveImmediate(as, RCX, SIGN_BIT | QNAN);
+    EmitMove(as, RDX, RAX);
+    EmitAlu(as, ALU_AND, RDX, RCX);
+    EmitAlu(as, ALU_CMP, RDX, RCX);
+    int notObject = EmitJump(as, CONDITION_NOT_EQUAL);
+    EmitMoveImmediate(as, RCX, ~(SIGN_BIT | QNAN));
+    EmitAlu(as, ALU_AND, RAX, RCX);
+    EmitAluMemory32(as, ALU_CMP, RAX, offsetof(Object, type), OBJECT_CLOSURE);
+    EmitExitIf(as, CONDITION_EQUAL, offset);
+    EmitAluMemory32(as, ALU_CMP, RAX, offsetof(Object, type), OBJECT_BOUND_METHOD);
+    EmitExitIf(as, CONDITION_EQUAL, offset);
+
+    PatchJump(as, notObject, as->count);
+    EmitCallValue(as, offset, argCount);
+}
+
+/**
+ * @brief Emits a call to the value below the arguments on the stack, leaving its result in its place.
+ *
+ * A compiled closure with the right arity is called directly; everything else goes through JitCall().
+ *
+ * @param as The Assembler to emit to.
+ * @param offset The offset of the instruction.
+ * @param argCount The number of arguments.
+ */
+static void EmitCallValue(Assembler* as, int offset, int argCount)
+{
+    EmitStoreSp(as);
+    EmitStoreIp(as, offset);
+
+    // The callee has to be a closure object
+    EmitStackPeek(as, RAX, argCount);
+    EmitMoveImmediate(as, RCX, SIGN_BIT | QNAN);
+    EmitMove(as, RDX, RAX);
+    EmitAlu(as, ALU_AND, RDX, RCX);
+    EmitAlu(as, ALU_CMP, RDX, RCX);
+    int notObject = EmitJump(as, CONDITION_NOT_EQUAL);
+    EmitMoveImmediate(as, RCX, ~(SIGN_BIT | QNAN));
+    EmitAlu(as, ALU_AND, RAX, RCX);
+    EmitAluMemory32(as, ALU_CMP, RAX, offsetof(Object, type), OBJECT_CLOSURE);
+    int notClosure = EmitJump(as, CONDITION_NOT_EQUAL);
+
+    // ...of a compiled function taking this many arguments, with room for its frame
+    EmitLoad(as, RDX, RAX, offsetof(ObjectClosure, function));
+    EmitAluMemory32(as, ALU_CMP, RDX, offsetof(ObjectFunction, arity), argCount);
+    int wrongArity = EmitJump(as, CONDITION_NOT_EQUAL);
+    EmitLoad(as, RSI, RDX, offsetof(ObjectFunction, jitCode));
+    EmitAluImmediate(as, ALU_CMP, RSI, 0);
+    int notCompiled = EmitJump(as, CONDITION_EQUAL);
+    // Growing either stack is left to Call()
+    EmitMoveImmediate(as, RDI, (uint64_t)(uintptr_t)&vm->frameCount);
+    EmitLoadInt32(as, RCX, RDI, 0);
+    EmitLoadInt32(as, R8, RDI, offsetof(VM, frameCapacity) - offsetof(VM, frameCount));
+    EmitAlu(as, ALU_CMP, RCX, R8);
+    int noFrame = EmitJump(as, CONDITION_ABOVE_EQUAL);
+    EmitLoadInt32(as, R8, RDX, offsetof(ObjectFunction, chunk) + offsetof(Chunk, stackSize));
+    EmitRex(as, true, R8, R8);
+    EmitByte(as, 0x69);
+    EmitRegisterOperand(as, R8, R8);
+    EmitInt32(as, sizeof(Value));
+    EmitAlu(as, ALU_ADD, R8, SP_REGISTER);
+    EmitMoveImmediate(as, R9, (uint64_t)(uintptr_t)&vm->stackEnd);
+    EmitLoad(as, R9, R9, 0);
+    EmitAlu(as, ALU_CMP, R8, R9);
+    int noStack = EmitJump(as, CONDITION_ABOVE);
+
+    // Push the frame the way Call() does
+    EmitAluMemory32(as, ALU_ADD, RDI, 0, 1);
+    EmitRex(as, true, RCX, RCX);
+    EmitByte(as, 0x69);
+    EmitRegisterOperand(as, RCX, RCX);
+    EmitInt32(as, sizeof(CallFrame));
+    EmitMoveImmediate(as, RDI, (uint64_t)(uintptr_t)&vm->frames);
+    EmitLoad(as, RDI, RDI, 0);
+    EmitAlu(as, ALU_ADD, RDI, RCX);
+    EmitStore(as, RDI, offsetof(CallFrame, closure), RAX);
+    EmitLea(as, RCX, RDX, offsetof(ObjectFunction, chunk));
+    EmitStore(as, RDI, offsetof(CallFrame, chunk), RCX);
+    EmitLoad(as, RCX, RDX, offsetof(ObjectFunction, chunk) + offsetof(Chunk, threaded));
+    EmitStore(as, RDI, offsetof(CallFrame, ip), RCX);
+    EmitLea(as, RCX, SP_REGISTER, -(argCount + 1) * (int)sizeof(Value));
+    EmitStore(as, RDI, offsetof(CallFrame, slots), RCX);
+    EmitAluMemory32(as, ALU_AND, RDI, offsetof(CallFrame, tailCalls), 0);
+    EmitByte(as, 0xff);
+    EmitRegisterOperand(as, 2, RSI);
+
+    // A callee that exited early is finished by the interpreter
+    EmitAluImmediate(as, ALU_CMP, RAX, JIT_EXITED);
+    int finished = EmitJump(as, CONDITION_NOT_EQUAL);
+    EmitCall(as, (uint64_t)(uintptr_t)&JitResume);
+    int called = EmitJump(as, ALWAYS);
+
+    PatchJump(as, notObject, as->count);
+    PatchJump(as, notClosure, as->count);
+    PatchJump(as, wrongArity, as->count);
+    PatchJump(as, notCompiled, as->count);
+    PatchJump(as, noFrame, as->count);
+    PatchJump(as, noStack, as->count);
+    EmitMoveImmediate(as, RDI, argCount);
+    EmitCall(as, (uint64_t)(uintptr_t)&JitCall);
+
+    // The runtime error has already been reported
+    PatchJump(as, finished, as->count);
+    PatchJump(as, called, as->count);
+    EmitAluImmediate(as, ALU_CMP, RAX, JIT_FAILED);
+    PatchJump(as, EmitJump(as, CONDITION_EQUAL), as->epilogue);
+
+    // The callee may have run anything, including code that defined new globals or grew the stacks
+    EmitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->sp);
+    EmitLoad(as, SP_REGISTER, RAX, 0);
+    EmitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->globalValues.values);
+    EmitLoad(as, GLOBALS_REGISTER, RAX, 0);
+    EmitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->frameCount);
+    EmitLoadInt32(as, RCX, RAX, 0);
+    EmitRex(as, true, RCX, RCX);
+    EmitByte(as, 0x69);
+    EmitRegisterOperand(as, RCX, RCX);
+    EmitInt32(as, sizeof(CallFrame));
+    EmitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->frames);
+    EmitLoad(as, FRAME_REGISTER, RAX, 0);
+    EmitAlu(as, ALU_ADD, FRAME_REGISTER, RCX);
+    EmitLea(as, FRAME_REGISTER, FRAME_REGISTER, -(int)sizeof(CallFrame));
+    EmitLoad(as, SLOTS_REGISTER, FRAME_REGISTER, offsetof(CallFrame, slots));
+}
+
+/**
+ * @brief Emits a return, popping the frame and leaving the result where the callee was.
+ *
+ * @param as The Assembler to emit to.
+ */
+static void EmitReturn(Assembler* as)
+{
+    // Only upvalues at or above the frame's slots need closing, and they sit first in the list
+    EmitMoveImmediate(as, RCX, (uint64_t)(uintptr_t)&vm->openUpvalues);
+    EmitLoad(as, RCX, RCX, 0);
+    EmitAluImmediate(as, ALU_CMP, RCX, 0);
+    int noUpvalues = EmitJump(as, CONDITION_EQUAL);
+    EmitLoad(as, RCX, RCX, offsetof(ObjectUpvalue, location));
+    EmitAlu(as, ALU_CMP, RCX, SLOTS_REGISTER);
+    int closeUpvalues = EmitJump(as, CONDITION_ABOVE_EQUAL);
+
+    PatchJump(as, noUpvalues, as->count);
+    EmitStackPeek(as, RAX, 0);
+    EmitStore(as, SLOTS_REGISTER, 0, RAX);
+    EmitLea(as, RAX, SLOTS_REGISTER, sizeof(Value));
+    EmitMoveImmediate(as, RCX, (uint64_t)(uintptr_t)&vm->sp);
+    EmitStore(as, RCX, 0, RAX);
+    EmitMoveImmediate(as, RCX, (uint64_t)(uintptr_t)&vm->frameCount);
+    EmitAluMemory32(as, ALU_SUB, RCX, 0, 1);
+    EmitMoveImmediate(as, RAX, JIT_RETURNED);
+    PatchJump(as, EmitJump(as, ALWAYS), as->epilogue);
+
+    PatchJump(as, closeUpvalues, as->count);
+    EmitStoreSp(as);
+    EmitCall(as, (uint64_t)(uintptr_t)&JitReturn);
+    EmitMoveImmediate(as, RAX, JIT_RETURNED);
+    PatchJump(as, EmitJump(as, ALWAYS), as->epilogue);
+}
+
+/**
+ * @brief Finds the last use of every IR instruction and gives each value a register for its lifetime.
+ *
+ * @param ta The TraceAssembler to allocate for.
+ * @return true Every value got a register.
+ * @return false The trace keeps more values alive at once than there are registers.
+ */
+static bool AllocateRegisters(TraceAssembler* ta)
+{
+    Trace* trace = ta->trace;
+    for (int i = 0; i < trace->irCount; i++)
+    {
+        ta->registers[i] = -1;
+        ta->lastUses[i] = -1;
+        ta->uses[i] = 0;
+    }
+
+    // Values a guard may exit with are used by the guard, as they have to be written back
+    for (int i = 0; i < trace->irCount; i++)
+    {
+        IrInstruction* instruction = &trace->ir[i];
+        if (instruction->isDead)
+        {
+            continue;
+        }
+
+        int operands[2];
+        int operandCount = IrOperands(instruction, operands);
+        for (int j = 0; j < operandCount; j++)
+        {
+            ta->lastUses[operands[j]] = i;
+            ta->uses[operands[j]]++;
+        }
+        if (instruction->snapshot != -1)
+        {
+            Snapshot* snapshot = &trace->snapshots[instruction->snapshot];
+            for (int j = 0; j < snapshot->count; j++)
+            {
+                ta->lastUses[trace->snapshotRefs[snapshot->first + j]] = i;
+                ta->uses[trace->snapshotRefs[snapshot->first + j]]++;
+            }
+        }
+    }
+
+    bool isRegisterFree[TRACE_REGISTER_COUNT];
+    bool isXmmFree[TRACE_XMM_COUNT];
+    for (int i = 0; i < TRACE_REGISTER_COUNT; i++)
+    {
+        isRegisterFree[i] = true;
+    }
+    for (int i = 0; i < TRACE_XMM_COUNT; i++)
+    {
+        isXmmFree[i] = true;
+    }
+
+    for (int i = 0; i < trace->irCount; i++)
+    {
+        IrInstruction* instruction = &trace->ir[i];
+        if (instruction->isDead)
+        {
+            continue;
+        }
+
+        switch (instruction->op)
+        {
+            case IR_CONSTANT:
+            case IR_STORE:
+            case IR_GUARD_TRUE:
+            case IR_GUARD_FALSE:
+            case IR_PRINT:
+            case IR_LOOP:
+                break;
+            default:
+            {
+                // The result never shares a register with the operands it is computed from
+                bool* isFree = instruction->isNumber ? isXmmFree : isRegisterFree;
+                int count = instruction->isNumber ? TRACE_XMM_COUNT : TRACE_REGISTER_COUNT;
+                int free = 0;
+                while (free < count && !isFree[free])
+                {
+                    free++;
+                }
+                if (free == count)
+                {
+                    return false;
+                }
+                isFree[free] = false;
+                ta->registers[i] = instruction->isNumber ? free : (int)traceRegisters[free];
+                break;
+            }
+        }
+
+        // Release every value this instruction was the last to use, its own too if nothing ever uses it
+        int released[UINT8_COUNT];
+        int releasedCount = 0;
+        int operands[2];
+        int operandCount = IrOperands(instruction, operands);
+        for (int j = 0; j < operandCount; j++)
+        {
+            released[releasedCount++] = operands[j];
+        }
+        if (instruction->snapshot != -1)
+        {
+            Snapshot* snapshot = &trace->snapshots[instruction->snapshot];
+            for (int j = 0; j < snapshot->count && releasedCount < UINT8_COUNT - 1; j++)
+            {
+                released[releasedCount++] = trace->snapshotRefs[snapshot->first + j];
+            }
+        }
+        released[releasedCount++] = i;
+
+        for (int j = 0; j < releasedCount; j++)
+        {
+            int value = released[j];
+            if (ta->registers[value] == -1 || (ta->lastUses[value] != i && !(value == i && ta->lastUses[i] == -1)))
+            {
+                continue;
+            }
+
+            if (trace->ir[value].isNumber)
+            {
+                isXmmFree[ta->registers[value]] = true;
+            }
+            else
+            {
+                for (int k = 0; k < TRACE_REGISTER_COUNT; k++)
+                {
+                    if ((int)traceRegisters[k] == ta->registers[value])
+                    {
+                        isRegisterFree[k] = true;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Emits the checks a trace makes once on entry, hoisted out of the loop.
+ *
+ * Promoted variables are checked to hold numbers and loaded into their registers, and the globals the
+ * trace reads or writes are checked to be defined. If any check fails the trace exits right away.
+ *
+ * @param ta The TraceAssembler to emit with.
+ */
+static void EmitTraceEntry(TraceAssembler* ta)
+{
+    Trace* trace = ta->trace;
+    int entryExit = trace->snapshotCount;
+    int promoted = 0;
+    for (int i = 0; i < trace->variableCount; i++)
+    {
+        TraceVariable* variable = &trace->variables[i];
+        ta->variableRegisters[i] = -1;
+        if (!variable->isPromoted && !variable->isGlobal)
+        {
+            continue;
+        }
+
+        EmitLoad(ta->as, RAX, VariableBase(variable), variable->slot * sizeof(Value));
+        if (variable->isPromoted)
+        {
+            ta->variableRegisters[i] = PROMOTED_XMM + promoted++;
+            EmitNumberGuard(ta->as, RAX, entryExit);
+            EmitToXmm(ta->as, ta->variableRegisters[i], RAX);
+        }
+        else
+        {
+            EmitUndefinedGuard(ta->as, RAX, entryExit);
+        }
+    }
+}
+
+/**
+ * @brief Emits the native code for a single IR instruction.
+ *
+ * @param ta The TraceAssembler to emit with.
+ * @param index The index of the instruction.
+ * @param loop The position of the top of the loop.
+ * @return true The instruction was emitted.
+ * @return false The instruction cannot be emitted.
+ */
+static bool EmitIr(TraceAssembler* ta, int index, int loop)
+{
+    Assembler* as = ta->as;
+    Trace* trace = ta->trace;
+    IrInstruction* instruction = &trace->ir[index];
+    int destination = ta->registers[index];
+
+    switch (instruction->op)
+    {
+        case IR_CONSTANT:
+            // Constants are materialized by the instructions using them
+            break;
+        case IR_LOAD:
+        {
+            TraceVariable* variable = &trace->variables[instruction->a];
+            EmitLoad(as, destination, VariableBase(variable), variable->slot * sizeof(Value));
+            break;
+        }
+        case IR_READ:
+            EmitSse(as, 0x66, SSE_MOVE, destination, ta->variableRegisters[instruction->a]);
+            break;
+        case IR_STORE:
+        {
+            TraceVariable* variable = &trace->variables[instruction->a];
+            if (variable->isPromoted)
+            {
+                int xmm = NumberOperand(ta, instruction->b, SCRATCH_XMM0);
+                EmitSse(as, 0x66, SSE_MOVE, ta->variableRegisters[instruction->a], xmm);
+            }
+            else
+            {
+                Register value = ValueOperand(ta, instruction->b, RAX);
+                EmitStore(as, VariableBase(variable), variable->slot * sizeof(Value), value);
+            }
+            break;
+        }
+        case IR_UNBOX:
+        {
+            Register value = ValueOperand(ta, instruction->a, RAX);
+            EmitNumberGuard(as, value, instruction->snapshot);
+            EmitToXmm(as, destination, value);
+            break;
+        }
+        case IR_ADD:
+        case IR_SUBTRACT:
+        case IR_MULTIPLY:
+        case IR_DIVIDE:
+        {
+            static const uint8_t operations[] =
+            {
+                [IR_ADD] = SSE_ADD,
+                [IR_SUBTRACT] = SSE_SUBTRACT,
+                [IR_MULTIPLY] = SSE_MULTIPLY,
+                [IR_DIVIDE] = SSE_DIVIDE,
+            };
+            int left = NumberOperand(ta, instruction->a, SCRATCH_XMM0);
+            int right = NumberOperand(ta, instruction->b, SCRATCH_XMM1);
+            EmitSse(as, 0x66, SSE_MOVE, destination, left);
+            EmitSse(as, 0xf2, operations[instruction->op], destination, right);
+            break;
+        }
+        case IR_NEGATE:
+        {
+            int value = NumberOperand(ta, instruction->a, SCRATCH_XMM0);
+            EmitFromXmm(as, RAX, value);
+            EmitMoveImmediate(as, RCX, SIGN_BIT);
+            EmitAlu(as, ALU_XOR, RAX, RCX);
+            EmitToXmm(as, destination, RAX);
+            break;
+        }
+        case IR_GREATER:
+        case IR_LESS:
+        case IR_EQUAL_NUMBER:
+        {
+            // A comparison only a guard looks at is left for the guard to branch on directly
+            if (IsFusedCompare(ta, index))
+            {
+                break;
+            }
+
+            Condition condition = EmitNumberCompare(ta, instruction);
+            EmitSetCondition(as, condition, RAX);
+            if (instruction->op == IR_EQUAL_NUMBER)
+            {
+                EmitSetCondition(as, CONDITION_NO_PARITY, RCX);
+                EmitByte(as, 0x20);
+                EmitRegisterOperand(as, RCX, RAX);
+            }
+            EmitBoolResult(as);
+            EmitMove(as, destination, RAX);
+            break;
+        }
+        case IR_EQUAL:
+        {
+            Register left = ValueOperand(ta, instruction->a, RAX);
+            if (left != RAX)
+            {
+                EmitMove(as, RAX, left);
+            }
+            Register right = ValueOperand(ta, instruction->b, RCX);
+            if (right != RCX)
+            {
+                EmitMove(as, RCX, right);
+            }
+            EmitEquality(as);
+            EmitBoolResult(as);
+            EmitMove(as, destination, RAX);
+            break;
+        }
+        case IR_NOT:
+        {
+            Register value = ValueOperand(ta, instruction->a, RAX);
+            if (value != RAX)
+            {
+                EmitMove(as, RAX, value);
+            }
+            EmitFalseyTest(as);
+            EmitSetCondition(as, CONDITION_BELOW_EQUAL, RAX);
+            EmitBoolResult(as);
+            EmitMove(as, destination, RAX);
+            break;
+        }
+        case IR_GUARD_TRUE:
+        case IR_GUARD_FALSE:
+        {
+            bool isTruthy = instruction->op == IR_GUARD_TRUE;
+            if (IsFusedCompare(ta, instruction->a))
+            {
+                IrInstruction* compare = &trace->ir[instruction->a];
+                Condition condition = EmitNumberCompare(ta, compare);
+                if (compare->op != IR_EQUAL_NUMBER)
+                {
+                    EmitExitIf(as, isTruthy ? CONDITION_BELOW_EQUAL : CONDITION_ABOVE, instruction->snapshot);
+                }
+                else if (isTruthy)
+                {
+                    // Unordered compares as unequal
+                    EmitExitIf(as, CONDITION_PARITY, instruction->snapshot);
+                    EmitExitIf(as, CONDITION_NOT_EQUAL, instruction->snapshot);
+                }
+                else
+                {
+                    int unordered = EmitJump(as, CONDITION_PARITY);
+                    EmitExitIf(as, condition, instruction->snapshot);
+                    PatchJump(as, unordered, as->count);
+                }
+                break;
+            }
+
+            Register value = ValueOperand(ta, instruction->a, RAX);
+            if (value != RAX)
+            {
+                EmitMove(as, RAX, value);
+            }
+            EmitFalseyTest(as);
+            EmitExitIf(as, isTruthy ? CONDITION_BELOW_EQUAL : CONDITION_ABOVE, instruction->snapshot);
+            break;
+        }
+        case IR_PRINT:
+            return EmitTracePrint(ta, index);
+        case IR_LOOP:
+            PatchJump(as, EmitJump(as, ALWAYS), loop);
+            break;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Emits a print, which has to hand the interpreter state over to memory around the call.
+ *
+ * @param ta The TraceAssembler to emit with.
+ * @param index The index of the print instruction.
+ * @return true The print was emitted.
+ * @return false A value outlives the call without being on the stack, where it could be saved.
+ */
+static bool EmitTracePrint(TraceAssembler* ta, int index)
+{
+    Assembler* as = ta->as;
+    Trace* trace = ta->trace;
+    IrInstruction* instruction = &trace->ir[index];
+    Snapshot* snapshot = &trace->snapshots[instruction->snapshot];
+    int* refs = &trace->snapshotRefs[snapshot->first];
+
+    for (int i = 0; i < index; i++)
+    {
+        if (ta->registers[i] == -1 || ta->lastUses[i] <= index)
+        {
+            continue;
+        }
+
+        bool isOnStack = false;
+        for (int j = 0; j < snapshot->count; j++)
+        {
+            isOnStack = isOnStack || refs[j] == i;
+        }
+        if (!isOnStack)
+        {
+            return false;
+        }
+    }
+
+    EmitWriteBack(ta);
+    for (int i = 0; i < snapshot->count; i++)
+    {
+        EmitStore(as, SP_REGISTER, i * sizeof(Value), ValueOperand(ta, refs[i], RAX));
+    }
+    Register value = ValueOperand(ta, instruction->a, RAX);
+    if (value != RDI)
+    {
+        EmitMove(as, RDI, value);
+    }
+    EmitCall(as, (uint64_t)(uintptr_t)&PrintLine);
+
+    for (int i = 0; i < trace->variableCount; i++)
+    {
+        TraceVariable* variable = &trace->variables[i];
+        if (variable->isPromoted)
+        {
+            EmitLoad(as, RAX, VariableBase(variable), variable->slot * sizeof(Value));
+            EmitToXmm(as, ta->variableRegisters[i], RAX);
+        }
+    }
+    for (int i = 0; i < snapshot->count; i++)
+    {
+        int ref = refs[i];
+        if (ta->registers[ref] == -1)
+        {
+            continue;
+        }
+        else if (trace->ir[ref].isNumber)
+        {
+            EmitLoad(as, RAX, SP_REGISTER, i * sizeof(Value));
+            EmitToXmm(as, ta->registers[ref], RAX);
+        }
+        else
+        {
+            EmitLoad(as, ta->registers[ref], SP_REGISTER, i * sizeof(Value));
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Emits one exit stub for every snapshot a guard can exit with, and one for the entry checks.
+ *
+ * A stub writes the promoted variables back, boxes the values of its snapshot onto the stack and points
+ * the frame's ip at the instruction to resume.
+ *
+ * @param ta The TraceAssembler to emit with.
+ */
+static void EmitTraceExits(TraceAssembler* ta)
+{
+    Assembler* as = ta->as;
+    Trace* trace = ta->trace;
+    for (int i = 0; i < as->patchCount; i++)
+    {
+        int exit = as->patches[i].target;
+        if (as->exitStubs[exit] != -1)
+        {
+            continue;
+        }
+
+        as->exitStubs[exit] = as->count;
+        int resume = trace->header;
+        if (exit < trace->snapshotCount)
+        {
+            Snapshot* snapshot = &trace->snapshots[exit];
+            EmitWriteBack(ta);
+            for (int j = 0; j < snapshot->count; j++)
+            {
+                int ref = trace->snapshotRefs[snapshot->first + j];
+                EmitStore(as, SP_REGISTER, j * sizeof(Value), ValueOperand(ta, ref, RAX));
+            }
+            if (snapshot->count > 0)
+            {
+                EmitAluImmediate(as, ALU_ADD, SP_REGISTER, snapshot->count * sizeof(Value));
+            }
+            resume = snapshot->resume;
+        }
+
+        EmitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)ThreadedInstruction(trace->chunk, resume));
+        EmitStore(as, FRAME_REGISTER, offsetof(CallFrame, ip), RAX);
+        PatchJump(as, EmitJump(as, ALWAYS), as->exitCommon);
+    }
+}
+
+/**
+ * @brief Writes the promoted variables of a trace back to their slots.
+ *
+ * @param ta The TraceAssembler to emit with.
+ */
+static void EmitWriteBack(TraceAssembler* ta)
+{
+    for (int i = 0; i < ta->trace->variableCount; i++)
+    {
+        TraceVariable* variable = &ta->trace->variables[i];
+        if (variable->isPromoted)
+        {
+            EmitFromXmm(ta->as, RAX, ta->variableRegisters[i]);
+            EmitStore(ta->as, VariableBase(variable), variable->slot * sizeof(Value), RAX);
+        }
+    }
+}
+
+/**
+ * @brief Compares two unboxed numbers.
+ *
+ * @param ta The TraceAssembler to emit with.
+ * @param compare The comparison to emit.
+ * @return Condition The condition that holds when the comparison is true, unordered aside.
+ */
+static Condition EmitNumberCompare(TraceAssembler* ta, IrInstruction* compare)
+{
+    int left = NumberOperand(ta, compare->a, SCRATCH_XMM0);
+    int right = NumberOperand(ta, compare->b, SCRATCH_XMM1);
+    switch (compare->op)
+    {
+        case IR_GREATER:
+            EmitSse(ta->as, 0x66, SSE_COMPARE, left, right);
+            return CONDITION_ABOVE;
+        case IR_LESS:
+            EmitSse(ta->as, 0x66, SSE_COMPARE, right, left);
+            return CONDITION_ABOVE;
+        default:
+            EmitSse(ta->as, 0x66, SSE_COMPARE, left, right);
+            return CONDITION_EQUAL;
+    }
+}
+
+/**
+ * @brief Determines if a comparison is only used by the guard right after it, which then branches on it.
+ *
+ * @param ta The TraceAssembler holding the trace.
+ * @param index The index of the instruction to check.
+ * @return true The guard emits the comparison itself.
+ * @return false The comparison produces a boolean.
+ */
+static bool IsFusedCompare(TraceAssembler* ta, int index)
+{
+    Trace* trace = ta->trace;
+    IrOp op = trace->ir[index].op;
+    if ((op != IR_GREATER && op != IR_LESS && op != IR_EQUAL_NUMBER) || ta->uses[index] != 1)
+    {
+        return false;
+    }
+
+    // Constants in between emit no code
+    int next = index + 1;
+    while (next < trace->irCount && (trace->ir[next].isDead || trace->ir[next].op == IR_CONSTANT))
+    {
+        next++;
+    }
+    return next < trace->irCount && trace->ir[next].a == index &&
+           (trace->ir[next].op == IR_GUARD_TRUE || trace->ir[next].op == IR_GUARD_FALSE);
+}
+
+/**
+ * @brief Finds the xmm register holding a number, loading it into a scratch register if it is a constant.
+ *
+ * @param ta The TraceAssembler to emit with.
+ * @param value The instruction producing the number.
+ * @param scratch The xmm register to load a constant into.
+ * @return int The xmm register holding the number.
+ */
+static int NumberOperand(TraceAssembler* ta, int value, int scratch)
+{
+    IrInstruction* instruction = &ta->trace->ir[value];
+    if (instruction->op == IR_CONSTANT)
+    {
+        EmitMoveImmediate(ta->as, RAX, instruction->constant);
+        EmitToXmm(ta->as, scratch, RAX);
+        return scratch;
+    }
+    return ta->registers[value];
+}
+
+/**
+ * @brief Finds the register holding a boxed value, boxing an unboxed number or a constant into a scratch register.
+ *
+ * @param ta The TraceAssembler to emit with.
+ * @param value The instruction producing the value.
+ * @param scratch The register to box into.
+ * @return Register The register holding the value.
+ */
+static Register ValueOperand(TraceAssembler* ta, int value, Register scratch)
+{
+    IrInstruction* instruction = &ta->trace->ir[value];
+    if (instruction->op == IR_CONSTANT)
+    {
+        EmitMoveImmediate(ta->as, scratch, instruction->constant);
+        return scratch;
+    }
+    else if (instruction->isNumber)
+    {
+        // A NaN-boxed number is the double itself
+        EmitFromXmm(ta->as, scratch, ta->registers[value]);
+        return scratch;
+    }
+    return (Register)ta->registers[value];
+}
+
+/**
+ * @brief Finds the register addressing the slots of a variable.
+ *
+ * @param variable The TraceVariable to address.
+ * @return Register The register holding the frame's slots or the global values.
+ */
+static Register VariableBase(TraceVariable* variable)
+{
+    return variable->isGlobal ? GLOBALS_REGISTER : SLOTS_REGISTER;
+}
+
+/**
+ * @brief Widens an integer constant to the double compiled code works on, ahead of time.
+ *
+ * @param value The constant.
+ * @return Value The constant, as a double if it is a number.
+ */
+static Value WidenConstant(Value value)
+{
+    return IS_INTEGER(value) ? NUMBER_VALUE(AS_NUMBER(value)) : value;
+}
+
+/**
+ * @brief Prints a Value on its own line for compiled OP_PRINT.
+ *
+ * @param value The Value to print.
+ */
+static void PrintLine(Value value)
+{
+    PrintValue(vm->options.output, value);
+    fputc('\n', vm->options.output);
+    fflush(vm->options.output);
+}
+
+/**
+ * @brief Appends a byte of machine code.
+ *
+ * @param as The Assembler to emit to.
+ * @param byte The byte to append.
+ */
+static void EmitByte(Assembler* as, uint8_t byte)
+{
+    if (as->capacity < as->count + 1)
+    {
+        int oldCapacity = as->capacity;
+        as->capacity = GROW_CAPACITY(oldCapacity);
+        as->code = GROW_ARRAY(uint8_t, as->code, oldCapacity, as->capacity);
+    }
+
+    as->code[as->count++] = byte;
+}
+
+/**
+ * @brief Appends a little-endian 32-bit immediate.
+ *
+ * @param as The Assembler to emit to.
+ * @param value The immediate to append.
+ */
+static void EmitInt32(Assembler* as, int32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        EmitByte(as, (uint8_t)((uint32_t)value >> (i * 8)));
+    }
+}
+
+/**
+ * @brief Appends a little-endian 64-bit immediate.
+ *
+ * @param as The Assembler to emit to.
+ * @param value The immediate to append.
+ */
+static void EmitInt64(Assembler* as, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        EmitByte(as, (uint8_t)(value >> (i * 8)));
+    }
+}
+
+/**
+ * @brief Appends a REX prefix when the operand size or the registers need one.
+ *
+ * @param as The Assembler to emit to.
+ * @param isWide Whether the operation is 64 bits wide.
+ * @param reg The register in the ModRM reg field.
+ * @param rm The register in the ModRM rm field.
+ */
+static void EmitRex(Assembler* as, bool isWide, int reg, int rm)
+{
+    uint8_t rex = 0x40 | (isWide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((rm & 8) ? 0x01 : 0);
+    if (rex != 0x40)
+    {
+        EmitByte(as, rex);
+    }
+}
+
+/**
+ * @brief Appends a ModRM operand addressing [base + displacement].
+ *
+ * @param as The Assembler to emit to.
+ * @param reg The register or opcode extension in the reg field.
+ * @param base The base register.
+ * @param displacement The displacement from the base.
+ */
+static void EmitMemoryOperand(Assembler* as, int reg, Register base, int32_t displacement)
+{
+    uint8_t fields = ((reg & 7) << 3) | (base & 7);
+
+    // rbp and r13 have no displacement-free form
+    if (displacement == 0 && (base & 7) != RBP)
+    {
+        EmitByte(as, 0x00 | fields);
+    }
+    else if (displacement >= INT8_MIN && displacement <= INT8_MAX)
+    {
+        EmitByte(as, 0x40 | fields);
+    }
+    else
+    {
+        EmitByte(as, 0x80 | fields);
+    }
+
+    // rsp and r12 as a base always take a SIB byte
+    if ((base & 7) == RSP)
+    {
+        EmitByte(as, 0x24);
+    }
+
+    if (displacement == 0 && (base & 7) != RBP)
+    {
+        return;
+    }
+    else if (displacement >= INT8_MIN && displacement <= INT8_MAX)
+    {
+        EmitByte(as, (uint8_t)displacement);
+    }
+    else
+    {
+        EmitInt32(as, displacement);
+    }
+}
+
+/**
+ * @brief Appends a ModRM operand between two registers.
+ *
+ * @param as The Assembler to emit to.
+ * @param reg The register or opcode extension in the reg field.
+ * @param rm The register in the rm field.
+ */
+static void EmitRegisterOperand(Assembler* as, int reg, int rm)
+{
+    EmitByte(as, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/**
+ * @brief Emits mov destination, [base + displacement].
+ */
+static void EmitLoad(Assembler* as, Register destination, Register base, int32_t displacement)
+{
+    EmitRex(as, true, destination, base);
+    EmitByte(as, 0x8b);
+    EmitMemoryOperand(as, destination, base, displacement);
+}
+
+/**
+ * @brief Emits movsxd destination, dword [base + displacement].
+ */
+static void EmitLoadInt32(Assembler* as, Register destination, Register base, int32_t displacement)
+{
+    EmitRex(as, true, destination, base);
+    EmitByte(as, 0x63);
+    EmitMemoryOperand(as, destination, base, displacement);
+}
+
+/**
+ * @brief Emits mov [base + displacement], source.
+ */
+static void EmitStore(Assembler* as, Register base, int32_t displacement, Register source)
+{
+    EmitRex(as, true, source, base);
+    EmitByte(as, 0x89);
+    EmitMemoryOperand(as, source, base, displacement);
+}
+
+/**
+ * @brief Emits mov destination, source.
+ */
+static void EmitMove(Assembler* as, Register destination, Register source)
+{
+    EmitRex(as, true, source, destination);
+    EmitByte(as, 0x89);
+    EmitRegisterOperand(as, source, destination);
+}
+
+/**
+ * @brief Emits mov destination, value, in its 32-bit form when the value fits.
+ */
+static void EmitMoveImmediate(Assembler* as, Register destination, uint64_t value)
+{
+    if (value <= UINT32_MAX)
+    {
+        EmitRex(as, false, 0, destination);
+        EmitByte(as, 0xb8 + (destination & 7));
+        EmitInt32(as, (int32_t)value);
+    }
+    else
+    {
+        EmitRex(as, true, 0, destination);
+        EmitByte(as, 0xb8 + (destination & 7));
+        EmitInt64(as, value);
+    }
+}
+
+/**
+ * @brief Emits a 64-bit ALU operation between two registers.
+ */
+static void EmitAlu(Assembler* as, AluOperation operation, Register destination, Register source)
+{
+    EmitRex(as, true, source, destination);
+    EmitByte(as, (operation << 3) | 0x01);
+    EmitRegisterOperand(as, source, destination);
+}
+
+/**
+ * @brief Emits a 64-bit ALU operation between a register and a sign-extended immediate.
+ */
+static void EmitAluImmediate(Assembler* as, AluOperation operation, Register destination, int32_t value)
+{
+    EmitRex(as, true, 0, destination);
+    if (value >= INT8_MIN && value <= INT8_MAX)
+    {
+        EmitByte(as, 0x83);
+        EmitRegisterOperand(as, operation, destination);
+        EmitByte(as, (uint8_t)value);
+    }
+    else
+    {
+        EmitByte(as, 0x81);
+        EmitRegisterOperand(as, operation, destination);
+        EmitInt32(as, value);
+    }
+}
+
+/**
+ * @brief Emits a 32-bit ALU operation between [base + displacement] and a sign-extended byte.
+ */
+static void EmitAluMemory32(Assembler* as, AluOperation operation, Register base, int32_t displacement, int8_t value)
+{
+    EmitRex(as, false, 0, base);
+    EmitByte(as, 0x83);
+    EmitMemoryOperand(as, operation, base, displacement);
+    EmitByte(as, (uint8_t)value);
+}
+
+/**
+ * @brief Emits lea destination, [base + displacement].
+ */
+static void EmitLea(Assembler* as, Register destination, Register base, int32_t displacement)
+{
+    EmitRex(as, true, destination, base);
+    EmitByte(as, 0x8d);
+    EmitMemoryOperand(as, destination, base, displacement);
+}
+
+/**
+ * @brief Emits movq xmm, source.
+ */
+static void EmitToXmm(Assembler* as, int xmm, Register source)
+{
+    EmitByte(as, 0x66);
+    EmitRex(as, true, xmm, source);
+    EmitByte(as, 0x0f);
+    EmitByte(as, 0x6e);
+    EmitRegisterOperand(as, xmm, source);
+}
+
+/**
+ * @brief Emits movq destination, xmm.
+ */
+static void EmitFromXmm(Assembler* as, Register destination, int xmm)
+{
+    EmitByte(as, 0x66);
+    EmitRex(as, true, xmm, destination);
+    EmitByte(as, 0x0f);
+    EmitByte(as, 0x7e);
+    EmitRegisterOperand(as, xmm, destination);
+}
+
+/**
+ * @brief Emits a scalar double instruction between two xmm registers.
+ */
+static void EmitSse(Assembler* as, uint8_t prefix, uint8_t opcode, int destination, int source)
+{
+    EmitByte(as, prefix);
+    EmitRex(as, false, destination, source);
+    EmitByte(as, 0x0f);
+    EmitByte(as, opcode);
+    EmitRegisterOperand(as, destination, source);
+}
+
+/**
+ * @brief Emits setcc into the low byte of rax, rcx, rdx or rbx.
+ */
+static void EmitSetCondition(Assembler* as, Condition condition, Register destination)
+{
+    EmitByte(as, 0x0f);
+    EmitByte(as, 0x90 | condition);
+    EmitRegisterOperand(as, 0, destination);
+}
+
+/**
+ * @brief Emits a call to a C function through rax.
+ */
+static void EmitCall(Assembler* as, uint64_t address)
+{
+    EmitMoveImmediate(as, RAX, address);
+    EmitByte(as, 0xff);
+    EmitRegisterOperand(as, 2, RAX);
+}
+
+/**
+ * @brief Emits push source.
+ */
+static void EmitPushRegister(Assembler* as, Register source)
+{
+    EmitRex(as, false, 0, source);
+    EmitByte(as, 0x50 + (source & 7));
+}
+
+/**
+ * @brief Emits pop destination.
+ */
+static void EmitPopRegister(Assembler* as, Register destination)
+{
+    EmitRex(as, false, 0, destination);
+    EmitByte(as, 0x58 + (destination & 7));
+}
+
+/**
+ * @brief Emits a jump with a 32-bit displacement to be patched later.
+ *
+ * @param as The Assembler to emit to.
+ * @param condition The condition to jump on, or ALWAYS.
+ * @return int The position of the displacement.
+ */
+static int EmitJump(Assembler* as, int condition)
+{
+    if (condition == ALWAYS)
+    {
+        EmitByte(as, 0xe9);
+    }
+    else
+    {
+        EmitByte(as, 0x0f);
+        EmitByte(as, 0x80 | condition);
+    }
+
+    int at = as->count;
+    EmitInt32(as, 0);
+    return at;
+}
+
+/**
+ * @brief Points an emitted jump at a position in the code.
+ *
+ * @param as The Assembler holding the jump.
+ * @param at The position of the jump's displacement.
+ * @param target The position to jump to.
+ */
+static void PatchJump(Assembler* as, int at, int target)
+{
+    int32_t displacement = target - (at + 4);
+    memcpy(&as->code[at], &displacement, sizeof(displacement));
+}
+
+#undef ALWAYS
+
+#endif
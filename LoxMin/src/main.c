@@ -1,54 +1,269 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
 #include "common.h"
 #include "chunk.h"
 #include "debug.h"
+#include "serializer.h"
+#include "snapshot.h"
 #include "vm.h"
 
-static void Repl();
-static void RunFile(const char* path);
-static char* ReadFile(const char* path);
+// Megabytes of compiled scripts the compile cache keeps before evicting the least recently used
+#define CACHE_SIZE_DEFAULT 64
+// Seconds after which a temporary file in the cache was left behind by a launch that died writing it
+#define CACHE_TEMP_AGE 3600
+
+/**
+ * @brief Holds one isolate's run of a script.
+ */
+typedef struct
+{
+    const Options* options;
+    const char* source;
+    const FrozenScript* script;
+    // Heap snapshot restored before running the script, or NULL
+    const char* heap;
+    bool isRestored;
+    InterpretResult result;
+} IsolateRun;
+
+/**
+ * @brief Holds one compiled script found in the compile cache.
+ */
+typedef struct
+{
+    char* path;
+    time_t used;
+    off_t size;
+} CacheEntry;
+
+/**
+ * @brief Holds one script of a batch, and what running it produced.
+ */
+typedef struct
+{
+    char* path;
+    int status;
+    double seconds;
+    char* output;
+    char* errors;
+} BatchScript;
+
+/**
+ * @brief Holds a batch of scripts, shared by the threads running them.
+ */
+typedef struct
+{
+    const Options* options;
+    BatchScript* scripts;
+    int count;
+    int capacity;
+    int next;
+    pthread_mutex_t lock;
+} Batch;
+
+static void Repl(VM* isolate);
+static void RunFile(const Options* options, const char* path, int isolates, bool freeze, bool showStats,
+                    const char* heap);
+static void CompileFile(const Options* options, const char* path, const char* output);
+static void SnapshotFile(const Options* options, const char* path, const char* heap, const char* output);
+static bool IsCompiledPath(const char* path);
+static bool OpenCache(char* directory, size_t size);
+static FrozenScript* CompileCached(const Options* options, const char* source, const char* directory, bool showStats);
+static uint64_t CacheKey(const Options* options, const char* source);
+static uint64_t HashBytes(uint64_t hash, const void* bytes, size_t size);
+static FrozenScript* LoadCached(VM* isolate, const char* path);
+static void SaveCached(const FrozenScript* script, const char* directory, const char* path);
+static void EvictCache(const char* directory);
+static int ListCache(const char* directory, CacheEntry** entries, long long* totalSize);
+static int CompareCacheEntries(const void* a, const void* b);
+static void CountCacheLookup(const char* directory, bool isHit, long* hits, long* misses);
+static void PrintCompileCacheStats(const char* directory, bool isHit, long hits, long misses);
+static void* RunIsolate(void* run);
+static int RunBatch(const Options* options, const char** paths, int pathCount, int workers);
+static void AddBatchPath(Batch* batch, const char* path);
+static int ComparePaths(const void* a, const void* b);
+static void* RunBatchWorker(void* batch);
+static void RunBatchScript(const Options* options, BatchScript* script);
+static void PrintJsonString(const char* string);
+static int ExitCode(InterpretResult result);
+static char* ReadFile(const char* path, FILE* errors);
+static char* ReadStream(FILE* file);
 
 /**
  * @brief Main entry point.
  */
 int main(int argc, const char* argv[])
 {
-    InitVM();
+    Options options;
+    InitOptions(&options);
+
+    const char* path = NULL;
+    bool quiet = false;
+    int isolates = 1;
+    bool freeze = false;
+    const char* output = NULL;
+    const char* heap = NULL;
+    const char* heapOutput = NULL;
+    bool showStats = false;
+    bool isBatch = false;
+    int workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char** paths = (const char**)malloc(sizeof(const char*) * argc);
+    int pathCount = 0;
+    if (paths == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        // Quiet mode for debugging
+        if (strcmp(argv[i], "-q") == 0)
+        {
+            quiet = true;
+        }
+        // Compile with register-form instructions
+        else if (strcmp(argv[i], "-r") == 0)
+        {
+            options.registerMode = true;
+        }
+        // Compile each function body on the function's first call
+        else if (strcmp(argv[i], "-l") == 0)
+        {
+            options.lazyCompile = true;
+        }
+        // Limit the depth of the call stack
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+        {
+            options.maxFrames = atoi(argv[++i]);
+        }
+        // Run the script in several isolates at once, each on a thread of its own
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+        {
+            isolates = atoi(argv[++i]);
+        }
+        // Compile the script once and freeze it, sharing its code between the isolates
+        else if (strcmp(argv[i], "-f") == 0)
+        {
+            freeze = true;
+        }
+        // Compile the script to a compiled script file instead of running it
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        // Run the script, then write the heap it leaves to a heap snapshot instead of exiting with it
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+        {
+            heapOutput = argv[++i];
+        }
+        // Restore a heap snapshot before running the script
+        else if (strcmp(argv[i], "-h") == 0 && i + 1 < argc)
+        {
+            heap = argv[++i];
+        }
+        // Report how often the compile cache has been hit
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            showStats = true;
+        }
+        // Run every script given, and every .lox file in the directories given, printing a JSON summary
+        else if (strcmp(argv[i], "-b") == 0)
+        {
+            isBatch = true;
+        }
+        // Number of threads running a batch
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+        {
+            workers = atoi(argv[++i]);
+        }
+#ifdef JIT_COMPILER
+        // Compile every function to native code on its first call, and every loop on its first iteration
+        else if (strcmp(argv[i], "-j") == 0)
+        {
+            options.jitThreshold = 0;
+            options.traceThreshold = 0;
+        }
+#endif
+        else if (argv[i][0] != '-' && (path == NULL || isBatch))
+        {
+            path = argv[i];
+            paths[pathCount++] = argv[i];
+        }
+        // Does our user know where they are?
+        else
+        {
+#ifdef JIT_COMPILER
+            fprintf(stderr, "Usage: LoxMin [path] [-q] [-r] [-l] [-d depth] [-i isolates] [-f] [-c output] [-p heap] [-h heap] [-s] [-j]\n");
+            fprintf(stderr, "       LoxMin -b paths... [-w workers] [-r] [-l] [-d depth] [-j]\n");
+#else
+            fprintf(stderr, "Usage: LoxMin [path] [-q] [-r] [-l] [-d depth] [-i isolates] [-f] [-c output] [-p heap] [-h heap] [-s]\n");
+            fprintf(stderr, "       LoxMin -b paths... [-w workers] [-r] [-l] [-d depth]\n");
+#endif
+            exit(64);
+        }
+    }
+
+    if (isBatch)
+    {
+        int status = RunBatch(&options, paths, pathCount, workers < 1 ? 1 : workers);
+        free(paths);
+        return status;
+    }
+    free(paths);
 
     // No path given
-    if (argc == 1)
+    if (path == NULL)
     {
         printf("LoxMin v1.0.0 - Kai NeSmith 2023\n");
-        Repl();
+        VM* isolate = NewVM(&options);
+        if (heap != NULL && !RestoreSnapshot(isolate, heap))
+        {
+            FreeVM(isolate);
+            exit(74);
+        }
+        Repl(isolate);
+        FreeVM(isolate);
     }
-    // Path provided
-    else if (argc == 2)
+    // Path provided, to compile ahead of time
+    else if (output != NULL)
     {
-        printf("LoxMin v1.0.0 - Kai NeSmith 2023\n");
-        RunFile(argv[1]);
+        CompileFile(&options, path, output);
     }
-    // Path provided, quiet mode for debugging
-    else if (argc == 3 && strcmp(argv[2], "-q") == 0)
+    // Path provided, to snapshot the heap it sets up
+    else if (heapOutput != NULL)
     {
-        RunFile(argv[1]);
+        SnapshotFile(&options, path, heap, heapOutput);
     }
-    // Does our user know where they are?
+    // Path provided
     else
     {
-        fprintf(stderr, "Usage: LoxMin [path] [-q]\n");
-        exit(64);
+        if (!quiet)
+        {
+            printf("LoxMin v1.0.0 - Kai NeSmith 2023\n");
+        }
+        RunFile(&options, path, isolates, freeze, showStats, heap);
     }
 
-    FreeVM();
     return 0;
 }
 
 /**
  * @brief Runs the interpreter as a REPL.
+ * 
+ * @param isolate The VM to run each line in.
  */
-static void Repl()
+static void Repl(VM* isolate)
 {
     char line[1024];
 
@@ -63,28 +278,914 @@ static void Repl()
         }
 
         // Interpret the input
-        Interpret(line);
+        Interpret(isolate, line);
+    }
+}
+
+/**
+ * @brief Runs the interpreter from a file, exiting with an error code if any isolate fails.
+ * 
+ * Source files are compiled through the compile cache unless it is disabled, compilation is lazy or a heap
+ * snapshot is restored, in which case every isolate compiles the file itself unless it is frozen.
+ * 
+ * @param options The Options to run the file with.
+ * @param path A path to the source file.
+ * @param isolates The number of isolates to run the file in at once; the first runs on this thread.
+ * @param freeze Whether to compile the file once, into a frozen script every isolate runs, unless a heap
+ *               snapshot is restored.
+ * @param showStats Whether to report how often the compile cache has been hit.
+ * @param heap A path to a heap snapshot every isolate restores before running the file, or NULL.
+ */
+static void RunFile(const Options* options, const char* path, int isolates, bool freeze, bool showStats,
+                    const char* heap)
+{
+    // A compiled script file is loaded as a frozen script, with nothing left to compile
+    char* source = NULL;
+    FrozenScript* script = NULL;
+    if (IsCompiledPath(path))
+    {
+        VM* isolate = NewVM(options);
+        script = LoadScript(isolate, path);
+        FreeVM(isolate);
+        if (script == NULL)
+        {
+            exit(74);
+        }
+    }
+    else
+    {
+        source = ReadFile(path, stderr);
+        if (source == NULL)
+        {
+            exit(74);
+        }
+
+        // A cached script is frozen, which compiles every body up front and so makes no sense lazily, nor
+        // with a restored heap
+        char cache[PATH_MAX];
+        if (!options->lazyCompile && heap == NULL && OpenCache(cache, sizeof(cache)))
+        {
+            script = CompileCached(options, source, cache, showStats);
+            if (script == NULL)
+            {
+                free(source);
+                exit(ExitCode(INTERPRET_COMPILE_ERROR));
+            }
+        }
+    }
+
+    // Frozen code addresses globals by the slots it was compiled against, which a restored heap lays out
+    // differently, so each isolate compiles the file against its own heap instead
+    if (freeze && script == NULL && heap == NULL)
+    {
+        VM* isolate = NewVM(options);
+        script = FreezeScript(isolate, source);
+        FreeVM(isolate);
+        if (script == NULL)
+        {
+            free(source);
+            exit(ExitCode(INTERPRET_COMPILE_ERROR));
+        }
+    }
+
+    IsolateRun* runs = (IsolateRun*)malloc(sizeof(IsolateRun) * isolates);
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * isolates);
+    if (runs == NULL || threads == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < isolates; i++)
+    {
+        runs[i].options = options;
+        runs[i].source = source;
+        runs[i].script = script;
+        runs[i].heap = heap;
+        runs[i].isRestored = true;
+        runs[i].result = INTERPRET_OK;
+    }
+    for (int i = 1; i < isolates; i++)
+    {
+        if (pthread_create(&threads[i], NULL, RunIsolate, &runs[i]) != 0)
+        {
+            fprintf(stderr, "Could not start isolate %d.\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    RunIsolate(&runs[0]);
+
+    InterpretResult result = runs[0].result;
+    bool isRestored = runs[0].isRestored;
+    for (int i = 1; i < isolates; i++)
+    {
+        pthread_join(threads[i], NULL);
+        if (result == INTERPRET_OK)
+        {
+            result = runs[i].result;
+        }
+        isRestored = isRestored && runs[i].isRestored;
+    }
+    free(threads);
+    free(runs);
+    free(source);
+    if (script != NULL)
+    {
+        FreeFrozenScript(script);
+    }
+
+    if (!isRestored)
+    {
+        exit(74);
+    }
+    if (result != INTERPRET_OK)
+    {
+        exit(ExitCode(result));
     }
 }
 
 /**
- * @brief Runs the interpreter from a file.
+ * @brief Compiles a source file to a compiled script file, which can then be run without compiling it again.
  * 
+ * @param options The Options to compile the file with.
  * @param path A path to the source file.
+ * @param output A path to the compiled script file to write.
  */
-static void RunFile(const char* path)
+static void CompileFile(const Options* options, const char* path, const char* output)
 {
-    char* source = ReadFile(path);
-    InterpretResult result = Interpret(source);
+    char* source = ReadFile(path, stderr);
+    if (source == NULL)
+    {
+        exit(74);
+    }
+
+    VM* isolate = NewVM(options);
+    FrozenScript* script = FreezeScript(isolate, source);
+    FreeVM(isolate);
+    free(source);
+    if (script == NULL)
+    {
+        exit(ExitCode(INTERPRET_COMPILE_ERROR));
+    }
+
+    FILE* file = fopen(output, "wb");
+    bool isWritten = file != NULL && SaveScript(script, file);
+    if (file != NULL && fclose(file) != 0)
+    {
+        isWritten = false;
+    }
+    FreeFrozenScript(script);
+    if (!isWritten)
+    {
+        fprintf(stderr, "Could not write file \"%s\".\n", output);
+        exit(74);
+    }
+}
+
+/**
+ * @brief Runs a source file and writes the heap it leaves behind to a heap snapshot, which later runs can
+ * restore instead of running the file again.
+ * 
+ * @param options The Options to run the file with.
+ * @param path A path to the source file.
+ * @param heap A path to a heap snapshot to restore before running the file, or NULL.
+ * @param output A path to the heap snapshot to write.
+ */
+static void SnapshotFile(const Options* options, const char* path, const char* heap, const char* output)
+{
+    char* source = ReadFile(path, stderr);
+    if (source == NULL)
+    {
+        exit(74);
+    }
+
+    VM* isolate = NewVM(options);
+    if (heap != NULL && !RestoreSnapshot(isolate, heap))
+    {
+        FreeVM(isolate);
+        free(source);
+        exit(74);
+    }
+    InterpretResult result = Interpret(isolate, source);
     free(source);
+    bool isSaved = result == INTERPRET_OK && SaveSnapshot(isolate, output);
+    FreeVM(isolate);
+    if (result != INTERPRET_OK)
+    {
+        exit(ExitCode(result));
+    }
+    if (!isSaved)
+    {
+        exit(74);
+    }
+}
+
+/**
+ * @brief Checks whether a path names a compiled script file rather than source code.
+ * 
+ * @param path A path to a script.
+ * @return true If the path ends in ".loxc".
+ * @return false If it does not.
+ */
+static bool IsCompiledPath(const char* path)
+{
+    size_t length = strlen(path);
+    return length >= 5 && strcmp(path + length - 5, ".loxc") == 0;
+}
+
+/**
+ * @brief Finds the compile cache directory, creating it if needed.
+ * 
+ * The cache lives in $LOXMIN_CACHE, or else in loxmin under $XDG_CACHE_HOME or ~/.cache. Setting
+ * $LOXMIN_CACHE to an empty string disables it.
+ * 
+ * @param directory A buffer receiving the path of the directory.
+ * @param size The size of the buffer.
+ * @return true If the cache can be used.
+ * @return false If it is disabled or its directory cannot be created.
+ */
+static bool OpenCache(char* directory, size_t size)
+{
+    const char* setting = getenv("LOXMIN_CACHE");
+    const char* cacheHome = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (setting != NULL)
+    {
+        if (setting[0] == '\0')
+        {
+            return false;
+        }
+        snprintf(directory, size, "%s", setting);
+    }
+    else if (cacheHome != NULL && cacheHome[0] != '\0')
+    {
+        snprintf(directory, size, "%s/loxmin", cacheHome);
+    }
+    else if (home != NULL && home[0] != '\0')
+    {
+        snprintf(directory, size, "%s/.cache", home);
+        mkdir(directory, 0700);
+        snprintf(directory, size, "%s/.cache/loxmin", home);
+    }
+    else
+    {
+        return false;
+    }
+
+    struct stat info;
+    mkdir(directory, 0700);
+    return stat(directory, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+/**
+ * @brief Loads the compiled form of a script from the compile cache, compiling it into the cache on a miss.
+ * 
+ * @param options The Options to compile the script with.
+ * @param source The source code of the script.
+ * @param directory The compile cache directory.
+ * @param showStats Whether to report how often the cache has been hit.
+ * @return FrozenScript* The frozen script, or NULL if the source does not compile.
+ */
+static FrozenScript* CompileCached(const Options* options, const char* source, const char* directory, bool showStats)
+{
+    char path[PATH_MAX];
+    bool hasPath = snprintf(path, sizeof(path), "%s/%016llx.loxc", directory,
+                            (unsigned long long)CacheKey(options, source)) < (int)sizeof(path);
+
+    VM* isolate = NewVM(options);
+    FrozenScript* script = NULL;
+    if (hasPath && access(path, R_OK) == 0)
+    {
+        script = LoadCached(isolate, path);
+    }
+
+    // A hit marks the script as recently used; a miss compiles it as usual and stores it for the next launch
+    bool isHit = script != NULL;
+    if (isHit)
+    {
+        utime(path, NULL);
+    }
+    else
+    {
+        script = FreezeScript(isolate, source);
+        if (script != NULL && hasPath)
+        {
+            SaveCached(script, directory, path);
+            EvictCache(directory);
+        }
+    }
+    FreeVM(isolate);
+
+    long hits;
+    long misses;
+    CountCacheLookup(directory, isHit, &hits, &misses);
+    if (showStats)
+    {
+        PrintCompileCacheStats(directory, isHit, hits, misses);
+    }
+    return script;
+}
+
+/**
+ * @brief Works out the key a script is cached under, from its source and everything else its bytecode depends on.
+ * 
+ * @param options The Options the script is compiled with.
+ * @param source The source code of the script.
+ * @return uint64_t The key.
+ */
+static uint64_t CacheKey(const Options* options, const char* source)
+{
+    // Rebuilding without changing the bytecode keeps the cache, while a build compiling differently misses it
+    uint32_t versions[] = { LOXC_VERSION, BYTECODE_VERSION };
+    uint64_t hash = 14695981039346656037ULL;
+    hash = HashBytes(hash, versions, sizeof(versions));
+    hash = HashBytes(hash, &options->registerMode, sizeof(options->registerMode));
+    return HashBytes(hash, source, strlen(source));
+}
 
-    if (result == INTERPRET_COMPILE_ERROR)
+/**
+ * @brief Folds a run of bytes into a 64-bit FNV-1a hash.
+ * 
+ * @param hash The hash so far.
+ * @param bytes The bytes to hash.
+ * @param size The number of bytes.
+ * @return uint64_t The new hash.
+ */
+static uint64_t HashBytes(uint64_t hash, const void* bytes, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
     {
-        exit(65);
+        hash ^= ((const uint8_t*)bytes)[i];
+        hash *= 1099511628211ULL;
     }
-    else if (result == INTERPRET_RUNTIME_ERROR)
+    return hash;
+}
+
+/**
+ * @brief Loads a compiled script from the compile cache.
+ * 
+ * Nothing is reported if the script cannot be loaded: whether it is missing, cut short, or fails its checksum,
+ * the caller simply compiles it again and overwrites it.
+ * 
+ * @param isolate The VM used as a template.
+ * @param path The path the script is cached under.
+ * @return FrozenScript* The frozen script, or NULL if there is no intact one.
+ */
+static FrozenScript* LoadCached(VM* isolate, const char* path)
+{
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor == -1)
     {
-        exit(70);
+        return NULL;
+    }
+
+    struct stat status;
+    void* mapping = MAP_FAILED;
+    if (fstat(descriptor, &status) == 0 && status.st_size > 0)
+    {
+        mapping = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    }
+    close(descriptor);
+    return mapping != MAP_FAILED ? LoadMappedScript(isolate, mapping, (size_t)status.st_size) : NULL;
+}
+
+/**
+ * @brief Stores a compiled script in the compile cache.
+ * 
+ * The script is written to a temporary file and renamed into place, which is atomic, so a launch running
+ * at the same time finds either the whole script or none of it. Failing to store it is not an error.
+ * 
+ * @param script The FrozenScript to store.
+ * @param directory The compile cache directory.
+ * @param path The path the script is cached under.
+ */
+static void SaveCached(const FrozenScript* script, const char* directory, const char* path)
+{
+    char temporary[PATH_MAX];
+    if (snprintf(temporary, sizeof(temporary), "%s/.tmp-XXXXXX", directory) >= (int)sizeof(temporary))
+    {
+        return;
+    }
+    int descriptor = mkstemp(temporary);
+    if (descriptor == -1)
+    {
+        return;
+    }
+
+    FILE* file = fdopen(descriptor, "wb");
+    bool isWritten = file != NULL && SaveScript(script, file);
+    if (file == NULL)
+    {
+        close(descriptor);
+    }
+    else if (fclose(file) != 0)
+    {
+        isWritten = false;
+    }
+
+    if (!isWritten || rename(temporary, path) != 0)
+    {
+        unlink(temporary);
+    }
+}
+
+/**
+ * @brief Evicts the least recently used scripts from the compile cache until it fits its size limit.
+ * 
+ * The limit is $LOXMIN_CACHE_SIZE megabytes, or CACHE_SIZE_DEFAULT if that is not set.
+ * 
+ * @param directory The compile cache directory.
+ */
+static void EvictCache(const char* directory)
+{
+    const char* setting = getenv("LOXMIN_CACHE_SIZE");
+    long long limit = setting != NULL && atoll(setting) > 0 ? atoll(setting) : CACHE_SIZE_DEFAULT;
+    limit *= 1024 * 1024;
+
+    CacheEntry* entries;
+    long long totalSize;
+    int count = ListCache(directory, &entries, &totalSize);
+    qsort(entries, count, sizeof(CacheEntry), CompareCacheEntries);
+    for (int i = 0; i < count; i++)
+    {
+        // A launch still running an evicted script keeps its mapping, which outlives the file
+        if (totalSize > limit && unlink(entries[i].path) == 0)
+        {
+            totalSize -= entries[i].size;
+        }
+        free(entries[i].path);
+    }
+    free(entries);
+}
+
+/**
+ * @brief Lists the compiled scripts in the compile cache, removing temporary files left behind on the way.
+ * 
+ * @param directory The compile cache directory.
+ * @param entries The resulting array of CacheEntry, to be freed along with every path in it.
+ * @param totalSize The resulting size of all of the scripts, in bytes.
+ * @return int The number of scripts.
+ */
+static int ListCache(const char* directory, CacheEntry** entries, long long* totalSize)
+{
+    *entries = NULL;
+    *totalSize = 0;
+    int count = 0;
+    int capacity = 0;
+
+    DIR* listing = opendir(directory);
+    if (listing == NULL)
+    {
+        return 0;
+    }
+
+    time_t now = time(NULL);
+    for (struct dirent* entry = readdir(listing); entry != NULL; entry = readdir(listing))
+    {
+        char path[PATH_MAX];
+        struct stat info;
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        if (stat(path, &info) != 0 || !S_ISREG(info.st_mode))
+        {
+            continue;
+        }
+
+        if (strncmp(entry->d_name, ".tmp-", 5) == 0)
+        {
+            if (now - info.st_mtime > CACHE_TEMP_AGE)
+            {
+                unlink(path);
+            }
+            continue;
+        }
+        if (!IsCompiledPath(entry->d_name))
+        {
+            continue;
+        }
+
+        if (count == capacity)
+        {
+            capacity = capacity < 8 ? 8 : capacity * 2;
+            *entries = (CacheEntry*)realloc(*entries, sizeof(CacheEntry) * capacity);
+        }
+        char* copy = (char*)malloc(strlen(path) + 1);
+        if (*entries == NULL || copy == NULL)
+        {
+            exit(EXIT_FAILURE);
+        }
+        strcpy(copy, path);
+
+        (*entries)[count].path = copy;
+        (*entries)[count].used = info.st_mtime;
+        (*entries)[count].size = info.st_size;
+        *totalSize += info.st_size;
+        count++;
+    }
+    closedir(listing);
+    return count;
+}
+
+/**
+ * @brief Orders two cache entries for qsort(), least recently used first.
+ * 
+ * @param a A pointer to the first CacheEntry.
+ * @param b A pointer to the second CacheEntry.
+ * @return int The order of the entries.
+ */
+static int CompareCacheEntries(const void* a, const void* b)
+{
+    time_t first = ((const CacheEntry*)a)->used;
+    time_t second = ((const CacheEntry*)b)->used;
+    return first < second ? -1 : first > second;
+}
+
+/**
+ * @brief Counts a lookup in the compile cache's hit and miss counters, which every launch shares.
+ * 
+ * @param directory The compile cache directory.
+ * @param isHit Whether the lookup was a hit.
+ * @param hits The resulting number of hits so far.
+ * @param misses The resulting number of misses so far.
+ */
+static void CountCacheLookup(const char* directory, bool isHit, long* hits, long* misses)
+{
+    *hits = 0;
+    *misses = 0;
+
+    char path[PATH_MAX];
+    int descriptor = snprintf(path, sizeof(path), "%s/stats", directory) < (int)sizeof(path) ?
+                     open(path, O_RDWR | O_CREAT, 0600) : -1;
+    if (descriptor == -1)
+    {
+        return;
+    }
+
+    // Launches count at the same time, so the counters are only read and written under a lock
+    if (flock(descriptor, LOCK_EX) == 0)
+    {
+        char counters[64] = {0};
+        if (read(descriptor, counters, sizeof(counters) - 1) <= 0 || sscanf(counters, "%ld %ld", hits, misses) != 2)
+        {
+            *hits = 0;
+            *misses = 0;
+        }
+        if (isHit)
+        {
+            (*hits)++;
+        }
+        else
+        {
+            (*misses)++;
+        }
+
+        int length = snprintf(counters, sizeof(counters), "%ld %ld\n", *hits, *misses);
+        if (lseek(descriptor, 0, SEEK_SET) != 0 || ftruncate(descriptor, 0) != 0 ||
+            write(descriptor, counters, length) != length)
+        {
+            fprintf(stderr, "Could not update compile cache statistics in \"%s\".\n", path);
+        }
+        flock(descriptor, LOCK_UN);
+    }
+    close(descriptor);
+}
+
+/**
+ * @brief Prints how often the compile cache has been hit, and how much it holds.
+ * 
+ * @param directory The compile cache directory.
+ * @param isHit Whether this launch's lookup was a hit.
+ * @param hits The number of hits so far.
+ * @param misses The number of misses so far.
+ */
+static void PrintCompileCacheStats(const char* directory, bool isHit, long hits, long misses)
+{
+    CacheEntry* entries;
+    long long totalSize;
+    int count = ListCache(directory, &entries, &totalSize);
+    for (int i = 0; i < count; i++)
+    {
+        free(entries[i].path);
+    }
+    free(entries);
+
+    long lookups = hits + misses;
+    fprintf(stderr, "Compile cache \"%s\": %s; %ld hits in %ld lookups (%.1f%%); %d scripts in %lld bytes.\n",
+            directory, isHit ? "hit" : "miss", hits, lookups, lookups > 0 ? 100.0 * hits / lookups : 0.0,
+            count, totalSize);
+}
+
+/**
+ * @brief Runs a script in a VM of its own, restoring its heap snapshot first if it has one.
+ * 
+ * @param run The IsolateRun to perform, receiving its result.
+ * @return void* Always NULL.
+ */
+static void* RunIsolate(void* run)
+{
+    IsolateRun* isolateRun = (IsolateRun*)run;
+    VM* isolate = NewVM(isolateRun->options);
+    if (isolateRun->heap != NULL && !RestoreSnapshot(isolate, isolateRun->heap))
+    {
+        isolateRun->isRestored = false;
+        FreeVM(isolate);
+        return NULL;
+    }
+    isolateRun->result = isolateRun->script != NULL ? InterpretFrozen(isolate, isolateRun->script)
+                                                    : Interpret(isolate, isolateRun->source);
+    FreeVM(isolate);
+    return NULL;
+}
+
+/**
+ * @brief Runs a batch of scripts, each in a fresh VM, and prints one line of JSON per script in the order given.
+ * 
+ * Every line holds the script's path, its exit status, its run time in seconds, and everything it printed
+ * and reported, captured separately for each script.
+ * 
+ * @param options The Options to run every script with.
+ * @param paths Paths to scripts, or to directories searched for .lox files.
+ * @param pathCount The number of paths.
+ * @param workers The number of threads running scripts.
+ * @return int 0 if every script succeeded, 1 otherwise.
+ */
+static int RunBatch(const Options* options, const char** paths, int pathCount, int workers)
+{
+    Batch batch;
+    batch.options = options;
+    batch.scripts = NULL;
+    batch.count = 0;
+    batch.capacity = 0;
+    batch.next = 0;
+    pthread_mutex_init(&batch.lock, NULL);
+    for (int i = 0; i < pathCount; i++)
+    {
+        AddBatchPath(&batch, paths[i]);
+    }
+
+    if (workers > batch.count)
+    {
+        workers = batch.count > 0 ? batch.count : 1;
+    }
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * workers);
+    if (threads == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 1; i < workers; i++)
+    {
+        if (pthread_create(&threads[i], NULL, RunBatchWorker, &batch) != 0)
+        {
+            fprintf(stderr, "Could not start worker %d.\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    RunBatchWorker(&batch);
+    for (int i = 1; i < workers; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    pthread_mutex_destroy(&batch.lock);
+
+    int status = 0;
+    for (int i = 0; i < batch.count; i++)
+    {
+        BatchScript* script = &batch.scripts[i];
+        printf("{\"path\": ");
+        PrintJsonString(script->path);
+        printf(", \"status\": %d, \"time\": %.6f, \"output\": ", script->status, script->seconds);
+        PrintJsonString(script->output);
+        printf(", \"errors\": ");
+        PrintJsonString(script->errors);
+        printf("}\n");
+
+        if (script->status != 0)
+        {
+            status = 1;
+        }
+        free(script->path);
+        free(script->output);
+        free(script->errors);
+    }
+    free(batch.scripts);
+
+    return status;
+}
+
+/**
+ * @brief Adds a script to a batch, or every .lox file under a directory in sorted order.
+ * 
+ * @param batch The Batch to add to.
+ * @param path A path to a script or a directory.
+ */
+static void AddBatchPath(Batch* batch, const char* path)
+{
+    struct stat info;
+    DIR* directory = stat(path, &info) == 0 && S_ISDIR(info.st_mode) ? opendir(path) : NULL;
+    if (directory != NULL)
+    {
+        char** names = NULL;
+        int count = 0;
+        int capacity = 0;
+        for (struct dirent* entry = readdir(directory); entry != NULL; entry = readdir(directory))
+        {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            {
+                continue;
+            }
+
+            if (count == capacity)
+            {
+                capacity = capacity < 8 ? 8 : capacity * 2;
+                names = (char**)realloc(names, sizeof(char*) * capacity);
+            }
+            size_t length = strlen(path) + strlen(entry->d_name) + 2;
+            char* name = (char*)malloc(length);
+            if (names == NULL || name == NULL)
+            {
+                exit(EXIT_FAILURE);
+            }
+            snprintf(name, length, "%s/%s", path, entry->d_name);
+            names[count++] = name;
+        }
+        closedir(directory);
+
+        qsort(names, count, sizeof(char*), ComparePaths);
+        for (int i = 0; i < count; i++)
+        {
+            size_t length = strlen(names[i]);
+            bool isScript = length > 4 && strcmp(names[i] + length - 4, ".lox") == 0;
+            if (isScript || (stat(names[i], &info) == 0 && S_ISDIR(info.st_mode)))
+            {
+                AddBatchPath(batch, names[i]);
+            }
+            free(names[i]);
+        }
+        free(names);
+        return;
+    }
+
+    // Anything else is run as given, so a missing script shows up in the summary
+    if (batch->count == batch->capacity)
+    {
+        batch->capacity = batch->capacity < 8 ? 8 : batch->capacity * 2;
+        batch->scripts = (BatchScript*)realloc(batch->scripts, sizeof(BatchScript) * batch->capacity);
+    }
+    char* copy = (char*)malloc(strlen(path) + 1);
+    if (batch->scripts == NULL || copy == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+    strcpy(copy, path);
+
+    BatchScript* script = &batch->scripts[batch->count++];
+    script->path = copy;
+    script->status = 0;
+    script->seconds = 0;
+    script->output = NULL;
+    script->errors = NULL;
+}
+
+/**
+ * @brief Orders two paths for qsort().
+ * 
+ * @param a A pointer to the first path.
+ * @param b A pointer to the second path.
+ * @return int The order of the paths.
+ */
+static int ComparePaths(const void* a, const void* b)
+{
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+/**
+ * @brief Runs scripts of a batch until none are left.
+ * 
+ * @param batch The Batch to take scripts from.
+ * @return void* Always NULL.
+ */
+static void* RunBatchWorker(void* batch)
+{
+    Batch* shared = (Batch*)batch;
+    while (true)
+    {
+        pthread_mutex_lock(&shared->lock);
+        int index = shared->next++;
+        pthread_mutex_unlock(&shared->lock);
+
+        if (index >= shared->count)
+        {
+            return NULL;
+        }
+        RunBatchScript(shared->options, &shared->scripts[index]);
+    }
+}
+
+/**
+ * @brief Runs one script of a batch in a fresh VM, capturing everything it prints.
+ * 
+ * @param options The Options to run the script with.
+ * @param script The BatchScript to run, receiving its results.
+ */
+static void RunBatchScript(const Options* options, BatchScript* script)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    Options scriptOptions = *options;
+    scriptOptions.output = tmpfile();
+    scriptOptions.errors = tmpfile();
+    if (scriptOptions.output == NULL || scriptOptions.errors == NULL)
+    {
+        fprintf(stderr, "Could not capture the output of \"%s\".\n", script->path);
+        exit(74);
+    }
+
+    char* source = ReadFile(script->path, scriptOptions.errors);
+    if (source == NULL)
+    {
+        script->status = 74;
+    }
+    else
+    {
+        VM* isolate = NewVM(&scriptOptions);
+        script->status = ExitCode(Interpret(isolate, source));
+        FreeVM(isolate);
+        free(source);
+    }
+
+    script->output = ReadStream(scriptOptions.output);
+    script->errors = ReadStream(scriptOptions.errors);
+    fclose(scriptOptions.output);
+    fclose(scriptOptions.errors);
+    if (script->output == NULL || script->errors == NULL)
+    {
+        fprintf(stderr, "Could not capture the output of \"%s\".\n", script->path);
+        exit(74);
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    script->seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Prints a string as a quoted JSON string.
+ * 
+ * @param string The string to print.
+ */
+static void PrintJsonString(const char* string)
+{
+    putchar('"');
+    for (const unsigned char* c = (const unsigned char*)string; *c != '\0'; c++)
+    {
+        switch (*c)
+        {
+            case '"':
+                printf("\\\"");
+                break;
+            case '\\':
+                printf("\\\\");
+                break;
+            case '\n':
+                printf("\\n");
+                break;
+            case '\r':
+                printf("\\r");
+                break;
+            case '\t':
+                printf("\\t");
+                break;
+            default:
+                if (*c < 0x20)
+                {
+                    printf("\\u%04x", *c);
+                }
+                else
+                {
+                    putchar(*c);
+                }
+                break;
+        }
+    }
+    putchar('"');
+}
+
+/**
+ * @brief Finds the exit code that reports an InterpretResult.
+ * 
+ * @param result The InterpretResult to report.
+ * @return int 0, 65 for a compile error or 70 for a runtime error.
+ */
+static int ExitCode(InterpretResult result)
+{
+    switch (result)
+    {
+        case INTERPRET_COMPILE_ERROR:
+            return 65;
+        case INTERPRET_RUNTIME_ERROR:
+            return 70;
+        default:
+            return 0;
     }
 }
 
@@ -92,18 +1193,36 @@ static void RunFile(const char* path)
  * @brief Reads a file into memory.
  * 
  * @param path A path to the file.
- * @return char* A pointer to the read bytes.
+ * @param errors The stream to report a failure on.
+ * @return char* A pointer to the read bytes, or NULL if the file could not be read.
  */
-static char* ReadFile(const char* path)
+static char* ReadFile(const char* path, FILE* errors)
 {
     FILE* file = fopen(path, "rb");
     if (file == NULL)
     {
-        fprintf(stderr, "Could not open file \"%s\".\n", path);
-        exit(74);
+        fprintf(errors, "Could not open file \"%s\".\n", path);
+        return NULL;
+    }
+
+    char* buffer = ReadStream(file);
+    fclose(file);
+    if (buffer == NULL)
+    {
+        fprintf(errors, "Could not read file \"%s\".\n", path);
     }
+    return buffer;
+}
 
-    // Get size of file
+/**
+ * @brief Reads a stream from its start into memory.
+ * 
+ * @param file The stream to read.
+ * @return char* A pointer to the null-terminated bytes, or NULL if the stream could not be read.
+ */
+static char* ReadStream(FILE* file)
+{
+    // Get size of stream
     fseek(file, 0L, SEEK_END);
     size_t fileSize = ftell(file);
     rewind(file);
@@ -112,21 +1231,17 @@ static char* ReadFile(const char* path)
     char* buffer = (char*)malloc(fileSize + 1);
     if (buffer == NULL)
     {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-        exit(74);
+        return NULL;
     }
 
-    // Read in file
+    // Read in stream
     size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
     if (bytesRead < fileSize)
     {
-        fprintf(stderr, "Could not read file \"%s\".\n", path);
-        exit(74);
+        free(buffer);
+        return NULL;
     }
     buffer[bytesRead] = '\0';
 
-    // Release file handle
-    fclose(file);
-
     return buffer;
 }
@@ -1,5 +1,7 @@
 #include <stdlib.h>
+#include <string.h>
 #include "compiler.h"
+#include "jit.h"
 #include "memory.h"
 #include "vm.h"
 
@@ -19,19 +21,36 @@ static void Sweep();
 
 void* Reallocate(void* pointer, size_t oldSize, size_t newSize)
 {
-    vm.bytesAllocated += newSize - oldSize;
+    vm->bytesAllocated += newSize - oldSize;
     if (newSize > oldSize)
     {
 #ifdef DEBUG_STRESS_GC
         CollectGarbage();
 #endif
 
-        if (vm.bytesAllocated > vm.nextGC)
+        if (vm->bytesAllocated > vm->nextGC)
         {
             CollectGarbage();
         }
     }
 
+    // Memory in a restored heap snapshot stays mapped: a block of it that grows is copied out instead
+    if ((uintptr_t)pointer - (uintptr_t)vm->snapshot < vm->snapshotSize)
+    {
+        if (newSize == 0)
+        {
+            return NULL;
+        }
+
+        void* result = malloc(newSize);
+        if (result == NULL)
+        {
+            exit(EXIT_FAILURE);
+        }
+        memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+        return result;
+    }
+
     if (newSize == 0)
     {
         free(pointer);
@@ -55,19 +74,19 @@ void CollectGarbage()
 {
 #ifdef DEBUG_LOG_GC
     printf("-- gc begin\n");
-    size_t before = vm.bytesAllocated;
+    size_t before = vm->bytesAllocated;
 #endif
 
     MarkRoots();
     TraceReferences();
-    TableRemoveWhite(&vm.strings);
+    TableRemoveWhite(&vm->strings);
     Sweep();
 
-    vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+    vm->nextGC = vm->bytesAllocated * GC_HEAP_GROW_FACTOR;
 
 #ifdef DEBUG_LOG_GC
     printf("-- gc end\n");
-    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n", before - vm.bytesAllocated, before, vm.bytesAllocated, vm.nextGC);
+    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n", before - vm->bytesAllocated, before, vm->bytesAllocated, vm->nextGC);
 #endif
 }
 
@@ -76,24 +95,27 @@ void CollectGarbage()
  */
 static void MarkRoots()
 {
-    for (Value* slot = vm.stack; slot < vm.sp; slot++)
+    for (Value* slot = vm->stack; slot < vm->sp; slot++)
     {
         MarkValue(*slot);
     }
 
-    for (int i = 0; i < vm.frameCount; i++)
+    for (int i = 0; i < vm->frameCount; i++)
     {
-        MarkObject((Object*)vm.frames[i].closure);
+        MarkObject((Object*)vm->frames[i].closure);
     }
 
-    for (ObjectUpvalue* upvalue = vm.openUpvalues; upvalue != NULL; upvalue = upvalue->next)
+    for (ObjectUpvalue* upvalue = vm->openUpvalues; upvalue != NULL; upvalue = upvalue->next)
     {
         MarkObject((Object*)upvalue);
     }
 
-    MarkTable(&vm.globals);
+    MarkTable(&vm->globalSlots);
+    MarkArray(&vm->globalValues);
+    MarkArray(&vm->globalNames);
+    MarkArray(&vm->handles);
     MarkCompilerRoots();
-    MarkObject((Object*)vm.initString);
+    MarkObject((Object*)vm->initString);
 }
 
 /**
@@ -130,30 +152,64 @@ void MarkObject(Object* object)
 
 #ifdef DEBUG_LOG_GC
     printf("%p mark ", (void*)object);
-    PrintValue(OBJECT_VALUE(object));
+    PrintValue(stdout, OBJECT_VALUE(object));
     printf("\n");
 #endif
 
     object->isMarked = true;
 
-    if (vm.grayCapacity < vm.grayCount + 1)
+    if (vm->grayCapacity < vm->grayCount + 1)
     {
-        vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
-        vm.grayStack = (Object**)realloc(vm.grayStack, sizeof(Object*) * vm.grayCapacity);
+        vm->grayCapacity = GROW_CAPACITY(vm->grayCapacity);
+        vm->grayStack = (Object**)realloc(vm->grayStack, sizeof(Object*) * vm->grayCapacity);
 
         // Fail to allocate gray item stack, die
-        if (vm.grayStack == NULL)
+        if (vm->grayStack == NULL)
         {
             exit(EXIT_FAILURE);
         }
     }
 
-    vm.grayStack[vm.grayCount++] = object;
+    vm->grayStack[vm->grayCount++] = object;
+}
+
+void FreezeObject(Object* object)
+{
+    if (object == NULL || object->isMarked)
+    {
+        return;
+    }
+
+    object->isMarked = true;
+    if (object->type == OBJECT_FUNCTION)
+    {
+        ObjectFunction* function = (ObjectFunction*)object;
+        FreezeObject((Object*)function->name);
+        for (int i = 0; i < function->chunk.constants.count; i++)
+        {
+            if (IS_OBJECT(function->chunk.constants.values[i]))
+            {
+                FreezeObject(AS_OBJECT(function->chunk.constants.values[i]));
+            }
+        }
+    }
+}
+
+void FreeLazyBody(ObjectFunction* function)
+{
+    if (function->lazy == NULL)
+    {
+        return;
+    }
+
+    FREE_ARRAY(ObjectString*, function->lazy->upvalueNames, function->upvalueCount);
+    FREE(LazyBody, function->lazy);
+    function->lazy = NULL;
 }
 
 void FreeObjects()
 {
-    Object* object = vm.objects;
+    Object* object = vm->objects;
     while (object != NULL)
     {
         Object* next = object->next;
@@ -161,7 +217,7 @@ void FreeObjects()
         object = next;
     }
 
-    free(vm.grayStack);
+    free(vm->grayStack);
 }
 
 /**
@@ -192,8 +248,20 @@ static void FreeObject(Object* object)
         case OBJECT_INSTANCE:
         {
             ObjectInstance* instance = (ObjectInstance*)object;
-            FreeTable(&instance->fields);
-            FREE(ObjectInstance, object);
+            if (instance->fields != instance->inlineFields)
+            {
+                FREE_ARRAY(Value, instance->fields, instance->fieldCapacity);
+            }
+            FreeTable(&instance->dictionary);
+            Reallocate(object, sizeof(ObjectInstance) + sizeof(Value) * instance->inlineCapacity, 0);
+            break;
+        }
+        case OBJECT_SHAPE:
+        {
+            ObjectShape* shape = (ObjectShape*)object;
+            FreeTable(&shape->indices);
+            FreeTable(&shape->transitions);
+            FREE(ObjectShape, object);
             break;
         }
         case OBJECT_UPVALUE:
@@ -211,6 +279,10 @@ static void FreeObject(Object* object)
         case OBJECT_FUNCTION:
         {
             ObjectFunction* function = (ObjectFunction*)object;
+#ifdef JIT_COMPILER
+            FreeNative(function);
+#endif
+            FreeLazyBody(function);
             FreeChunk(&function->chunk);
             FREE(ObjectFunction, object);
             break;
@@ -221,7 +293,10 @@ static void FreeObject(Object* object)
         case OBJECT_STRING:
         {
             ObjectString* string = (ObjectString*)object;
-            FREE_ARRAY(char, string->chars, string->length + 1);
+            if (!string->isBorrowed)
+            {
+                FREE_ARRAY(char, string->chars, string->length + 1);
+            }
             FREE(ObjectString, object);
             break;
         }
@@ -233,9 +308,9 @@ static void FreeObject(Object* object)
  */
 static void TraceReferences()
 {
-    while (vm.grayCount > 0)
+    while (vm->grayCount > 0)
     {
-        Object* object = vm.grayStack[--vm.grayCount];
+        Object* object = vm->grayStack[--vm->grayCount];
         BlackenObject(object);
     }
 }
@@ -249,7 +324,7 @@ static void BlackenObject(Object* object)
 {
 #ifdef DEBUG_LOG_GC
     printf("%p blacken ", (void*)object);
-    PrintValue(OBJECT_VALUE(object));
+    PrintValue(stdout, OBJECT_VALUE(object));
     printf("\n");
 #endif
 
@@ -267,13 +342,29 @@ static void BlackenObject(Object* object)
             ObjectClass* _class = (ObjectClass*)object;
             MarkObject((Object*)_class->name);
             MarkTable(&_class->methods);
+            MarkObject((Object*)_class->rootShape);
             break;
         }
         case OBJECT_INSTANCE:
         {
             ObjectInstance* instance = (ObjectInstance*)object;
             MarkObject((Object*)instance->_class);
-            MarkTable(&instance->fields);
+            if (instance->shape != NULL)
+            {
+                MarkObject((Object*)instance->shape);
+                for (int i = 0; i < instance->shape->fieldCount; i++)
+                {
+                    MarkValue(instance->fields[i]);
+                }
+            }
+            MarkTable(&instance->dictionary);
+            break;
+        }
+        case OBJECT_SHAPE:
+        {
+            ObjectShape* shape = (ObjectShape*)object;
+            MarkTable(&shape->indices);
+            MarkTable(&shape->transitions);
             break;
         }
         case OBJECT_CLOSURE:
@@ -291,6 +382,36 @@ static void BlackenObject(Object* object)
             ObjectFunction* function = (ObjectFunction*)object;
             MarkObject((Object*)function->name);
             MarkArray(&function->chunk.constants);
+            if (function->lazy != NULL)
+            {
+                MarkObject((Object*)function->lazy->source);
+                for (int i = 0; i < function->upvalueCount; i++)
+                {
+                    MarkObject((Object*)function->lazy->upvalueNames[i]);
+                }
+            }
+
+            // Cached shapes stay alive so a new shape can never reuse a cached address
+            for (int i = 0; i < function->chunk.cacheCount; i++)
+            {
+                InlineCache* cache = &function->chunk.caches[i];
+                MarkObject((Object*)cache->shape);
+                MarkObject((Object*)cache->transition);
+                MarkObject((Object*)cache->method);
+            }
+            for (int i = 0; i < function->chunk.invokeCacheCount; i++)
+            {
+                InvokeCache* cache = &function->chunk.invokeCaches[i];
+                for (int j = 0; j < cache->count; j++)
+                {
+                    MarkObject(cache->entries[j].receiver);
+                    MarkObject((Object*)cache->entries[j].method);
+                }
+            }
+            for (int i = 0; i < function->chunk.callCacheCount; i++)
+            {
+                MarkObject((Object*)function->chunk.callCaches[i].closure);
+            }
             break;
         }
         case OBJECT_UPVALUE:
@@ -308,7 +429,7 @@ static void BlackenObject(Object* object)
 static void Sweep()
 {
     Object* previous = NULL;
-    Object* object = vm.objects;
+    Object* object = vm->objects;
     while (object != NULL)
     {
         if (object->isMarked)
@@ -327,7 +448,7 @@ static void Sweep()
             }
             else
             {
-                vm.objects = object;
+                vm->objects = object;
             }
 
             FreeObject(unreached);
@@ -6,10 +6,13 @@
 #include "value.h"
 #include "vm.h"
 
-static void PrintFunction(ObjectFunction* function);
+static void PrintFunction(FILE* file, ObjectFunction* function);
 static Object* AllocateObject(size_t size, ObjectType type);
 static ObjectString* AllocateString(char* chars, int length, uint32_t hash);
 static uint32_t HashString(const char* key, int length);
+static ObjectShape* AddTransition(ObjectShape* shape, ObjectString* name);
+static void GrowFields(ObjectInstance* instance);
+static void MakeDictionary(ObjectInstance* instance);
 
 /**
  * @brief Allocates an object of a given type.
@@ -28,17 +31,105 @@ ObjectBoundMethod* NewBoundMethod(Value receiver, ObjectClosure* method)
 
 ObjectInstance* NewInstance(ObjectClass* _class)
 {
-    ObjectInstance* instance = ALLOCATE_OBJECT(ObjectInstance, OBJECT_INSTANCE);
+    // Reserve room for as many fields as any instance of the class has needed so far
+    int capacity = _class->fieldCount;
+    ObjectInstance* instance = (ObjectInstance*)AllocateObject(sizeof(ObjectInstance) + sizeof(Value) * capacity,
+                                                               OBJECT_INSTANCE);
     instance->_class = _class;
-    InitTable(&instance->fields);
+    instance->shape = _class->rootShape;
+    instance->fields = instance->inlineFields;
+    instance->fieldCapacity = capacity;
+    instance->inlineCapacity = capacity;
+    InitTable(&instance->dictionary);
     return instance;
 }
 
+bool InstanceGet(ObjectInstance* instance, ObjectString* name, Value* value)
+{
+    if (instance->shape == NULL)
+    {
+        return TableGet(&instance->dictionary, name, value);
+    }
+
+    int index = ShapeFieldIndex(instance->shape, name);
+    if (index == -1)
+    {
+        return false;
+    }
+
+    *value = instance->fields[index];
+    return true;
+}
+
+void InstanceSet(ObjectInstance* instance, ObjectString* name, Value value)
+{
+    ObjectShape* shape = instance->shape;
+    if (shape == NULL)
+    {
+        TableSet(&instance->dictionary, name, value);
+        return;
+    }
+
+    int index = ShapeFieldIndex(shape, name);
+    if (index != -1)
+    {
+        instance->fields[index] = value;
+        return;
+    }
+
+    if (shape->fieldCount == SHAPE_MAX_FIELDS)
+    {
+        MakeDictionary(instance);
+        TableSet(&instance->dictionary, name, value);
+        return;
+    }
+
+    // Follow the transition for the new field, creating it the first time it is taken
+    Value transition;
+    ObjectShape* next = TableGet(&shape->transitions, name, &transition) ? AS_SHAPE(transition)
+                                                                          : AddTransition(shape, name);
+    if (shape->fieldCount == instance->fieldCapacity)
+    {
+        GrowFields(instance);
+    }
+
+    instance->fields[shape->fieldCount] = value;
+    instance->shape = next;
+
+    if (next->fieldCount > instance->_class->fieldCount)
+    {
+        instance->_class->fieldCount = next->fieldCount;
+    }
+}
+
+int ShapeFieldIndex(ObjectShape* shape, ObjectString* name)
+{
+    Value index;
+    return TableGet(&shape->indices, name, &index) ? (int)AS_NUMBER(index) : -1;
+}
+
+ObjectShape* NewShape(int fieldCount)
+{
+    ObjectShape* shape = ALLOCATE_OBJECT(ObjectShape, OBJECT_SHAPE);
+    shape->fieldCount = fieldCount;
+    InitTable(&shape->indices);
+    InitTable(&shape->transitions);
+    return shape;
+}
+
 ObjectClass* NewClass(ObjectString* name)
 {
+    ObjectShape* rootShape = NewShape(0);
+    StackPush(OBJECT_VALUE(rootShape));
+
     ObjectClass* _class = ALLOCATE_OBJECT(ObjectClass, OBJECT_CLASS);
     _class->name = name;
     InitTable(&_class->methods);
+    _class->rootShape = rootShape;
+    _class->fieldCount = 0;
+    _class->methodVersion = 0;
+
+    StackPop();
     return _class;
 }
 
@@ -72,6 +163,12 @@ ObjectFunction* NewFunction()
     function->arity = 0;
     function->upvalueCount = 0;
     function->name = NULL;
+    function->lazy = NULL;
+#ifdef JIT_COMPILER
+    function->callCount = 0;
+    function->jitCode = NULL;
+    function->jitSize = 0;
+#endif
     InitChunk(&function->chunk);
     return function;
 }
@@ -87,7 +184,7 @@ ObjectString* TakeString(char* chars, int length)
 {
     // Check if an equivalent string is already present in memory
     uint32_t hash = HashString(chars, length);
-    ObjectString* interned = TableFindString(&vm.strings, chars, length, hash);
+    ObjectString* interned = TableFindString(&vm->strings, chars, length, hash);
     if (interned != NULL)
     {
         // Get rid of the previous string
@@ -102,7 +199,7 @@ ObjectString* CopyString(const char* chars, int length)
 {
     // Check if an equivalent string is already present in memory
     uint32_t hash = HashString(chars, length);
-    ObjectString* interned = TableFindString(&vm.strings, chars, length, hash);
+    ObjectString* interned = TableFindString(&vm->strings, chars, length, hash);
     if (interned != NULL)
     {
         return interned;
@@ -116,33 +213,61 @@ ObjectString* CopyString(const char* chars, int length)
     return AllocateString(heapChars, length, hash);
 }
 
-void PrintObject(Value value)
+ObjectString* BorrowString(const char* chars, int length)
+{
+    uint32_t hash = HashString(chars, length);
+    ObjectString* interned = TableFindString(&vm->strings, chars, length, hash);
+    if (interned != NULL)
+    {
+        return interned;
+    }
+
+    ObjectString* string = AllocateString((char*)chars, length, hash);
+    string->isBorrowed = true;
+    return string;
+}
+
+Value StringValue(const char* chars, int length)
+{
+#ifdef NAN_BOXING
+    if (length <= SHORT_STRING_MAX)
+    {
+        return ShortStringValue(chars, length);
+    }
+#endif
+    return OBJECT_VALUE(CopyString(chars, length));
+}
+
+void PrintObject(FILE* file, Value value)
 {
     switch(OBJECT_TYPE(value))
     {
         case OBJECT_BOUND_METHOD:
-            PrintFunction(AS_BOUND_METHOD(value)->method->function);
+            PrintFunction(file, AS_BOUND_METHOD(value)->method->function);
             break;
         case OBJECT_CLASS:
-            printf("%s", AS_CLASS(value)->name->chars);
+            fprintf(file, "%s", AS_CLASS(value)->name->chars);
             break;
         case OBJECT_INSTANCE:
-            printf("%s instance", AS_INSTANCE(value)->_class->name->chars);
+            fprintf(file, "%s instance", AS_INSTANCE(value)->_class->name->chars);
+            break;
+        case OBJECT_SHAPE:
+            fprintf(file, "shape");
             break;
         case OBJECT_UPVALUE:
-            printf("upvalue");
+            fprintf(file, "upvalue");
             break;
         case OBJECT_CLOSURE:
-            PrintFunction(AS_CLOSURE(value)->function);
+            PrintFunction(file, AS_CLOSURE(value)->function);
             break;
         case OBJECT_FUNCTION:
-            PrintFunction(AS_FUNCTION(value));
+            PrintFunction(file, AS_FUNCTION(value));
             break;
         case OBJECT_NATIVE:
-            printf("<native fn>");
+            fprintf(file, "<native fn>");
             break;
         case OBJECT_STRING:
-            printf("%s", AS_CSTRING(value));
+            fprintf(file, "%s", AS_CSTRING(value));
             break;
     }
 }
@@ -150,16 +275,17 @@ void PrintObject(Value value)
 /**
  * @brief Prints a function object.
  * 
+ * @param file The stream to print to.
  * @param function An ObjectFunction to print.
  */
-static void PrintFunction(ObjectFunction* function)
+static void PrintFunction(FILE* file, ObjectFunction* function)
 {
     if (function->name == NULL)
     {
-        printf("<script>");
+        fprintf(file, "<script>");
         return;
     }
-    printf("<fn %s>", function->name->chars);
+    fprintf(file, "<fn %s>", function->name->chars);
 }
 
 /**
@@ -175,8 +301,8 @@ static Object* AllocateObject(size_t size, ObjectType type)
 
     object->type = type;
     object->isMarked = false;
-    object->next = vm.objects;
-    vm.objects = object;
+    object->next = vm->objects;
+    vm->objects = object;
 
 #ifdef DEBUG_LOG_GC
     printf("%p allocate %zu for %d\n", (void*)object, size, type);
@@ -197,11 +323,12 @@ static ObjectString* AllocateString(char* chars, int length, uint32_t hash)
     ObjectString* string = ALLOCATE_OBJECT(ObjectString, OBJECT_STRING);
 
     string->length = length;
+    string->isBorrowed = false;
     string->chars = chars;
     string->hash = hash;
 
     StackPush(OBJECT_VALUE(string));
-    TableSet(&vm.strings, string, NIL_VALUE);
+    TableSet(&vm->strings, string, NIL_VALUE);
     StackPop();
 
     return string;
@@ -224,3 +351,71 @@ static uint32_t HashString(const char* key, int length)
     }
     return hash;
 }
+
+/**
+ * @brief Creates the shape reached by adding a field to another shape.
+ * 
+ * @param shape The ObjectShape to extend.
+ * @param name The name of the added field.
+ * @return ObjectShape* A pointer to the new ObjectShape object.
+ */
+static ObjectShape* AddTransition(ObjectShape* shape, ObjectString* name)
+{
+    ObjectShape* next = NewShape(shape->fieldCount + 1);
+    StackPush(OBJECT_VALUE(next));
+
+    TableCopy(&shape->indices, &next->indices);
+    TableSet(&next->indices, name, NUMBER_VALUE(shape->fieldCount));
+    TableSet(&shape->transitions, name, OBJECT_VALUE(next));
+
+    StackPop();
+    return next;
+}
+
+/**
+ * @brief Moves an instance's fields into a larger out-of-line array.
+ * 
+ * @param instance An ObjectInstance whose fields are full.
+ */
+static void GrowFields(ObjectInstance* instance)
+{
+    int capacity = GROW_CAPACITY(instance->fieldCapacity);
+    Value* fields = ALLOCATE(Value, capacity);
+    for (int i = 0; i < instance->shape->fieldCount; i++)
+    {
+        fields[i] = instance->fields[i];
+    }
+
+    if (instance->fields != instance->inlineFields)
+    {
+        FREE_ARRAY(Value, instance->fields, instance->fieldCapacity);
+    }
+    instance->fields = fields;
+    instance->fieldCapacity = capacity;
+}
+
+/**
+ * @brief Switches an instance from its shape to a hash table of its own.
+ * 
+ * @param instance An ObjectInstance with too many fields for a shape.
+ */
+static void MakeDictionary(ObjectInstance* instance)
+{
+    Table* indices = &instance->shape->indices;
+    for (int i = 0; i < indices->capacity; i++)
+    {
+        Entry* entry = &indices->entries[i];
+        if (entry->key != NULL)
+        {
+            TableSet(&instance->dictionary, entry->key, instance->fields[(int)AS_NUMBER(entry->value)]);
+        }
+    }
+
+    if (instance->fields != instance->inlineFields)
+    {
+        FREE_ARRAY(Value, instance->fields, instance->fieldCapacity);
+    }
+    instance->fields = instance->inlineFields;
+    instance->fieldCapacity = instance->inlineCapacity;
+    instance->shape = NULL;
+}
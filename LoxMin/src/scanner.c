@@ -29,7 +29,7 @@ typedef struct
     int line;
 } Scanner;
 
-Scanner scanner;
+THREAD_LOCAL Scanner scanner;
 
 void InitScanner(const char* source)
 {
@@ -38,6 +38,13 @@ void InitScanner(const char* source)
     scanner.line = 1;
 }
 
+void ResumeScanner(const char* start, int line)
+{
+    scanner.start = start;
+    scanner.current = start;
+    scanner.line = line;
+}
+
 Token ScanToken()
 {
     SkipWhitespace();
@@ -0,0 +1,454 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "memory.h"
+#include "object.h"
+#include "serializer.h"
+
+// Every record starts on a word boundary, so line tables can be used in place
+#define WORD_SIZE 4
+// Offset basis of the 64-bit FNV-1a hash that checksums the body of a compiled script file
+#define CHECKSUM_BASIS 14695981039346656037ULL
+
+/**
+ * @brief Enumerates the kinds of constant a compiled script file holds.
+ */
+typedef enum
+{
+    CONSTANT_INTEGER,
+    CONSTANT_NUMBER,
+    CONSTANT_STRING,
+    CONSTANT_SHORT_STRING,
+    CONSTANT_FUNCTION,
+} ConstantKind;
+
+/**
+ * @brief Walks a mapped compiled script file, checking every read against its end.
+ */
+typedef struct
+{
+    const uint8_t* current;
+    const uint8_t* end;
+    bool hadError;
+} Reader;
+
+static const char magic[WORD_SIZE] = {'L', 'O', 'X', 'C'};
+
+static uint64_t HashBytes(uint64_t hash, const void* bytes, size_t size);
+static bool WriteWord(FILE* file, uint32_t word);
+static bool WriteBytes(FILE* file, const void* bytes, size_t size);
+static bool WriteString(FILE* file, const char* chars, int length);
+static bool WriteFunction(FILE* file, ObjectFunction* function);
+static const uint8_t* ReadBytes(Reader* reader, size_t size);
+static uint32_t ReadWord(Reader* reader);
+static const char* ReadChars(Reader* reader, int* length);
+static ObjectString* ReadString(Reader* reader);
+static ObjectFunction* ReadFunction(Reader* reader);
+
+bool SaveScript(const FrozenScript* script, FILE* file)
+{
+    // The body is written to memory first, as the header holds its checksum
+    char* body = NULL;
+    size_t bodySize = 0;
+    FILE* stream = open_memstream(&body, &bodySize);
+    if (stream == NULL)
+    {
+        return false;
+    }
+
+    bool isWritten = WriteWord(stream, (uint32_t)script->globalCount);
+    for (int i = 0; isWritten && i < script->globalCount; i++)
+    {
+        ObjectString* name = AS_STRING(script->heap->globalNames.values[i]);
+        isWritten = WriteString(stream, name->chars, name->length);
+    }
+    isWritten = WriteFunction(stream, script->function) && isWritten;
+    isWritten = fclose(stream) == 0 && isWritten;
+
+    uint64_t checksum = HashBytes(CHECKSUM_BASIS, body, bodySize);
+    isWritten = isWritten &&
+                WriteBytes(file, magic, WORD_SIZE) &&
+                WriteWord(file, LOXC_VERSION) &&
+                WriteWord(file, BYTECODE_VERSION) &&
+                WriteBytes(file, &checksum, sizeof(checksum)) &&
+                fwrite(body, 1, bodySize, file) == bodySize;
+    free(body);
+    return isWritten;
+}
+
+FrozenScript* LoadScript(VM* isolate, const char* path)
+{
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor == -1)
+    {
+        fprintf(isolate->options.errors, "Could not open file \"%s\".\n", path);
+        return NULL;
+    }
+
+    struct stat status;
+    void* mapping = MAP_FAILED;
+    if (fstat(descriptor, &status) == 0 && status.st_size > 0)
+    {
+        mapping = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    }
+    close(descriptor);
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(isolate->options.errors, "Could not read file \"%s\".\n", path);
+        return NULL;
+    }
+
+    FrozenScript* script = LoadMappedScript(isolate, mapping, (size_t)status.st_size);
+    if (script == NULL)
+    {
+        fprintf(isolate->options.errors, "File \"%s\" is not a script this build can run.\n", path);
+    }
+    return script;
+}
+
+FrozenScript* LoadMappedScript(VM* isolate, void* mapping, size_t size)
+{
+    FrozenScript* script = (FrozenScript*)malloc(sizeof(FrozenScript));
+    if (script == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+    script->heap = NewVM(&isolate->options);
+    script->function = NULL;
+    script->mapping = mapping;
+    script->mappingSize = size;
+
+    VM* caller = vm;
+    vm = script->heap;
+
+    Reader reader;
+    reader.current = (const uint8_t*)mapping;
+    reader.end = reader.current + size;
+    reader.hadError = false;
+
+    // A damaged file is turned away before any of it is read, as the bytecode itself is not verified
+    const uint8_t* header = ReadBytes(&reader, WORD_SIZE);
+    uint64_t checksum = 0;
+    if (header != NULL && memcmp(header, magic, WORD_SIZE) == 0 && ReadWord(&reader) == LOXC_VERSION &&
+        ReadWord(&reader) == BYTECODE_VERSION)
+    {
+        const uint8_t* bytes = ReadBytes(&reader, sizeof(checksum));
+        if (bytes != NULL)
+        {
+            memcpy(&checksum, bytes, sizeof(checksum));
+        }
+    }
+    else
+    {
+        reader.hadError = true;
+    }
+    if (!reader.hadError && checksum == HashBytes(CHECKSUM_BASIS, reader.current, (size_t)(reader.end - reader.current)))
+    {
+        // Slots were handed out in this order when the script was compiled, and must be again
+        uint32_t globalCount = ReadWord(&reader);
+        for (uint32_t i = 0; i < globalCount && !reader.hadError; i++)
+        {
+            ObjectString* name = ReadString(&reader);
+            if (name == NULL || GlobalSlot(name) != (int)i)
+            {
+                reader.hadError = true;
+            }
+        }
+
+        if (!reader.hadError)
+        {
+            script->function = ReadFunction(&reader);
+        }
+    }
+
+    script->globalCount = vm->globalNames.count;
+    if (script->function != NULL && !reader.hadError)
+    {
+        FreezeObject((Object*)script->function);
+        for (int i = 0; i < vm->globalNames.count; i++)
+        {
+            FreezeObject(AS_OBJECT(vm->globalNames.values[i]));
+        }
+    }
+
+    vm = caller;
+    if (script->function == NULL || reader.hadError)
+    {
+        FreeFrozenScript(script);
+        return NULL;
+    }
+    return script;
+}
+
+/**
+ * @brief Hashes a run of bytes with 64-bit FNV-1a, continuing from a previous hash.
+ * 
+ * @param hash The hash so far, or CHECKSUM_BASIS to start a new one.
+ * @param bytes The bytes to hash.
+ * @param size The number of bytes.
+ * @return uint64_t The hash including the bytes.
+ */
+static uint64_t HashBytes(uint64_t hash, const void* bytes, size_t size)
+{
+    const uint8_t* current = (const uint8_t*)bytes;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= current[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Writes one word of a compiled script file.
+ * 
+ * @param file The stream to write to.
+ * @param word The word to write.
+ * @return true If the word was written.
+ * @return false If writing failed.
+ */
+static bool WriteWord(FILE* file, uint32_t word)
+{
+    return fwrite(&word, sizeof(word), 1, file) == 1;
+}
+
+/**
+ * @brief Writes a run of bytes, padded up to the next word boundary.
+ * 
+ * @param file The stream to write to.
+ * @param bytes The bytes to write.
+ * @param size The number of bytes.
+ * @return true If the bytes were written.
+ * @return false If writing failed.
+ */
+static bool WriteBytes(FILE* file, const void* bytes, size_t size)
+{
+    static const uint8_t padding[WORD_SIZE] = {0};
+    size_t paddingSize = (WORD_SIZE - size % WORD_SIZE) % WORD_SIZE;
+    return fwrite(bytes, 1, size, file) == size && fwrite(padding, 1, paddingSize, file) == paddingSize;
+}
+
+/**
+ * @brief Writes a string record: its length, then its null-terminated characters.
+ * 
+ * @param file The stream to write to.
+ * @param chars The characters of the string.
+ * @param length The length of the string.
+ * @return true If the string was written.
+ * @return false If writing failed.
+ */
+static bool WriteString(FILE* file, const char* chars, int length)
+{
+    return WriteWord(file, (uint32_t)length) && WriteBytes(file, chars, (size_t)length + 1);
+}
+
+/**
+ * @brief Writes a function record, followed by the records of every function it defines.
+ * 
+ * @param file The stream to write to.
+ * @param function The ObjectFunction to write.
+ * @return true If the function was written.
+ * @return false If writing failed.
+ */
+static bool WriteFunction(FILE* file, ObjectFunction* function)
+{
+    Chunk* chunk = &function->chunk;
+    bool isWritten = WriteWord(file, (uint32_t)function->arity) &&
+                     WriteWord(file, (uint32_t)function->upvalueCount) &&
+                     WriteWord(file, function->name != NULL) &&
+                     (function->name == NULL || WriteString(file, function->name->chars, function->name->length)) &&
+                     WriteWord(file, (uint32_t)chunk->count) &&
+                     WriteBytes(file, chunk->code, (size_t)chunk->count) &&
+                     WriteBytes(file, chunk->lines, sizeof(int) * chunk->count) &&
+                     WriteWord(file, (uint32_t)chunk->constants.count);
+
+    for (int i = 0; isWritten && i < chunk->constants.count; i++)
+    {
+        Value constant = chunk->constants.values[i];
+        if (IS_STRING(constant))
+        {
+            // Names are heap strings whatever their length, while literals short enough are packed
+            char buffer[SHORT_STRING_MAX + 1];
+            int length;
+            const char* chars = StringChars(constant, buffer, &length);
+            isWritten = WriteWord(file, IS_SHORT_STRING(constant) ? CONSTANT_SHORT_STRING : CONSTANT_STRING) &&
+                        WriteString(file, chars, length);
+        }
+        else if (IS_FUNCTION(constant))
+        {
+            isWritten = WriteWord(file, CONSTANT_FUNCTION) && WriteFunction(file, AS_FUNCTION(constant));
+        }
+        else if (IS_INTEGER(constant))
+        {
+            isWritten = WriteWord(file, CONSTANT_INTEGER) && WriteWord(file, (uint32_t)AS_INTEGER(constant));
+        }
+        else
+        {
+            double number = AS_NUMBER(constant);
+            isWritten = WriteWord(file, CONSTANT_NUMBER) && WriteBytes(file, &number, sizeof(number));
+        }
+    }
+
+    return isWritten;
+}
+
+/**
+ * @brief Reads a run of bytes in place, skipping the padding after it.
+ * 
+ * @param reader The Reader to read from.
+ * @param size The number of bytes.
+ * @return const uint8_t* The bytes within the mapped file, or NULL if the file ends first.
+ */
+static const uint8_t* ReadBytes(Reader* reader, size_t size)
+{
+    size_t paddedSize = size + (WORD_SIZE - size % WORD_SIZE) % WORD_SIZE;
+    if (reader->hadError || paddedSize > (size_t)(reader->end - reader->current))
+    {
+        reader->hadError = true;
+        return NULL;
+    }
+
+    const uint8_t* bytes = reader->current;
+    reader->current += paddedSize;
+    return bytes;
+}
+
+/**
+ * @brief Reads one word.
+ * 
+ * @param reader The Reader to read from.
+ * @return uint32_t The word, or 0 if the file ends first.
+ */
+static uint32_t ReadWord(Reader* reader)
+{
+    uint32_t word = 0;
+    const uint8_t* bytes = ReadBytes(reader, sizeof(word));
+    if (bytes != NULL)
+    {
+        memcpy(&word, bytes, sizeof(word));
+    }
+    return word;
+}
+
+/**
+ * @brief Reads a string record in place.
+ * 
+ * @param reader The Reader to read from.
+ * @param length The resulting length of the string.
+ * @return const char* The null-terminated characters within the mapped file, or NULL if the record is malformed.
+ */
+static const char* ReadChars(Reader* reader, int* length)
+{
+    uint32_t size = ReadWord(reader);
+    const uint8_t* chars = size < INT32_MAX ? ReadBytes(reader, (size_t)size + 1) : NULL;
+    if (chars == NULL || chars[size] != '\0')
+    {
+        reader->hadError = true;
+        return NULL;
+    }
+
+    *length = (int)size;
+    return (const char*)chars;
+}
+
+/**
+ * @brief Reads a string record, interning the string with its characters left in the mapped file.
+ * 
+ * @param reader The Reader to read from.
+ * @return ObjectString* The string, or NULL if the record is malformed.
+ */
+static ObjectString* ReadString(Reader* reader)
+{
+    int length;
+    const char* chars = ReadChars(reader, &length);
+    return chars != NULL ? BorrowString(chars, length) : NULL;
+}
+
+/**
+ * @brief Reads a function record and every function it defines.
+ * 
+ * @param reader The Reader to read from.
+ * @return ObjectFunction* The function, or NULL if the record is malformed.
+ */
+static ObjectFunction* ReadFunction(Reader* reader)
+{
+    ObjectFunction* function = NewFunction();
+    StackPush(OBJECT_VALUE(function));
+    function->arity = (int)ReadWord(reader);
+    function->upvalueCount = (int)ReadWord(reader);
+    if (ReadWord(reader))
+    {
+        function->name = ReadString(reader);
+    }
+
+    Chunk* chunk = &function->chunk;
+    uint32_t count = ReadWord(reader);
+    const uint8_t* code = count <= INT32_MAX / sizeof(int) ? ReadBytes(reader, count) : NULL;
+    const uint8_t* lines = code != NULL ? ReadBytes(reader, sizeof(int) * count) : NULL;
+    if (lines == NULL || count == 0)
+    {
+        reader->hadError = true;
+    }
+    else
+    {
+        chunk->count = (int)count;
+        chunk->capacity = (int)count;
+        chunk->code = (uint8_t*)code;
+        chunk->lines = (int*)lines;
+        chunk->isBorrowed = true;
+    }
+
+    uint32_t constantCount = ReadWord(reader);
+    for (uint32_t i = 0; i < constantCount && !reader->hadError; i++)
+    {
+        Value constant = NIL_VALUE;
+        switch (ReadWord(reader))
+        {
+            case CONSTANT_INTEGER:
+                constant = INTEGER_VALUE((int32_t)ReadWord(reader));
+                break;
+            case CONSTANT_NUMBER:
+            {
+                double number = 0;
+                const uint8_t* bytes = ReadBytes(reader, sizeof(number));
+                if (bytes != NULL)
+                {
+                    memcpy(&number, bytes, sizeof(number));
+                }
+                constant = NUMBER_VALUE(number);
+                break;
+            }
+            case CONSTANT_STRING:
+            {
+                ObjectString* string = ReadString(reader);
+                constant = string != NULL ? OBJECT_VALUE(string) : NIL_VALUE;
+                break;
+            }
+            case CONSTANT_SHORT_STRING:
+            {
+                // Packed again where the build packs strings at all
+                int length;
+                const char* chars = ReadChars(reader, &length);
+                constant = chars != NULL ? StringValue(chars, length) : NIL_VALUE;
+                break;
+            }
+            case CONSTANT_FUNCTION:
+            {
+                ObjectFunction* nested = ReadFunction(reader);
+                constant = nested != NULL ? OBJECT_VALUE(nested) : NIL_VALUE;
+                break;
+            }
+            default:
+                reader->hadError = true;
+                break;
+        }
+        AddConstant(chunk, constant);
+    }
+
+    StackPop();
+    return reader->hadError ? NULL : function;
+}
@@ -0,0 +1,952 @@
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+#include "snapshot.h"
+#include "table.h"
+
+// Every block of an image starts on a boundary fit for any of its fields
+#define BLOCK_ALIGNMENT 8
+// Starting value of a 64-bit FNV-1a hash
+#define HASH_BASIS 14695981039346656037ULL
+
+#ifdef NAN_BOXING
+// The tag bits of a boxed pointer sit above any address, so relocating adds to the whole Value
+#define VALUE_POINTER_OFFSET 0
+#define POINTER_BITS(word) ((word) & ~(SIGN_BIT | QNAN))
+#else
+#define VALUE_POINTER_OFFSET offsetof(Value, as)
+#define POINTER_BITS(word) (word)
+#endif
+
+/**
+ * @brief Starts a snapshot file, which goes on with the image, its relocations and its natives.
+ */
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    // Fingerprint of how the writing build lays out objects, which the restoring build must share
+    uint64_t layout;
+    uint64_t imageSize;
+    uint64_t relocationCount;
+    uint64_t nativeCount;
+    // Bytes the heap accounts for once the image is part of it
+    uint64_t heapBytes;
+    // FNV-1a hash of everything following the header, so that a damaged snapshot is never restored
+    uint64_t checksum;
+} SnapshotHeader;
+
+/**
+ * @brief Holds the roots of a heap, at the start of its image.
+ */
+typedef struct
+{
+    Table globalSlots;
+    ValueArray globalValues;
+    ValueArray globalNames;
+    Table strings;
+    ObjectString* initString;
+    Object* objects;
+} SnapshotRoots;
+
+/**
+ * @brief Names the global a native of the image is defined as, for the restoring VM to supply its function.
+ */
+typedef struct
+{
+    uint64_t native;
+    uint64_t name;
+} SnapshotNative;
+
+/**
+ * @brief Builds the image of a heap, in which every pointer is an offset from the start of the image.
+ */
+typedef struct
+{
+    uint8_t* bytes;
+    size_t count;
+    size_t capacity;
+
+    // Offsets of the words holding pointers, which restoring adds the address of the image to
+    uint64_t* relocations;
+    size_t relocationCount;
+    size_t relocationCapacity;
+    SnapshotNative* natives;
+    size_t nativeCount;
+    size_t nativeCapacity;
+
+    // Where each object is placed in the image, keyed by its address with open addressing
+    Object** placed;
+    size_t* offsets;
+    size_t placedCapacity;
+
+    size_t heapBytes;
+    const char* error;
+} Image;
+
+static void* GrowBuffer(void* buffer, size_t* capacity, size_t needed, size_t size);
+static size_t Reserve(Image* image, size_t size);
+static size_t HashPointer(Object* object, size_t capacity);
+static void PlaceObject(Image* image, Object* object);
+static bool FindObject(Image* image, Object* object, size_t* offset);
+static size_t ObjectSize(Object* object);
+static void AddRelocation(Image* image, size_t at);
+static void WritePointer(Image* image, size_t at, size_t target);
+static void WriteObject(Image* image, size_t at, Object* object);
+static void WriteValue(Image* image, size_t at, Value value);
+static size_t WriteValues(Image* image, const Value* values, int count, int capacity);
+static void WriteArray(Image* image, size_t at, const ValueArray* array);
+static void WriteTable(Image* image, size_t at, const Table* table);
+static void WriteFunction(Image* image, size_t at, ObjectFunction* function);
+static void WriteInstance(Image* image, size_t at, ObjectInstance* instance);
+static void CopyObject(Image* image, Object* object);
+static void FreeImage(Image* image);
+static bool WriteSnapshot(Image* image, const char* path);
+static uint64_t HashBytes(uint64_t hash, const void* bytes, size_t size);
+static uint64_t LayoutFingerprint();
+static bool RelocateImage(uint8_t* image, const SnapshotHeader* header, const uint64_t* relocations,
+                          const SnapshotNative* natives);
+static const char* BindNatives(VM* isolate, uint8_t* image, const SnapshotHeader* header,
+                               const SnapshotNative* natives);
+
+bool SaveSnapshot(VM* isolate, const char* path)
+{
+    VM* caller = vm;
+    vm = isolate;
+
+    if (vm->frameCount > 0)
+    {
+        fprintf(vm->options.errors, "Cannot snapshot a VM that is running code.\n");
+        vm = caller;
+        return false;
+    }
+    CollectGarbage();
+
+    Image image;
+    memset(&image, 0, sizeof(Image));
+    size_t objectCount = 0;
+    for (Object* object = vm->objects; object != NULL; object = object->next)
+    {
+        objectCount++;
+    }
+    image.placedCapacity = 16;
+    while (image.placedCapacity < objectCount * 2)
+    {
+        image.placedCapacity *= 2;
+    }
+    image.placed = (Object**)calloc(image.placedCapacity, sizeof(Object*));
+    image.offsets = (size_t*)malloc(sizeof(size_t) * image.placedCapacity);
+    if (image.placed == NULL || image.offsets == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // Place every object first, so any pointer between them can be translated while copying
+    size_t roots = Reserve(&image, sizeof(SnapshotRoots));
+    for (Object* object = vm->objects; object != NULL; object = object->next)
+    {
+        PlaceObject(&image, object);
+    }
+    for (Object* object = vm->objects; object != NULL; object = object->next)
+    {
+        CopyObject(&image, object);
+    }
+
+    WriteTable(&image, roots + offsetof(SnapshotRoots, globalSlots), &vm->globalSlots);
+    WriteArray(&image, roots + offsetof(SnapshotRoots, globalValues), &vm->globalValues);
+    WriteArray(&image, roots + offsetof(SnapshotRoots, globalNames), &vm->globalNames);
+    WriteTable(&image, roots + offsetof(SnapshotRoots, strings), &vm->strings);
+    WriteObject(&image, roots + offsetof(SnapshotRoots, initString), (Object*)vm->initString);
+    WriteObject(&image, roots + offsetof(SnapshotRoots, objects), vm->objects);
+    Reserve(&image, 0);
+
+    bool isSaved = false;
+    if (image.error != NULL)
+    {
+        fprintf(vm->options.errors, "%s\n", image.error);
+    }
+    else if (!WriteSnapshot(&image, path))
+    {
+        fprintf(vm->options.errors, "Could not write file \"%s\".\n", path);
+    }
+    else
+    {
+        isSaved = true;
+    }
+
+    FreeImage(&image);
+    vm = caller;
+    return isSaved;
+}
+
+bool RestoreSnapshot(VM* isolate, const char* path)
+{
+    FILE* errors = isolate->options.errors;
+    if (isolate->snapshot != NULL)
+    {
+        fprintf(errors, "A VM can only restore one heap snapshot.\n");
+        return false;
+    }
+
+    int file = open(path, O_RDONLY);
+    if (file == -1)
+    {
+        fprintf(errors, "Could not open file \"%s\".\n", path);
+        return false;
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0 || status.st_size < (off_t)sizeof(SnapshotHeader))
+    {
+        fprintf(errors, "File \"%s\" is not a heap snapshot this build can restore.\n", path);
+        close(file);
+        return false;
+    }
+
+    // A private mapping lets relocation write to the image without touching the file; relocation writes to
+    // nearly every page, so they are all faulted in at once
+    size_t size = (size_t)status.st_size;
+    uint8_t* mapping = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(errors, "Could not read file \"%s\".\n", path);
+        return false;
+    }
+
+    SnapshotHeader header;
+    memcpy(&header, mapping, sizeof(SnapshotHeader));
+    size_t available = size - sizeof(SnapshotHeader);
+    bool isValid = memcmp(header.magic, "LOXH", 4) == 0 && header.version == SNAPSHOT_VERSION &&
+                   header.layout == LayoutFingerprint() &&
+                   header.imageSize >= sizeof(SnapshotRoots) && header.imageSize % BLOCK_ALIGNMENT == 0 &&
+                   header.imageSize <= available &&
+                   header.relocationCount <= (available - header.imageSize) / sizeof(uint64_t) &&
+                   header.nativeCount <= (available - header.imageSize) / sizeof(SnapshotNative) &&
+                   header.imageSize + header.relocationCount * sizeof(uint64_t) +
+                           header.nativeCount * sizeof(SnapshotNative) == available &&
+                   header.checksum == HashBytes(HASH_BASIS, mapping + sizeof(SnapshotHeader), available);
+
+    uint8_t* image = mapping + sizeof(SnapshotHeader);
+    const uint64_t* relocations = (const uint64_t*)(image + header.imageSize);
+    const SnapshotNative* natives = (const SnapshotNative*)(relocations + header.relocationCount);
+    if (!isValid || !RelocateImage(image, &header, relocations, natives))
+    {
+        fprintf(errors, "File \"%s\" is not a heap snapshot this build can restore.\n", path);
+        munmap(mapping, size);
+        return false;
+    }
+
+    const char* missing = BindNatives(isolate, image, &header, natives);
+    if (missing != NULL)
+    {
+        fprintf(errors, "Heap snapshot \"%s\" needs the native '%s', which is not defined.\n", path, missing);
+        munmap(mapping, size);
+        return false;
+    }
+
+    VM* caller = vm;
+    vm = isolate;
+
+    // Threaded code holds addresses of this process, so each function is threaded from its bytecode on its
+    // first call, like one whose body is yet to be compiled
+    SnapshotRoots* roots = (SnapshotRoots*)image;
+    Object* last = NULL;
+    for (Object* object = roots->objects; object != NULL; object = object->next)
+    {
+        if (object->type == OBJECT_FUNCTION)
+        {
+            ((ObjectFunction*)object)->chunk.stackSize = STACK_SIZE_LAZY;
+        }
+        last = object;
+    }
+
+    // The VM's own objects stay in its heap, where the next collection frees whatever the image replaced
+    FreeTable(&vm->globalSlots);
+    FreeValueArray(&vm->globalValues);
+    FreeValueArray(&vm->globalNames);
+    FreeTable(&vm->strings);
+    vm->globalSlots = roots->globalSlots;
+    vm->globalValues = roots->globalValues;
+    vm->globalNames = roots->globalNames;
+    vm->strings = roots->strings;
+    vm->initString = roots->initString;
+    if (last != NULL)
+    {
+        last->next = vm->objects;
+        vm->objects = roots->objects;
+    }
+
+    vm->snapshot = mapping;
+    vm->snapshotSize = size;
+    vm->bytesAllocated += header.heapBytes;
+
+    vm = caller;
+    return true;
+}
+
+/**
+ * @brief Grows a malloc'd buffer to hold at least a number of elements.
+ *
+ * @param buffer The buffer, or NULL.
+ * @param capacity The number of elements the buffer holds, updated to its new capacity.
+ * @param needed The number of elements it must hold.
+ * @param size The size of one element.
+ * @return void* The buffer, which may have moved.
+ */
+static void* GrowBuffer(void* buffer, size_t* capacity, size_t needed, size_t size)
+{
+    if (needed <= *capacity)
+    {
+        return buffer;
+    }
+
+    size_t grown = *capacity < 256 ? 256 : *capacity * 2;
+    while (grown < needed)
+    {
+        grown *= 2;
+    }
+    buffer = realloc(buffer, grown * size);
+    if (buffer == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+    *capacity = grown;
+    return buffer;
+}
+
+/**
+ * @brief Appends a zeroed block to an image.
+ *
+ * @param image The Image to append to.
+ * @param size The size of the block in bytes.
+ * @return size_t The offset of the block, aligned to BLOCK_ALIGNMENT.
+ */
+static size_t Reserve(Image* image, size_t size)
+{
+    size_t offset = (image->count + BLOCK_ALIGNMENT - 1) & ~(size_t)(BLOCK_ALIGNMENT - 1);
+    image->bytes = (uint8_t*)GrowBuffer(image->bytes, &image->capacity, offset + size, sizeof(uint8_t));
+    memset(image->bytes + image->count, 0, offset + size - image->count);
+    image->count = offset + size;
+    return offset;
+}
+
+/**
+ * @brief Hashes the address of an object.
+ *
+ * @param object The Object.
+ * @param capacity The capacity of the table, a power of two.
+ * @return size_t The slot to start probing at.
+ */
+static size_t HashPointer(Object* object, size_t capacity)
+{
+    return (size_t)(((uint64_t)(uintptr_t)object >> 3) * 11400714819323198485ull) & (capacity - 1);
+}
+
+/**
+ * @brief Reserves the block of an object and records where it went.
+ *
+ * @param image The Image to place the object in.
+ * @param object The Object.
+ */
+static void PlaceObject(Image* image, Object* object)
+{
+    size_t index = HashPointer(object, image->placedCapacity);
+    while (image->placed[index] != NULL)
+    {
+        index = (index + 1) & (image->placedCapacity - 1);
+    }
+    // A string's characters follow it in the same block
+    size_t size = ObjectSize(object);
+    if (object->type == OBJECT_STRING)
+    {
+        size += ((ObjectString*)object)->length + 1;
+    }
+    image->placed[index] = object;
+    image->offsets[index] = Reserve(image, size);
+}
+
+/**
+ * @brief Finds where an object was placed in an image.
+ *
+ * @param image The Image.
+ * @param object The Object to look for.
+ * @param offset Set to the offset of the object's block.
+ * @return true If the object is in the image.
+ * @return false If the object belongs to no heap the image holds.
+ */
+static bool FindObject(Image* image, Object* object, size_t* offset)
+{
+    size_t index = HashPointer(object, image->placedCapacity);
+    while (image->placed[index] != NULL)
+    {
+        if (image->placed[index] == object)
+        {
+            *offset = image->offsets[index];
+            return true;
+        }
+        index = (index + 1) & (image->placedCapacity - 1);
+    }
+    return false;
+}
+
+/**
+ * @brief Works out the size of an object, an instance's inline fields included.
+ *
+ * @param object The Object.
+ * @return size_t The size of the object in bytes.
+ */
+static size_t ObjectSize(Object* object)
+{
+    switch (object->type)
+    {
+        case OBJECT_BOUND_METHOD:
+            return sizeof(ObjectBoundMethod);
+        case OBJECT_CLASS:
+            return sizeof(ObjectClass);
+        case OBJECT_INSTANCE:
+            return sizeof(ObjectInstance) + sizeof(Value) * ((ObjectInstance*)object)->inlineCapacity;
+        case OBJECT_SHAPE:
+            return sizeof(ObjectShape);
+        case OBJECT_UPVALUE:
+            return sizeof(ObjectUpvalue);
+        case OBJECT_CLOSURE:
+            return sizeof(ObjectClosure);
+        case OBJECT_FUNCTION:
+            return sizeof(ObjectFunction);
+        case OBJECT_NATIVE:
+            return sizeof(ObjectNative);
+        case OBJECT_STRING:
+            return sizeof(ObjectString);
+    }
+    return 0;
+}
+
+/**
+ * @brief Records that a word of an image holds a pointer to relocate.
+ *
+ * @param image The Image.
+ * @param at The offset of the word.
+ */
+static void AddRelocation(Image* image, size_t at)
+{
+    image->relocations = (uint64_t*)GrowBuffer(image->relocations, &image->relocationCapacity,
+                                               image->relocationCount + 1, sizeof(uint64_t));
+    image->relocations[image->relocationCount++] = at;
+}
+
+/**
+ * @brief Writes a pointer into an image as the offset it points to.
+ *
+ * @param image The Image.
+ * @param at The offset to write the pointer to.
+ * @param target The offset of what it points to.
+ */
+static void WritePointer(Image* image, size_t at, size_t target)
+{
+    uintptr_t word = target;
+    memcpy(image->bytes + at, &word, sizeof(uintptr_t));
+    AddRelocation(image, at);
+}
+
+/**
+ * @brief Writes a pointer to an object into an image.
+ *
+ * @param image The Image.
+ * @param at The offset to write the pointer to.
+ * @param object The Object pointed to, or NULL.
+ */
+static void WriteObject(Image* image, size_t at, Object* object)
+{
+    size_t offset;
+    if (object == NULL)
+    {
+        memset(image->bytes + at, 0, sizeof(Object*));
+    }
+    else if (FindObject(image, object, &offset))
+    {
+        WritePointer(image, at, offset);
+    }
+    else
+    {
+        image->error = "Cannot snapshot a heap that refers to objects outside of it, such as a frozen script's.";
+    }
+}
+
+/**
+ * @brief Writes a Value into an image, translating any object it holds.
+ *
+ * @param image The Image.
+ * @param at The offset to write the Value to.
+ * @param value The Value.
+ */
+static void WriteValue(Image* image, size_t at, Value value)
+{
+    if (IS_OBJECT(value))
+    {
+        size_t offset;
+        if (!FindObject(image, AS_OBJECT(value), &offset))
+        {
+            image->error = "Cannot snapshot a heap that refers to objects outside of it, such as a frozen script's.";
+            return;
+        }
+        value = OBJECT_VALUE((Object*)(uintptr_t)offset);
+        AddRelocation(image, at + VALUE_POINTER_OFFSET);
+    }
+    memcpy(image->bytes + at, &value, sizeof(Value));
+}
+
+/**
+ * @brief Appends an array of Values to an image, filling its unused slots with nil.
+ *
+ * @param image The Image.
+ * @param values The Values.
+ * @param count The number of Values in use.
+ * @param capacity The number of Values the array holds.
+ * @return size_t The offset of the array.
+ */
+static size_t WriteValues(Image* image, const Value* values, int count, int capacity)
+{
+    size_t offset = Reserve(image, sizeof(Value) * capacity);
+    for (int i = 0; i < capacity; i++)
+    {
+        WriteValue(image, offset + sizeof(Value) * i, i < count ? values[i] : NIL_VALUE);
+    }
+    image->heapBytes += sizeof(Value) * capacity;
+    return offset;
+}
+
+/**
+ * @brief Writes a ValueArray into an image, trimmed to the Values it holds.
+ *
+ * @param image The Image.
+ * @param at The offset to write the ValueArray to.
+ * @param array The ValueArray.
+ */
+static void WriteArray(Image* image, size_t at, const ValueArray* array)
+{
+    ValueArray copy;
+    InitValueArray(&copy);
+    copy.count = array->count;
+    copy.capacity = array->count;
+    memcpy(image->bytes + at, &copy, sizeof(ValueArray));
+    if (array->count > 0)
+    {
+        size_t values = WriteValues(image, array->values, array->count, array->count);
+        WritePointer(image, at + offsetof(ValueArray, values), values);
+    }
+}
+
+/**
+ * @brief Writes a Table into an image, keeping its capacity so every entry stays in its slot.
+ *
+ * @param image The Image.
+ * @param at The offset to write the Table to.
+ * @param table The Table.
+ */
+static void WriteTable(Image* image, size_t at, const Table* table)
+{
+    Table copy = *table;
+    copy.entries = NULL;
+    memcpy(image->bytes + at, &copy, sizeof(Table));
+    if (table->capacity == 0)
+    {
+        return;
+    }
+
+    size_t entries = Reserve(image, sizeof(Entry) * table->capacity);
+    for (int i = 0; i < table->capacity; i++)
+    {
+        size_t entry = entries + sizeof(Entry) * i;
+        WriteObject(image, entry + offsetof(Entry, key), (Object*)table->entries[i].key);
+        WriteValue(image, entry + offsetof(Entry, value), table->entries[i].value);
+    }
+    image->heapBytes += sizeof(Entry) * table->capacity;
+    WritePointer(image, at + offsetof(Table, entries), entries);
+}
+
+/**
+ * @brief Writes a function into an image with its bytecode only, leaving out everything built to run it.
+ *
+ * @param image The Image.
+ * @param at The offset of the function's block.
+ * @param function The ObjectFunction.
+ */
+static void WriteFunction(Image* image, size_t at, ObjectFunction* function)
+{
+    Chunk* chunk = &function->chunk;
+    ObjectFunction copy = *function;
+    InitChunk(&copy.chunk);
+    copy.chunk.count = chunk->count;
+    copy.chunk.capacity = chunk->count;
+#ifdef JIT_COMPILER
+    copy.callCount = 0;
+    copy.jitCode = NULL;
+    copy.jitSize = 0;
+#endif
+    // Keep the header CopyObject() already translated
+    memcpy(&copy.obj, image->bytes + at, sizeof(Object));
+    memcpy(image->bytes + at, &copy, sizeof(ObjectFunction));
+
+    size_t chunkAt = at + offsetof(ObjectFunction, chunk);
+    WriteObject(image, at + offsetof(ObjectFunction, name), (Object*)function->name);
+    WriteArray(image, chunkAt + offsetof(Chunk, constants), &chunk->constants);
+    if (chunk->count > 0)
+    {
+        size_t code = Reserve(image, chunk->count);
+        memcpy(image->bytes + code, chunk->code, chunk->count);
+        WritePointer(image, chunkAt + offsetof(Chunk, code), code);
+
+        size_t lines = Reserve(image, sizeof(int) * chunk->count);
+        memcpy(image->bytes + lines, chunk->lines, sizeof(int) * chunk->count);
+        WritePointer(image, chunkAt + offsetof(Chunk, lines), lines);
+        image->heapBytes += (sizeof(uint8_t) + sizeof(int)) * chunk->count;
+    }
+
+    LazyBody* lazy = function->lazy;
+    if (lazy == NULL)
+    {
+        return;
+    }
+
+    // The body keeps pointing into its source, whose characters follow the string in the image
+    size_t body = Reserve(image, sizeof(LazyBody));
+    size_t source;
+    LazyBody bodyCopy = *lazy;
+    bodyCopy.upvalueNames = NULL;
+    memcpy(image->bytes + body, &bodyCopy, sizeof(LazyBody));
+    if (!FindObject(image, (Object*)lazy->source, &source))
+    {
+        image->error = "Cannot snapshot a heap that refers to objects outside of it, such as a frozen script's.";
+        return;
+    }
+    WritePointer(image, body + offsetof(LazyBody, source), source);
+    WritePointer(image, body + offsetof(LazyBody, start),
+                 source + sizeof(ObjectString) + (size_t)(lazy->start - lazy->source->chars));
+    if (function->upvalueCount > 0)
+    {
+        size_t names = Reserve(image, sizeof(ObjectString*) * function->upvalueCount);
+        for (int i = 0; i < function->upvalueCount; i++)
+        {
+            WriteObject(image, names + sizeof(ObjectString*) * i, (Object*)lazy->upvalueNames[i]);
+        }
+        WritePointer(image, body + offsetof(LazyBody, upvalueNames), names);
+    }
+    image->heapBytes += sizeof(LazyBody) + sizeof(ObjectString*) * function->upvalueCount;
+    WritePointer(image, at + offsetof(ObjectFunction, lazy), body);
+}
+
+/**
+ * @brief Writes an instance into an image, keeping inline fields inline and the rest out of line.
+ *
+ * @param image The Image.
+ * @param at The offset of the instance's block.
+ * @param instance The ObjectInstance.
+ */
+static void WriteInstance(Image* image, size_t at, ObjectInstance* instance)
+{
+    int fieldCount = instance->shape != NULL ? instance->shape->fieldCount : 0;
+    // Out-of-line fields always hold more than the inline ones, and may sit right after an instance with none
+    bool isInline = instance->fieldCapacity == instance->inlineCapacity;
+    size_t inlineFields = at + offsetof(ObjectInstance, inlineFields);
+    for (int i = 0; i < instance->inlineCapacity; i++)
+    {
+        WriteValue(image, inlineFields + sizeof(Value) * i,
+                   isInline && i < fieldCount ? instance->fields[i] : NIL_VALUE);
+    }
+
+    WriteObject(image, at + offsetof(ObjectInstance, _class), (Object*)instance->_class);
+    WriteObject(image, at + offsetof(ObjectInstance, shape), (Object*)instance->shape);
+    WriteTable(image, at + offsetof(ObjectInstance, dictionary), &instance->dictionary);
+    size_t fields = isInline ? inlineFields
+                             : WriteValues(image, instance->fields, fieldCount, instance->fieldCapacity);
+    WritePointer(image, at + offsetof(ObjectInstance, fields), fields);
+}
+
+/**
+ * @brief Copies an object into the block placed for it, translating every pointer it holds.
+ *
+ * @param image The Image.
+ * @param object The Object.
+ */
+static void CopyObject(Image* image, Object* object)
+{
+    size_t at = 0;
+    FindObject(image, object, &at);
+    size_t size = ObjectSize(object);
+    memcpy(image->bytes + at, object, size);
+    ((Object*)(image->bytes + at))->isMarked = false;
+    WriteObject(image, at + offsetof(Object, next), object->next);
+    image->heapBytes += size;
+
+    switch (object->type)
+    {
+        case OBJECT_BOUND_METHOD:
+        {
+            ObjectBoundMethod* bound = (ObjectBoundMethod*)object;
+            WriteValue(image, at + offsetof(ObjectBoundMethod, receiver), bound->receiver);
+            WriteObject(image, at + offsetof(ObjectBoundMethod, method), (Object*)bound->method);
+            break;
+        }
+        case OBJECT_CLASS:
+        {
+            ObjectClass* _class = (ObjectClass*)object;
+            WriteObject(image, at + offsetof(ObjectClass, name), (Object*)_class->name);
+            WriteTable(image, at + offsetof(ObjectClass, methods), &_class->methods);
+            WriteObject(image, at + offsetof(ObjectClass, rootShape), (Object*)_class->rootShape);
+            break;
+        }
+        case OBJECT_INSTANCE:
+            WriteInstance(image, at, (ObjectInstance*)object);
+            break;
+        case OBJECT_SHAPE:
+        {
+            ObjectShape* shape = (ObjectShape*)object;
+            WriteTable(image, at + offsetof(ObjectShape, indices), &shape->indices);
+            WriteTable(image, at + offsetof(ObjectShape, transitions), &shape->transitions);
+            break;
+        }
+        case OBJECT_UPVALUE:
+        {
+            // An idle VM has closed every upvalue, so each points at its own value
+            ObjectUpvalue* upvalue = (ObjectUpvalue*)object;
+            WritePointer(image, at + offsetof(ObjectUpvalue, location), at + offsetof(ObjectUpvalue, closed));
+            WriteValue(image, at + offsetof(ObjectUpvalue, closed), upvalue->closed);
+            WriteObject(image, at + offsetof(ObjectUpvalue, next), NULL);
+            break;
+        }
+        case OBJECT_CLOSURE:
+        {
+            ObjectClosure* closure = (ObjectClosure*)object;
+            WriteObject(image, at + offsetof(ObjectClosure, function), (Object*)closure->function);
+            WriteObject(image, at + offsetof(ObjectClosure, upvalues), NULL);
+            if (closure->upvalueCount > 0)
+            {
+                size_t upvalues = Reserve(image, sizeof(ObjectUpvalue*) * closure->upvalueCount);
+                for (int i = 0; i < closure->upvalueCount; i++)
+                {
+                    WriteObject(image, upvalues + sizeof(ObjectUpvalue*) * i, (Object*)closure->upvalues[i]);
+                }
+                image->heapBytes += sizeof(ObjectUpvalue*) * closure->upvalueCount;
+                WritePointer(image, at + offsetof(ObjectClosure, upvalues), upvalues);
+            }
+            break;
+        }
+        case OBJECT_FUNCTION:
+            WriteFunction(image, at, (ObjectFunction*)object);
+            break;
+        case OBJECT_NATIVE:
+        {
+            // A native's function is an address of this process, so the image names the global it is instead
+            memset(image->bytes + at + offsetof(ObjectNative, function), 0, sizeof(NativeFn));
+            size_t name;
+            int slot = 0;
+            while (slot < vm->globalValues.count && !(IS_OBJECT(vm->globalValues.values[slot]) &&
+                                                      AS_OBJECT(vm->globalValues.values[slot]) == object))
+            {
+                slot++;
+            }
+            if (slot == vm->globalValues.count ||
+                !FindObject(image, AS_OBJECT(vm->globalNames.values[slot]), &name))
+            {
+                image->error = "Cannot snapshot a native function that is not defined as a global.";
+                break;
+            }
+            image->natives = (SnapshotNative*)GrowBuffer(image->natives, &image->nativeCapacity,
+                                                         image->nativeCount + 1, sizeof(SnapshotNative));
+            image->natives[image->nativeCount].native = at;
+            image->natives[image->nativeCount].name = name;
+            image->nativeCount++;
+            break;
+        }
+        case OBJECT_STRING:
+        {
+            ObjectString* string = (ObjectString*)object;
+            WritePointer(image, at + offsetof(ObjectString, chars), at + sizeof(ObjectString));
+            memcpy(image->bytes + at + sizeof(ObjectString), string->chars, string->length + 1);
+            if (!string->isBorrowed)
+            {
+                image->heapBytes += string->length + 1;
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Frees the buffers of an image.
+ *
+ * @param image The Image.
+ */
+static void FreeImage(Image* image)
+{
+    free(image->bytes);
+    free(image->relocations);
+    free(image->natives);
+    free(image->placed);
+    free(image->offsets);
+}
+
+/**
+ * @brief Writes the header, image, relocations and natives of a snapshot to a file.
+ *
+ * @param image The finished Image.
+ * @param path A path to the file.
+ * @return true If the whole snapshot was written.
+ * @return false If the file could not be written.
+ */
+static bool WriteSnapshot(Image* image, const char* path)
+{
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(SnapshotHeader));
+    memcpy(header.magic, "LOXH", 4);
+    header.version = SNAPSHOT_VERSION;
+    header.layout = LayoutFingerprint();
+    header.imageSize = image->count;
+    header.relocationCount = image->relocationCount;
+    header.nativeCount = image->nativeCount;
+    header.heapBytes = image->heapBytes;
+    header.checksum = HashBytes(HASH_BASIS, image->bytes, image->count);
+    header.checksum = HashBytes(header.checksum, image->relocations, sizeof(uint64_t) * image->relocationCount);
+    header.checksum = HashBytes(header.checksum, image->natives, sizeof(SnapshotNative) * image->nativeCount);
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        return false;
+    }
+    bool isWritten = fwrite(&header, sizeof(SnapshotHeader), 1, file) == 1 &&
+                     fwrite(image->bytes, 1, image->count, file) == image->count &&
+                     fwrite(image->relocations, sizeof(uint64_t), image->relocationCount, file) ==
+                         image->relocationCount &&
+                     fwrite(image->natives, sizeof(SnapshotNative), image->nativeCount, file) == image->nativeCount;
+    return fclose(file) == 0 && isWritten;
+}
+
+/**
+ * @brief Folds a run of bytes into a 64-bit FNV-1a hash.
+ *
+ * @param hash The hash so far.
+ * @param bytes The bytes to hash.
+ * @param size The number of bytes.
+ * @return uint64_t The new hash.
+ */
+static uint64_t HashBytes(uint64_t hash, const void* bytes, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= ((const uint8_t*)bytes)[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Turns every offset in a mapped image into an address, once all of them are known to be in bounds.
+ *
+ * @param image The mapped image.
+ * @param header The header of the snapshot.
+ * @param relocations The offsets of the words to relocate.
+ * @param natives The natives of the image, whose offsets are checked too.
+ * @return true If the image was relocated.
+ * @return false If an offset was out of bounds, leaving the image untouched.
+ */
+static bool RelocateImage(uint8_t* image, const SnapshotHeader* header, const uint64_t* relocations,
+                          const SnapshotNative* natives)
+{
+    for (uint64_t i = 0; i < header->nativeCount; i++)
+    {
+        if (natives[i].native > header->imageSize - sizeof(ObjectNative) ||
+            natives[i].name > header->imageSize - sizeof(ObjectString))
+        {
+            return false;
+        }
+    }
+
+    for (uint64_t i = 0; i < header->relocationCount; i++)
+    {
+        uint64_t at = relocations[i];
+        if (at % sizeof(uintptr_t) != 0 || at > header->imageSize - sizeof(uintptr_t))
+        {
+            return false;
+        }
+        uintptr_t word;
+        memcpy(&word, image + at, sizeof(uintptr_t));
+        if (POINTER_BITS((uint64_t)word) >= header->imageSize)
+        {
+            return false;
+        }
+    }
+
+    for (uint64_t i = 0; i < header->relocationCount; i++)
+    {
+        uintptr_t* word = (uintptr_t*)(image + relocations[i]);
+        *word += (uintptr_t)image;
+    }
+    return true;
+}
+
+/**
+ * @brief Gives every native of a relocated image the function defined under its name in a VM.
+ *
+ * @param isolate The VM restoring the image.
+ * @param image The relocated image.
+ * @param header The header of the snapshot.
+ * @param natives The natives of the image.
+ * @return const char* NULL once all natives are bound, or the name of one the VM does not define.
+ */
+static const char* BindNatives(VM* isolate, uint8_t* image, const SnapshotHeader* header,
+                               const SnapshotNative* natives)
+{
+    for (uint64_t i = 0; i < header->nativeCount; i++)
+    {
+        ObjectNative* native = (ObjectNative*)(image + natives[i].native);
+        ObjectString* name = (ObjectString*)(image + natives[i].name);
+
+        native->function = NULL;
+        for (int slot = 0; slot < isolate->globalNames.count; slot++)
+        {
+            ObjectString* global = AS_STRING(isolate->globalNames.values[slot]);
+            Value value = isolate->globalValues.values[slot];
+            if (global->length == name->length && memcmp(global->chars, name->chars, name->length) == 0 &&
+                IS_NATIVE(value))
+            {
+                native->function = AS_NATIVE(value);
+            }
+        }
+        if (native->function == NULL)
+        {
+            return name->chars;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Works out the fingerprint of how this build lays out the objects and bytecode of an image.
+ *
+ * Builds with other options, like the JIT or the trace recorder, give objects other sizes; reordering the
+ * fields of an object without changing its size takes a new SNAPSHOT_VERSION.
+ *
+ * @return uint64_t The fingerprint.
+ */
+static uint64_t LayoutFingerprint()
+{
+    uint32_t versions[] = { SNAPSHOT_VERSION, BYTECODE_VERSION };
+    size_t sizes[] =
+    {
+        sizeof(void*), sizeof(Value), sizeof(Object), sizeof(ObjectBoundMethod), sizeof(ObjectClass),
+        sizeof(ObjectInstance), sizeof(ObjectShape), sizeof(ObjectUpvalue), sizeof(ObjectClosure),
+        sizeof(ObjectFunction), sizeof(ObjectNative), sizeof(ObjectString), sizeof(LazyBody), sizeof(Chunk),
+        sizeof(ValueArray), sizeof(Table), sizeof(Entry), sizeof(SnapshotRoots),
+    };
+    uint64_t hash = HashBytes(HASH_BASIS, versions, sizeof(versions));
+    return HashBytes(hash, sizes, sizeof(sizes));
+}
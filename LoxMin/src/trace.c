@@ -0,0 +1,1205 @@
+#include <stdio.h>
+#include "trace.h"
+
+#ifdef TRACE_RECORDER
+
+#include "debug.h"
+#include "jit.h"
+#include "memory.h"
+
+/**
+ * @brief Enumerates the outcomes of recording a single instruction.
+ */
+typedef enum
+{
+    STEP_RECORDED,
+    STEP_CLOSED,
+    STEP_ABORTED,
+} StepResult;
+
+/**
+ * @brief Tracks the operand stack of a trace while it is turned into IR.
+ *
+ * Every value above the loop's base is held as a reference to the instruction producing it, which also
+ * covers the locals a loop body declares.
+ */
+typedef struct
+{
+    Trace* trace;
+    int stack[UINT8_COUNT];
+    int stackCount;
+    int snapshot;
+    int offset;
+} IrBuilder;
+
+static StepResult RecordStep(Trace* trace, CallFrame* frame, int* offset);
+static bool ArithmeticResult(uint8_t operation, Value a, Value b, Value* result);
+static TraceType TypeOf(Value value);
+static bool IsFalsey(Value value);
+static void AddStep(Trace* trace, TraceStep* step);
+
+static bool BuildIr(Trace* trace);
+static void FindVariables(Trace* trace);
+static void NoteVariable(Trace* trace, bool isGlobal, int slot, uint8_t type);
+static int FindVariable(Trace* trace, bool isGlobal, int slot);
+static bool BuildStep(IrBuilder* builder, TraceStep* step);
+static int BuildBinary(IrBuilder* builder, uint8_t operation, TraceStep* step, int left, int right);
+static void BuildGuard(IrBuilder* builder, int condition, bool isTruthy, int resume);
+static int ReadLocal(IrBuilder* builder, int slot);
+static void WriteLocal(IrBuilder* builder, int slot, int value);
+static int ReadVariable(IrBuilder* builder, bool isGlobal, int slot);
+static void WriteVariable(IrBuilder* builder, bool isGlobal, int slot, int value);
+static int ToNumber(IrBuilder* builder, int value);
+static int CurrentSnapshot(IrBuilder* builder);
+static int TakeSnapshot(IrBuilder* builder, int resume);
+static bool IsBoolean(Trace* trace, int value);
+static int Emit(Trace* trace, IrOp op, bool isNumber, int a, int b);
+static int EmitConstant(Trace* trace, Value value);
+static void EliminateDeadCode(Trace* trace);
+
+void RecordTrace(LoopAnchor* loop, CallFrame* frame)
+{
+    loop->hits = 0;
+    loop->attempts++;
+
+    Trace* trace = ALLOCATE(Trace, 1);
+    trace->chunk = frame->chunk;
+    trace->header = loop->header;
+    trace->loopOffset = loop->offset;
+    trace->baseDepth = (int)(vm->sp - frame->slots);
+    trace->abortReason = NULL;
+    trace->steps = NULL;
+    trace->stepCount = 0;
+    trace->stepCapacity = 0;
+    trace->ir = NULL;
+    trace->irCount = 0;
+    trace->irCapacity = 0;
+    trace->variables = NULL;
+    trace->variableCount = 0;
+    trace->variableCapacity = 0;
+    trace->snapshots = NULL;
+    trace->snapshotCount = 0;
+    trace->snapshotCapacity = 0;
+    trace->snapshotRefs = NULL;
+    trace->snapshotRefCount = 0;
+    trace->snapshotRefCapacity = 0;
+    trace->code = NULL;
+    trace->codeSize = 0;
+
+    int offset = loop->header;
+    StepResult result = STEP_RECORDED;
+    while (result == STEP_RECORDED)
+    {
+        if (trace->stepCount == TRACE_MAX_STEPS)
+        {
+            trace->abortReason = "trace too long";
+            result = STEP_ABORTED;
+            break;
+        }
+        result = RecordStep(trace, frame, &offset);
+    }
+    frame->ip = ThreadedInstruction(trace->chunk, offset);
+
+    if (result == STEP_CLOSED && BuildIr(trace))
+    {
+#ifdef JIT_COMPILER
+        if (CompileTrace(trace))
+        {
+            loop->trace = trace;
+        }
+        else
+        {
+            trace->abortReason = "no native form";
+        }
+#else
+        // Without the JIT a loop is only recorded to be dumped
+        loop->attempts = TRACE_MAX_ATTEMPTS;
+#endif
+    }
+
+#ifdef DEBUG_DUMP_TRACES
+    PrintTrace(trace);
+#endif
+
+    if (loop->trace != trace)
+    {
+        FreeTrace(trace);
+    }
+}
+
+void FreeTrace(Trace* trace)
+{
+    if (trace == NULL)
+    {
+        return;
+    }
+
+#ifdef JIT_COMPILER
+    FreeNativeTrace(trace);
+#endif
+    FREE_ARRAY(TraceStep, trace->steps, trace->stepCapacity);
+    FREE_ARRAY(IrInstruction, trace->ir, trace->irCapacity);
+    FREE_ARRAY(TraceVariable, trace->variables, trace->variableCapacity);
+    FREE_ARRAY(Snapshot, trace->snapshots, trace->snapshotCapacity);
+    FREE_ARRAY(int, trace->snapshotRefs, trace->snapshotRefCapacity);
+    FREE(Trace, trace);
+}
+
+int IrOperands(IrInstruction* instruction, int operands[2])
+{
+    switch (instruction->op)
+    {
+        case IR_CONSTANT:
+        case IR_LOAD:
+        case IR_READ:
+        case IR_LOOP:
+            return 0;
+        case IR_STORE:
+            operands[0] = instruction->b;
+            return 1;
+        case IR_UNBOX:
+        case IR_NEGATE:
+        case IR_NOT:
+        case IR_GUARD_TRUE:
+        case IR_GUARD_FALSE:
+        case IR_PRINT:
+            operands[0] = instruction->a;
+            return 1;
+        default:
+            operands[0] = instruction->a;
+            operands[1] = instruction->b;
+            return 2;
+    }
+}
+
+/**
+ * @brief Executes and records the instruction at an offset, the way Run() would execute it.
+ *
+ * An instruction the recorder cannot hold is left unexecuted for the interpreter.
+ *
+ * @param trace The Trace being recorded.
+ * @param frame The CallFrame running the loop.
+ * @param offset The offset of the instruction, advanced to the next one to execute.
+ * @return StepResult Whether recording goes on, closed the loop or was aborted.
+ */
+static StepResult RecordStep(Trace* trace, CallFrame* frame, int* offset)
+{
+    Chunk* chunk = trace->chunk;
+    uint8_t* code = &chunk->code[*offset];
+    Value* constants = chunk->constants.values;
+    Value* slots = frame->slots;
+    Value* globals = vm->globalValues.values;
+    int next = *offset + InstructionLength(chunk, *offset);
+
+    TraceStep step;
+    step.offset = *offset;
+    step.types[0] = TYPE_NONE;
+    step.types[1] = TYPE_NONE;
+    step.isTaken = false;
+
+#define PEEK(distance) (vm->sp[-1 - (distance)])
+#define ABORT(reason) \
+        do \
+        { \
+            trace->abortReason = (reason); \
+            return STEP_ABORTED; \
+        } while (false)
+
+    switch (code[0])
+    {
+        case OP_CONSTANT:
+            StackPush(constants[code[1]]);
+            break;
+        case OP_NIL:
+            StackPush(NIL_VALUE);
+            break;
+        case OP_TRUE:
+            StackPush(BOOL_VALUE(true));
+            break;
+        case OP_FALSE:
+            StackPush(BOOL_VALUE(false));
+            break;
+        case OP_POP:
+            StackPop();
+            break;
+        case OP_GET_LOCAL:
+            step.types[0] = TypeOf(slots[code[1]]);
+            StackPush(slots[code[1]]);
+            break;
+        case OP_SET_LOCAL:
+            step.types[0] = TypeOf(PEEK(0));
+            slots[code[1]] = PEEK(0);
+            break;
+        case OP_POP_LOCAL:
+            step.types[0] = TypeOf(PEEK(0));
+            slots[code[1]] = StackPop();
+            break;
+        case OP_GET_GLOBAL:
+        {
+            Value value = globals[(code[1] << 8) | code[2]];
+            if (IS_UNDEFINED(value))
+            {
+                ABORT("undefined global");
+            }
+            step.types[0] = TypeOf(value);
+            StackPush(value);
+            break;
+        }
+        case OP_SET_GLOBAL:
+        case OP_POP_GLOBAL:
+        {
+            int slot = (code[1] << 8) | code[2];
+            if (IS_UNDEFINED(globals[slot]))
+            {
+                ABORT("undefined global");
+            }
+            step.types[0] = TypeOf(PEEK(0));
+            globals[slot] = PEEK(0);
+            if (code[0] == OP_POP_GLOBAL)
+            {
+                StackPop();
+            }
+            break;
+        }
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        {
+            Value result;
+            if (!ArithmeticResult(code[0], PEEK(1), PEEK(0), &result))
+            {
+                ABORT(code[0] == OP_ADD ? "operands are not two numbers" : "operands are not numbers");
+            }
+            step.types[0] = TypeOf(PEEK(1));
+            step.types[1] = TypeOf(PEEK(0));
+            StackPop();
+            PEEK(0) = result;
+            break;
+        }
+        case OP_ADD_LL:
+        case OP_ADD_LK:
+        case OP_SUBTRACT_LL:
+        case OP_SUBTRACT_LK:
+        case OP_MULTIPLY_LL:
+        case OP_MULTIPLY_LK:
+        case OP_DIVIDE_LL:
+        case OP_DIVIDE_LK:
+        case OP_GREATER_LL:
+        case OP_GREATER_LK:
+        case OP_LESS_LL:
+        case OP_LESS_LK:
+        case OP_EQUAL_LL:
+        case OP_EQUAL_LK:
+        case OP_JUMP_GREATER_LL:
+        case OP_JUMP_GREATER_LK:
+        case OP_JUMP_LESS_LL:
+        case OP_JUMP_LESS_LK:
+        case OP_JUMP_EQUAL_LL:
+        case OP_JUMP_EQUAL_LK:
+        {
+            bool isConstant = code[0] == OP_ADD_LK || code[0] == OP_SUBTRACT_LK || code[0] == OP_MULTIPLY_LK ||
+                              code[0] == OP_DIVIDE_LK || code[0] == OP_GREATER_LK || code[0] == OP_LESS_LK ||
+                              code[0] == OP_EQUAL_LK || code[0] == OP_JUMP_GREATER_LK ||
+                              code[0] == OP_JUMP_LESS_LK || code[0] == OP_JUMP_EQUAL_LK;
+            Value a = slots[code[1]];
+            Value b = isConstant ? constants[code[2]] : slots[code[2]];
+            Value result;
+            if (!ArithmeticResult(BaseOperation(code[0]), a, b, &result))
+            {
+                ABORT("operands are not numbers");
+            }
+            step.types[0] = TypeOf(a);
+            step.types[1] = TypeOf(b);
+
+            if (code[0] >= OP_JUMP_GREATER_LL && code[0] <= OP_JUMP_EQUAL_LK)
+            {
+                step.isTaken = AS_BOOL(result) == (bool)code[3];
+                if (step.isTaken)
+                {
+                    next += (code[4] << 8) | code[5];
+                }
+            }
+            else
+            {
+                StackPush(result);
+            }
+            break;
+        }
+        case OP_NOT:
+            step.types[0] = TypeOf(PEEK(0));
+            PEEK(0) = BOOL_VALUE(IsFalsey(PEEK(0)));
+            break;
+        case OP_NEGATE:
+            if (!IS_NUMBER(PEEK(0)))
+            {
+                ABORT("operand is not a number");
+            }
+            step.types[0] = TYPE_NUMBER;
+            PEEK(0) = NUMBER_VALUE(-AS_NUMBER(PEEK(0)));
+            break;
+        case OP_PRINT:
+            step.types[0] = TypeOf(PEEK(0));
+            PrintValue(vm->options.output, StackPop());
+            fputc('\n', vm->options.output);
+            fflush(vm->options.output);
+            break;
+        case OP_JUMP:
+            next += (code[1] << 8) | code[2];
+            break;
+        case OP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_FALSE:
+            step.types[0] = TypeOf(PEEK(0));
+            step.isTaken = IsFalsey(PEEK(0));
+            if (code[0] == OP_POP_JUMP_IF_FALSE)
+            {
+                StackPop();
+            }
+            if (step.isTaken)
+            {
+                next += (code[1] << 8) | code[2];
+            }
+            break;
+        case OP_LOOP:
+        {
+            next -= (code[1] << 8) | code[2];
+            if (next == trace->header)
+            {
+                AddStep(trace, &step);
+                *offset = next;
+                return STEP_CLOSED;
+            }
+
+            // A for loop jumps back from its increment too, but any other back edge taken twice is an inner loop
+            for (int i = 0; i < trace->stepCount; i++)
+            {
+                if (trace->steps[i].offset == *offset)
+                {
+                    ABORT("inner loop");
+                }
+            }
+            break;
+        }
+        default:
+            ABORT("unsupported instruction");
+    }
+
+#undef PEEK
+#undef ABORT
+
+    // The instruction ran, so the interpreter carries on after it whether or not the trace does
+    *offset = next;
+    if (next > trace->loopOffset)
+    {
+        trace->abortReason = "left the loop";
+        return STEP_ABORTED;
+    }
+
+    AddStep(trace, &step);
+    return STEP_RECORDED;
+}
+
+/**
+ * @brief Computes a binary operation the recorder may execute: a comparison, or arithmetic on two numbers.
+ *
+ * @param operation The stack form of the operation.
+ * @param a The left operand.
+ * @param b The right operand.
+ * @param result Where to store the result.
+ * @return true The operation was computed.
+ * @return false The operands are not numbers, leaving the operation to the interpreter.
+ */
+static bool ArithmeticResult(uint8_t operation, Value a, Value b, Value* result)
+{
+    if (operation == OP_EQUAL)
+    {
+        *result = BOOL_VALUE(AreValuesEqual(a, b));
+        return true;
+    }
+    if (!IS_NUMBER(a) || !IS_NUMBER(b))
+    {
+        return false;
+    }
+
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+    switch (operation)
+    {
+        case OP_GREATER:
+            *result = BOOL_VALUE(x > y);
+            break;
+        case OP_LESS:
+            *result = BOOL_VALUE(x < y);
+            break;
+        case OP_ADD:
+            *result = NUMBER_VALUE(x + y);
+            break;
+        case OP_SUBTRACT:
+            *result = NUMBER_VALUE(x - y);
+            break;
+        case OP_MULTIPLY:
+            *result = NUMBER_VALUE(x * y);
+            break;
+        default:
+            *result = NUMBER_VALUE(x / y);
+            break;
+    }
+    return true;
+}
+
+/**
+ * @brief Finds the type a trace records for a Value.
+ *
+ * @param value The Value to check.
+ * @return TraceType The type of the Value.
+ */
+static TraceType TypeOf(Value value)
+{
+    if (IS_NUMBER(value))
+    {
+        return TYPE_NUMBER;
+    }
+    else if (IS_BOOL(value))
+    {
+        return TYPE_BOOL;
+    }
+    else if (IS_NIL(value))
+    {
+        return TYPE_NIL;
+    }
+    return TYPE_OBJECT;
+}
+
+/**
+ * @brief Determines if a Value is falsey, as the interpreter does.
+ *
+ * @param value A Value to check.
+ * @return true The Value is nil or false.
+ * @return false The Value is truthy.
+ */
+static bool IsFalsey(Value value)
+{
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+/**
+ * @brief Appends a recorded step to a trace.
+ *
+ * @param trace The Trace to append to.
+ * @param step The TraceStep to append.
+ */
+static void AddStep(Trace* trace, TraceStep* step)
+{
+    if (trace->stepCapacity < trace->stepCount + 1)
+    {
+        int oldCapacity = trace->stepCapacity;
+        trace->stepCapacity = GROW_CAPACITY(oldCapacity);
+        trace->steps = GROW_ARRAY(TraceStep, trace->steps, oldCapacity, trace->stepCapacity);
+    }
+
+    trace->steps[trace->stepCount++] = *step;
+}
+
+/**
+ * @brief Turns the recorded steps of a closed loop into optimized IR.
+ *
+ * Values are typed by what the recorder saw: arithmetic works on unboxed numbers behind guards, variables
+ * that only ever held numbers are promoted so that their guards move out of the loop, constant operations
+ * are folded, and whatever no guard, store or exit needs is dropped.
+ *
+ * @param trace The Trace to build the IR of.
+ * @return true The IR was built.
+ * @return false The steps could not be turned into IR.
+ */
+static bool BuildIr(Trace* trace)
+{
+    FindVariables(trace);
+
+    IrBuilder builder;
+    builder.trace = trace;
+    builder.stackCount = 0;
+    for (int i = 0; i < trace->stepCount - 1; i++)
+    {
+        builder.snapshot = -1;
+        builder.offset = trace->steps[i].offset;
+        if (!BuildStep(&builder, &trace->steps[i]))
+        {
+            return false;
+        }
+    }
+
+    // Every iteration has to start from the same stack
+    if (builder.stackCount != 0)
+    {
+        trace->abortReason = "unbalanced stack";
+        return false;
+    }
+
+    Emit(trace, IR_LOOP, false, -1, -1);
+    EliminateDeadCode(trace);
+    return true;
+}
+
+/**
+ * @brief Collects the variables a trace touches below the loop's base, promoting those that held only numbers.
+ *
+ * @param trace The Trace to scan.
+ */
+static void FindVariables(Trace* trace)
+{
+    for (int i = 0; i < trace->stepCount; i++)
+    {
+        TraceStep* step = &trace->steps[i];
+        uint8_t* code = &trace->chunk->code[step->offset];
+        switch (code[0])
+        {
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+            case OP_POP_LOCAL:
+                if (code[1] < trace->baseDepth)
+                {
+                    NoteVariable(trace, false, code[1], step->types[0]);
+                }
+                break;
+            case OP_GET_GLOBAL:
+            case OP_SET_GLOBAL:
+            case OP_POP_GLOBAL:
+                NoteVariable(trace, true, (code[1] << 8) | code[2], step->types[0]);
+                break;
+            case OP_ADD_LL:
+            case OP_SUBTRACT_LL:
+            case OP_MULTIPLY_LL:
+            case OP_DIVIDE_LL:
+            case OP_GREATER_LL:
+            case OP_LESS_LL:
+            case OP_EQUAL_LL:
+            case OP_JUMP_GREATER_LL:
+            case OP_JUMP_LESS_LL:
+            case OP_JUMP_EQUAL_LL:
+                if (code[2] < trace->baseDepth)
+                {
+                    NoteVariable(trace, false, code[2], step->types[1]);
+                }
+                // Fall through to the left operand
+            case OP_ADD_LK:
+            case OP_SUBTRACT_LK:
+            case OP_MULTIPLY_LK:
+            case OP_DIVIDE_LK:
+            case OP_GREATER_LK:
+            case OP_LESS_LK:
+            case OP_EQUAL_LK:
+            case OP_JUMP_GREATER_LK:
+            case OP_JUMP_LESS_LK:
+            case OP_JUMP_EQUAL_LK:
+                if (code[1] < trace->baseDepth)
+                {
+                    NoteVariable(trace, false, code[1], step->types[0]);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Notes one access to a variable along with the type it held.
+ *
+ * @param trace The Trace being scanned.
+ * @param isGlobal Whether the variable is a global.
+ * @param slot The slot of the variable.
+ * @param type The type the variable was seen to hold.
+ */
+static void NoteVariable(Trace* trace, bool isGlobal, int slot, uint8_t type)
+{
+    int index = FindVariable(trace, isGlobal, slot);
+    if (index == -1)
+    {
+        if (trace->variableCapacity < trace->variableCount + 1)
+        {
+            int oldCapacity = trace->variableCapacity;
+            trace->variableCapacity = GROW_CAPACITY(oldCapacity);
+            trace->variables = GROW_ARRAY(TraceVariable, trace->variables, oldCapacity, trace->variableCapacity);
+        }
+
+        int promoted = 0;
+        for (int i = 0; i < trace->variableCount; i++)
+        {
+            promoted += trace->variables[i].isPromoted;
+        }
+
+        index = trace->variableCount++;
+        trace->variables[index].isGlobal = isGlobal;
+        trace->variables[index].isPromoted = promoted < TRACE_MAX_PROMOTED;
+        trace->variables[index].slot = slot;
+    }
+
+    if (type != TYPE_NUMBER)
+    {
+        trace->variables[index].isPromoted = false;
+    }
+}
+
+/**
+ * @brief Finds a variable already collected for a trace.
+ *
+ * @param trace The Trace to search.
+ * @param isGlobal Whether the variable is a global.
+ * @param slot The slot of the variable.
+ * @return int The index of the variable, or -1 if it has not been seen.
+ */
+static int FindVariable(Trace* trace, bool isGlobal, int slot)
+{
+    for (int i = 0; i < trace->variableCount; i++)
+    {
+        if (trace->variables[i].isGlobal == isGlobal && trace->variables[i].slot == slot)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Emits the IR for one recorded step.
+ *
+ * @param builder The IrBuilder to emit with.
+ * @param step The TraceStep to emit.
+ * @return true The step was emitted.
+ * @return false The step has no IR form.
+ */
+static bool BuildStep(IrBuilder* builder, TraceStep* step)
+{
+    Trace* trace = builder->trace;
+    uint8_t* code = &trace->chunk->code[step->offset];
+    Value* constants = trace->chunk->constants.values;
+    int* stack = builder->stack;
+
+    switch (code[0])
+    {
+        case OP_CONSTANT:
+            stack[builder->stackCount++] = EmitConstant(trace, constants[code[1]]);
+            break;
+        case OP_NIL:
+            stack[builder->stackCount++] = EmitConstant(trace, NIL_VALUE);
+            break;
+        case OP_TRUE:
+            stack[builder->stackCount++] = EmitConstant(trace, BOOL_VALUE(true));
+            break;
+        case OP_FALSE:
+            stack[builder->stackCount++] = EmitConstant(trace, BOOL_VALUE(false));
+            break;
+        case OP_POP:
+            builder->stackCount--;
+            break;
+        case OP_GET_LOCAL:
+            stack[builder->stackCount] = ReadLocal(builder, code[1]);
+            builder->stackCount++;
+            break;
+        case OP_SET_LOCAL:
+        case OP_POP_LOCAL:
+            WriteLocal(builder, code[1], stack[builder->stackCount - 1]);
+            if (code[0] == OP_POP_LOCAL)
+            {
+                builder->stackCount--;
+            }
+            break;
+        case OP_GET_GLOBAL:
+            stack[builder->stackCount] = ReadVariable(builder, true, (code[1] << 8) | code[2]);
+            builder->stackCount++;
+            break;
+        case OP_SET_GLOBAL:
+        case OP_POP_GLOBAL:
+            WriteVariable(builder, true, (code[1] << 8) | code[2], stack[builder->stackCount - 1]);
+            if (code[0] == OP_POP_GLOBAL)
+            {
+                builder->stackCount--;
+            }
+            break;
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        {
+            int result = BuildBinary(builder, code[0], step, stack[builder->stackCount - 2],
+                                     stack[builder->stackCount - 1]);
+            builder->stackCount--;
+            stack[builder->stackCount - 1] = result;
+            break;
+        }
+        case OP_ADD_LL:
+        case OP_ADD_LK:
+        case OP_SUBTRACT_LL:
+        case OP_SUBTRACT_LK:
+        case OP_MULTIPLY_LL:
+        case OP_MULTIPLY_LK:
+        case OP_DIVIDE_LL:
+        case OP_DIVIDE_LK:
+        case OP_GREATER_LL:
+        case OP_GREATER_LK:
+        case OP_LESS_LL:
+        case OP_LESS_LK:
+        case OP_EQUAL_LL:
+        case OP_EQUAL_LK:
+        case OP_JUMP_GREATER_LL:
+        case OP_JUMP_GREATER_LK:
+        case OP_JUMP_LESS_LL:
+        case OP_JUMP_LESS_LK:
+        case OP_JUMP_EQUAL_LL:
+        case OP_JUMP_EQUAL_LK:
+        {
+            bool isConstant = code[0] == OP_ADD_LK || code[0] == OP_SUBTRACT_LK || code[0] == OP_MULTIPLY_LK ||
+                              code[0] == OP_DIVIDE_LK || code[0] == OP_GREATER_LK || code[0] == OP_LESS_LK ||
+                              code[0] == OP_EQUAL_LK || code[0] == OP_JUMP_GREATER_LK ||
+                              code[0] == OP_JUMP_LESS_LK || code[0] == OP_JUMP_EQUAL_LK;
+            int left = ReadLocal(builder, code[1]);
+            int right = isConstant ? EmitConstant(trace, constants[code[2]]) : ReadLocal(builder, code[2]);
+            int result = BuildBinary(builder, BaseOperation(code[0]), step, left, right);
+
+            if (code[0] >= OP_JUMP_GREATER_LL && code[0] <= OP_JUMP_EQUAL_LK)
+            {
+                // The comparison came out the way that made the jump go where it went
+                int jump = (code[4] << 8) | code[5];
+                int resume = step->isTaken ? step->offset + 6 : step->offset + 6 + jump;
+                BuildGuard(builder, result, step->isTaken == (bool)code[3], resume);
+            }
+            else
+            {
+                stack[builder->stackCount++] = result;
+            }
+            break;
+        }
+        case OP_NOT:
+        {
+            int value = stack[builder->stackCount - 1];
+            if (trace->ir[value].op == IR_CONSTANT)
+            {
+                Value constant = trace->ir[value].constant;
+                stack[builder->stackCount - 1] = EmitConstant(trace, BOOL_VALUE(IsFalsey(constant)));
+            }
+            else
+            {
+                stack[builder->stackCount - 1] = Emit(trace, IR_NOT, false, value, -1);
+            }
+            break;
+        }
+        case OP_NEGATE:
+        {
+            int value = ToNumber(builder, stack[builder->stackCount - 1]);
+            if (trace->ir[value].op == IR_CONSTANT)
+            {
+                value = EmitConstant(trace, NUMBER_VALUE(-AS_NUMBER(trace->ir[value].constant)));
+            }
+            else
+            {
+                value = Emit(trace, IR_NEGATE, true, value, -1);
+            }
+            stack[builder->stackCount - 1] = value;
+            break;
+        }
+        case OP_PRINT:
+        {
+            // Printing calls out of the trace, which first writes the interpreter state back
+            int value = stack[--builder->stackCount];
+            int print = Emit(trace, IR_PRINT, false, value, -1);
+            trace->ir[print].snapshot = TakeSnapshot(builder, step->offset + 1);
+            break;
+        }
+        case OP_JUMP:
+        case OP_LOOP:
+            break;
+        case OP_JUMP_IF_FALSE:
+        {
+            int jump = (code[1] << 8) | code[2];
+            int resume = step->isTaken ? step->offset + 3 : step->offset + 3 + jump;
+            int condition = stack[builder->stackCount - 1];
+            bool isBoolean = IsBoolean(trace, condition);
+
+            // A comparison left on the stack is known once the guard passed, and known the other way when it failed
+            if (isBoolean && trace->ir[condition].op != IR_CONSTANT)
+            {
+                stack[builder->stackCount - 1] = EmitConstant(trace, BOOL_VALUE(step->isTaken));
+                BuildGuard(builder, condition, !step->isTaken, resume);
+                stack[builder->stackCount - 1] = EmitConstant(trace, BOOL_VALUE(!step->isTaken));
+            }
+            else
+            {
+                BuildGuard(builder, condition, !step->isTaken, resume);
+            }
+            break;
+        }
+        case OP_POP_JUMP_IF_FALSE:
+        {
+            int jump = (code[1] << 8) | code[2];
+            int resume = step->isTaken ? step->offset + 3 : step->offset + 3 + jump;
+            int condition = stack[--builder->stackCount];
+            BuildGuard(builder, condition, !step->isTaken, resume);
+            break;
+        }
+        default:
+            trace->abortReason = "no IR form";
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Emits a binary operation typed by the operands the recorder saw, folding constant operands.
+ *
+ * @param builder The IrBuilder to emit with.
+ * @param operation The stack form of the operation.
+ * @param step The TraceStep holding the observed operand types.
+ * @param left The left operand.
+ * @param right The right operand.
+ * @return int The instruction holding the result.
+ */
+static int BuildBinary(IrBuilder* builder, uint8_t operation, TraceStep* step, int left, int right)
+{
+    Trace* trace = builder->trace;
+
+    IrOp op;
+    switch (operation)
+    {
+        case OP_EQUAL:
+            if (step->types[0] != TYPE_NUMBER || step->types[1] != TYPE_NUMBER)
+            {
+                if (trace->ir[left].op == IR_CONSTANT && trace->ir[right].op == IR_CONSTANT)
+                {
+                    return EmitConstant(trace, BOOL_VALUE(AreValuesEqual(trace->ir[left].constant,
+                                                                         trace->ir[right].constant)));
+                }
+                return Emit(trace, IR_EQUAL, false, left, right);
+            }
+            op = IR_EQUAL_NUMBER;
+            break;
+        case OP_GREATER:
+            op = IR_GREATER;
+            break;
+        case OP_LESS:
+            op = IR_LESS;
+            break;
+        case OP_ADD:
+            op = IR_ADD;
+            break;
+        case OP_SUBTRACT:
+            op = IR_SUBTRACT;
+            break;
+        case OP_MULTIPLY:
+            op = IR_MULTIPLY;
+            break;
+        default:
+            op = IR_DIVIDE;
+            break;
+    }
+
+    left = ToNumber(builder, left);
+    right = ToNumber(builder, right);
+    if (trace->ir[left].op == IR_CONSTANT && trace->ir[right].op == IR_CONSTANT)
+    {
+        Value result;
+        ArithmeticResult(operation, trace->ir[left].constant, trace->ir[right].constant, &result);
+        return EmitConstant(trace, result);
+    }
+    return Emit(trace, op, op <= IR_DIVIDE, left, right);
+}
+
+/**
+ * @brief Emits a guard that the trace goes on only while a condition is as recorded.
+ *
+ * A constant condition needs no guard, since it cannot differ from what the recorder saw.
+ *
+ * @param builder The IrBuilder to emit with.
+ * @param condition The condition to check.
+ * @param isTruthy Whether the condition was truthy when recorded.
+ * @param resume The offset the interpreter resumes at when the condition differs.
+ */
+static void BuildGuard(IrBuilder* builder, int condition, bool isTruthy, int resume)
+{
+    Trace* trace = builder->trace;
+    if (trace->ir[condition].op == IR_CONSTANT)
+    {
+        return;
+    }
+
+    int snapshot = TakeSnapshot(builder, resume);
+    int guard = Emit(trace, isTruthy ? IR_GUARD_TRUE : IR_GUARD_FALSE, false, condition, -1);
+    trace->ir[guard].snapshot = snapshot;
+}
+
+/**
+ * @brief Reads a local, from its variable below the loop's base or from the builder's stack above it.
+ *
+ * @param builder The IrBuilder to emit with.
+ * @param slot The slot of the local.
+ * @return int The instruction holding the local's value.
+ */
+static int ReadLocal(IrBuilder* builder, int slot)
+{
+    if (slot >= builder->trace->baseDepth)
+    {
+        return builder->stack[slot - builder->trace->baseDepth];
+    }
+    return ReadVariable(builder, false, slot);
+}
+
+/**
+ * @brief Writes a local, to its variable below the loop's base or to the builder's stack above it.
+ *
+ * @param builder The IrBuilder to emit with.
+ * @param slot The slot of the local.
+ * @param value The instruction holding the value to write.
+ */
+static void WriteLocal(IrBuilder* builder, int slot, int value)
+{
+    if (slot >= builder->trace->baseDepth)
+    {
+        builder->stack[slot - builder->trace->baseDepth] = value;
+        return;
+    }
+    WriteVariable(builder, false, slot, value);
+}
+
+/**
+ * @brief Reads a variable, straight from its register when it is promoted.
+ *
+ * @param builder The IrBuilder to emit with.
+ * @param isGlobal Whether the variable is a global.
+ * @param slot The slot of the variable.
+ * @return int The instruction holding the variable's value.
+ */
+static int ReadVariable(IrBuilder* builder, bool isGlobal, int slot)
+{
+    int variable = FindVariable(builder->trace, isGlobal, slot);
+    bool isPromoted = builder->trace->variables[variable].isPromoted;
+    return Emit(builder->trace, isPromoted ? IR_READ : IR_LOAD, isPromoted, variable, -1);
+}
+
+/**
+ * @brief Writes a variable, unboxing the value first when the variable is promoted.
+ *
+ * @param builder The IrBuilder to emit with.
+ * @param isGlobal Whether the variable is a global.
+ * @param slot The slot of the variable.
+ * @param value The instruction holding the value to write.
+ */
+static void WriteVariable(IrBuilder* builder, bool isGlobal, int slot, int value)
+{
+    int variable = FindVariable(builder->trace, isGlobal, slot);
+    if (builder->trace->variables[variable].isPromoted)
+    {
+        value = ToNumber(builder, value);
+    }
+    Emit(builder->trace, IR_STORE, false, variable, value);
+}
+
+/**
+ * @brief Makes sure a value is an unboxed number, guarding that it holds one if it is not known to.
+ *
+ * @param builder The IrBuilder to emit with.
+ * @param value The instruction holding the value.
+ * @return int The instruction holding the number.
+ */
+static int ToNumber(IrBuilder* builder, int value)
+{
+    Trace* trace = builder->trace;
+    if (trace->ir[value].isNumber)
+    {
+        return value;
+    }
+
+    int snapshot = CurrentSnapshot(builder);
+    int unbox = Emit(trace, IR_UNBOX, true, value, -1);
+    trace->ir[unbox].snapshot = snapshot;
+    return unbox;
+}
+
+/**
+ * @brief Takes, once per step, the snapshot that resumes the step's own instruction.
+ *
+ * @param builder The IrBuilder to emit with, still holding the step's operands.
+ * @return int The index of the snapshot.
+ */
+static int CurrentSnapshot(IrBuilder* builder)
+{
+    if (builder->snapshot == -1)
+    {
+        builder->snapshot = TakeSnapshot(builder, builder->offset);
+    }
+    return builder->snapshot;
+}
+
+/**
+ * @brief Records the builder's stack as the state to rebuild if the trace exits.
+ *
+ * @param builder The IrBuilder to snapshot.
+ * @param resume The offset the interpreter resumes at.
+ * @return int The index of the snapshot.
+ */
+static int TakeSnapshot(IrBuilder* builder, int resume)
+{
+    Trace* trace = builder->trace;
+    if (trace->snapshotCapacity < trace->snapshotCount + 1)
+    {
+        int oldCapacity = trace->snapshotCapacity;
+        trace->snapshotCapacity = GROW_CAPACITY(oldCapacity);
+        trace->snapshots = GROW_ARRAY(Snapshot, trace->snapshots, oldCapacity, trace->snapshotCapacity);
+    }
+    while (trace->snapshotRefCapacity < trace->snapshotRefCount + builder->stackCount)
+    {
+        int oldCapacity = trace->snapshotRefCapacity;
+        trace->snapshotRefCapacity = GROW_CAPACITY(oldCapacity);
+        trace->snapshotRefs = GROW_ARRAY(int, trace->snapshotRefs, oldCapacity, trace->snapshotRefCapacity);
+    }
+
+    Snapshot* snapshot = &trace->snapshots[trace->snapshotCount];
+    snapshot->resume = resume;
+    snapshot->first = trace->snapshotRefCount;
+    snapshot->count = builder->stackCount;
+    for (int i = 0; i < builder->stackCount; i++)
+    {
+        trace->snapshotRefs[trace->snapshotRefCount++] = builder->stack[i];
+    }
+    return trace->snapshotCount++;
+}
+
+/**
+ * @brief Determines if an instruction is known to produce a boolean.
+ *
+ * @param trace The Trace holding the instruction.
+ * @param value The instruction to check.
+ * @return true The instruction always produces true or false.
+ * @return false The instruction may produce anything.
+ */
+static bool IsBoolean(Trace* trace, int value)
+{
+    switch (trace->ir[value].op)
+    {
+        case IR_GREATER:
+        case IR_LESS:
+        case IR_EQUAL_NUMBER:
+        case IR_EQUAL:
+        case IR_NOT:
+            return true;
+        case IR_CONSTANT:
+            return IS_BOOL(trace->ir[value].constant);
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Appends an instruction to a trace's IR.
+ *
+ * @param trace The Trace to append to.
+ * @param op The operation.
+ * @param isNumber Whether the instruction produces an unboxed number.
+ * @param a The first operand.
+ * @param b The second operand.
+ * @return int The index of the instruction.
+ */
+static int Emit(Trace* trace, IrOp op, bool isNumber, int a, int b)
+{
+    if (trace->irCapacity < trace->irCount + 1)
+    {
+        int oldCapacity = trace->irCapacity;
+        trace->irCapacity = GROW_CAPACITY(oldCapacity);
+        trace->ir = GROW_ARRAY(IrInstruction, trace->ir, oldCapacity, trace->irCapacity);
+    }
+
+    IrInstruction* instruction = &trace->ir[trace->irCount];
+    instruction->op = op;
+    instruction->isNumber = isNumber;
+    instruction->isDead = false;
+    instruction->a = a;
+    instruction->b = b;
+    instruction->snapshot = -1;
+    instruction->constant = NIL_VALUE;
+    return trace->irCount++;
+}
+
+/**
+ * @brief Appends a constant to a trace's IR.
+ *
+ * @param trace The Trace to append to.
+ * @param value The Value of the constant.
+ * @return int The index of the instruction.
+ */
+static int EmitConstant(Trace* trace, Value value)
+{
+    // Compiled traces keep numbers in xmm registers as doubles
+    if (IS_INTEGER(value))
+    {
+        value = NUMBER_VALUE(AS_NUMBER(value));
+    }
+
+    int constant = Emit(trace, IR_CONSTANT, IS_NUMBER(value), -1, -1);
+    trace->ir[constant].constant = value;
+    return constant;
+}
+
+/**
+ * @brief Marks the instructions whose results nothing uses as dead.
+ *
+ * Guards, stores, prints and unboxing, which guards too, always stay.
+ *
+ * @param trace The Trace to clean up.
+ */
+static void EliminateDeadCode(Trace* trace)
+{
+    int* uses = ALLOCATE(int, trace->irCount);
+    for (int i = 0; i < trace->irCount; i++)
+    {
+        uses[i] = 0;
+    }
+
+    for (int i = 0; i < trace->irCount; i++)
+    {
+        IrInstruction* instruction = &trace->ir[i];
+        int operands[2];
+        int operandCount = IrOperands(instruction, operands);
+        for (int j = 0; j < operandCount; j++)
+        {
+            uses[operands[j]]++;
+        }
+        if (instruction->snapshot != -1)
+        {
+            Snapshot* snapshot = &trace->snapshots[instruction->snapshot];
+            for (int j = 0; j < snapshot->count; j++)
+            {
+                uses[trace->snapshotRefs[snapshot->first + j]]++;
+            }
+        }
+    }
+
+    // Operands come before their users, so one backward pass finds whole dead chains
+    for (int i = trace->irCount - 1; i >= 0; i--)
+    {
+        IrInstruction* instruction = &trace->ir[i];
+        bool isPure = instruction->op != IR_STORE && instruction->op != IR_UNBOX &&
+                      instruction->op != IR_GUARD_TRUE && instruction->op != IR_GUARD_FALSE &&
+                      instruction->op != IR_PRINT && instruction->op != IR_LOOP;
+        if (!isPure || uses[i] != 0)
+        {
+            continue;
+        }
+
+        instruction->isDead = true;
+        int operands[2];
+        int operandCount = IrOperands(instruction, operands);
+        for (int j = 0; j < operandCount; j++)
+        {
+            uses[operands[j]]--;
+        }
+    }
+
+    FREE_ARRAY(int, uses, trace->irCount);
+}
+
+#endif
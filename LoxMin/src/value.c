@@ -30,39 +30,48 @@ void FreeValueArray(ValueArray* array)
     InitValueArray(array);
 }
 
-void PrintValue(Value value)
+void PrintValue(FILE* file, Value value)
 {
 #ifdef NAN_BOXING
     if (IS_BOOL(value))
     {
-        printf(AS_BOOL(value) ? "true" : "false");
+        fprintf(file, AS_BOOL(value) ? "true" : "false");
     }
     else if (IS_NIL(value))
     {
-        printf("nil");
+        fprintf(file, "nil");
     }
     else if (IS_NUMBER(value))
     {
-        printf("%g", AS_NUMBER(value));
+        fprintf(file, "%g", AS_NUMBER(value));
     }
     else if (IS_OBJECT(value))
     {
-        PrintObject(value);
+        PrintObject(file, value);
+    }
+    else if (IS_SHORT_STRING(value))
+    {
+        char chars[SHORT_STRING_MAX + 1];
+        ShortStringChars(value, chars);
+        fprintf(file, "%s", chars);
     }
 #else
     switch (value.type)
     {
         case VALUE_BOOL:
-            printf(AS_BOOL(value) ? "true" : "false");
+            fprintf(file, AS_BOOL(value) ? "true" : "false");
             break;
         case VALUE_NIL:
-            printf("nil");
+            fprintf(file, "nil");
             break;
         case VALUE_NUMBER:
-            printf("%g", AS_NUMBER(value));
+            fprintf(file, "%g", AS_NUMBER(value));
             break;
         case VALUE_OBJECT:
-            PrintObject(value);
+            PrintObject(file, value);
+            break;
+        case VALUE_UNDEFINED:
+            fprintf(file, "undefined");
             break;
     }
 #endif
@@ -71,6 +80,10 @@ void PrintValue(Value value)
 bool AreValuesEqual(Value a, Value b)
 {
 #ifdef NAN_BOXING
+    if (IS_INTEGER(a) && IS_INTEGER(b))
+    {
+        return a == b;
+    }
     if (IS_NUMBER(a) && IS_NUMBER(b))
     {
         return AS_NUMBER(a) == AS_NUMBER(b);
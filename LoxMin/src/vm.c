@@ -1,78 +1,180 @@
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <time.h>
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "jit.h"
 #include "memory.h"
 #include "object.h"
+#include "trace.h"
 #include "vm.h"
 
-static InterpretResult Run();
+static InterpretResult RunScript(ObjectFunction* function);
+static InterpretResult Run(int baseFrame);
+#ifdef JIT_COMPILER
+static JitStatus FinishFrame(int baseFrame);
+#endif
+#ifdef DEBUG_TRACE_EXECUTION
+static void TraceExecution(CallFrame* frame);
+#endif
 static Value StackPeek(int distance);
 static ObjectUpvalue* CaptureUpvalue(Value* local);
 static void CloseUpvalues(Value* last);
 static bool CallValue(Value callee, int argCount);
 static bool Call(ObjectClosure* closure, int argCount);
+static inline bool PushFrame(ObjectClosure* closure, Value* slots);
+static bool GrowStacks(int neededSlots);
+static bool ReuseFrame(ObjectClosure* closure, int argCount);
 static void DefineMethod(ObjectString* name);
 static bool BindMethod(ObjectClass* _class, ObjectString* name);
-static bool Invoke(ObjectString* name, int argCount);
-static bool InvokeFromClass(ObjectClass* _class, ObjectString* name, int argCount);
-static void DefineNative(const char* name, NativeFn function);
+static bool Invoke(ObjectString* name, int argCount, InvokeCache* cache);
+static bool InvokeFromClass(ObjectClass* _class, ObjectString* name, int argCount, InvokeCache* cache,
+                            Object* receiver);
+static ObjectClosure* FindCachedMethod(InvokeCache* cache, Object* receiver, ObjectClass* _class);
+static void UpdateInvokeCache(InvokeCache* cache, Object* receiver, ObjectClass* _class, ObjectClosure* method);
+static ObjectFunction* InstantiateFunction(ObjectFunction* frozen);
+static ObjectString* InternFrozenString(ObjectString* string);
 static Value ClockNative(int argCount, Value* args);
 static bool IsFalsey(Value value);
 static void ConcatenateStrings();
 static void RuntimeError(const char* format, ...);
 
-VM vm;
+THREAD_LOCAL VM* vm = NULL;
 
 /**
  * @brief Resets the stack to an empty state.
  */
 static void ResetStack()
 {
-    vm.sp = vm.stack;
-    vm.frameCount = 0;
-    vm.openUpvalues = NULL;
+    vm->sp = vm->stack;
+    vm->frameCount = 0;
+    vm->openUpvalues = NULL;
+}
+
+void InitOptions(Options* options)
+{
+    options->registerMode = false;
+    options->lazyCompile = false;
+    options->maxFrames = FRAMES_MAX;
+    options->output = stdout;
+    options->errors = stderr;
+    options->jitThreshold = JIT_CALL_THRESHOLD;
+    options->traceThreshold = TRACE_HOT_LOOP;
 }
 
-void InitVM()
+VM* NewVM(const Options* options)
 {
+    VM* isolate = (VM*)malloc(sizeof(VM));
+    if (isolate == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+    VM* caller = vm;
+    vm = isolate;
+
+    // Frames are only allocated by the first call, once the limit on them is known
+    vm->frames = NULL;
+    vm->frameCapacity = 0;
+    vm->stack = (Value*)malloc(sizeof(Value) * STACK_INITIAL);
+    if (vm->stack == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+    vm->stackEnd = vm->stack + STACK_INITIAL;
     ResetStack();
-    vm.objects = NULL;
-    vm.bytesAllocated = 0;
-    vm.nextGC = 1024 * 1024;
+    vm->objects = NULL;
+    vm->bytesAllocated = 0;
+    vm->nextGC = 1024 * 1024;
 
-    vm.grayCount = 0;
-    vm.grayCapacity = 0;
-    vm.grayStack = NULL;
+    vm->grayCount = 0;
+    vm->grayCapacity = 0;
+    vm->grayStack = NULL;
+    vm->snapshot = NULL;
+    vm->snapshotSize = 0;
 
-    InitTable(&vm.globals);
-    InitTable(&vm.strings);
+    InitTable(&vm->globalSlots);
+    InitValueArray(&vm->globalValues);
+    InitValueArray(&vm->globalNames);
+    InitTable(&vm->strings);
+    InitValueArray(&vm->handles);
+    vm->freeHandle = -1;
 
-    vm.initString = NULL;
-    vm.initString = CopyString("init", 4);
+    vm->options = *options;
 
-    DefineNative("clock", ClockNative);
+#ifdef COMPUTED_GOTO
+    // With no handler table yet, Run() only publishes it for ThreadChunk()
+    vm->handlers = NULL;
+    Run(0);
+#endif
+
+    vm->initString = NULL;
+    vm->initString = CopyString("init", 4);
+
+    DefineNative(isolate, "clock", ClockNative);
+
+    vm = caller;
+    return isolate;
 }
 
-void FreeVM()
+void FreeVM(VM* isolate)
 {
-    FreeTable(&vm.globals);
-    FreeTable(&vm.strings);
-    vm.initString = NULL;
+    VM* caller = vm;
+    vm = isolate;
+
+#ifdef DEBUG_PROFILE_OPCODES
+    PrintProfile();
+#endif
+#ifdef DEBUG_CACHE_STATS
+    PrintCacheStats();
+#endif
+
+    FreeTable(&vm->globalSlots);
+    FreeValueArray(&vm->globalValues);
+    FreeValueArray(&vm->globalNames);
+    FreeTable(&vm->strings);
+    FreeValueArray(&vm->handles);
+    vm->initString = NULL;
     FreeObjects();
+    if (vm->snapshot != NULL)
+    {
+        munmap(vm->snapshot, vm->snapshotSize);
+    }
+
+    free(vm->frames);
+    free(vm->stack);
+    free(vm);
+    vm = caller == isolate ? NULL : caller;
+}
+
+int GlobalSlot(ObjectString* name)
+{
+    Value slot;
+    if (TableGet(&vm->globalSlots, name, &slot))
+    {
+        return (int)AS_NUMBER(slot);
+    }
+
+    StackPush(OBJECT_VALUE(name));
+    int index = vm->globalValues.count;
+    WriteValueArray(&vm->globalValues, UNDEFINED_VALUE);
+    WriteValueArray(&vm->globalNames, OBJECT_VALUE(name));
+    TableSet(&vm->globalSlots, name, NUMBER_VALUE(index));
+    StackPop();
+    return index;
 }
 
 void StackPush(Value value)
 {
-    *(vm.sp++) = value;
+    *(vm->sp++) = value;
 }
 
 Value StackPop()
 {
-    return *(--vm.sp);
+    return *(--vm->sp);
 }
 
 /**
@@ -83,409 +185,1262 @@ Value StackPop()
  */
 static Value StackPeek(int distance)
 {
-    return vm.sp[-1 - distance];
+    return vm->sp[-1 - distance];
 }
 
-InterpretResult Interpret(const char* source)
+InterpretResult Interpret(VM* isolate, const char* source)
 {
+    VM* caller = vm;
+    vm = isolate;
+
+    InterpretResult result = INTERPRET_COMPILE_ERROR;
     ObjectFunction* function = Compile(source);
-    if (function == NULL)
+    if (function != NULL)
     {
-        return INTERPRET_COMPILE_ERROR;
+        result = RunScript(function);
     }
 
+    vm = caller;
+    return result;
+}
+
+FrozenScript* FreezeScript(VM* isolate, const char* source)
+{
+    FrozenScript* script = (FrozenScript*)malloc(sizeof(FrozenScript));
+    if (script == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+    script->heap = NewVM(&isolate->options);
+    // Frozen code is shared and never written to, so every body is compiled up front
+    script->heap->options.lazyCompile = false;
+    script->mapping = NULL;
+    script->mappingSize = 0;
+
+    VM* caller = vm;
+    vm = script->heap;
+
+    // Lay the globals out like the template's, past the ones every VM starts with
+    for (int i = vm->globalNames.count; i < isolate->globalNames.count; i++)
+    {
+        ObjectString* name = AS_STRING(isolate->globalNames.values[i]);
+        GlobalSlot(CopyString(name->chars, name->length));
+    }
+
+    script->function = Compile(source);
+    script->globalCount = vm->globalNames.count;
+    if (script->function != NULL)
+    {
+        FreezeObject((Object*)script->function);
+        for (int i = 0; i < vm->globalNames.count; i++)
+        {
+            FreezeObject(AS_OBJECT(vm->globalNames.values[i]));
+        }
+    }
+
+    vm = caller;
+    if (script->function == NULL)
+    {
+        FreeFrozenScript(script);
+        return NULL;
+    }
+    return script;
+}
+
+InterpretResult InterpretFrozen(VM* isolate, const FrozenScript* script)
+{
+    VM* caller = vm;
+    vm = isolate;
+
+    // Compiled code addresses globals by slot, which must mean the same in this VM
+    InterpretResult result = INTERPRET_OK;
+    for (int i = 0; i < script->globalCount; i++)
+    {
+        ObjectString* name = InternFrozenString(AS_STRING(script->heap->globalNames.values[i]));
+        if (GlobalSlot(name) != i)
+        {
+            fprintf(vm->options.errors, "Cannot run frozen script: global '%s' is laid out differently.\n", name->chars);
+            result = INTERPRET_COMPILE_ERROR;
+            break;
+        }
+    }
+
+    if (result == INTERPRET_OK)
+    {
+        result = RunScript(InstantiateFunction(script->function));
+    }
+
+    vm = caller;
+    return result;
+}
+
+void FreeFrozenScript(FrozenScript* script)
+{
+    FreeVM(script->heap);
+    if (script->mapping != NULL)
+    {
+        munmap(script->mapping, script->mappingSize);
+    }
+    free(script);
+}
+
+/**
+ * @brief Runs a compiled script to completion.
+ * 
+ * @param function The ObjectFunction of the script.
+ * @return InterpretResult The result of the interpretation.
+ */
+static InterpretResult RunScript(ObjectFunction* function)
+{
     StackPush(OBJECT_VALUE(function));
     ObjectClosure* closure = NewClosure(function);
     StackPop();
     StackPush(OBJECT_VALUE(closure));
     Call(closure, 0);
 
-    return Run();
+#ifdef JIT_COMPILER
+    InterpretResult result = FinishFrame(0) == JIT_FAILED ? INTERPRET_RUNTIME_ERROR : INTERPRET_OK;
+#else
+    InterpretResult result = Run(0);
+#endif
+    // The script returns nil like any function; nothing is left of it once it is gone
+    if (result == INTERPRET_OK)
+    {
+        StackPop();
+    }
+    return result;
+}
+
+#ifdef JIT_COMPILER
+JitStatus JitCall(int argCount)
+{
+    int frameCount = vm->frameCount;
+    if (!CallValue(StackPeek(argCount), argCount))
+    {
+        return JIT_FAILED;
+    }
+
+    // Natives and classes without an initializer are already done
+    if (vm->frameCount == frameCount)
+    {
+        return JIT_RETURNED;
+    }
+
+    return FinishFrame(frameCount);
+}
+
+JitStatus JitResume()
+{
+    return Run(vm->frameCount - 1) == INTERPRET_OK ? JIT_RETURNED : JIT_FAILED;
+}
+
+void JitReturn()
+{
+    Value result = StackPop();
+    CallFrame* frame = &vm->frames[vm->frameCount - 1];
+    CloseUpvalues(frame->slots);
+    vm->frameCount--;
+
+    vm->sp = frame->slots;
+    StackPush(result);
+}
+
+/**
+ * @brief Runs the frame on top of the frame stack until it returns, natively for as long as it can.
+ * 
+ * @param baseFrame The frame count once the frame has returned.
+ * @return JitStatus JIT_RETURNED, or JIT_FAILED on a runtime error.
+ */
+static JitStatus FinishFrame(int baseFrame)
+{
+    CallFrame* frame = &vm->frames[vm->frameCount - 1];
+    if (frame->closure->function->jitCode != NULL)
+    {
+        JitStatus status = RunNative(frame);
+        if (status != JIT_EXITED)
+        {
+            return status;
+        }
+    }
+
+    return Run(baseFrame) == INTERPRET_OK ? JIT_RETURNED : JIT_FAILED;
 }
+#endif
 
 /**
  * @brief Runs the virtual machine on a piece of code.
  * 
+ * @param baseFrame Returns once a return brings the frame count back down to this; 0 runs the script to its end.
  * @return InterpretResult The result of the code.
  */
-static InterpretResult Run()
+static InterpretResult Run(int baseFrame)
 {
-    CallFrame* frame = &vm.frames[vm.frameCount - 1];
+#ifdef COMPUTED_GOTO
+    // Threaded code jumps straight from handler to handler through these addresses
+    static void* dispatchTable[] =
+    {
+        [OP_CONSTANT] = &&LABEL_OP_CONSTANT,
+        [OP_NIL] = &&LABEL_OP_NIL,
+        [OP_TRUE] = &&LABEL_OP_TRUE,
+        [OP_FALSE] = &&LABEL_OP_FALSE,
+        [OP_POP] = &&LABEL_OP_POP,
+        [OP_GET_LOCAL] = &&LABEL_OP_GET_LOCAL,
+        [OP_SET_LOCAL] = &&LABEL_OP_SET_LOCAL,
+        [OP_GET_GLOBAL] = &&LABEL_OP_GET_GLOBAL,
+        [OP_DEFINE_GLOBAL] = &&LABEL_OP_DEFINE_GLOBAL,
+        [OP_SET_GLOBAL] = &&LABEL_OP_SET_GLOBAL,
+        [OP_GET_UPVALUE] = &&LABEL_OP_GET_UPVALUE,
+        [OP_SET_UPVALUE] = &&LABEL_OP_SET_UPVALUE,
+        [OP_GET_PROPERTY] = &&LABEL_OP_GET_PROPERTY,
+        [OP_SET_PROPERTY] = &&LABEL_OP_SET_PROPERTY,
+        [OP_GET_SUPER] = &&LABEL_OP_GET_SUPER,
+        [OP_EQUAL] = &&LABEL_OP_EQUAL,
+        [OP_GREATER] = &&LABEL_OP_GREATER,
+        [OP_LESS] = &&LABEL_OP_LESS,
+        [OP_ADD] = &&LABEL_OP_ADD,
+        [OP_SUBTRACT] = &&LABEL_OP_SUBTRACT,
+        [OP_MULTIPLY] = &&LABEL_OP_MULTIPLY,
+        [OP_DIVIDE] = &&LABEL_OP_DIVIDE,
+        [OP_NOT] = &&LABEL_OP_NOT,
+        [OP_NEGATE] = &&LABEL_OP_NEGATE,
+        [OP_PRINT] = &&LABEL_OP_PRINT,
+        [OP_JUMP] = &&LABEL_OP_JUMP,
+        [OP_JUMP_IF_FALSE] = &&LABEL_OP_JUMP_IF_FALSE,
+        [OP_LOOP] = &&LABEL_OP_LOOP,
+        [OP_CALL] = &&LABEL_OP_CALL,
+        [OP_TAIL_CALL] = &&LABEL_OP_TAIL_CALL,
+        [OP_INVOKE] = &&LABEL_OP_INVOKE,
+        [OP_SUPER_INVOKE] = &&LABEL_OP_SUPER_INVOKE,
+        [OP_CLOSURE] = &&LABEL_OP_CLOSURE,
+        [OP_CLOSE_UPVALUE] = &&LABEL_OP_CLOSE_UPVALUE,
+        [OP_RETURN] = &&LABEL_OP_RETURN,
+        [OP_CLASS] = &&LABEL_OP_CLASS,
+        [OP_INHERIT] = &&LABEL_OP_INHERIT,
+        [OP_METHOD] = &&LABEL_OP_METHOD,
+        [OP_ADD_LL] = &&LABEL_OP_ADD_LL,
+        [OP_ADD_LK] = &&LABEL_OP_ADD_LK,
+        [OP_SUBTRACT_LL] = &&LABEL_OP_SUBTRACT_LL,
+        [OP_SUBTRACT_LK] = &&LABEL_OP_SUBTRACT_LK,
+        [OP_MULTIPLY_LL] = &&LABEL_OP_MULTIPLY_LL,
+        [OP_MULTIPLY_LK] = &&LABEL_OP_MULTIPLY_LK,
+        [OP_DIVIDE_LL] = &&LABEL_OP_DIVIDE_LL,
+        [OP_DIVIDE_LK] = &&LABEL_OP_DIVIDE_LK,
+        [OP_GREATER_LL] = &&LABEL_OP_GREATER_LL,
+        [OP_GREATER_LK] = &&LABEL_OP_GREATER_LK,
+        [OP_LESS_LL] = &&LABEL_OP_LESS_LL,
+        [OP_LESS_LK] = &&LABEL_OP_LESS_LK,
+        [OP_EQUAL_LL] = &&LABEL_OP_EQUAL_LL,
+        [OP_EQUAL_LK] = &&LABEL_OP_EQUAL_LK,
+        [OP_JUMP_GREATER_LL] = &&LABEL_OP_JUMP_GREATER_LL,
+        [OP_JUMP_GREATER_LK] = &&LABEL_OP_JUMP_GREATER_LK,
+        [OP_JUMP_LESS_LL] = &&LABEL_OP_JUMP_LESS_LL,
+        [OP_JUMP_LESS_LK] = &&LABEL_OP_JUMP_LESS_LK,
+        [OP_JUMP_EQUAL_LL] = &&LABEL_OP_JUMP_EQUAL_LL,
+        [OP_JUMP_EQUAL_LK] = &&LABEL_OP_JUMP_EQUAL_LK,
+        [OP_POP_LOCAL] = &&LABEL_OP_POP_LOCAL,
+        [OP_POP_GLOBAL] = &&LABEL_OP_POP_GLOBAL,
+        [OP_POP_JUMP_IF_FALSE] = &&LABEL_OP_POP_JUMP_IF_FALSE,
+        [OP_ADD_NUMBER] = &&LABEL_OP_ADD_NUMBER,
+        [OP_ADD_STRING] = &&LABEL_OP_ADD_STRING,
+        [OP_EQUAL_NUMBER] = &&LABEL_OP_EQUAL_NUMBER,
+    };
 
-#define READ_BYTE() (*frame->ip++)
-#define READ_SHORT() \
-        (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
-#define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()])
-#define READ_STRING() AS_STRING(READ_CONSTANT())
-#define BINARY_OP(valueType, op) \
+    if (vm->handlers == NULL)
+    {
+        vm->handlers = dispatchTable;
+        return INTERPRET_OK;
+    }
+#endif
+
+    // The hot interpreter state lives in locals so it can stay in registers; it is only written
+    // back to the frame and vm->sp before anything outside Run() may look at it
+    CallFrame* frame;
+    register ThreadedCode* ip;
+    register Value* sp;
+    register Value* slots;
+
+    // Slots are only added while compiling, which a call may do for a lazily compiled function, so the
+    // global array can only have moved once a frame is loaded again
+    Value* globals = vm->globalValues.values;
+
+#define STORE_FRAME() \
+        do \
+        { \
+            frame->ip = ip; \
+            vm->sp = sp; \
+        } while (false)
+#define LOAD_FRAME() \
+        do \
+        { \
+            frame = &vm->frames[vm->frameCount - 1]; \
+            ip = frame->ip; \
+            slots = frame->slots; \
+            sp = vm->sp; \
+            globals = vm->globalValues.values; \
+        } while (false)
+#ifdef JIT_COMPILER
+// Runs a frame just pushed by a call natively if it has been compiled, then carries on with whichever
+// frame is on top: the caller once the callee returned, or the callee if its native code exited early
+#define LOAD_CALLEE() \
         do \
         { \
-            if (!IS_NUMBER(StackPeek(0)) || !IS_NUMBER(StackPeek(1))) \
+            CallFrame* callee = &vm->frames[vm->frameCount - 1]; \
+            if (callee != frame && callee->closure->function->jitCode != NULL && \
+                RunNative(callee) == JIT_FAILED) \
             { \
-                RuntimeError("Operands must be numbers."); \
                 return INTERPRET_RUNTIME_ERROR; \
             } \
-            double b = AS_NUMBER(StackPop()); \
-            double a = AS_NUMBER(StackPop()); \
-            StackPush(valueType(a op b)); \
+            LOAD_FRAME(); \
+        } while (false)
+#else
+#define LOAD_CALLEE() LOAD_FRAME()
+#endif
+#define RUNTIME_ERROR(...) \
+        do \
+        { \
+            STORE_FRAME(); \
+            RuntimeError(__VA_ARGS__); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } while (false)
+#define PUSH(value) (*sp++ = (value))
+#define POP() (*--sp)
+#define DROP() (--sp)
+#define PEEK(distance) (sp[-1 - (distance)])
+#define READ_OPERAND() ((ip++)->operand)
+#define READ_TARGET() ((ip++)->target)
+#define READ_CONSTANT() ((ip++)->value)
+#define READ_STRING() AS_STRING(READ_CONSTANT())
+#define READ_CACHE() ((ip++)->cache)
+#define READ_INVOKE_CACHE() ((ip++)->invokeCache)
+#define READ_CALL_CACHE() ((ip++)->callCache)
+#define READ_LOOP() ((ip++)->loop)
+#define READ_LOCAL() (slots[READ_OPERAND()])
+#define GLOBAL_NAME(slot) (AS_CSTRING(vm->globalNames.values[slot]))
+// Finishes an instruction on two integers while the result fits in 32 bits; anything else falls through
+// to the same operation on doubles
+#define INTEGER_OP(a, op, b, setResult) \
+        do \
+        { \
+            if (ARE_INTEGERS(a, b)) \
+            { \
+                int64_t result = (int64_t)AS_INTEGER(a) op AS_INTEGER(b); \
+                if (result >= INT32_MIN && result <= INT32_MAX) \
+                { \
+                    setResult(INTEGER_VALUE(result)); \
+                    DISPATCH(); \
+                } \
+            } \
+        } while (false)
+#define INTEGER_COMPARE(a, op, b, setResult) \
+        do \
+        { \
+            if (ARE_INTEGERS(a, b)) \
+            { \
+                setResult(BOOL_VALUE(AS_INTEGER(a) op AS_INTEGER(b))); \
+                DISPATCH(); \
+            } \
+        } while (false)
+// Multiplication and division always work on doubles, which keeps their signed zeros and fractions
+#define NO_INTEGER_FORM(a, op, b, setResult) do { } while (false)
+#define SET_BINARY(value) (PEEK(1) = (value), DROP())
+#define BINARY_OP(integerForm, valueType, op) \
+        do \
+        { \
+            integerForm(PEEK(1), op, PEEK(0), SET_BINARY); \
+            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) \
+            { \
+                RUNTIME_ERROR("Operands must be numbers."); \
+            } \
+            double b = AS_NUMBER(POP()); \
+            double a = AS_NUMBER(POP()); \
+            PUSH(valueType(a op b)); \
+        } while (false)
+#define REGISTER_OP(integerForm, valueType, op, readRight) \
+        do \
+        { \
+            Value a = READ_LOCAL(); \
+            Value b = readRight; \
+            integerForm(a, op, b, PUSH); \
+            if (!IS_NUMBER(a) || !IS_NUMBER(b)) \
+            { \
+                RUNTIME_ERROR("Operands must be numbers."); \
+            } \
+            PUSH(valueType(AS_NUMBER(a) op AS_NUMBER(b))); \
+        } while (false)
+#define REGISTER_ADD(readRight) \
+        do \
+        { \
+            Value a = READ_LOCAL(); \
+            Value b = readRight; \
+            INTEGER_OP(a, +, b, PUSH); \
+            if (IS_NUMBER(a) && IS_NUMBER(b)) \
+            { \
+                PUSH(NUMBER_VALUE(AS_NUMBER(a) + AS_NUMBER(b))); \
+            } \
+            else if (IS_STRING(a) && IS_STRING(b)) \
+            { \
+                PUSH(a); \
+                PUSH(b); \
+                STORE_FRAME(); \
+                ConcatenateStrings(); \
+                sp = vm->sp; \
+            } \
+            else \
+            { \
+                RUNTIME_ERROR("Operands must be two numbers or two strings."); \
+            } \
+        } while (false)
+#define COMPARE_JUMP(op, readRight) \
+        do \
+        { \
+            Value a = READ_LOCAL(); \
+            Value b = readRight; \
+            bool sense = READ_OPERAND(); \
+            ThreadedCode* target = READ_TARGET(); \
+            if (ARE_INTEGERS(a, b)) \
+            { \
+                if ((AS_INTEGER(a) op AS_INTEGER(b)) == sense) \
+                { \
+                    ip = target; \
+                } \
+                DISPATCH(); \
+            } \
+            if (!IS_NUMBER(a) || !IS_NUMBER(b)) \
+            { \
+                RUNTIME_ERROR("Operands must be numbers."); \
+            } \
+            if ((AS_NUMBER(a) op AS_NUMBER(b)) == sense) \
+            { \
+                ip = target; \
+            } \
         } while (false)
 
-    while (1)
-    {
-        // Debug visibility routines
+#ifdef DEBUG_CACHE_STATS
+#define CACHE_HIT(cache) ((cache)->hits++)
+#define CACHE_MISS(cache) ((cache)->misses++)
+#else
+#define CACHE_HIT(cache) do { } while (false)
+#define CACHE_MISS(cache) do { } while (false)
+#endif
+
 #ifdef DEBUG_TRACE_EXECUTION
-        // Print stack contents
-        printf("          ");
-        for (Value* slot = vm.stack; slot < vm.sp; slot++)
-        {
-            printf("[ ");
-            PrintValue(*slot);
-            printf(" ]");
-        }
-        printf("\n");
+#define TRACE_EXECUTION() \
+        do \
+        { \
+            STORE_FRAME(); \
+            TraceExecution(frame); \
+        } while (false)
+#else
+#define TRACE_EXECUTION() do { } while (false)
+#endif
+
+#ifdef DEBUG_PROFILE_OPCODES
+#define PROFILE_INSTRUCTION() \
+        ProfileInstruction(frame->chunk, frame->chunk->threadedOffsets[ip - frame->chunk->threaded])
+#else
+#define PROFILE_INSTRUCTION() do { } while (false)
+#endif
 
-        // Disassemble and print current instruction
-        DisassembleInstruction(&frame->closure->function->chunk, (int)(frame->ip - frame->closure->function->chunk.code));
+#ifdef COMPUTED_GOTO
+#define CASE(opcode) LABEL_##opcode
+#define DISPATCH() \
+        do \
+        { \
+            TRACE_EXECUTION(); \
+            PROFILE_INSTRUCTION(); \
+            goto *(ip++)->handler; \
+        } while (false)
+#define INTERPRET_LOOP DISPATCH();
+// Rewrites the instruction being run, which takes no operands, to another form of the same operation
+#define QUICKEN(form) (ip[-1].handler = dispatchTable[form])
+// Runs the instruction being run again, through whatever form QUICKEN() left it in
+#define REDISPATCH() goto *ip[-1].handler
+#else
+#define CASE(opcode) case opcode
+#define DISPATCH() goto loop
+#define INTERPRET_LOOP \
+        loop: \
+            TRACE_EXECUTION(); \
+            PROFILE_INSTRUCTION(); \
+            ip++; \
+        redispatch: \
+            switch (ip[-1].opcode)
+#define QUICKEN(form) (ip[-1].opcode = (form))
+#define REDISPATCH() goto redispatch
 #endif
 
-        uint8_t instruction = READ_BYTE();
-        switch (instruction)
+    LOAD_FRAME();
+
+    INTERPRET_LOOP
+    {
+        CASE(OP_CONSTANT):
+        {
+            Value constant = READ_CONSTANT();
+            PUSH(constant);
+            DISPATCH();
+        }
+        CASE(OP_NIL):
+        {
+            PUSH(NIL_VALUE);
+            DISPATCH();
+        }
+        CASE(OP_TRUE):
+        {
+            PUSH(BOOL_VALUE(true));
+            DISPATCH();
+        }
+        CASE(OP_FALSE):
+        {
+            PUSH(BOOL_VALUE(false));
+            DISPATCH();
+        }
+        CASE(OP_POP):
         {
-            case OP_CONSTANT:
+            DROP();
+            DISPATCH();
+        }
+        CASE(OP_GET_LOCAL):
+        {
+            uint8_t slot = READ_OPERAND();
+            PUSH(slots[slot]);
+            DISPATCH();
+        }
+        CASE(OP_SET_LOCAL):
+        {
+            uint8_t slot = READ_OPERAND();
+            slots[slot] = PEEK(0);
+            DISPATCH();
+        }
+        CASE(OP_GET_GLOBAL):
+        {
+            int slot = READ_OPERAND();
+            Value value = globals[slot];
+            if (IS_UNDEFINED(value))
             {
-                Value constant = READ_CONSTANT();
-                StackPush(constant);
-                break;
+                RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_NAME(slot));
             }
-            case OP_NIL:
+            PUSH(value);
+            DISPATCH();
+        }
+        CASE(OP_DEFINE_GLOBAL):
+        {
+            globals[READ_OPERAND()] = POP();
+            DISPATCH();
+        }
+        CASE(OP_SET_GLOBAL):
+        {
+            int slot = READ_OPERAND();
+            if (IS_UNDEFINED(globals[slot]))
             {
-                StackPush(NIL_VALUE);
-                break;
+                RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_NAME(slot));
             }
-            case OP_TRUE:
+            globals[slot] = PEEK(0);
+            DISPATCH();
+        }
+        CASE(OP_GET_UPVALUE):
+        {
+            uint8_t slot = READ_OPERAND();
+            PUSH(*frame->closure->upvalues[slot]->location);
+            DISPATCH();
+        }
+        CASE(OP_SET_UPVALUE):
+        {
+            uint8_t slot = READ_OPERAND();
+            *frame->closure->upvalues[slot]->location = PEEK(0);
+            DISPATCH();
+        }
+        CASE(OP_GET_PROPERTY):
+        {
+            if (!IS_INSTANCE(PEEK(0)))
             {
-                StackPush(BOOL_VALUE(true));
-                break;
+                RUNTIME_ERROR("Only instances have properties.");
             }
-            case OP_FALSE:
+
+            ObjectInstance* instance = AS_INSTANCE(PEEK(0));
+            ObjectString* name = READ_STRING();
+            InlineCache* cache = READ_CACHE();
+            ObjectShape* shape = instance->shape;
+
+            if (shape != NULL && shape == cache->shape)
             {
-                StackPush(BOOL_VALUE(false));
-                break;
+                if (cache->method == NULL)
+                {
+                    CACHE_HIT(cache);
+                    PEEK(0) = instance->fields[cache->index];
+                    DISPATCH();
+                }
+                if (cache->version == instance->_class->methodVersion)
+                {
+                    CACHE_HIT(cache);
+                    STORE_FRAME();
+                    PEEK(0) = OBJECT_VALUE(NewBoundMethod(PEEK(0), cache->method));
+                    DISPATCH();
+                }
             }
-            case OP_POP:
+            CACHE_MISS(cache);
+
+            // Search for a field first
+            Value value;
+            int index = shape != NULL ? ShapeFieldIndex(shape, name) : -1;
+            if (index != -1)
             {
-                StackPop();
-                break;
+                cache->shape = shape;
+                cache->method = NULL;
+                cache->index = index;
+                PEEK(0) = instance->fields[index];
+                DISPATCH();
             }
-            case OP_GET_LOCAL:
+            if (shape == NULL && TableGet(&instance->dictionary, name, &value))
             {
-                uint8_t slot = READ_BYTE();
-                StackPush(frame->slots[slot]);
-                break;
+                PEEK(0) = value;
+                DISPATCH();
             }
-            case OP_SET_LOCAL:
+
+            // No field, assume method and search
+            if (!TableGet(&instance->_class->methods, name, &value))
             {
-                uint8_t slot = READ_BYTE();
-                frame->slots[slot] = StackPeek(0);
-                break;
+                RUNTIME_ERROR("Undefined property '%s'.", name->chars);
             }
-            case OP_GET_GLOBAL:
+            if (shape != NULL)
             {
-                ObjectString* name = READ_STRING();
-                Value value;
-                if (!TableGet(&vm.globals, name, &value))
-                {
-                    RuntimeError("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                StackPush(value);
-                break;
+                cache->shape = shape;
+                cache->method = AS_CLOSURE(value);
+                cache->version = instance->_class->methodVersion;
             }
-            case OP_DEFINE_GLOBAL:
+            STORE_FRAME();
+            PEEK(0) = OBJECT_VALUE(NewBoundMethod(PEEK(0), AS_CLOSURE(value)));
+            DISPATCH();
+        }
+        CASE(OP_SET_PROPERTY):
+        {
+            if (!IS_INSTANCE(PEEK(1)))
             {
-                ObjectString* name = READ_STRING();
-                TableSet(&vm.globals, name, StackPeek(0));
-                StackPop();
-                break;
+                RUNTIME_ERROR("Only instances have fields.");
             }
-            case OP_SET_GLOBAL:
+
+            ObjectInstance* instance = AS_INSTANCE(PEEK(1));
+            ObjectString* name = READ_STRING();
+            InlineCache* cache = READ_CACHE();
+            ObjectShape* shape = instance->shape;
+
+            // A cached transition only applies while the instance still has room for the new field
+            if (shape != NULL && shape == cache->shape &&
+                (cache->transition == NULL || cache->index < instance->fieldCapacity))
             {
-                ObjectString* name = READ_STRING();
-                if (TableSet(&vm.globals, name, StackPeek(0)))
+                CACHE_HIT(cache);
+                instance->fields[cache->index] = PEEK(0);
+                if (cache->transition != NULL)
                 {
-                    TableDelete(&vm.globals, name);
-                    RuntimeError("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
+                    instance->shape = cache->transition;
                 }
-                break;
             }
-            case OP_GET_UPVALUE:
+            else
             {
-                uint8_t slot = READ_BYTE();
-                StackPush(*frame->closure->upvalues[slot]->location);
-                break;
-            }
-            case OP_SET_UPVALUE:
-            {
-                uint8_t slot = READ_BYTE();
-                *frame->closure->upvalues[slot]->location = StackPeek(0);
-                break;
-            }
-            case OP_GET_PROPERTY:
-            {
-                if (!IS_INSTANCE(StackPeek(0)))
+                CACHE_MISS(cache);
+                STORE_FRAME();
+                InstanceSet(instance, name, PEEK(0));
+                if (shape != NULL && instance->shape != NULL)
                 {
-                    RuntimeError("Only instances have properties.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    cache->shape = shape;
+                    cache->transition = instance->shape != shape ? instance->shape : NULL;
+                    cache->index = ShapeFieldIndex(instance->shape, name);
                 }
+            }
 
-                ObjectInstance* instance = AS_INSTANCE(StackPeek(0));
-                ObjectString* name = READ_STRING();
-
-                // Search for a field first
-                Value value;
-                if (TableGet(&instance->fields, name, &value))
-                {
-                    StackPop();
-                    StackPush(value);
-                    break;
-                }
+            Value value = POP();
+            PEEK(0) = value;
+            DISPATCH();
+        }
+        CASE(OP_GET_SUPER):
+        {
+            ObjectString* name = READ_STRING();
+            ObjectClass* superclass = AS_CLASS(POP());
 
-                // No field, assume method and search
-                if (!BindMethod(instance->_class, name))
-                {
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
+            STORE_FRAME();
+            if (!BindMethod(superclass, name))
+            {
+                return INTERPRET_RUNTIME_ERROR;
             }
-            case OP_SET_PROPERTY:
+            sp = vm->sp;
+            DISPATCH();
+        }
+        CASE(OP_EQUAL):
+        {
+            Value b = POP();
+            Value a = POP();
+            if (IS_NUMBER(a) && IS_NUMBER(b))
             {
-                if (!IS_INSTANCE(StackPeek(1)))
-                {
-                    RuntimeError("Only instances have fields.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-
-                ObjectInstance* instance = AS_INSTANCE(StackPeek(1));
-                TableSet(&instance->fields, READ_STRING(), StackPeek(0));
-                Value value = StackPop();
-                StackPop();
-                StackPush(value);
-                break;
+                QUICKEN(OP_EQUAL_NUMBER);
+                PUSH(BOOL_VALUE(AS_NUMBER(a) == AS_NUMBER(b)));
             }
-            case OP_GET_SUPER:
+            else
             {
-                ObjectString* name = READ_STRING();
-                ObjectClass* superclass = AS_CLASS(StackPop());
-
-                if (!BindMethod(superclass, name))
-                {
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
+                PUSH(BOOL_VALUE(AreValuesEqual(a, b)));
             }
-            case OP_EQUAL:
+            DISPATCH();
+        }
+        CASE(OP_GREATER):
+        {
+            BINARY_OP(INTEGER_COMPARE, BOOL_VALUE, >);
+            DISPATCH();
+        }
+        CASE(OP_LESS):
+        {
+            BINARY_OP(INTEGER_COMPARE, BOOL_VALUE, <);
+            DISPATCH();
+        }
+        CASE(OP_ADD):
+        {
+            Value b = PEEK(0);
+            Value a = PEEK(1);
+            if (IS_NUMBER(a) && IS_NUMBER(b))
             {
-                Value b = StackPop();
-                Value a = StackPop();
-                StackPush(BOOL_VALUE(AreValuesEqual(a, b)));
-                break;
+                QUICKEN(OP_ADD_NUMBER);
+                INTEGER_OP(a, +, b, SET_BINARY);
+                SET_BINARY(NUMBER_VALUE(AS_NUMBER(a) + AS_NUMBER(b)));
             }
-            case OP_GREATER:
+            else if (IS_STRING(a) && IS_STRING(b))
             {
-                BINARY_OP(BOOL_VALUE, >);
-                break;
+                QUICKEN(OP_ADD_STRING);
+                STORE_FRAME();
+                ConcatenateStrings();
+                sp = vm->sp;
             }
-            case OP_LESS:
+            else
             {
-                BINARY_OP(BOOL_VALUE, <);
-                break;
+                RUNTIME_ERROR("Operands must be two numbers or two strings.");
             }
-            case OP_ADD:
+            DISPATCH();
+        }
+        CASE(OP_SUBTRACT):
+        {
+            BINARY_OP(INTEGER_OP, NUMBER_VALUE, -);
+            DISPATCH();
+        }
+        CASE(OP_MULTIPLY):
+        {
+            BINARY_OP(NO_INTEGER_FORM, NUMBER_VALUE, *);
+            DISPATCH();
+        }
+        CASE(OP_DIVIDE):
+        {
+            BINARY_OP(NO_INTEGER_FORM, NUMBER_VALUE, /);
+            DISPATCH();
+        }
+        CASE(OP_NOT):
+        {
+            PEEK(0) = BOOL_VALUE(IsFalsey(PEEK(0)));
+            DISPATCH();
+        }
+        CASE(OP_NEGATE):
+        {
+            if (!IS_NUMBER(PEEK(0)))
             {
-                if (IS_STRING(StackPeek(0)) && IS_STRING(StackPeek(1)))
-                {
-                    ConcatenateStrings();
-                }
-                else if (IS_NUMBER(StackPeek(0)) && IS_NUMBER(StackPeek(1)))
-                {
-                    double b = AS_NUMBER(StackPop());
-                    double a = AS_NUMBER(StackPop());
-                    StackPush(NUMBER_VALUE(a + b));
-                }
-                else
-                {
-                    RuntimeError("Operands must be two numbers or two strings.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                break;
+                RUNTIME_ERROR("Operand must be a number.");
             }
-            case OP_SUBTRACT:
+            PEEK(0) = NUMBER_VALUE(-AS_NUMBER(PEEK(0)));
+            DISPATCH();
+        }
+        CASE(OP_PRINT):
+        {
+            PrintValue(vm->options.output, POP());
+            fputc('\n', vm->options.output);
+            fflush(vm->options.output);
+            DISPATCH();
+        }
+        CASE(OP_JUMP):
+        {
+            ip = ip->target;
+            DISPATCH();
+        }
+        CASE(OP_JUMP_IF_FALSE):
+        {
+            ThreadedCode* target = READ_TARGET();
+            if (IsFalsey(PEEK(0)))
             {
-                BINARY_OP(NUMBER_VALUE, -);
-                break;
+                ip = target;
             }
-            case OP_MULTIPLY:
+            DISPATCH();
+        }
+        CASE(OP_LOOP):
+        {
+#ifdef TRACE_RECORDER
+            ThreadedCode* header = READ_TARGET();
+            LoopAnchor* loop = READ_LOOP();
+            ip = header;
+#ifdef JIT_COMPILER
+            // A compiled trace runs the loop until one of its guards fails
+            if (loop->trace != NULL)
             {
-                BINARY_OP(NUMBER_VALUE, *);
-                break;
+                STORE_FRAME();
+                RunTrace(loop->trace, frame);
+                LOAD_FRAME();
+                DISPATCH();
             }
-            case OP_DIVIDE:
+#endif
+            if (loop->attempts < TRACE_MAX_ATTEMPTS && ++loop->hits > vm->options.traceThreshold)
             {
-                BINARY_OP(NUMBER_VALUE, /);
-                break;
+                STORE_FRAME();
+                RecordTrace(loop, frame);
+                LOAD_FRAME();
             }
-            case OP_NOT:
+#else
+            ip = ip->target;
+#endif
+            DISPATCH();
+        }
+        CASE(OP_CALL):
+        {
+            int argCount = READ_OPERAND();
+            CallCache* cache = READ_CALL_CACHE();
+            Value callee = PEEK(argCount);
+            STORE_FRAME();
+            if (IS_OBJECT(callee) && AS_OBJECT(callee) == (Object*)cache->closure)
             {
-                StackPush(BOOL_VALUE(IsFalsey(StackPop())));
-                break;
+                // The arity was checked when the closure was cached, so its frame can go straight on
+                CACHE_HIT(cache);
+                if (!PushFrame(cache->closure, sp - argCount - 1))
+                {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
             }
-            case OP_NEGATE:
+            else
             {
-                if (!IS_NUMBER(StackPeek(0)))
+                // A bound method may be collected once its receiver has replaced it on the stack
+                CACHE_MISS(cache);
+                bool isClosure = IS_CLOSURE(callee);
+                if (!CallValue(callee, argCount))
                 {
-                    RuntimeError("Operand must be a number.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                StackPush(NUMBER_VALUE(-AS_NUMBER(StackPop())));
-                break;
+                if (isClosure)
+                {
+                    cache->closure = AS_CLOSURE(callee);
+                }
             }
-            case OP_PRINT:
+            LOAD_CALLEE();
+            DISPATCH();
+        }
+        CASE(OP_TAIL_CALL):
+        {
+            int argCount = READ_OPERAND();
+            CallCache* cache = READ_CALL_CACHE();
+            Value callee = PEEK(argCount);
+            STORE_FRAME();
+            ObjectClosure* closure;
+            if (IS_OBJECT(callee) && AS_OBJECT(callee) == (Object*)cache->closure)
             {
-                PrintValue(StackPop());
-                printf("\n");
-                fflush(stdout);
-                break;
+                CACHE_HIT(cache);
+                closure = cache->closure;
             }
-            case OP_JUMP:
+            else if (IS_CLOSURE(callee) || IS_BOUND_METHOD(callee))
             {
-                uint16_t offset = READ_SHORT();
-                frame->ip += offset;
-                break;
+                CACHE_MISS(cache);
+                if (IS_BOUND_METHOD(callee))
+                {
+                    PEEK(argCount) = AS_BOUND_METHOD(callee)->receiver;
+                    closure = AS_BOUND_METHOD(callee)->method;
+                }
+                else
+                {
+                    closure = AS_CLOSURE(callee);
+                }
+
+                if (argCount != closure->function->arity)
+                {
+                    RUNTIME_ERROR("Expected %d arguments but got %d.", closure->function->arity, argCount);
+                }
+                if (IS_CLOSURE(callee))
+                {
+                    cache->closure = closure;
+                }
             }
-            case OP_JUMP_IF_FALSE:
+            else
             {
-                uint16_t offset = READ_SHORT();
-                if (IsFalsey(StackPeek(0)))
+                // Natives and classes are called as usual, leaving their result to the return that follows
+                CACHE_MISS(cache);
+                if (!CallValue(callee, argCount))
                 {
-                    frame->ip += offset;
+                    return INTERPRET_RUNTIME_ERROR;
                 }
-                break;
+                LOAD_CALLEE();
+                DISPATCH();
             }
-            case OP_LOOP:
+
+            if (!ReuseFrame(closure, argCount))
             {
-                uint16_t offset = READ_SHORT();
-                frame->ip -= offset;
-                break;
+                return INTERPRET_RUNTIME_ERROR;
             }
-            case OP_CALL:
+            LOAD_FRAME();
+#ifdef JIT_COMPILER
+            // The frame now belongs to the callee, which runs natively if it can
+            if (closure->function->jitCode != NULL)
             {
-                int argCount = READ_BYTE();
-                if (!CallValue(StackPeek(argCount), argCount))
+                JitStatus status = RunNative(frame);
+                if (status == JIT_FAILED)
                 {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+                if (status == JIT_RETURNED && vm->frameCount == baseFrame)
+                {
+                    return INTERPRET_OK;
+                }
+                LOAD_FRAME();
             }
-            case OP_INVOKE:
+#endif
+            DISPATCH();
+        }
+        CASE(OP_INVOKE):
+        {
+            ObjectString* method = READ_STRING();
+            int argCount = READ_OPERAND();
+            InvokeCache* cache = READ_INVOKE_CACHE();
+            STORE_FRAME();
+            if (!Invoke(method, argCount, cache))
             {
-                ObjectString* method = READ_STRING();
-                int argCount = READ_BYTE();
-                if (!Invoke(method, argCount))
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_CALLEE();
+            DISPATCH();
+        }
+        CASE(OP_SUPER_INVOKE):
+        {
+            ObjectString* method = READ_STRING();
+            int argCount = READ_OPERAND();
+            InvokeCache* cache = READ_INVOKE_CACHE();
+            ObjectClass* superclass = AS_CLASS(POP());
+            STORE_FRAME();
+
+            ObjectClosure* cached = FindCachedMethod(cache, (Object*)superclass, superclass);
+            if (cached != NULL ? !Call(cached, argCount)
+                               : !InvokeFromClass(superclass, method, argCount, cache, (Object*)superclass))
+            {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_CALLEE();
+            DISPATCH();
+        }
+        CASE(OP_CLOSURE):
+        {
+            ObjectFunction* function = AS_FUNCTION(READ_CONSTANT());
+            STORE_FRAME();
+            ObjectClosure* closure = NewClosure(function);
+            PUSH(OBJECT_VALUE(closure));
+            vm->sp = sp;
+            for (int i = 0; i < closure->upvalueCount; i++)
+            {
+                uint8_t isLocal = READ_OPERAND();
+                uint8_t index = READ_OPERAND();
+                if (isLocal)
                 {
-                    return INTERPRET_RUNTIME_ERROR;
+                    closure->upvalues[i] = CaptureUpvalue(slots + index);
                 }
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+                else
+                {
+                    closure->upvalues[i] = frame->closure->upvalues[index];
+                }
+            }
+            DISPATCH();
+        }
+        CASE(OP_CLOSE_UPVALUE):
+        {
+            CloseUpvalues(sp - 1);
+            DROP();
+            DISPATCH();
+        }
+        CASE(OP_RETURN):
+        {
+            Value result = POP();
+            CloseUpvalues(slots);
+            vm->frameCount--;
+            sp = slots;
+            PUSH(result);
+            if (vm->frameCount == baseFrame)
+            {
+                vm->sp = sp;
+                return INTERPRET_OK;
+            }
+
+            frame = &vm->frames[vm->frameCount - 1];
+            ip = frame->ip;
+            slots = frame->slots;
+            DISPATCH();
+        }
+        CASE(OP_CLASS):
+        {
+            ObjectString* name = READ_STRING();
+            STORE_FRAME();
+            PUSH(OBJECT_VALUE(NewClass(name)));
+            DISPATCH();
+        }
+        CASE(OP_INHERIT):
+        {
+            Value superclass = PEEK(1);
+            if (!IS_CLASS(superclass))
+            {
+                RUNTIME_ERROR("Superclass must be a class.");
             }
-            case OP_SUPER_INVOKE:
+
+            ObjectClass* subclass = AS_CLASS(PEEK(0));
+            STORE_FRAME();
+            TableCopy(&AS_CLASS(superclass)->methods, &subclass->methods);
+            subclass->methodVersion++;
+            DROP();
+            DISPATCH();
+        }
+        CASE(OP_METHOD):
+        {
+            ObjectString* name = READ_STRING();
+            STORE_FRAME();
+            DefineMethod(name);
+            sp = vm->sp;
+            DISPATCH();
+        }
+        CASE(OP_ADD_LL):
+        {
+            REGISTER_ADD(READ_LOCAL());
+            DISPATCH();
+        }
+        CASE(OP_ADD_LK):
+        {
+            REGISTER_ADD(READ_CONSTANT());
+            DISPATCH();
+        }
+        CASE(OP_SUBTRACT_LL):
+        {
+            REGISTER_OP(INTEGER_OP, NUMBER_VALUE, -, READ_LOCAL());
+            DISPATCH();
+        }
+        CASE(OP_SUBTRACT_LK):
+        {
+            REGISTER_OP(INTEGER_OP, NUMBER_VALUE, -, READ_CONSTANT());
+            DISPATCH();
+        }
+        CASE(OP_MULTIPLY_LL):
+        {
+            REGISTER_OP(NO_INTEGER_FORM, NUMBER_VALUE, *, READ_LOCAL());
+            DISPATCH();
+        }
+        CASE(OP_MULTIPLY_LK):
+        {
+            REGISTER_OP(NO_INTEGER_FORM, NUMBER_VALUE, *, READ_CONSTANT());
+            DISPATCH();
+        }
+        CASE(OP_DIVIDE_LL):
+        {
+            REGISTER_OP(NO_INTEGER_FORM, NUMBER_VALUE, /, READ_LOCAL());
+            DISPATCH();
+        }
+        CASE(OP_DIVIDE_LK):
+        {
+            REGISTER_OP(NO_INTEGER_FORM, NUMBER_VALUE, /, READ_CONSTANT());
+            DISPATCH();
+        }
+        CASE(OP_GREATER_LL):
+        {
+            REGISTER_OP(INTEGER_COMPARE, BOOL_VALUE, >, READ_LOCAL());
+            DISPATCH();
+        }
+        CASE(OP_GREATER_LK):
+        {
+            REGISTER_OP(INTEGER_COMPARE, BOOL_VALUE, >, READ_CONSTANT());
+            DISPATCH();
+        }
+        CASE(OP_LESS_LL):
+        {
+            REGISTER_OP(INTEGER_COMPARE, BOOL_VALUE, <, READ_LOCAL());
+            DISPATCH();
+        }
+        CASE(OP_LESS_LK):
+        {
+            REGISTER_OP(INTEGER_COMPARE, BOOL_VALUE, <, READ_CONSTANT());
+            DISPATCH();
+        }
+        CASE(OP_EQUAL_LL):
+        {
+            Value a = READ_LOCAL();
+            Value b = READ_LOCAL();
+            PUSH(BOOL_VALUE(AreValuesEqual(a, b)));
+            DISPATCH();
+        }
+        CASE(OP_EQUAL_LK):
+        {
+            Value a = READ_LOCAL();
+            Value b = READ_CONSTANT();
+            PUSH(BOOL_VALUE(AreValuesEqual(a, b)));
+            DISPATCH();
+        }
+        CASE(OP_JUMP_GREATER_LL):
+        {
+            COMPARE_JUMP(>, READ_LOCAL());
+            DISPATCH();
+        }
+        CASE(OP_JUMP_GREATER_LK):
+        {
+            COMPARE_JUMP(>, READ_CONSTANT());
+            DISPATCH();
+        }
+        CASE(OP_JUMP_LESS_LL):
+        {
+            COMPARE_JUMP(<, READ_LOCAL());
+            DISPATCH();
+        }
+        CASE(OP_JUMP_LESS_LK):
+        {
+            COMPARE_JUMP(<, READ_CONSTANT());
+            DISPATCH();
+        }
+        CASE(OP_JUMP_EQUAL_LL):
+        {
+            Value a = READ_LOCAL();
+            Value b = READ_LOCAL();
+            bool sense = READ_OPERAND();
+            ThreadedCode* target = READ_TARGET();
+            if (AreValuesEqual(a, b) == sense)
             {
-                ObjectString* method = READ_STRING();
-                int argCount= READ_BYTE();
-                ObjectClass* superclass = AS_CLASS(StackPop());
-                if (!InvokeFromClass(superclass, method, argCount))
-                {
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+                ip = target;
             }
-            case OP_CLOSURE:
+            DISPATCH();
+        }
+        CASE(OP_JUMP_EQUAL_LK):
+        {
+            Value a = READ_LOCAL();
+            Value b = READ_CONSTANT();
+            bool sense = READ_OPERAND();
+            ThreadedCode* target = READ_TARGET();
+            if (AreValuesEqual(a, b) == sense)
             {
-                ObjectFunction* function = AS_FUNCTION(READ_CONSTANT());
-                ObjectClosure* closure = NewClosure(function);
-                StackPush(OBJECT_VALUE(closure));
-                for (int i = 0; i < closure->upvalueCount; i++)
-                {
-                    uint8_t isLocal = READ_BYTE();
-                    uint8_t index = READ_BYTE();
-                    if (isLocal)
-                    {
-                        closure->upvalues[i] = CaptureUpvalue(frame->slots + index);
-                    }
-                    else
-                    {
-                        closure->upvalues[i] = frame->closure->upvalues[index];
-                    }
-                }
-                break;
+                ip = target;
             }
-            case OP_CLOSE_UPVALUE:
+            DISPATCH();
+        }
+        CASE(OP_POP_LOCAL):
+        {
+            uint8_t slot = READ_OPERAND();
+            slots[slot] = POP();
+            DISPATCH();
+        }
+        CASE(OP_POP_GLOBAL):
+        {
+            int slot = READ_OPERAND();
+            if (IS_UNDEFINED(globals[slot]))
             {
-                CloseUpvalues(vm.sp - 1);
-                StackPop();
-                break;
+                RUNTIME_ERROR("Undefined variable '%s'.", GLOBAL_NAME(slot));
             }
-            case OP_RETURN:
+            globals[slot] = POP();
+            DISPATCH();
+        }
+        CASE(OP_POP_JUMP_IF_FALSE):
+        {
+            ThreadedCode* target = READ_TARGET();
+            if (IsFalsey(POP()))
             {
-                Value result = StackPop();
-                CloseUpvalues(frame->slots);
-                vm.frameCount--;
-                if (vm.frameCount == 0)
-                {
-                    StackPop();
-                    return INTERPRET_OK;
-                }
-                
-                vm.sp = frame->slots;
-                StackPush(result);
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+                ip = target;
             }
-            case OP_CLASS:
+            DISPATCH();
+        }
+        CASE(OP_ADD_NUMBER):
+        {
+            Value b = PEEK(0);
+            Value a = PEEK(1);
+            INTEGER_OP(a, +, b, SET_BINARY);
+            if (!IS_NUMBER(a) || !IS_NUMBER(b))
             {
-                StackPush(OBJECT_VALUE(NewClass(READ_STRING())));
-                break;
+                QUICKEN(OP_ADD);
+                REDISPATCH();
             }
-            case OP_INHERIT:
+            SET_BINARY(NUMBER_VALUE(AS_NUMBER(a) + AS_NUMBER(b)));
+            DISPATCH();
+        }
+        CASE(OP_ADD_STRING):
+        {
+            if (!IS_STRING(PEEK(0)) || !IS_STRING(PEEK(1)))
             {
-                Value superclass = StackPeek(1);
-                if (!IS_CLASS(superclass))
-                {
-                    RuntimeError("Superclass must be a class.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-
-                ObjectClass* subclass = AS_CLASS(StackPeek(0));
-                TableCopy(&AS_CLASS(superclass)->methods, &subclass->methods);
-                StackPop();
-                break;
+                QUICKEN(OP_ADD);
+                REDISPATCH();
             }
-            case OP_METHOD:
+            STORE_FRAME();
+            ConcatenateStrings();
+            sp = vm->sp;
+            DISPATCH();
+        }
+        CASE(OP_EQUAL_NUMBER):
+        {
+            Value b = PEEK(0);
+            Value a = PEEK(1);
+            INTEGER_COMPARE(a, ==, b, SET_BINARY);
+            if (!IS_NUMBER(a) || !IS_NUMBER(b))
             {
-                DefineMethod(READ_STRING());
-                break;
+                QUICKEN(OP_EQUAL);
+                REDISPATCH();
             }
+            SET_BINARY(BOOL_VALUE(AS_NUMBER(a) == AS_NUMBER(b)));
+            DISPATCH();
         }
     }
 
-#undef READ_BYTE
-#undef READ_SHORT
+    // Unknown opcode, should never be reached
+    return INTERPRET_RUNTIME_ERROR;
+
+#undef STORE_FRAME
+#undef LOAD_FRAME
+#undef LOAD_CALLEE
+#undef RUNTIME_ERROR
+#undef PUSH
+#undef POP
+#undef DROP
+#undef PEEK
+#undef READ_OPERAND
+#undef READ_TARGET
 #undef READ_CONSTANT
 #undef READ_STRING
+#undef READ_CACHE
+#undef READ_INVOKE_CACHE
+#undef READ_CALL_CACHE
+#undef READ_LOOP
+#undef READ_LOCAL
+#undef GLOBAL_NAME
+#undef INTEGER_OP
+#undef INTEGER_COMPARE
+#undef NO_INTEGER_FORM
+#undef SET_BINARY
 #undef BINARY_OP
+#undef REGISTER_OP
+#undef REGISTER_ADD
+#undef COMPARE_JUMP
+#undef CACHE_HIT
+#undef CACHE_MISS
+#undef TRACE_EXECUTION
+#undef PROFILE_INSTRUCTION
+#undef CASE
+#undef DISPATCH
+#undef INTERPRET_LOOP
+#undef QUICKEN
+#undef REDISPATCH
+}
+
+#ifdef DEBUG_TRACE_EXECUTION
+/**
+ * @brief Prints the stack contents and the instruction about to execute.
+ * 
+ * @param frame The CallFrame currently executing.
+ */
+static void TraceExecution(CallFrame* frame)
+{
+    // Print stack contents
+    printf("          ");
+    for (Value* slot = vm->stack; slot < vm->sp; slot++)
+    {
+        printf("[ ");
+        PrintValue(stdout, *slot);
+        printf(" ]");
+    }
+    printf("\n");
+
+    // Disassemble and print current instruction
+    DisassembleInstruction(frame->chunk, frame->chunk->threadedOffsets[frame->ip - frame->chunk->threaded]);
 }
+#endif
 
 /**
  * @brief Captures a local Value as an upvalue.
@@ -497,7 +1452,7 @@ static ObjectUpvalue* CaptureUpvalue(Value* local)
 {
     // Look for existing upvalue, don't duplicate!
     ObjectUpvalue* prevUpvalue = NULL;
-    ObjectUpvalue* upvalue = vm.openUpvalues;
+    ObjectUpvalue* upvalue = vm->openUpvalues;
     while (upvalue != NULL && upvalue->location > local)
     {
         prevUpvalue = upvalue;
@@ -514,7 +1469,7 @@ static ObjectUpvalue* CaptureUpvalue(Value* local)
 
     if (prevUpvalue == NULL)
     {
-        vm.openUpvalues = newUpvalue;
+        vm->openUpvalues = newUpvalue;
     }
     else
     {
@@ -531,12 +1486,12 @@ static ObjectUpvalue* CaptureUpvalue(Value* local)
  */
 static void CloseUpvalues(Value* last)
 {
-    while (vm.openUpvalues != NULL && vm.openUpvalues->location >= last)
+    while (vm->openUpvalues != NULL && vm->openUpvalues->location >= last)
     {
-        ObjectUpvalue* upvalue = vm.openUpvalues;
+        ObjectUpvalue* upvalue = vm->openUpvalues;
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
-        vm.openUpvalues = upvalue->next;
+        vm->openUpvalues = upvalue->next;
     }
 }
 
@@ -557,15 +1512,15 @@ static bool CallValue(Value callee, int argCount)
             case OBJECT_BOUND_METHOD:
             {
                 ObjectBoundMethod* bound = AS_BOUND_METHOD(callee);
-                vm.sp[-argCount - 1] = bound->receiver;
+                vm->sp[-argCount - 1] = bound->receiver;
                 return Call(bound->method, argCount);
             }
             case OBJECT_CLASS:
             {
                 ObjectClass* _class = AS_CLASS(callee);
-                vm.sp[-argCount - 1] = OBJECT_VALUE(NewInstance(_class));
+                vm->sp[-argCount - 1] = OBJECT_VALUE(NewInstance(_class));
                 Value initializer;
-                if (TableGet(&_class->methods, vm.initString, &initializer))
+                if (TableGet(&_class->methods, vm->initString, &initializer))
                 {
                     return Call(AS_CLOSURE(initializer), argCount);
                 }
@@ -581,8 +1536,8 @@ static bool CallValue(Value callee, int argCount)
             case OBJECT_NATIVE:
             {
                 NativeFn native = AS_NATIVE(callee);
-                Value result = native(argCount, vm.sp - argCount);
-                vm.sp -= argCount + 1;
+                Value result = native(argCount, vm->sp - argCount);
+                vm->sp -= argCount + 1;
                 StackPush(result);
                 return true;
             }
@@ -610,16 +1565,157 @@ static bool Call(ObjectClosure* closure, int argCount)
         return false;
     }
 
-    if (vm.frameCount == FRAMES_MAX)
+    return PushFrame(closure, vm->sp - argCount - 1);
+}
+
+/**
+ * @brief Pushes the frame of a call whose arguments are known to match, growing the stacks if it has to.
+ * 
+ * A function whose body was only skimmed is compiled first, and one restored from a heap snapshot is
+ * threaded first.
+ * 
+ * @param closure The function closure being called, taking exactly the arguments on the stack.
+ * @param slots The first stack slot of the frame, holding the callee.
+ * @return true The frame was pushed.
+ * @return false The call would overflow the stack, or the callee's body does not compile.
+ */
+static inline bool PushFrame(ObjectClosure* closure, Value* slots)
+{
+    int stackSize = closure->function->chunk.stackSize;
+    if (vm->frameCount == vm->frameCapacity || vm->sp + stackSize > vm->stackEnd)
     {
-        RuntimeError("Stack overflow.");
-        return false;
+        if (closure->function->lazy != NULL)
+        {
+            if (!CompileLazyBody(closure->function))
+            {
+                RuntimeError("Could not compile function '%s'.", closure->function->name->chars);
+                return false;
+            }
+            stackSize = closure->function->chunk.stackSize;
+        }
+        else if (closure->function->chunk.threaded == NULL)
+        {
+            ThreadChunk(&closure->function->chunk);
+            stackSize = closure->function->chunk.stackSize;
+        }
+
+        // The stack may move, taking the frame's slots with it
+        int base = (int)(slots - vm->stack);
+        if (!GrowStacks((int)(vm->sp - vm->stack) + stackSize))
+        {
+            return false;
+        }
+        slots = vm->stack + base;
+    }
+
+#ifdef JIT_COMPILER
+    // Compile exactly once, when the function turns hot; counting stops there, and failures stay interpreted
+    ObjectFunction* function = closure->function;
+    if (function->callCount <= vm->options.jitThreshold && function->callCount++ == vm->options.jitThreshold)
+    {
+        CompileNative(function);
     }
+#endif
 
-    CallFrame* frame = &vm.frames[vm.frameCount++];
+    CallFrame* frame = &vm->frames[vm->frameCount++];
     frame->closure = closure;
-    frame->ip = closure->function->chunk.code;
-    frame->slots = vm.sp - argCount - 1;
+    frame->chunk = &closure->function->chunk;
+    frame->ip = frame->chunk->threaded;
+    frame->slots = slots;
+    frame->tailCalls = 0;
+    return true;
+}
+
+/**
+ * @brief Makes room for one more frame and for a number of stack slots.
+ * 
+ * Moving the value stack moves every pointer into it: vm->sp, the slots of each frame and the location
+ * of each open upvalue.
+ * 
+ * @param neededSlots The number of stack slots that have to fit.
+ * @return true There is room.
+ * @return false Another frame would go past vm->options.maxFrames, which has been reported as a stack overflow.
+ */
+static bool GrowStacks(int neededSlots)
+{
+    if (vm->frameCount == vm->frameCapacity)
+    {
+        if (vm->frameCount >= vm->options.maxFrames)
+        {
+            RuntimeError("Stack overflow.");
+            return false;
+        }
+
+        int capacity = vm->frameCapacity < FRAMES_INITIAL ? FRAMES_INITIAL : GROW_CAPACITY(vm->frameCapacity);
+        if (capacity > vm->options.maxFrames)
+        {
+            capacity = vm->options.maxFrames;
+        }
+        CallFrame* frames = (CallFrame*)realloc(vm->frames, sizeof(CallFrame) * capacity);
+        if (frames == NULL)
+        {
+            exit(EXIT_FAILURE);
+        }
+        vm->frames = frames;
+        vm->frameCapacity = capacity;
+    }
+
+    int stackCapacity = (int)(vm->stackEnd - vm->stack);
+    if (neededSlots > stackCapacity)
+    {
+        while (stackCapacity < neededSlots)
+        {
+            stackCapacity = GROW_CAPACITY(stackCapacity);
+        }
+
+        Value* stack = (Value*)realloc(vm->stack, sizeof(Value) * stackCapacity);
+        if (stack == NULL)
+        {
+            exit(EXIT_FAILURE);
+        }
+        if (stack != vm->stack)
+        {
+            vm->sp = stack + (vm->sp - vm->stack);
+            for (int i = 0; i < vm->frameCount; i++)
+            {
+                vm->frames[i].slots = stack + (vm->frames[i].slots - vm->stack);
+            }
+            for (ObjectUpvalue* upvalue = vm->openUpvalues; upvalue != NULL; upvalue = upvalue->next)
+            {
+                upvalue->location = stack + (upvalue->location - vm->stack);
+            }
+        }
+        vm->stack = stack;
+        vm->stackEnd = stack + stackCapacity;
+    }
+    return true;
+}
+
+/**
+ * @brief Hands the frame on top of the frame stack over to a closure called in tail position.
+ * 
+ * The frame's upvalues are closed first, then the callee and its arguments slide down over its slots.
+ * 
+ * @param closure The function closure being called, taking exactly the arguments on the stack.
+ * @param argCount The number of arguments.
+ * @return true The callee has the frame.
+ * @return false The callee needs more stack than it can have.
+ */
+static bool ReuseFrame(ObjectClosure* closure, int argCount)
+{
+    CallFrame* frame = &vm->frames[vm->frameCount - 1];
+    Value* slots = frame->slots;
+    int tailCalls = frame->tailCalls + 1;
+    CloseUpvalues(slots);
+    memmove(slots, vm->sp - argCount - 1, (argCount + 1) * sizeof(Value));
+    vm->sp = slots + argCount + 1;
+
+    vm->frameCount--;
+    if (!PushFrame(closure, slots))
+    {
+        return false;
+    }
+    vm->frames[vm->frameCount - 1].tailCalls = tailCalls;
     return true;
 }
 
@@ -633,6 +1729,7 @@ static void DefineMethod(ObjectString* name)
     Value method = StackPeek(0);
     ObjectClass* _class = AS_CLASS(StackPeek(1));
     TableSet(&_class->methods, name, method);
+    _class->methodVersion++;
     StackPop();
 }
 
@@ -666,10 +1763,11 @@ static bool BindMethod(ObjectClass* _class, ObjectString* name)
  * 
  * @param name The name of the method.
  * @param argCount The number of arguments fed to the method.
+ * @param cache The invoke cache of the calling instruction.
  * @return true If the invocation succeeded.
  * @return false If the invocation failed.
  */
-static bool Invoke(ObjectString* name, int argCount)
+static bool Invoke(ObjectString* name, int argCount, InvokeCache* cache)
 {
     Value receiver = StackPeek(argCount);
 
@@ -681,14 +1779,22 @@ static bool Invoke(ObjectString* name, int argCount)
 
     ObjectInstance* instance = AS_INSTANCE(receiver);
 
+    // A shape pins down both the class and the absence of a field shadowing the method
+    Object* shape = (Object*)instance->shape;
+    ObjectClosure* cached = shape != NULL ? FindCachedMethod(cache, shape, instance->_class) : NULL;
+    if (cached != NULL)
+    {
+        return Call(cached, argCount);
+    }
+
     Value value;
-    if (TableGet(&instance->fields, name, &value))
+    if (InstanceGet(instance, name, &value))
     {
-        vm.sp[-argCount - 1] = value;
+        vm->sp[-argCount - 1] = value;
         return CallValue(value, argCount);
     }
 
-    return InvokeFromClass(instance->_class, name, argCount);
+    return InvokeFromClass(instance->_class, name, argCount, cache, shape);
 }
 
 /**
@@ -697,10 +1803,13 @@ static bool Invoke(ObjectString* name, int argCount)
  * @param _class The class containing the method.
  * @param name The name of the method.
  * @param argCount The number of arguments fed to the method.
+ * @param cache The invoke cache of the calling instruction.
+ * @param receiver The key to cache the method under, or NULL to leave the cache alone.
  * @return true If the invocation succeeded.
  * @return false If the invocation failed.
  */
-static bool InvokeFromClass(ObjectClass* _class, ObjectString* name, int argCount)
+static bool InvokeFromClass(ObjectClass* _class, ObjectString* name, int argCount, InvokeCache* cache,
+                            Object* receiver)
 {
     Value method;
     if (!TableGet(&_class->methods, name, &method))
@@ -708,22 +1817,248 @@ static bool InvokeFromClass(ObjectClass* _class, ObjectString* name, int argCoun
         RuntimeError("Undefined property '%s'.", name->chars);
         return false;
     }
+
+    if (receiver != NULL)
+    {
+        UpdateInvokeCache(cache, receiver, _class, AS_CLOSURE(method));
+    }
     return Call(AS_CLOSURE(method), argCount);
 }
 
 /**
- * @brief Defines a native function.
+ * @brief Looks up the method an invoke instruction last called for a receiver.
+ * 
+ * @param cache The invoke cache of the instruction.
+ * @param receiver The receiver's shape, or the superclass for a super invoke.
+ * @param _class The class the method is looked up in.
+ * @return ObjectClosure* The cached method, or NULL if there is no up-to-date entry.
+ */
+static ObjectClosure* FindCachedMethod(InvokeCache* cache, Object* receiver, ObjectClass* _class)
+{
+    for (int i = 0; i < cache->count; i++)
+    {
+        InvokeCacheEntry* entry = &cache->entries[i];
+        if (entry->receiver == receiver && entry->version == _class->methodVersion)
+        {
+#ifdef DEBUG_CACHE_STATS
+            cache->hits++;
+#endif
+            return entry->method;
+        }
+    }
+
+#ifdef DEBUG_CACHE_STATS
+    cache->misses++;
+#endif
+    return NULL;
+}
+
+/**
+ * @brief Records the method an invoke instruction called for a receiver.
+ * 
+ * @param cache The invoke cache of the instruction.
+ * @param receiver The receiver's shape, or the superclass for a super invoke.
+ * @param _class The class the method was found in.
+ * @param method The method that was called.
+ */
+static void UpdateInvokeCache(InvokeCache* cache, Object* receiver, ObjectClass* _class, ObjectClosure* method)
+{
+    if (cache->isMegamorphic)
+    {
+        return;
+    }
+
+    // Refresh an entry gone stale through a method redefinition before claiming a new one
+    int index = 0;
+    while (index < cache->count && cache->entries[index].receiver != receiver)
+    {
+        index++;
+    }
+
+    if (index == INVOKE_CACHE_SIZE)
+    {
+        cache->isMegamorphic = true;
+        cache->count = 0;
+        return;
+    }
+
+    cache->entries[index].receiver = receiver;
+    cache->entries[index].method = method;
+    cache->entries[index].version = _class->methodVersion;
+    if (index == cache->count)
+    {
+        cache->count++;
+    }
+}
+
+/**
+ * @brief Instantiates a frozen function for the running VM, along with every function it defines.
+ * 
+ * The instance borrows the frozen code and lines. Its constants are its own, so that they can hold the
+ * instances of nested functions and the strings this VM interned first.
+ * 
+ * @param frozen The frozen ObjectFunction.
+ * @return ObjectFunction* The instance.
+ */
+static ObjectFunction* InstantiateFunction(ObjectFunction* frozen)
+{
+    ObjectFunction* function = NewFunction();
+    StackPush(OBJECT_VALUE(function));
+    function->arity = frozen->arity;
+    function->upvalueCount = frozen->upvalueCount;
+    function->name = frozen->name;
+
+    Chunk* chunk = &function->chunk;
+    chunk->count = frozen->chunk.count;
+    chunk->capacity = frozen->chunk.capacity;
+    chunk->code = frozen->chunk.code;
+    chunk->lines = frozen->chunk.lines;
+    chunk->isBorrowed = true;
+    for (int i = 0; i < frozen->chunk.constants.count; i++)
+    {
+        Value constant = frozen->chunk.constants.values[i];
+        if (IS_FUNCTION(constant))
+        {
+            constant = OBJECT_VALUE(InstantiateFunction(AS_FUNCTION(constant)));
+        }
+        else if (IsObjectType(constant, OBJECT_STRING))
+        {
+            constant = OBJECT_VALUE(InternFrozenString(AS_STRING(constant)));
+        }
+        AddConstant(chunk, constant);
+    }
+    ThreadChunk(chunk);
+
+    StackPop();
+    return function;
+}
+
+/**
+ * @brief Finds the running VM's string for a frozen one, interning the frozen string if it has none yet.
  * 
- * @param name The name of the function.
- * @param function The function.
+ * @param string A frozen ObjectString.
+ * @return ObjectString* The string the VM compares by identity.
  */
-static void DefineNative(const char* name, NativeFn function)
+static ObjectString* InternFrozenString(ObjectString* string)
+{
+    ObjectString* interned = TableFindString(&vm->strings, string->chars, string->length, string->hash);
+    if (interned == NULL)
+    {
+        TableSet(&vm->strings, string, NIL_VALUE);
+        interned = string;
+    }
+    return interned;
+}
+
+void DefineNative(VM* isolate, const char* name, NativeFn function)
 {
+    VM* caller = vm;
+    vm = isolate;
+
     StackPush(OBJECT_VALUE(CopyString(name, (int)strlen(name))));
     StackPush(OBJECT_VALUE(NewNative(function)));
-    TableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+    int slot = GlobalSlot(AS_STRING(StackPeek(1)));
+    vm->globalValues.values[slot] = StackPeek(0);
     StackPop();
     StackPop();
+
+    vm = caller;
+}
+
+bool GetGlobal(VM* isolate, const char* name, Value* value)
+{
+    VM* caller = vm;
+    vm = isolate;
+
+    Value slot;
+    bool isDefined = TableGet(&vm->globalSlots, CopyString(name, (int)strlen(name)), &slot) &&
+                     !IS_UNDEFINED(vm->globalValues.values[(int)AS_NUMBER(slot)]);
+    if (isDefined)
+    {
+        *value = vm->globalValues.values[(int)AS_NUMBER(slot)];
+    }
+
+    vm = caller;
+    return isDefined;
+}
+
+InterpretResult CallFunction(VM* isolate, Value callee, int argCount, const Value* args, Value* result)
+{
+    VM* caller = vm;
+    vm = isolate;
+
+    InterpretResult status = INTERPRET_RUNTIME_ERROR;
+    int neededSlots = (int)(vm->sp - vm->stack) + argCount + 1;
+    if (vm->sp + argCount + 1 <= vm->stackEnd || GrowStacks(neededSlots))
+    {
+        StackPush(callee);
+        for (int i = 0; i < argCount; i++)
+        {
+            StackPush(args[i]);
+        }
+
+        int frameCount = vm->frameCount;
+        if (CallValue(callee, argCount))
+        {
+            // Natives and classes without an initializer are already done
+            status = INTERPRET_OK;
+            if (vm->frameCount > frameCount)
+            {
+#ifdef JIT_COMPILER
+                status = FinishFrame(frameCount) == JIT_FAILED ? INTERPRET_RUNTIME_ERROR : INTERPRET_OK;
+#else
+                status = Run(frameCount);
+#endif
+            }
+            if (status == INTERPRET_OK)
+            {
+                *result = StackPop();
+            }
+        }
+    }
+
+    vm = caller;
+    return status;
+}
+
+Value MakeString(VM* isolate, const char* chars, int length)
+{
+    VM* caller = vm;
+    vm = isolate;
+    Value string = StringValue(chars, length);
+    vm = caller;
+    return string;
+}
+
+int HoldValue(VM* isolate, Value value)
+{
+    int handle = isolate->freeHandle;
+    if (handle != -1)
+    {
+        isolate->freeHandle = AS_INTEGER(isolate->handles.values[handle]);
+        isolate->handles.values[handle] = value;
+        return handle;
+    }
+
+    // Growing the handles may collect garbage, which must not take the value with it
+    VM* caller = vm;
+    vm = isolate;
+    StackPush(value);
+    WriteValueArray(&vm->handles, value);
+    StackPop();
+    vm = caller;
+    return isolate->handles.count - 1;
+}
+
+Value HeldValue(VM* isolate, int handle)
+{
+    return isolate->handles.values[handle];
+}
+
+void ReleaseValue(VM* isolate, int handle)
+{
+    isolate->handles.values[handle] = INTEGER_VALUE(isolate->freeHandle);
+    isolate->freeHandle = handle;
 }
 
 /**
@@ -755,24 +2090,42 @@ static bool IsFalsey(Value value)
  */
 static void ConcatenateStrings()
 {
-    ObjectString* b = AS_STRING(StackPeek(0));
-    ObjectString* a = AS_STRING(StackPeek(1));
+    char bufferA[SHORT_STRING_MAX + 1];
+    char bufferB[SHORT_STRING_MAX + 1];
+    int lengthA;
+    int lengthB;
+    const char* a = StringChars(StackPeek(1), bufferA, &lengthA);
+    const char* b = StringChars(StackPeek(0), bufferB, &lengthB);
 
-    int length = a->length + b->length;
-    char* chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
+    int length = lengthA + lengthB;
+    Value result;
+    if (length <= SHORT_STRING_MAX)
+    {
+        char chars[SHORT_STRING_MAX + 1];
+        memcpy(chars, a, lengthA);
+        memcpy(chars + lengthA, b, lengthB);
+        result = StringValue(chars, length);
+    }
+    else
+    {
+        char* chars = ALLOCATE(char, length + 1);
+        memcpy(chars, a, lengthA);
+        memcpy(chars + lengthA, b, lengthB);
+        chars[length] = '\0';
+        result = OBJECT_VALUE(TakeString(chars, length));
+    }
 
-    ObjectString* result = TakeString(chars, length);
     StackPop();
     StackPop();
-    StackPush(OBJECT_VALUE(result));
+    StackPush(result);
 }
 
 /**
  * @brief Reports a runtime error and resets the stack.
  * 
+ * The stack trace of a deep stack, like that of a runaway recursion, shows only the TRACE_FRAMES_SHOWN
+ * innermost and outermost frames.
+ * 
  * @param format An error message with formatting.
  * @param ... 
  */
@@ -780,23 +2133,35 @@ static void RuntimeError(const char* format, ...)
 {
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vfprintf(vm->options.errors, format, args);
     va_end(args);
-    fputs("\n", stderr);
+    fputs("\n", vm->options.errors);
 
-    for (int i = vm.frameCount - 1; i >= 0; i--)
+    for (int i = vm->frameCount - 1; i >= 0; i--)
     {
-        CallFrame* frame = &vm.frames[i];
+        if (vm->frameCount > TRACE_FRAMES_SHOWN * 2 && i == vm->frameCount - 1 - TRACE_FRAMES_SHOWN)
+        {
+            int omitted = vm->frameCount - TRACE_FRAMES_SHOWN * 2;
+            fprintf(vm->options.errors, "... %d frame%s omitted\n", omitted, omitted == 1 ? "" : "s");
+            i = TRACE_FRAMES_SHOWN;
+            continue;
+        }
+
+        CallFrame* frame = &vm->frames[i];
         ObjectFunction* function = frame->closure->function;
-        size_t instruction = frame->ip - function->chunk.code - 1;
-        fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
+        size_t instruction = frame->chunk->threadedOffsets[frame->ip - frame->chunk->threaded - 1];
+        fprintf(vm->options.errors, "[line %d] in ", frame->chunk->lines[instruction]);
         if (function->name == NULL)
         {
-            fprintf(stderr, "script\n");
+            fprintf(vm->options.errors, "script\n");
         }
         else
         {
-            fprintf(stderr, "%s()\n", function->name->chars);
+            fprintf(vm->options.errors, "%s()\n", function->name->chars);
+        }
+        if (frame->tailCalls > 0)
+        {
+            fprintf(vm->options.errors, "(%d tail call%s elided)\n", frame->tailCalls, frame->tailCalls == 1 ? "" : "s");
         }
     }
 
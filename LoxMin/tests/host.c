@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm.h"
+
+// Instances allocated by churn(), enough to trigger several garbage collections
+#define CHURN_COUNT 200000
+
+static const char* script =
+    "class Pair {\n"
+    "  init(head, tail) { this.head = head; this.tail = tail; }\n"
+    "}\n"
+    "fun add(a, b) { return a + b; }\n"
+    "fun twice(x) { return hostDouble(x) + hostDouble(x); }\n"
+    "fun greet(name) { return \"Hello, \" + name + \"!\"; }\n"
+    "fun head(pair) { return pair.head; }\n"
+    "fun fail() { return nil.field; }\n"
+    "fun churn(n) {\n"
+    "  var list = nil;\n"
+    "  for (var i = 0; i < n; i = i + 1) list = Pair(i, list);\n"
+    "}\n";
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what);
+static Value HostDouble(int argCount, Value* args);
+static Value Global(VM* isolate, const char* name);
+static bool CallsTo(VM* isolate, const char* name, int argCount, const Value* args, Value* result);
+static bool IsNumber(Value value, double number);
+
+/**
+ * @brief Drives a VM through the embedding API in vm.h, the way a host linking libloxmin does.
+ *
+ * Prints every check that fails, and exits with 1 if any did.
+ */
+int main()
+{
+    Options options;
+    InitOptions(&options);
+    VM* isolate = NewVM(&options);
+    DefineNative(isolate, "hostDouble", HostDouble);
+    Check(Interpret(isolate, script) == INTERPRET_OK, "the script runs");
+
+    // Globals the script defined, and ones it did not
+    Value value;
+    Check(GetGlobal(isolate, "add", &value) && IS_CLOSURE(value), "add() is a global function");
+    Check(!GetGlobal(isolate, "missing", &value), "an undefined global is not found");
+
+    // Calls with numbers, natives and strings
+    Value result;
+    Value numbers[] = { NUMBER_VALUE(1), NUMBER_VALUE(2) };
+    Check(CallsTo(isolate, "add", 2, numbers, &result) && IsNumber(result, 3), "add(1, 2) returns 3");
+    Value five = NUMBER_VALUE(5);
+    Check(CallsTo(isolate, "twice", 1, &five, &result) && IsNumber(result, 20), "a native is called from Lox");
+    // Strings are interned, so an equal string is the same Value; it is held, as the call may collect it
+    int greeting = HoldValue(isolate, MakeString(isolate, "Hello, host!", 12));
+    Value name = MakeString(isolate, "host", 4);
+    Check(CallsTo(isolate, "greet", 1, &name, &result) && AreValuesEqual(result, HeldValue(isolate, greeting)),
+          "greet() returns a string");
+    ReleaseValue(isolate, greeting);
+
+    // A runtime error ends its call, and the VM goes on running the next ones
+    Check(!CallsTo(isolate, "fail", 0, NULL, &result), "fail() reports a runtime error");
+    Check(CallsTo(isolate, "add", 2, numbers, &result) && IsNumber(result, 3), "a call after an error runs");
+    Check(!CallsTo(isolate, "fail", 0, NULL, &result), "fail() reports a runtime error again");
+
+    // Held values live through collections; the rest of the heap is free to go
+    Value pairArgs[] = { NUMBER_VALUE(42), NIL_VALUE };
+    Check(CallsTo(isolate, "Pair", 2, pairArgs, &result) && IS_INSTANCE(result), "Pair() makes an instance");
+    int pair = HoldValue(isolate, result);
+    const char* text = "a string far too long to be packed into a value";
+    int string = HoldValue(isolate, MakeString(isolate, text, (int)strlen(text)));
+
+    size_t nextGC = isolate->nextGC;
+    Value count = NUMBER_VALUE(CHURN_COUNT);
+    Check(CallsTo(isolate, "churn", 1, &count, &result), "churn() runs");
+    Check(isolate->nextGC != nextGC, "churn() collects garbage");
+
+    Value held = HeldValue(isolate, pair);
+    Check(CallsTo(isolate, "head", 1, &held, &result) && IsNumber(result, 42), "a held instance survives");
+    held = HeldValue(isolate, string);
+    Check(IS_STRING(held) && AS_STRING(held)->length == (int)strlen(text) &&
+          memcmp(AS_CSTRING(held), text, strlen(text)) == 0, "a held string survives");
+
+    // A released handle is handed out again
+    ReleaseValue(isolate, pair);
+    Check(HoldValue(isolate, NIL_VALUE) == pair, "a released handle is reused");
+
+    FreeVM(isolate);
+    return failures > 0 ? 1 : 0;
+}
+
+/**
+ * @brief Records the outcome of one check, printing it if it failed.
+ *
+ * @param condition Whether the check passed.
+ * @param what What was checked.
+ */
+static void Check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+/**
+ * @brief Native function the host defines for the script, doubling a number.
+ */
+static Value HostDouble(int argCount, Value* args)
+{
+    return NUMBER_VALUE(AS_NUMBER(args[0]) * 2);
+}
+
+/**
+ * @brief Reads a global variable the script must have defined.
+ *
+ * @param isolate The VM to read from.
+ * @param name The name of the global variable.
+ * @return Value Its Value, or nil if it is not defined.
+ */
+static Value Global(VM* isolate, const char* name)
+{
+    Value value;
+    if (!GetGlobal(isolate, name, &value))
+    {
+        printf("FAILED: %s is defined\n", name);
+        failures++;
+        return NIL_VALUE;
+    }
+    return value;
+}
+
+/**
+ * @brief Calls a global function or class.
+ *
+ * @param isolate The VM to run the call in.
+ * @param name The name of the global to call.
+ * @param argCount The number of arguments.
+ * @param args The arguments.
+ * @param result The Value the call returned.
+ * @return true If the call ran to completion.
+ * @return false If it stopped at a runtime error.
+ */
+static bool CallsTo(VM* isolate, const char* name, int argCount, const Value* args, Value* result)
+{
+    return CallFunction(isolate, Global(isolate, name), argCount, args, result) == INTERPRET_OK;
+}
+
+/**
+ * @brief Checks that a Value is a given number, whether it is boxed as an integer or a double.
+ *
+ * @param value The Value to check.
+ * @param number The number it should be.
+ * @return true If the Value is that number.
+ * @return false If it is not.
+ */
+static bool IsNumber(Value value, double number)
+{
+    return IS_NUMBER(value) && AS_NUMBER(value) == number;
+}
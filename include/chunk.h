@@ -0,0 +1,287 @@
+#ifndef loxmin_chunk_h
+#define loxmin_chunk_h
+
+#include "common.h"
+#include "value.h"
+
+struct ObjectShape;
+struct ObjectClosure;
+struct Trace;
+
+/**
+ * @brief Enumerates all available opcodes.
+ */
+typedef enum
+{
+    OP_CONSTANT,
+    OP_NIL,
+    OP_TRUE,
+    OP_FALSE,
+    OP_POP,
+    OP_GET_LOCAL,
+    OP_SET_LOCAL,
+    OP_GET_GLOBAL,
+    OP_DEFINE_GLOBAL,
+    OP_SET_GLOBAL,
+    OP_GET_UPVALUE,
+    OP_SET_UPVALUE,
+    OP_GET_PROPERTY,
+    OP_SET_PROPERTY,
+    OP_GET_SUPER,
+    OP_EQUAL,
+    OP_GREATER,
+    OP_LESS,
+    OP_ADD,
+    OP_SUBTRACT,
+    OP_MULTIPLY,
+    OP_DIVIDE,
+    OP_NOT,
+    OP_NEGATE,
+    OP_PRINT,
+    OP_JUMP,
+    OP_JUMP_IF_FALSE,
+    OP_LOOP,
+    OP_CALL,
+    OP_TAIL_CALL,
+    OP_INVOKE,
+    OP_SUPER_INVOKE,
+    OP_CLOSURE,
+    OP_CLOSE_UPVALUE,
+    OP_RETURN,
+    OP_CLASS,
+    OP_INHERIT,
+    OP_METHOD,
+
+    // Register forms, reading locals (L) and constants (K) straight from the frame
+    OP_ADD_LL,
+    OP_ADD_LK,
+    OP_SUBTRACT_LL,
+    OP_SUBTRACT_LK,
+    OP_MULTIPLY_LL,
+    OP_MULTIPLY_LK,
+    OP_DIVIDE_LL,
+    OP_DIVIDE_LK,
+    OP_GREATER_LL,
+    OP_GREATER_LK,
+    OP_LESS_LL,
+    OP_LESS_LK,
+    OP_EQUAL_LL,
+    OP_EQUAL_LK,
+    OP_JUMP_GREATER_LL,
+    OP_JUMP_GREATER_LK,
+    OP_JUMP_LESS_LL,
+    OP_JUMP_LESS_LK,
+    OP_JUMP_EQUAL_LL,
+    OP_JUMP_EQUAL_LK,
+    OP_POP_LOCAL,
+
+    // Superinstructions only produced by FuseChunk()
+    OP_POP_GLOBAL,
+    OP_POP_JUMP_IF_FALSE,
+
+    // Quickened forms, never compiled: Run() rewrites the threaded code of a generic instruction to one of
+    // these once it has seen the types of its operands, and back again when they change
+    OP_ADD_NUMBER,
+    OP_ADD_STRING,
+    OP_EQUAL_NUMBER,
+} OpCode;
+
+/**
+ * @brief Remembers where a property instruction last found its property, keyed by the receiver's shape.
+ */
+typedef struct
+{
+    struct ObjectShape* shape;
+    struct ObjectShape* transition;
+    struct ObjectClosure* method;
+    int index;
+    int version;
+
+    int offset;
+    uint64_t hits;
+    uint64_t misses;
+} InlineCache;
+
+#define INVOKE_CACHE_SIZE 4
+
+// Stack slots claimed by a function whose body has not been compiled or threaded yet: more than any stack
+// has, so its first call takes the slow path of pushing a frame, which compiles or threads it
+#define STACK_SIZE_LAZY (INT32_MAX / (int)sizeof(Value))
+
+/**
+ * @brief Maps one receiver seen by an invoke instruction to the method it called.
+ */
+typedef struct
+{
+    Object* receiver;
+    struct ObjectClosure* method;
+    int version;
+} InvokeCacheEntry;
+
+/**
+ * @brief Remembers the methods an invoke instruction called for its last few receivers.
+ * 
+ * Receivers are keyed by shape for OP_INVOKE and by superclass for OP_SUPER_INVOKE. A site that sees more
+ * receivers than it has entries turns megamorphic and stops caching.
+ */
+typedef struct
+{
+    InvokeCacheEntry entries[INVOKE_CACHE_SIZE];
+    int count;
+    bool isMegamorphic;
+
+    int offset;
+    uint64_t hits;
+    uint64_t misses;
+} InvokeCache;
+
+/**
+ * @brief Remembers the closure a call instruction last called, whose arity is known to match the call.
+ */
+typedef struct
+{
+    struct ObjectClosure* closure;
+
+    int offset;
+    uint64_t hits;
+    uint64_t misses;
+} CallCache;
+
+#ifdef TRACE_RECORDER
+/**
+ * @brief Counts how often a loop jumps back to its header, and holds the loop's trace once it has one.
+ */
+typedef struct
+{
+    int offset;
+    int header;
+    int hits;
+    int attempts;
+    struct Trace* trace;
+} LoopAnchor;
+#endif
+
+/**
+ * @brief Represents one word of pre-decoded, direct-threaded code.
+ */
+typedef union ThreadedCode
+{
+    void* handler;
+    uint8_t opcode;
+    int operand;
+    Value value;
+    union ThreadedCode* target;
+    InlineCache* cache;
+    InvokeCache* invokeCache;
+    CallCache* callCache;
+#ifdef TRACE_RECORDER
+    LoopAnchor* loop;
+#endif
+} ThreadedCode;
+
+/**
+ * @brief Stores a series of instructions.
+ */
+typedef struct
+{
+    int count;
+    int capacity;
+    uint8_t* code;
+    int* lines;
+    ValueArray constants;
+    // Code and lines belong to the frozen chunk this one was instantiated from, which frees them
+    bool isBorrowed;
+
+    int threadedCount;
+    ThreadedCode* threaded;
+    int* threadedOffsets;
+    // Stack slots a frame running the chunk can use above its callee and arguments
+    int stackSize;
+
+    int cacheCount;
+    InlineCache* caches;
+    int invokeCacheCount;
+    InvokeCache* invokeCaches;
+    int callCacheCount;
+    CallCache* callCaches;
+#ifdef TRACE_RECORDER
+    int loopCount;
+    LoopAnchor* loops;
+#endif
+} Chunk;
+
+/**
+ * @brief Initializes a Chunk.
+ * 
+ * @param chunk A Chunk to initialize.
+ */
+void InitChunk(Chunk* chunk);
+
+/**
+ * @brief Writes a single byte to a Chunk.
+ * 
+ * @param chunk A Chunk to write to.
+ * @param byte A byte to be written.
+ * @param line The line of source code where the byte originates from.
+ */
+void WriteChunk(Chunk* chunk, uint8_t byte, int line);
+
+/**
+ * @brief Frees a Chunk.
+ * 
+ * @param chunk A Chunk to free.
+ */
+void FreeChunk(Chunk* chunk);
+
+/**
+ * @brief Determines the length of an instruction in bytes, operands included.
+ * 
+ * @param chunk The Chunk holding the instruction.
+ * @param offset The offset of the instruction.
+ * @return int The length of the instruction.
+ */
+int InstructionLength(Chunk* chunk, int offset);
+
+/**
+ * @brief Fuses hot instruction sequences of a compiled Chunk into superinstructions.
+ * 
+ * @param chunk A Chunk to rewrite in place.
+ */
+void FuseChunk(Chunk* chunk);
+
+/**
+ * @brief Translates a Chunk's bytecode into direct-threaded code, decoding all operands ahead of time.
+ * 
+ * Also works out how many stack slots a call running the chunk can need.
+ * 
+ * @param chunk A Chunk to translate.
+ */
+void ThreadChunk(Chunk* chunk);
+
+/**
+ * @brief Finds the threaded code of an instruction, where the interpreter would start executing it.
+ * 
+ * @param chunk A threaded Chunk.
+ * @param offset The bytecode offset of the instruction.
+ * @return ThreadedCode* The first threaded word of the instruction.
+ */
+ThreadedCode* ThreadedInstruction(Chunk* chunk, int offset);
+
+/**
+ * @brief Finds the stack operation a register-form instruction performs.
+ * 
+ * @param instruction A register-form or compare-jump opcode.
+ * @return OpCode The matching stack opcode.
+ */
+OpCode BaseOperation(OpCode instruction);
+
+/**
+ * @brief Adds a constant to a Chunk's constants ValueArray.
+ * 
+ * @param chunk A Chunk to add a constant to.
+ * @param value The Value of the constant.
+ * @return int The index where the constant was appended within the constants ValueArray.
+ */
+int AddConstant(Chunk* chunk, Value value);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef loxmin_common_h
+#define loxmin_common_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define NAN_BOXING
+//#define DEBUG_PRINT_CODE
+//#define DEBUG_TRACE_EXECUTION
+//#define DEBUG_PROFILE_OPCODES
+//#define DEBUG_CACHE_STATS
+
+// Compiles hot functions to x86-64; also enabled by building with -DJIT_COMPILER
+//#define JIT_COMPILER
+
+// Prints every trace recorded for a hot loop; works without the JIT, which compiles the traces it records
+//#define DEBUG_DUMP_TRACES
+
+#if defined(JIT_COMPILER) || defined(DEBUG_DUMP_TRACES)
+#define TRACE_RECORDER
+#endif
+
+// Threaded dispatch relies on the GCC/Clang "labels as values" extension;
+// build with -DNO_COMPUTED_GOTO to fall back to a portable switch
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
+
+//#define DEBUG_STRESS_GC
+//#define DEBUG_LOG_GC
+
+#define UINT8_COUNT (UINT8_MAX + 1)
+
+// State reached without a parameter, like the running VM and the compiler, is kept per thread
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+#endif
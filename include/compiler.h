@@ -0,0 +1,29 @@
+#ifndef loxmin_compiler_h
+#define loxmin_compiler_h
+
+#include "object.h"
+#include "vm.h"
+
+/**
+ * @brief Compiles a piece of source code to an ObjectFunction.
+ * 
+ * @param source A source code string to compile.
+ * @return ObjectFunction* The resultant function.
+ */
+ObjectFunction* Compile(const char* source);
+
+/**
+ * @brief Compiles the body of a function whose declaration was only skimmed.
+ * 
+ * @param function An ObjectFunction with a LazyBody.
+ * @return true The body compiled, and the function is ready to run.
+ * @return false The body has errors, which have been reported.
+ */
+bool CompileLazyBody(ObjectFunction* function);
+
+/**
+ * @brief Marks all compiler roots for garbage collection.
+ */
+void MarkCompilerRoots();
+
+#endif
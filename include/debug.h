@@ -0,0 +1,55 @@
+#ifndef loxmin_debug_h
+#define loxmin_debug_h
+
+#include "chunk.h"
+#include "trace.h"
+
+/**
+ * @brief Disassembles all of the instructions of a Chunk.
+ * 
+ * @param chunk A Chunk to disassemble.
+ * @param name The name of the Chunk.
+ */
+void DisassembleChunk(Chunk* chunk, const char* name);
+
+/**
+ * @brief Disassembles a single instruction.
+ * 
+ * @param chunk A Chunk holding the instruction.
+ * @param offset The offset of the instruction.
+ * @return int The offset of the next instruction.
+ */
+int DisassembleInstruction(Chunk* chunk, int offset);
+
+#ifdef DEBUG_PROFILE_OPCODES
+/**
+ * @brief Records the opcode sequences that begin at an instruction about to execute.
+ * 
+ * @param chunk A Chunk holding the instruction.
+ * @param offset The offset of the instruction.
+ */
+void ProfileInstruction(Chunk* chunk, int offset);
+
+/**
+ * @brief Prints the most frequently executed opcode sequences to stderr.
+ */
+void PrintProfile();
+#endif
+
+#ifdef DEBUG_CACHE_STATS
+/**
+ * @brief Prints the hit and miss counts of every inline cache still alive to stderr.
+ */
+void PrintCacheStats();
+#endif
+
+#ifdef DEBUG_DUMP_TRACES
+/**
+ * @brief Prints a recorded trace: the steps the recorder took, the IR they became and what came of it.
+ * 
+ * @param trace A Trace to print.
+ */
+void PrintTrace(Trace* trace);
+#endif
+
+#endif
@@ -0,0 +1,365 @@
+#ifndef loxmin_object_h
+#define loxmin_object_h
+
+#include "common.h"
+#include "chunk.h"
+#include "table.h"
+#include "value.h"
+
+// Instances with more fields than this fall back to a hash table of their own
+#define SHAPE_MAX_FIELDS 64
+
+/**
+ * @brief Enumerates all available Object types.
+ */
+typedef enum
+{
+    OBJECT_BOUND_METHOD,
+    OBJECT_CLASS,
+    OBJECT_INSTANCE,
+    OBJECT_SHAPE,
+    OBJECT_UPVALUE,
+    OBJECT_CLOSURE,
+    OBJECT_FUNCTION,
+    OBJECT_NATIVE,
+    OBJECT_STRING,
+} ObjectType;
+
+/**
+ * @brief Represents an object.
+ */
+struct Object 
+{
+    ObjectType type;
+    bool isMarked;
+    struct Object* next;
+};
+
+/**
+ * @brief Represents a string.
+ */
+struct ObjectString
+{
+    Object obj;
+    int length;
+    // Characters borrowed from memory that outlives the string, such as a mapped compiled script
+    bool isBorrowed;
+    char* chars;
+    uint32_t hash;
+};
+
+/**
+ * @brief Holds what it takes to compile the body of a function whose declaration was only skimmed.
+ */
+typedef struct
+{
+    // The script's source, kept alive until the body has been compiled
+    ObjectString* source;
+    // The parameter list, where compiling the body resumes scanning
+    const char* start;
+    int line;
+    uint8_t type;
+    bool isInClass;
+    bool hasSuperclass;
+    // The names of the variables the closure captures, one for each upvalue
+    ObjectString** upvalueNames;
+} LazyBody;
+
+/**
+ * @brief Represents a function.
+ */
+typedef struct
+{
+    Object obj;
+    int arity;
+    int upvalueCount;
+    Chunk chunk;
+    ObjectString* name;
+    // Set until the body of a lazily compiled function is compiled, on its first call
+    LazyBody* lazy;
+#ifdef JIT_COMPILER
+    int callCount;
+    void* jitCode;
+    size_t jitSize;
+#endif
+} ObjectFunction;
+
+/**
+ * @brief Represents an upvalue.
+ */
+typedef struct ObjectUpvalue
+{
+    Object obj;
+    Value* location;
+    Value closed;
+    struct ObjectUpvalue* next;
+} ObjectUpvalue;
+
+/**
+ * @brief Represents a closure.
+ */
+typedef struct ObjectClosure
+{
+    Object obj;
+    ObjectFunction* function;
+    ObjectUpvalue** upvalues;
+    int upvalueCount;
+} ObjectClosure;
+
+typedef Value (*NativeFn)(int argCount, Value* args);
+
+/**
+ * @brief Represents a native function.
+ */
+typedef struct
+{
+    Object obj;
+    NativeFn function;
+} ObjectNative;
+
+/**
+ * @brief Represents the layout shared by all instances that added the same fields in the same order.
+ */
+typedef struct ObjectShape
+{
+    Object obj;
+    int fieldCount;
+    Table indices;
+    Table transitions;
+} ObjectShape;
+
+/**
+ * @brief Represents a class.
+ */
+typedef struct
+{
+    Object obj;
+    ObjectString* name;
+    Table methods;
+    ObjectShape* rootShape;
+    int fieldCount;
+    int methodVersion;
+} ObjectClass;
+
+/**
+ * @brief Represents an instance.
+ * 
+ * Field values are stored in shape order, inline until they outgrow the space reserved at allocation.
+ * An instance whose shape is NULL is in dictionary mode and keeps its fields in a Table instead.
+ */
+typedef struct
+{
+    Object obj;
+    ObjectClass* _class;
+    ObjectShape* shape;
+    Value* fields;
+    int fieldCapacity;
+    int inlineCapacity;
+    Table dictionary;
+    Value inlineFields[];
+} ObjectInstance;
+
+/**
+ * @brief Represents a bound method.
+ */
+typedef struct
+{
+    Object obj;
+    Value receiver;
+    ObjectClosure* method;
+} ObjectBoundMethod;
+
+#define OBJECT_TYPE(value)  (AS_OBJECT(value)->type)
+
+#define IS_BOUND_METHOD(value)  IsObjectType(value, OBJECT_BOUND_METHOD)
+#define IS_CLASS(value)         IsObjectType(value, OBJECT_CLASS)
+#define IS_CLOSURE(value)       IsObjectType(value, OBJECT_CLOSURE)
+#define IS_FUNCTION(value)      IsObjectType(value, OBJECT_FUNCTION)
+#define IS_INSTANCE(value)      IsObjectType(value, OBJECT_INSTANCE)
+#define IS_SHAPE(value)         IsObjectType(value, OBJECT_SHAPE)
+#define IS_NATIVE(value)        IsObjectType(value, OBJECT_NATIVE)
+#define IS_STRING(value)        (IS_SHORT_STRING(value) || IsObjectType(value, OBJECT_STRING))
+
+#define AS_BOUND_METHOD(value)  ((ObjectBoundMethod*)AS_OBJECT(value))
+#define AS_CLASS(value)         ((ObjectClass*)AS_OBJECT(value))
+#define AS_CLOSURE(value)       ((ObjectClosure*)AS_OBJECT(value))
+#define AS_FUNCTION(value)      ((ObjectFunction*)AS_OBJECT(value))
+#define AS_INSTANCE(value)      ((ObjectInstance*)AS_OBJECT(value))
+#define AS_SHAPE(value)         ((ObjectShape*)AS_OBJECT(value))
+#define AS_NATIVE(value)        (((ObjectNative*)AS_OBJECT(value))->function)
+// Only for strings known to live on the heap, such as names; see StringChars() for any string Value
+#define AS_STRING(value)        ((ObjectString*)AS_OBJECT(value))
+#define AS_CSTRING(value)       (((ObjectString*)AS_OBJECT(value))->chars)
+
+/**
+ * @brief Instantiates a new bound method.
+ * 
+ * @param receiver The receiver of the bound method.
+ * @param method The method itself.
+ * @return ObjectBoundMethod* A pointer to the new ObjectBoundMethod object.
+ */
+ObjectBoundMethod* NewBoundMethod(Value receiver, ObjectClosure* method);
+
+/**
+ * @brief Instantiates a new class instance.
+ * 
+ * @param _class An ObjectClass to produce an instance of.
+ * @return ObjectInstance* A pointer to the new ObjectInstance object.
+ */
+ObjectInstance* NewInstance(ObjectClass* _class);
+
+/**
+ * @brief Attempts to get the value of an instance field.
+ * 
+ * @param instance An ObjectInstance to read from.
+ * @param name The name of the field.
+ * @param value A resulting Value.
+ * @return true If the instance has the field.
+ * @return false If the instance does not have the field.
+ */
+bool InstanceGet(ObjectInstance* instance, ObjectString* name, Value* value);
+
+/**
+ * @brief Sets the value of an instance field, adding the field if it is new.
+ * 
+ * @param instance An ObjectInstance to write to.
+ * @param name The name of the field.
+ * @param value The Value of the field.
+ */
+void InstanceSet(ObjectInstance* instance, ObjectString* name, Value value);
+
+/**
+ * @brief Finds the slot of a field within a shape.
+ * 
+ * @param shape An ObjectShape to search.
+ * @param name The name of the field.
+ * @return int The index of the field, or -1 if the shape has no such field.
+ */
+int ShapeFieldIndex(ObjectShape* shape, ObjectString* name);
+
+/**
+ * @brief Instantiates a new shape.
+ * 
+ * @param fieldCount The number of fields described by the shape.
+ * @return ObjectShape* A pointer to the new ObjectShape object.
+ */
+ObjectShape* NewShape(int fieldCount);
+
+/**
+ * @brief Instantiates a new class.
+ * 
+ * @param name The name of the class.
+ * @return ObjectClass* A pointer to the new ObjectClass object.
+ */
+ObjectClass* NewClass(ObjectString* name);
+
+/**
+ * @brief Instantiates a new upvalue.
+ * 
+ * @param slot The slot of the upvalue.
+ * @return ObjectUpvalue* A pointer to the new ObjectUpvalue object.
+ */
+ObjectUpvalue* NewUpvalue(Value* slot);
+
+/**
+ * @brief Instantiates a new closure.
+ * 
+ * @param function A function to close around.
+ * @return ObjectClosure* A pointer to the new ObjectClosure object.
+ */
+ObjectClosure* NewClosure(ObjectFunction* function);
+
+/**
+ * @brief Instantiates a new function.
+ * 
+ * @return ObjectFunction* A pointer to the new ObjectFunction object.
+ */
+ObjectFunction* NewFunction();
+
+/**
+ * @brief Instantiates a new native function.
+ * 
+ * @param function A native function.
+ * @return ObjectNative* A pointer to the new ObjectNative object.
+ */
+ObjectNative* NewNative(NativeFn function);
+
+/**
+ * @brief Takes ownership of a given string and allocates it.
+ * 
+ * @param chars A pointer to the string's characters.
+ * @param length The length of the string.
+ * @return ObjectString* A pointer to the resulting ObjectString.
+ */
+ObjectString* TakeString(char* chars, int length);
+
+/**
+ * @brief Copies a string into memory and creates an ObjectString object.
+ * 
+ * @param chars A pointer to the characters to copy.
+ * @param length The length of the string.
+ * @return ObjectString* A pointer to the resulting ObjectString.
+ */
+ObjectString* CopyString(const char* chars, int length);
+
+/**
+ * @brief Interns a string without copying its characters, which must stay in place for as long as it lives.
+ * 
+ * @param chars A pointer to the null-terminated characters.
+ * @param length The length of the string.
+ * @return ObjectString* A pointer to the resulting ObjectString, or an equivalent one already interned.
+ */
+ObjectString* BorrowString(const char* chars, int length);
+
+/**
+ * @brief Creates a string Value, packing it into the Value itself when it is short enough.
+ * 
+ * @param chars A pointer to the characters to copy.
+ * @param length The length of the string.
+ * @return Value The resulting string Value.
+ */
+Value StringValue(const char* chars, int length);
+
+/**
+ * @brief Prints an Object and its contents in a human-readable form.
+ * 
+ * @param file The stream to print to.
+ * @param value A Value holding an Object.
+ */
+void PrintObject(FILE* file, Value value);
+
+/**
+ * @brief Checks if a Value is an Object and its type matches a given ObjectType.
+ * 
+ * @param value A Value to check.
+ * @param type An ObjectType to verify.
+ * @return true If the Value is an Object and its type matches the specified ObjectType.
+ * @return false If the Value is not Object or its type does not match the specified ObjectType.
+ */
+static inline bool IsObjectType(Value value, ObjectType type)
+{
+    return IS_OBJECT(value) && OBJECT_TYPE(value) == type;
+}
+
+/**
+ * @brief Finds the characters of a string Value, whether it is short or lives on the heap.
+ * 
+ * @param value A string Value.
+ * @param buffer A buffer of at least SHORT_STRING_MAX + 1 bytes, used to unpack a short string.
+ * @param length The resulting length of the string.
+ * @return const char* The null-terminated characters of the string.
+ */
+static inline const char* StringChars(Value value, char* buffer, int* length)
+{
+#ifdef NAN_BOXING
+    if (IS_SHORT_STRING(value))
+    {
+        *length = ShortStringChars(value, buffer);
+        return buffer;
+    }
+#endif
+    *length = AS_STRING(value)->length;
+    return AS_CSTRING(value);
+}
+
+#endif
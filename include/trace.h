@@ -0,0 +1,171 @@
+#ifndef loxmin_trace_h
+#define loxmin_trace_h
+
+#include "common.h"
+#include "chunk.h"
+#include "value.h"
+#include "vm.h"
+
+#ifdef TRACE_RECORDER
+
+// Times a loop has to jump back to its header before it is recorded
+#define TRACE_HOT_LOOP 64
+// Recordings a loop gets before it is left to the interpreter for good
+#define TRACE_MAX_ATTEMPTS 2
+#define TRACE_MAX_STEPS 512
+// Variables a trace can keep unboxed in registers
+#define TRACE_MAX_PROMOTED 8
+
+/**
+ * @brief Enumerates the types a trace observes values to have.
+ */
+typedef enum
+{
+    TYPE_NONE,
+    TYPE_NIL,
+    TYPE_BOOL,
+    TYPE_NUMBER,
+    TYPE_OBJECT,
+} TraceType;
+
+/**
+ * @brief Records one instruction executed by the trace recorder.
+ */
+typedef struct
+{
+    int offset;
+    uint8_t types[2];
+    bool isTaken;
+} TraceStep;
+
+/**
+ * @brief Enumerates the operations of a trace's intermediate representation.
+ */
+typedef enum
+{
+    IR_CONSTANT,
+    IR_LOAD,
+    IR_READ,
+    IR_STORE,
+    IR_UNBOX,
+    IR_ADD,
+    IR_SUBTRACT,
+    IR_MULTIPLY,
+    IR_DIVIDE,
+    IR_NEGATE,
+    IR_GREATER,
+    IR_LESS,
+    IR_EQUAL_NUMBER,
+    IR_EQUAL,
+    IR_NOT,
+    IR_GUARD_TRUE,
+    IR_GUARD_FALSE,
+    IR_PRINT,
+    IR_LOOP,
+} IrOp;
+
+/**
+ * @brief Represents one instruction of a trace's intermediate representation.
+ *
+ * Instructions are referred to by their index. Loads, reads and stores name a variable in a, stores take
+ * the value to store in b, and every other instruction takes its operands in a and b. Guards, unboxing and
+ * prints carry the snapshot of the interpreter state to exit with.
+ */
+typedef struct
+{
+    uint8_t op;
+    bool isNumber;
+    bool isDead;
+    int a;
+    int b;
+    int snapshot;
+    Value constant;
+} IrInstruction;
+
+/**
+ * @brief Describes a local or global variable touched by a trace.
+ *
+ * Variables only ever seen holding numbers are promoted: they are checked once when the trace is entered,
+ * kept unboxed in a register and written back when it exits.
+ */
+typedef struct
+{
+    bool isGlobal;
+    bool isPromoted;
+    int slot;
+} TraceVariable;
+
+/**
+ * @brief Describes the interpreter state to rebuild when a trace exits.
+ */
+typedef struct
+{
+    int resume;
+    int first;
+    int count;
+} Snapshot;
+
+/**
+ * @brief Stores a loop recorded by the trace recorder, its optimized form and, once compiled, its native code.
+ */
+typedef struct Trace
+{
+    Chunk* chunk;
+    int header;
+    int loopOffset;
+    int baseDepth;
+    const char* abortReason;
+
+    TraceStep* steps;
+    int stepCount;
+    int stepCapacity;
+
+    IrInstruction* ir;
+    int irCount;
+    int irCapacity;
+
+    TraceVariable* variables;
+    int variableCount;
+    int variableCapacity;
+
+    Snapshot* snapshots;
+    int snapshotCount;
+    int snapshotCapacity;
+    int* snapshotRefs;
+    int snapshotRefCount;
+    int snapshotRefCapacity;
+
+    void* code;
+    size_t codeSize;
+} Trace;
+
+/**
+ * @brief Records one iteration of a hot loop, starting at its header, and compiles the trace if it can.
+ *
+ * The recorder executes every instruction it records, so the frame carries on from wherever recording
+ * stopped: back at the header once the loop closed, or at the first instruction a trace cannot hold.
+ *
+ * @param loop The LoopAnchor of the loop, whose trace is set once the loop has native code.
+ * @param frame The CallFrame running the loop, with its ip at the header and vm->sp stored.
+ */
+void RecordTrace(LoopAnchor* loop, CallFrame* frame);
+
+/**
+ * @brief Finds the operands of an IR instruction that refer to other instructions.
+ *
+ * @param instruction The IrInstruction to look at.
+ * @param operands Where to store the operands.
+ * @return int The number of operands stored.
+ */
+int IrOperands(IrInstruction* instruction, int operands[2]);
+
+/**
+ * @brief Frees a trace and its native code.
+ *
+ * @param trace The Trace to free, or NULL.
+ */
+void FreeTrace(Trace* trace);
+
+#endif
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef loxmin_value_h
+#define loxmin_value_h
+
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+
+typedef struct Object Object;
+typedef struct ObjectString ObjectString;
+
+#ifdef NAN_BOXING
+
+#define SIGN_BIT    ((uint64_t)0x8000000000000000)
+#define QNAN        ((uint64_t)0x7ffc000000000000)
+#define TAG_NIL     1
+#define TAG_FALSE   2
+#define TAG_TRUE    3
+#define TAG_UNDEFINED 4
+// Small integers keep their 32 bits in the low half of the payload, under a bit no other tag uses
+#define TAG_INTEGER ((uint64_t)0x0001000000000000)
+// Short strings keep their bytes in the low five bytes of the payload, lowest first, and their length above them
+#define TAG_SHORT_STRING ((uint64_t)0x0002000000000000)
+#define SHORT_STRING_MAX 5
+
+typedef uint64_t Value;
+
+#define IS_BOOL(value)      (((value) | 1) == TRUE_VALUE)
+#define IS_NIL(value)       ((value) == NIL_VALUE)
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VALUE)
+#define IS_INTEGER(value)   (((value) & (SIGN_BIT | QNAN | TAG_INTEGER)) == (QNAN | TAG_INTEGER))
+#define IS_NUMBER(value)    (((value) & QNAN) != QNAN || IS_INTEGER(value))
+// No value but an integer sets the integer tag, so two values are integers exactly when their bits in common are one
+#define ARE_INTEGERS(a, b)  IS_INTEGER((a) & (b))
+#define IS_OBJECT(value)    (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+#define IS_SHORT_STRING(value) (((value) & (SIGN_BIT | QNAN | TAG_SHORT_STRING)) == (QNAN | TAG_SHORT_STRING))
+
+#define AS_BOOL(value)      ((value) == TRUE_VALUE)
+#define AS_INTEGER(value)   ((int32_t)(uint32_t)(value))
+#define AS_NUMBER(value)    ValueToNum(value)
+#define AS_OBJECT(value)    ((Object*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+#define BOOL_VALUE(b)       ((b) ? TRUE_VALUE : FALSE_VALUE)
+#define FALSE_VALUE         ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VALUE          ((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define NIL_VALUE           ((Value)(uint64_t)(QNAN | TAG_NIL))
+// Marks a global slot that has not been defined yet; never visible to scripts
+#define UNDEFINED_VALUE     ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
+#define INTEGER_VALUE(i)    ((Value)(QNAN | TAG_INTEGER | (uint32_t)(int32_t)(i)))
+#define NUMBER_VALUE(num)   NumToValue(num)
+#define OBJECT_VALUE(obj)   (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+
+static inline double ValueToNum(Value value)
+{
+    if (IS_INTEGER(value))
+    {
+        return (double)AS_INTEGER(value);
+    }
+
+    double num;
+    memcpy(&num, &value, sizeof(Value));
+    return num;
+}
+
+static inline Value NumToValue(double num)
+{
+    Value value;
+    memcpy(&value, &num, sizeof(double));
+    return value;
+}
+
+/**
+ * @brief Packs a string of at most SHORT_STRING_MAX bytes into a Value.
+ * 
+ * Equal strings always pack into identical Values, so they compare like interned strings do.
+ * 
+ * @param chars A pointer to the string's characters.
+ * @param length The length of the string.
+ * @return Value The packed string.
+ */
+static inline Value ShortStringValue(const char* chars, int length)
+{
+    Value value = QNAN | TAG_SHORT_STRING | ((uint64_t)length << (8 * SHORT_STRING_MAX));
+    for (int i = 0; i < length; i++)
+    {
+        value |= (uint64_t)(uint8_t)chars[i] << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * @brief Unpacks the characters of a short string.
+ * 
+ * @param value A short string Value.
+ * @param chars A buffer of at least SHORT_STRING_MAX + 1 bytes, receiving the null-terminated characters.
+ * @return int The length of the string.
+ */
+static inline int ShortStringChars(Value value, char* chars)
+{
+    int length = (int)((value >> (8 * SHORT_STRING_MAX)) & 0xff);
+    for (int i = 0; i < length; i++)
+    {
+        chars[i] = (char)(value >> (8 * i));
+    }
+    chars[length] = '\0';
+    return length;
+}
+
+#else
+
+/**
+ * @brief Enumerates all available Value types.
+ */
+typedef enum
+{
+    VALUE_BOOL,
+    VALUE_NIL,
+    VALUE_NUMBER,
+    VALUE_OBJECT,
+    VALUE_UNDEFINED,
+} ValueType;
+
+/**
+ * @brief Represents a value.
+ */
+typedef struct 
+{
+    ValueType type;
+    union
+    {
+        bool boolean;
+        double number;
+        Object* obj;
+    } as;
+} Value;
+
+#define IS_BOOL(value)   ((value).type == VALUE_BOOL)
+#define IS_NIL(value)    ((value).type == VALUE_NIL)
+#define IS_NUMBER(value) ((value).type == VALUE_NUMBER)
+#define IS_OBJECT(value) ((value).type == VALUE_OBJECT)
+#define IS_UNDEFINED(value) ((value).type == VALUE_UNDEFINED)
+// Only NaN-boxed values have room for a separate integer representation
+#define IS_INTEGER(value) false
+#define ARE_INTEGERS(a, b) false
+#define IS_SHORT_STRING(value) false
+#define SHORT_STRING_MAX 0
+
+#define AS_BOOL(value)   ((value).as.boolean)
+#define AS_INTEGER(value) ((int32_t)(value).as.number)
+#define AS_NUMBER(value) ((value).as.number)
+#define AS_OBJECT(value) ((value).as.obj)
+
+#define BOOL_VALUE(value)    ((Value){VALUE_BOOL,   {.boolean = value}})
+#define NIL_VALUE            ((Value){VALUE_NIL,    {.number = 0}})
+#define INTEGER_VALUE(value) NUMBER_VALUE((double)(value))
+#define NUMBER_VALUE(value)  ((Value){VALUE_NUMBER, {.number = value}})
+#define OBJECT_VALUE(object) ((Value){VALUE_OBJECT, {.obj = (Object*)object}})
+#define UNDEFINED_VALUE      ((Value){VALUE_UNDEFINED, {.number = 0}})
+
+#endif
+
+/**
+ * @brief Stores a series of values.
+ */
+typedef struct
+{
+    int capacity;
+    int count;
+    Value* values;
+} ValueArray;
+
+/**
+ * @brief Initializes a ValueArray.
+ * 
+ * @param array A ValueArray to initialize.
+ */
+void InitValueArray(ValueArray* array);
+
+/**
+ * @brief Writes a single Value to a ValueArray.
+ * 
+ * @param array A ValueArray to write to.
+ * @param value A Value to write.
+ */
+void WriteValueArray(ValueArray* array, Value value);
+
+/**
+ * @brief Frees a ValueArray.
+ * 
+ * @param array A ValueArray to free.
+ */
+void FreeValueArray(ValueArray* array);
+
+/**
+ * @brief Prints a Value in a human-readable form.
+ * 
+ * @param file The stream to print to.
+ * @param value A Value to print.
+ */
+void PrintValue(FILE* file, Value value);
+
+/**
+ * @brief Determines if two Values are equal.
+ * 
+ * @param a The first Value.
+ * @param b The second Value.
+ * @return true The two Values are equal.
+ * @return false The two Values are not equal.
+ */
+bool AreValuesEqual(Value a, Value b);
+
+#endif